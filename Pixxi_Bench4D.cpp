@@ -0,0 +1,960 @@
+/**
+ * Host benchmarks for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_Bench4D.h"
+
+#ifdef PIXXI_HOST
+
+#include "Pixxi_FanOut4D.h"
+#include "Pixxi_File4D.h"
+#include "Pixxi_Heap4D.h"
+#include "Pixxi_HostTransport4D.h"
+#include "Pixxi_Sector4D.h"
+#include "Pixxi_Simulator4D.h"
+#include "Pixxi_Video4D.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static uint16_t benchXs[PIXXI_BENCH_VERTICES];
+static uint16_t benchYs[PIXXI_BENCH_VERTICES];
+
+//Bytes of the rectangle commands seen by ackRectangles() and not yet ACKed
+static uint32_t rectangleBytes;
+
+//ACKs every complete gfx_RectangleFilled
+static void ackRectangles(void * context, Pixxi_SimTransport4D * port, const uint8_t * data, uint16_t size)
+{
+	const uint32_t command = 2 + 4 * 2 + 2;
+	uint8_t ack = 6;
+
+	rectangleBytes += size;
+	while (rectangleBytes >= command)
+	{
+		rectangleBytes -= command;
+		port->feed(&ack, 1);
+	}
+}
+
+void Pixxi_BenchPipeline4D(uint32_t baud, uint32_t latencyUs, uint8_t depth, Pixxi_PipelineBench4D * result)
+{
+	Pixxi_LoopbackTransport4D link(baud);
+	link.LatencyUs = latencyUs;
+	link.Responder = ackRectangles;
+	rectangleBytes = 0;
+	Pixxi_Serial_4DLib display(&link);
+	display.setPipelineDepth(depth);
+
+	memset(result, 0, sizeof(Pixxi_PipelineBench4D));
+	result->Depth = depth;
+	result->Commands = 100;
+	uint64_t start = Pixxi_HostNanos();
+	for (uint16_t i = 0; i < result->Commands; i++)
+		display.gfx_RectangleFilled(i, i, i + 5, i + 5, 0xF800);
+	display.CollectAcks();
+	result->Ms = (Pixxi_HostNanos() - start) / 1e6f;
+	result->Errors = display.Errors4D;
+}
+
+//Fan-out job: four lines placed by the job number
+static void benchLines(Pixxi_Serial_4DLib * display, void * context)
+{
+	uint16_t job = (uint16_t) (uintptr_t) context;
+
+	for (uint16_t i = 0; i < 4; i++)
+		display->gfx_Line(job % 200, i * 10, 239 - job % 200, 300 - i * 10, 0xF800 + job);
+}
+
+/*
+ * One pass of the fan-out bench, returns commands per second. Fanned out, jobs are posted a
+ * few at a time, as a main loop would.
+ */
+static float fanOutRun(uint32_t baud, uint8_t panels, bool fanOut, Pixxi_FanOutBench4D * result)
+{
+	Pixxi_LoopbackTransport4D * links[PIXXI_FANOUT_DISPLAYS];
+	Pixxi_Simulator4D * screens[PIXXI_FANOUT_DISPLAYS];
+	Pixxi_Serial_4DLib * displays[PIXXI_FANOUT_DISPLAYS];
+	Pixxi_FanOut4D scheduler;
+	uint64_t commands = 0;
+
+	for (uint8_t i = 0; i < panels; i++)
+	{
+		links[i] = new Pixxi_LoopbackTransport4D(baud);
+		screens[i] = new Pixxi_Simulator4D(240, 320);
+		screens[i]->Baud = baud;
+		screens[i]->attach(links[i]);
+		displays[i] = new Pixxi_Serial_4DLib(links[i]);
+		displays[i]->begin();
+	}
+
+	uint64_t start = Pixxi_HostNanos();
+	if (!fanOut)
+	{
+		for (uint8_t i = 0; i < panels; i++)
+			for (uint32_t job = 0; job < result->Jobs; job++)
+				benchLines(displays[i], (void *) (uintptr_t) job);
+	}
+	else
+	{
+		uint32_t posted = 0;
+
+		for (uint8_t i = 0; i < panels; i++)
+			scheduler.add(displays[i]);
+		while (posted < result->Jobs || scheduler.queued() > 0)
+		{
+			while (posted < result->Jobs && scheduler.queued() < panels * 8U)
+				scheduler.broadcast(benchLines, (void *) (uintptr_t) posted++);
+			scheduler.run();
+		}
+		scheduler.drain();
+		result->Errors = scheduler.errors();
+	}
+	float seconds = (Pixxi_HostNanos() - start) / 1e9f;
+
+	result->Same = true;
+	for (uint8_t i = 0; i < panels; i++)
+	{
+		commands += screens[i]->Commands;
+		result->Same = result->Same && screens[i]->checksum() == screens[0]->checksum();
+	}
+	for (uint8_t i = 0; i < panels; i++)
+	{
+		delete displays[i];
+		delete screens[i];
+		delete links[i];
+	}
+	return commands / seconds;
+}
+
+void Pixxi_BenchFanOut4D(uint32_t baud, uint8_t panels, Pixxi_FanOutBench4D * result)
+{
+	memset(result, 0, sizeof(Pixxi_FanOutBench4D));
+	if (panels > PIXXI_FANOUT_DISPLAYS)
+		panels = PIXXI_FANOUT_DISPLAYS;
+	result->Panels = panels;
+	result->Jobs = 200;
+
+	result->BlockingCps = fanOutRun(baud, panels, false, result);
+	bool same = result->Same;
+	result->FanOutCps = fanOutRun(baud, panels, true, result);
+	result->Same = result->Same && same;
+}
+
+//CSV for the file benches
+static char benchCsv[20000];
+
+void Pixxi_BenchReader4D(uint32_t baud, Pixxi_ReaderBench4D * result)
+{
+	Pixxi_LoopbackTransport4D link(baud);
+	Pixxi_Simulator4D screen(240, 320);
+	screen.Baud = baud;
+	screen.attach(&link);
+	Pixxi_Serial_4DLib display(&link);
+	display.begin();
+
+	memset(result, 0, sizeof(Pixxi_ReaderBench4D));
+	for (uint16_t i = 0; i < 800; i++)
+		result->Bytes += snprintf(benchCsv + result->Bytes, sizeof(benchCsv) - result->Bytes, "%u,sensor%u,%u.%02u\r\n", i, i % 7, i * 3, i % 100);
+	screen.addFile("CONFIG.CSV", (const uint8_t *) benchCsv, result->Bytes);
+	result->WireMs = result->Bytes * 10000.0f / baud;
+	result->Same = true;
+
+	//As an application would without the reader
+	uint8_t block[32];
+	uint32_t at = 0;
+	uint64_t start = Pixxi_HostNanos();
+	uint16_t handle = display.file_Open((char *) "CONFIG.CSV", 'r');
+	while (1)
+	{
+		uint16_t got = display.file_Read(block, sizeof(block), handle);
+		result->Same = result->Same && at + got <= result->Bytes && memcmp(benchCsv + at, block, got) == 0;
+		at += got;
+		if (got < sizeof(block))
+			break;
+	}
+	display.file_Close(handle);
+	result->ReadMs = (Pixxi_HostNanos() - start) / 1e6f;
+	result->Same = result->Same && at == result->Bytes;
+
+	//Line by line through the reader, checking each against the file
+	static uint8_t buffer[2048];
+	Pixxi_FileReader4D reader(&display, buffer, sizeof(buffer));
+	char line[80];
+	int32_t length;
+	at = 0;
+	start = Pixxi_HostNanos();
+	result->Same = result->Same && reader.open((char *) "CONFIG.CSV");
+	while ((length = reader.getline(line, sizeof(line))) >= 0)
+	{
+		result->Same = result->Same && at + length + 2 <= result->Bytes && memcmp(benchCsv + at, line, length) == 0;
+		at += length + 2;
+		result->Lines++;
+	}
+	reader.close();
+	result->ReaderMs = (Pixxi_HostNanos() - start) / 1e6f;
+	result->Same = result->Same && at == result->Bytes;
+	result->Blocks = reader.Blocks;
+	result->Stalls = reader.Stalls;
+	result->Dropped = link.Dropped;
+}
+
+//Line I of the writer bench's log
+static uint32_t logLine(char * line, uint32_t i)
+{
+	return snprintf(line, 64, "%06u,%5u,%5u,%5u\n", i, i * 3 % 1000, i * 7 % 1000, i * 11 % 1000);
+}
+
+//True if the card's file Name holds Size bytes of benchCsv
+static bool onCard(Pixxi_Simulator4D * screen, const char * name, uint32_t size)
+{
+	uint32_t length;
+	const uint8_t * data = screen->file(name, &length);
+
+	return data != NULL && length == size && memcmp(data, benchCsv, size) == 0;
+}
+
+void Pixxi_BenchWriter4D(uint32_t baud, Pixxi_WriterBench4D * result)
+{
+	Pixxi_LoopbackTransport4D link(baud);
+	Pixxi_Simulator4D screen(240, 320);
+	screen.Baud = baud;
+	screen.attach(&link);
+	Pixxi_Serial_4DLib display(&link);
+	display.begin();
+
+	char line[64];
+	memset(result, 0, sizeof(Pixxi_WriterBench4D));
+	for (uint16_t i = 0; i < 500; i++)
+		result->Bytes += logLine(benchCsv + result->Bytes, i);
+	result->WireMs = result->Bytes * 10000.0f / baud;
+
+	//A line at a time, each waiting for its ACK
+	uint64_t start = Pixxi_HostNanos();
+	uint16_t handle = display.file_Open((char *) "PUTS.CSV", 'w');
+	for (uint16_t i = 0; i < 500; i++)
+	{
+		logLine(line, i);
+		display.file_PutS(line, handle);
+	}
+	display.file_Close(handle);
+	result->PutSMs = (Pixxi_HostNanos() - start) / 1e6f;
+	result->Same = onCard(&screen, "PUTS.CSV", result->Bytes);
+
+	start = Pixxi_HostNanos();
+	handle = display.file_Open((char *) "PUTC.CSV", 'w');
+	for (uint16_t i = 0; i < 2000; i++)
+		display.file_PutC(benchCsv[i], handle);
+	display.file_Close(handle);
+	result->PutCMs = (Pixxi_HostNanos() - start) / 1e6f;
+
+	//Coalesced
+	static uint8_t buffer[4096];
+	Pixxi_FileWriter4D writer(&display, buffer, sizeof(buffer));
+	start = Pixxi_HostNanos();
+	writer.open((char *) "WRITER.CSV", 'w');
+	for (uint16_t i = 0; i < 500; i++)
+	{
+		logLine(line, i);
+		writer.puts(line);
+	}
+	result->Same = writer.close() && result->Same && onCard(&screen, "WRITER.CSV", result->Bytes);
+	result->WriterMs = (Pixxi_HostNanos() - start) / 1e6f;
+	result->Writes = writer.Writes;
+
+	//25 bytes a millisecond is twice what 115200 baud carries, so with Block off bytes are dropped, never waited for
+	Pixxi_FileWriter4D fast(&display, buffer, 512);
+	fast.Block = false;
+	fast.open((char *) "FAST.CSV", 'w');
+	for (uint16_t i = 0; i < 500; i++)
+	{
+		memcpy(line, benchCsv + i * 25, 25);
+		line[25] = 0;
+		start = Pixxi_HostNanos();
+		fast.puts(line);
+		float ms = (Pixxi_HostNanos() - start) / 1e6f;
+		if (ms > result->MaxCallMs)
+			result->MaxCallMs = ms;
+		while (Pixxi_HostNanos() - start < 1000000)
+			;
+	}
+	fast.close();
+	result->Refused = fast.Dropped;
+}
+
+//Sectors in the ring log, after its header in sector 0
+#define BENCH_LOG_SECTORS 256
+
+//What the sector bench's media should hold
+static uint8_t benchMedia[(BENCH_LOG_SECTORS + 1) * 512];
+
+//Contents of record N at Sector
+static void logRecord(uint8_t * data, uint32_t sector, uint32_t n)
+{
+	for (uint16_t i = 0; i < 512; i++)
+		data[i] = (uint8_t) (sector * 31 + n * 7 + i);
+}
+
+/*
+ * One sector access for the ring log, through Cache, or if it is NULL with a media_SetSector
+ * for each. Counts the direct round trips and checks reads against benchMedia.
+ */
+static bool logAccess(Pixxi_Serial_4DLib * display, Pixxi_SectorCache4D * cache, uint32_t sector, uint8_t * data, bool write, uint32_t * roundTrips)
+{
+	Pixxi_Future4D seek;
+	Pixxi_Future4D access;
+
+	if (write)
+		memcpy(benchMedia + sector * 512, data, 512);
+	if (cache != NULL)
+	{
+		if (write)
+			return cache->write(sector, data);
+		return cache->read(sector, data) && memcmp(data, benchMedia + sector * 512, 512) == 0;
+	}
+
+	display->media_SetSectorAsync(sector >> 16, sector & 0xFFFF, &seek);
+	if (write)
+		display->media_WrSectorAsync(data, &access);
+	else
+		display->media_RdSectorAsync(data, &access);
+	*roundTrips += 2;
+	return display->wait(&access) && (write || memcmp(data, benchMedia + sector * 512, 512) == 0);
+}
+
+//The ring log workload, returns its time in ms
+static float logRun(uint32_t baud, bool cached, Pixxi_SectorBench4D * result)
+{
+	Pixxi_LoopbackTransport4D link(baud);
+	Pixxi_Simulator4D screen(240, 320);
+	screen.Baud = baud;
+	screen.attach(&link);
+	screen.setMedia(1024);
+	screen.setExecUs(F_media_RdSector, 400);
+	screen.setExecUs(F_media_WrSector, 800);
+	Pixxi_Serial_4DLib display(&link);
+	display.begin();
+	display.setPipelineDepth(8);
+	display.media_Init();
+
+	static uint8_t memory[8 * 512];
+	Pixxi_SectorCache4D cache(&display, memory, 8);
+	Pixxi_SectorCache4D * through = cached ? &cache : NULL;
+	uint8_t record[512];
+	uint8_t header[512];
+	uint32_t roundTrips = 0;
+	uint32_t head = 0;
+
+	memset(benchMedia, 0, sizeof(benchMedia));
+	uint64_t start = Pixxi_HostNanos();
+	for (uint32_t n = 0; n < 600; n++)
+	{
+		logRecord(record, 1 + head, n);
+		result->Same = logAccess(&display, through, 1 + head, record, true, &roundTrips) && result->Same;
+		head = (head + 1) % BENCH_LOG_SECTORS;
+
+		result->Same = logAccess(&display, through, 0, header, false, &roundTrips) && result->Same;
+		memcpy(header, &n, 4);
+		memcpy(header + 4, &head, 4);
+		result->Same = logAccess(&display, through, 0, header, true, &roundTrips) && result->Same;
+
+		if (n % 50 == 49)
+			for (uint32_t k = 0; k < 40; k++)
+			{
+				uint32_t sector = 1 + (head + BENCH_LOG_SECTORS - 40 + k) % BENCH_LOG_SECTORS;
+				result->Same = logAccess(&display, through, sector, record, false, &roundTrips) && result->Same;
+			}
+	}
+	if (cached)
+	{
+		result->Same = cache.flush() && result->Same;
+		result->CacheRoundTrips = cache.Seeks + cache.SectorsRead + cache.SectorsWritten;
+		result->Hits = cache.Hits;
+		result->Misses = cache.Misses;
+	}
+	else
+		result->DirectRoundTrips = roundTrips;
+	float ms = (Pixxi_HostNanos() - start) / 1e6f;
+
+	for (uint32_t sector = 0; sector <= BENCH_LOG_SECTORS; sector++)
+		result->Same = result->Same && memcmp(screen.mediaSector(sector), benchMedia + sector * 512, 512) == 0;
+	return ms;
+}
+
+void Pixxi_BenchSectors4D(uint32_t baud, Pixxi_SectorBench4D * result)
+{
+	memset(result, 0, sizeof(Pixxi_SectorBench4D));
+	result->Same = true;
+	result->DirectMs = logRun(baud, false, result);
+	result->CacheMs = logRun(baud, true, result);
+
+	Pixxi_LoopbackTransport4D link(baud);
+	Pixxi_Simulator4D screen(240, 320);
+	screen.Baud = baud;
+	screen.attach(&link);
+	screen.setMedia(1024);
+	screen.setExecUs(F_media_RdSector, 400);
+	for (uint32_t sector = 0; sector < 1024; sector++)
+		logRecord(screen.mediaSector(sector), sector, 0);
+	Pixxi_Serial_4DLib display(&link);
+	display.begin();
+
+	static uint8_t memory[16 * 512];
+	uint8_t data[512];
+	uint8_t expected[512];
+	result->ScanWireMs = 300 * 515 * 10000.0f / baud;
+	for (uint8_t ahead = 0; ahead <= 8; ahead += 8)
+	{
+		Pixxi_SectorCache4D cache(&display, memory, 16);
+		cache.ReadAhead = ahead;
+		uint64_t start = Pixxi_HostNanos();
+		for (uint32_t sector = 100; sector < 400; sector++)
+		{
+			logRecord(expected, sector, 0);
+			result->Same = cache.read(sector, data) && memcmp(data, expected, 512) == 0 && result->Same;
+		}
+		*(ahead ? &result->ScanAheadMs : &result->ScanMs) = (Pixxi_HostNanos() - start) / 1e6f;
+	}
+}
+
+//Canary bytes either side of the fuzzed buffers
+#define BENCH_CANARY 32
+#define BENCH_CANARY_BYTE 0xA5
+
+//Reply the fuzz responder gives to the next command
+static uint8_t fuzzReply[600];
+static uint16_t fuzzReplySize;
+static bool fuzzPending;
+
+static uint32_t fuzzState;
+
+static uint32_t fuzzRandom(void)
+{
+	fuzzState = fuzzState * 1103515245 + 12345;
+	return fuzzState >> 8;
+}
+
+//Answers the first bytes of each command with whatever the fuzzer has set up
+static void fuzzResponder(void * context, Pixxi_SimTransport4D * port, const uint8_t * data, uint16_t size)
+{
+	if (!fuzzPending)
+		return;
+	fuzzPending = false;
+	if (fuzzReplySize > 0)
+		port->feed(fuzzReply, fuzzReplySize);
+}
+
+void Pixxi_BenchFuzz4D(uint32_t cases, uint32_t seed, Pixxi_FuzzBench4D * result)
+{
+	static uint8_t buffer[BENCH_CANARY + 600 + BENCH_CANARY];
+	uint8_t * into = buffer + BENCH_CANARY;
+	uint8_t payload[512];
+
+	memset(result, 0, sizeof(Pixxi_FuzzBench4D));
+	fuzzState = seed;
+	for (uint32_t i = 0; i < cases; i++)
+	{
+		uint8_t call = fuzzRandom() % 3;			// file_Read, readString, media_RdSector
+		uint8_t shape = fuzzRandom() % 4;			// well formed, NAK, truncated, random
+		uint16_t size = call == 2 ? 512 : fuzzRandom() % 300;
+		uint16_t count = call == 2 ? 512 : fuzzRandom() % 300;
+		uint16_t word = fuzzRandom() & 1;
+		uint16_t got = 0;
+
+		//The reply a display would send, for file_Read and readString a count then the bytes
+		fuzzReplySize = 0;
+		fuzzReply[fuzzReplySize++] = shape == 1 ? 0x15 : 6;
+		if (shape != 1)
+		{
+			if (call == 2)
+				word = fuzzRandom() & 1;
+			else
+				word = count;
+			fuzzReply[fuzzReplySize++] = word >> 8;
+			fuzzReply[fuzzReplySize++] = word & 0xFF;
+			for (uint16_t k = 0; k < count; k++)
+			{
+				payload[k] = call == 1 ? 'a' + fuzzRandom() % 26 : fuzzRandom();
+				fuzzReply[fuzzReplySize++] = payload[k];
+			}
+		}
+		if (shape == 2)
+			fuzzReplySize = fuzzRandom() % fuzzReplySize;
+		else if (shape == 3)
+		{
+			fuzzReplySize = fuzzRandom() % sizeof(fuzzReply);
+			for (uint16_t k = 0; k < fuzzReplySize; k++)
+				fuzzReply[k] = fuzzRandom();
+		}
+		fuzzPending = true;
+
+		//A fresh link each time, so what one reply leaves behind cannot answer the next
+		Pixxi_LoopbackTransport4D * link = new Pixxi_LoopbackTransport4D(2000000);
+		link->Responder = fuzzResponder;
+		Pixxi_Serial_4DLib * display = new Pixxi_Serial_4DLib(link);
+		display->begin();
+		display->Timing.Enabled = false;
+		display->TimeLimit4D = 5;
+
+		memset(buffer, BENCH_CANARY_BYTE, sizeof(buffer));
+		if (call == 0)
+			got = display->file_Read(into, size, 1);
+		else if (call == 1)
+			got = display->readString(1, (char *) into, size);
+		else
+			got = display->media_RdSector(into);
+		fuzzPending = false;
+		int error = display->Error4D;
+		delete display;
+		delete link;
+
+		result->Cases++;
+		if (error == Err4D_Timeout)
+			result->Timeouts++;
+		for (uint16_t k = 0; k < sizeof(buffer); k++)
+			if ((k < BENCH_CANARY || k >= BENCH_CANARY + size) && buffer[k] != BENCH_CANARY_BYTE)
+			{
+				result->Overruns++;
+				break;
+			}
+
+		if (shape == 2)
+			result->Truncated++;
+		else if (shape == 3)
+			result->Random++;
+		else
+		{
+			bool exact;
+
+			result->WellFormed++;
+			if (shape == 1)
+				exact = error == Err4D_NAK;
+			else if (call == 0)
+			{
+				uint16_t length = count < size ? count : size;
+				exact = got == length && memcmp(into, payload, length) == 0;
+			}
+			else if (call == 1)
+			{
+				uint16_t length = size == 0 ? 0 : (count < size - 1 ? count : size - 1);
+				exact = got == length && memcmp(into, payload, length) == 0 && (size == 0 || into[length] == 0);
+			}
+			else
+				exact = got == word && memcmp(into, payload, 512) == 0;
+			if (exact && (shape == 1 || error == Err4D_OK))
+				result->Exact++;
+		}
+	}
+}
+
+#define BENCH_FRAMES 150
+#define BENCH_FRAME_US 40000
+
+//Random numbers for the video and heap benches, the same for the same seed
+static uint32_t benchState;
+
+static uint32_t benchRandom(uint32_t range)
+{
+	benchState = benchState * 1103515245 + 12345;
+	return (benchState >> 8) % range;
+}
+
+static uint32_t benchUs(void)
+{
+	return Pixxi_HostNanos() / 1000;
+}
+
+//Busy for Us, as application code would be
+static void benchWork(uint32_t us)
+{
+	uint32_t start = benchUs();
+
+	while (benchUs() - start < us)
+		;
+}
+
+void Pixxi_BenchVideo4D(uint8_t mode, uint32_t frameUs, Pixxi_VideoBench4D * result)
+{
+	static uint32_t times[BENCH_FRAMES];
+	static uint32_t shownAt[BENCH_FRAMES];
+	uint32_t shown = 0;
+
+	memset(result, 0, sizeof(Pixxi_VideoBench4D));
+	result->Mode = mode;
+	benchState = 1;
+	for (uint16_t i = 0; i < BENCH_FRAMES; i++)
+		times[i] = frameUs + benchRandom(6000);
+
+	Pixxi_LoopbackTransport4D link(600000);
+	Pixxi_Simulator4D screen(240, 320);
+	screen.Baud = 600000;
+	screen.attach(&link);
+	screen.setFrameUs(times, BENCH_FRAMES);
+	screen.setExecUs(F_media_VideoFrame, 0);
+	Pixxi_Serial_4DLib display(&link);
+	display.begin();
+	Pixxi_CommandQueue4D queue(&display);
+	Pixxi_VideoPlayer4D player(&display);
+	benchState = 7;
+
+	uint32_t start = benchUs();
+	if (mode == PIXXI_BENCH_VIDEO_LOOP)
+	{
+		for (uint16_t frame = 0; frame < BENCH_FRAMES; frame++)
+		{
+			display.media_VideoFrame(0, 0, frame);
+			shownAt[shown++] = benchUs();
+			display.txt_FGcolour(0xFFFF);
+			benchWork(benchRandom(20000));
+			benchWork(3000);
+		}
+		result->Shown = shown;
+	}
+	else
+	{
+		uint32_t tick = start;
+		uint32_t work = 0;
+
+		player.Skip = mode != PIXXI_BENCH_VIDEO_NO_SKIP;
+		if (mode == PIXXI_BENCH_VIDEO_QUEUE)
+			player.Queue = &queue;
+		player.start(0, 0, 0, BENCH_FRAMES, BENCH_FRAME_US, start);
+		while (player.playing())
+		{
+			//Application work in 1ms slices, with a turn for the player after each
+			if (work == 0)
+			{
+				work = benchRandom(20);
+				display.txt_FGcolour(0xFFFF);
+			}
+			benchWork(1000);
+			work--;
+
+			uint32_t now = benchUs();
+			if (mode == PIXXI_BENCH_VIDEO_QUEUE)
+			{
+				//As from a 1kHz timer interrupt, with the display task pumping
+				while ((int32_t) (now - tick) >= 0)
+				{
+					player.tick(now);
+					tick += 1000;
+				}
+				queue.pump();
+			}
+			else
+				player.tick(now);
+			while (shown < player.Shown && shown < BENCH_FRAMES)
+				shownAt[shown++] = now;
+		}
+		result->Shown = player.Shown;
+		result->Dropped = player.Dropped;
+		result->Failed = player.Failed;
+	}
+	result->Ms = (benchUs() - start) / 1000.0f;
+	result->SettersSent = display.StateSent;
+
+	//Intervals between frames coming up
+	double sum = 0;
+	double squares = 0;
+	for (uint32_t i = 0; i + 1 < shown; i++)
+	{
+		double interval = (double) (shownAt[i + 1] - shownAt[i]);
+		sum += interval;
+		squares += interval * interval;
+		if (fabs(interval - BENCH_FRAME_US) / 1000 > result->WorstOffMs)
+			result->WorstOffMs = fabs(interval - BENCH_FRAME_US) / 1000;
+	}
+	if (shown > 1)
+	{
+		double mean = sum / (shown - 1);
+		result->Fps = 1e6 / mean;
+		result->IntervalSdMs = sqrt(squares / (shown - 1) - mean * mean) / 1000;
+	}
+}
+
+//Blocks the random heap run keeps at once
+#define BENCH_BLOCKS 100
+
+//Pattern byte K of the block at Handle
+static uint8_t heapPattern(uint16_t handle, uint16_t k)
+{
+	return (uint8_t) (handle * 7 + k);
+}
+
+/*
+ * Random allocs and frees straight on a heap, counting blocks which overlap or get written
+ * over while held.
+ */
+static void heapRandom(Pixxi_HeapBench4D * result)
+{
+	Pixxi_LoopbackTransport4D link(0);
+	Pixxi_Simulator4D screen(240, 320);
+	screen.attach(&link);
+	Pixxi_Serial_4DLib display(&link);
+	display.begin();
+	Pixxi_DisplayHeap4D heap(&display);
+
+	uint16_t handles[BENCH_BLOCKS];
+	uint16_t sizes[BENCH_BLOCKS];
+	uint16_t count = 0;
+	uint8_t pattern[1024];
+
+	for (uint32_t i = 0; i < 20000; i++)
+	{
+		if (count < BENCH_BLOCKS && benchRandom(2))
+		{
+			uint16_t size = 1 + (benchRandom(10) ? benchRandom(200) : benchRandom(800));
+			heap.Screen = benchRandom(4);
+			uint16_t handle = heap.alloc(size);
+			if (handle == 0)
+				continue;
+
+			//Handles and sizes are in words on the display
+			uint16_t words = (size + 1) / 2;
+			bool overlaps = handle < 0x1000 || handle + words > 0x1000 + PIXXI_SIM_RAM_SIZE / 2;
+			for (uint16_t k = 0; k < count; k++)
+				overlaps = overlaps || (handle < handles[k] + (sizes[k] + 1) / 2 && handles[k] < handle + words);
+			if (overlaps)
+				result->Overlaps++;
+
+			for (uint16_t k = 0; k < size; k++)
+				pattern[k] = heapPattern(handle, k);
+			display.SendByteArrayToRAM(handle, size, pattern);
+			handles[count] = handle;
+			sizes[count++] = size;
+		}
+		else if (count > 0)
+		{
+			uint16_t at = benchRandom(count);
+			for (uint16_t k = 0; k < sizes[at]; k++)
+			{
+				uint16_t word = screen.ramWord(handles[at], k / 2);
+				if ((k & 1 ? word >> 8 : word & 0xFF) != heapPattern(handles[at], k))
+				{
+					result->Clobbered++;
+					break;
+				}
+			}
+			heap.free(handles[at]);
+			handles[at] = handles[--count];
+			sizes[at] = sizes[count];
+		}
+	}
+}
+
+void Pixxi_BenchHeap4D(bool pooled, Pixxi_HeapBench4D * result)
+{
+	Pixxi_LoopbackTransport4D link(115200);
+	Pixxi_Simulator4D screen(240, 320);
+	screen.Baud = 115200;
+	screen.attach(&link);
+	Pixxi_Serial_4DLib display(&link);
+	display.begin();
+	Pixxi_DisplayHeap4D heap(&display);
+	if (pooled)
+		display.setHeap(&heap);
+
+	uint16_t data[64];
+	char text[40];
+	for (uint16_t i = 0; i < 64; i++)
+		data[i] = i;
+
+	memset(result, 0, sizeof(Pixxi_HeapBench4D));
+	result->Pooled = pooled;
+	benchState = 3;
+	uint64_t start = Pixxi_HostNanos();
+	for (uint16_t page = 0; page < 200 && !result->OutOfRam; page++)
+	{
+		heap.Screen = page & 0xFF;
+		for (uint16_t widget = 0; widget < 10 && !result->OutOfRam; widget++)
+		{
+			uint16_t handle;
+			uint16_t params;
+			uint16_t length = 3 + benchRandom(30);
+
+			display.widget_Init(4 + benchRandom(40), data, &handle, &params);
+			memset(text, 'x', length);
+			text[length] = 0;
+			result->OutOfRam = handle == 0 || params == 0 || display.widget_InitString(text) == 0;
+		}
+		if (result->OutOfRam)
+			break;
+
+		result->Screens++;
+		if (pooled)
+		{
+			if (heap.fragmentation() > result->Fragmentation)
+				result->Fragmentation = heap.fragmentation();
+			heap.freeScreen(page & 0xFF);
+		}
+	}
+	result->ScreenMs = (Pixxi_HostNanos() - start) / 1e6f / (result->Screens > 0 ? result->Screens : 1);
+	result->MemCalls = screen.MemAllocs + screen.MemFrees;
+
+	if (pooled)
+		heapRandom(result);
+}
+
+//Bytes of the polyline commands seen by ackPolylines() and not yet ACKed
+static uint32_t polylineBytes;
+
+/*
+ * Responder which ACKs every complete gfx_Polyline without decoding it, so only the library's
+ * own work is timed.
+ */
+static void ackPolylines(void * context, Pixxi_SimTransport4D * port, const uint8_t * data, uint16_t size)
+{
+	const uint32_t command = 2 + 2 + 4 * PIXXI_BENCH_VERTICES + 2;
+	uint8_t ack = 6;
+
+	polylineBytes += size;
+	while (polylineBytes >= command)
+	{
+		polylineBytes -= command;
+		port->feed(&ack, 1);
+	}
+}
+
+void Pixxi_BenchPolyline4D(uint32_t baud, Pixxi_PolylineBench4D * result)
+{
+	const uint32_t bytes = 2 + 2 + 4 * PIXXI_BENCH_VERTICES + 2;
+
+	memset(result, 0, sizeof(Pixxi_PolylineBench4D));
+	for (uint16_t i = 0; i < PIXXI_BENCH_VERTICES; i++)
+	{
+		benchXs[i] = i % 240;
+		benchYs[i] = (i * 7) % 320;
+	}
+
+	//On the wire, against the simulator with no execution time so the link is all there is
+	{
+		Pixxi_LoopbackTransport4D link(baud);
+		Pixxi_Simulator4D screen(240, 320);
+		screen.DefaultExecUs = 0;
+		screen.PixelNs = 0;
+		screen.attach(&link);
+		Pixxi_Serial_4DLib display(&link);
+		display.begin();
+
+		result->Baud = baud;
+		result->Calls = baud / (bytes * 10) + 1;
+		link.resetStats();
+		uint64_t start = Pixxi_HostNanos();
+		for (uint32_t i = 0; i < result->Calls; i++)
+			display.gfx_Polyline(PIXXI_BENCH_VERTICES, benchXs, benchYs, 0xFFFF);
+		uint64_t elapsed = Pixxi_HostNanos() - start;
+
+		result->CallUs = elapsed / 1000.0f / result->Calls;
+		result->WireBusy = (float) link.WireNs / elapsed;
+		result->Unknown = screen.Unknown;
+	}
+
+	//Encoding alone, on a link which takes everything at once
+	{
+		const uint32_t calls = 20000;
+		Pixxi_MemoryTransport4D link;
+		link.Responder = ackPolylines;
+		polylineBytes = 0;
+		Pixxi_Serial_4DLib display(&link);
+		display.begin();
+
+		uint64_t start = Pixxi_HostNanos();
+		for (uint32_t i = 0; i < calls; i++)
+			display.gfx_Polyline(PIXXI_BENCH_VERTICES, benchXs, benchYs, 0xFFFF);
+		result->EncodeUs = (Pixxi_HostNanos() - start) / 1000.0f / calls;
+	}
+}
+
+#ifdef PIXXI_BENCH_MAIN
+
+#if PIXXI_RX_RING_SIZE < 1024
+#error "Build the benches with a PIXXI_RX_RING_SIZE of 1024 or more, for the sector replies"
+#endif
+
+int main(void)
+{
+	static const uint32_t rates[] = {115200, 921600, 3000000};
+	static const uint8_t depths[] = {0, 2, 4, 8};
+
+	printf("100 gfx_RectangleFilled, 115200 baud, 3 ms turnaround\n");
+	for (uint8_t i = 0; i < sizeof(depths); i++)
+	{
+		Pixxi_PipelineBench4D pipeline;
+		Pixxi_BenchPipeline4D(115200, 3000, depths[i], &pipeline);
+		printf("  depth %u: %.1f ms, errors %u\n", pipeline.Depth, pipeline.Ms, pipeline.Errors);
+	}
+
+	printf("200 jobs of 4 gfx_Line per panel, 115200 baud\n");
+	for (uint8_t panels = 1; panels <= 4; panels *= 2)
+	{
+		Pixxi_FanOutBench4D fanOut;
+		Pixxi_BenchFanOut4D(115200, panels, &fanOut);
+		printf("  %u panels: %.0f cmds/s blocking, %.0f cmds/s fanned out, same image %d, errors %u\n", fanOut.Panels,
+			fanOut.BlockingCps, fanOut.FanOutCps, fanOut.Same, fanOut.Errors);
+	}
+
+	Pixxi_ReaderBench4D reader;
+	Pixxi_BenchReader4D(115200, &reader);
+	printf("%u byte CSV, %u lines, 115200 baud, wire %.0f ms\n", reader.Bytes, reader.Lines, reader.WireMs);
+	printf("  32 byte file_Reads %.0f ms, Pixxi_FileReader4D %.0f ms (%u blocks, %u stalls), same %d, dropped %llu\n", reader.ReadMs,
+		reader.ReaderMs, reader.Blocks, reader.Stalls, reader.Same, (unsigned long long) reader.Dropped);
+
+	Pixxi_WriterBench4D writer;
+	Pixxi_BenchWriter4D(115200, &writer);
+	printf("500 CSV lines, %u bytes, 115200 baud, wire %.0f ms\n", writer.Bytes, writer.WireMs);
+	printf("  file_PutS %.0f ms, Pixxi_FileWriter4D %.0f ms (%u writes), same %d; 2000 file_PutC %.0f ms\n", writer.PutSMs,
+		writer.WriterMs, writer.Writes, writer.Same, writer.PutCMs);
+	printf("  non-blocking at twice the link rate: longest call %.2f ms, %u bytes dropped\n", writer.MaxCallMs, writer.Refused);
+
+	Pixxi_SectorBench4D sectors;
+	Pixxi_BenchSectors4D(600000, &sectors);
+	printf("Ring log on raw media, 600000 baud\n");
+	printf("  direct %u round trips %.0f ms, cached %u round trips %.0f ms (%u hits, %u misses), same %d\n",
+		sectors.DirectRoundTrips, sectors.DirectMs, sectors.CacheRoundTrips, sectors.CacheMs, sectors.Hits, sectors.Misses, sectors.Same);
+	printf("  300 sector scan %.0f ms, with read-ahead %.0f ms, wire %.0f ms\n", sectors.ScanMs, sectors.ScanAheadMs, sectors.ScanWireMs);
+
+	Pixxi_FuzzBench4D fuzz;
+	Pixxi_BenchFuzz4D(5000, 12345, &fuzz);
+	printf("Data reply fuzz, %u cases\n", fuzz.Cases);
+	printf("  %u of %u well formed exact, %u truncated, %u random, %u timeouts, %u overruns\n", fuzz.Exact, fuzz.WellFormed,
+		fuzz.Truncated, fuzz.Random, fuzz.Timeouts, fuzz.Overruns);
+
+	static const char * videoModes[] = {"frame and delay loop", "Pixxi_VideoPlayer4D", "player, Skip off", "player, 1kHz tick via queue"};
+	printf("150 frames at 25fps, 600000 baud\n");
+	for (uint8_t overloaded = 0; overloaded < 2; overloaded++)
+		for (uint8_t mode = overloaded ? PIXXI_BENCH_VIDEO_PLAYER : PIXXI_BENCH_VIDEO_LOOP; mode <= (overloaded ? PIXXI_BENCH_VIDEO_NO_SKIP : PIXXI_BENCH_VIDEO_QUEUE); mode++)
+		{
+			Pixxi_VideoBench4D video;
+			Pixxi_BenchVideo4D(mode, overloaded ? 52000 : 22000, &video);
+			printf("  %s, frames %s: %.2f fps, interval sd %.1f ms, worst %.1f ms off, %u shown, %u dropped, %u failed, %.0f ms, setters sent %u\n",
+				videoModes[mode], overloaded ? "52-58 ms" : "22-28 ms", video.Fps, video.IntervalSdMs, video.WorstOffMs, video.Shown, video.Dropped,
+				video.Failed, video.Ms, video.SettersSent);
+		}
+
+	printf("Screens of 10 widgets, 115200 baud\n");
+	for (uint8_t pooled = 0; pooled < 2; pooled++)
+	{
+		Pixxi_HeapBench4D heap;
+		Pixxi_BenchHeap4D(pooled, &heap);
+		printf("  %s: %u screens%s, %.1f ms each, %u mem_Alloc/mem_Free", pooled ? "Pixxi_DisplayHeap4D" : "mem_Alloc", heap.Screens,
+			heap.OutOfRam ? " then out of display RAM" : "", heap.ScreenMs, heap.MemCalls);
+		if (pooled)
+			printf(", fragmentation at most %u%%; random run %u overlaps, %u clobbered", heap.Fragmentation, heap.Overlaps, heap.Clobbered);
+		printf("\n");
+	}
+
+	printf("%u-vertex gfx_Polyline\n", PIXXI_BENCH_VERTICES);
+	for (uint8_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+	{
+		Pixxi_PolylineBench4D polyline;
+		Pixxi_BenchPolyline4D(rates[i], &polyline);
+		printf("  %7u baud: %u calls, %.0f us each, wire %.1f%% busy, encode %.2f us, unknown %u\n", polyline.Baud,
+			polyline.Calls, polyline.CallUs, 100 * polyline.WireBusy, polyline.EncodeUs, polyline.Unknown);
+	}
+	return 0;
+}
+
+#endif
+
+#endif
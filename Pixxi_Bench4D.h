@@ -0,0 +1,185 @@
+/**
+ * Host benchmarks for the Pixxi serial library.
+ *
+ * Only built with PIXXI_HOST defined. Each function sets up its own loopback transports and
+ * Pixxi_Simulator4D displays, runs one of the workloads the library's optimisations were
+ * measured on, and fills in a result struct, so the figures quoted for them can be checked
+ * on any PC. Wall times come from Pixxi_HostNanos() and vary with the machine; byte counts,
+ * round trips and wire times do not.
+ *
+ * Built with PIXXI_BENCH_MAIN defined, Pixxi_Bench4D.cpp also has a main() which runs them
+ * all and prints the results. The sector replies need a bigger receive ring than the default:
+ *
+ *	g++ -std=gnu++20 -O2 -DPIXXI_HOST -DPIXXI_BENCH_MAIN -DPIXXI_RX_RING_SIZE=1024 -I. Pixxi_*.cpp -o bench4d -lpthread
+ */
+#ifndef Pixxi_Bench4D_h
+#define Pixxi_Bench4D_h
+
+#ifdef PIXXI_HOST
+
+#include "Pixxi_Serial_4Dlib.h"
+
+typedef struct {
+	uint8_t Depth;
+	uint32_t Commands;			// gfx_RectangleFilled calls made
+	float Ms;					// until the last ACK was in
+	uint32_t Errors;			// Errors4D at the end, should be 0
+} Pixxi_PipelineBench4D;
+
+/*
+ * 100 gfx_RectangleFilled at Baud with pipelining Depth deep, to a display which answers each
+ * one LatencyUs after it has arrived.
+ */
+void Pixxi_BenchPipeline4D(uint32_t baud, uint32_t latencyUs, uint8_t depth, Pixxi_PipelineBench4D * result);
+
+typedef struct {
+	uint8_t Panels;
+	uint32_t Jobs;				// per panel, each of 4 gfx_Line
+	float BlockingCps;			// commands per second, one display after the other without pipelining
+	float FanOutCps;			// through Pixxi_FanOut4D
+	bool Same;					// every panel ended with the same image
+	uint32_t Errors;			// failed replies through Pixxi_FanOut4D, should be 0
+} Pixxi_FanOutBench4D;
+
+/*
+ * Panels displays (at most PIXXI_FANOUT_DISPLAYS), each on its own loopback link at Baud with its
+ * own simulator, given 200 jobs each: first one display after the other waiting for every ACK,
+ * then through Pixxi_FanOut4D.
+ */
+void Pixxi_BenchFanOut4D(uint32_t baud, uint8_t panels, Pixxi_FanOutBench4D * result);
+
+typedef struct {
+	uint32_t Bytes;				// size of the CSV file
+	uint32_t Lines;
+	float WireMs;				// time its bytes alone take on the wire
+	float ReadMs;				// read with file_Read 32 bytes at a time, waiting for each
+	float ReaderMs;				// parsed line by line through Pixxi_FileReader4D
+	uint32_t Blocks;			// file_Reads the reader made
+	uint32_t Stalls;			// times it had to wait for one
+	bool Same;					// both got the file as it is on the card
+	uint64_t Dropped;			// bytes the simulated link lost, should be 0
+} Pixxi_ReaderBench4D;
+
+//A CSV of about 16KB on the simulated card at Baud, read whole and then line by line
+void Pixxi_BenchReader4D(uint32_t baud, Pixxi_ReaderBench4D * result);
+
+typedef struct {
+	uint32_t Bytes;				// of the 500 CSV lines
+	float WireMs;				// time they alone take on the wire
+	float PutSMs;				// written with file_PutS a line at a time
+	float WriterMs;				// through Pixxi_FileWriter4D, until close() returned
+	uint32_t Writes;			// file_Writes the writer made
+	float PutCMs;				// 2000 bytes with file_PutC
+	float MaxCallMs;			// longest puts() with Block off, fed at twice the link rate
+	uint32_t Refused;			// bytes it dropped meanwhile
+	bool Same;					// the card ended up with what was written
+} Pixxi_WriterBench4D;
+
+//Logging to the simulated card at Baud: 500 CSV lines each way, then a non-blocking writer outpaced
+void Pixxi_BenchWriter4D(uint32_t baud, Pixxi_WriterBench4D * result);
+
+typedef struct {
+	uint32_t DirectRoundTrips;	// media_SetSector, RdSector and WrSector for every access
+	float DirectMs;
+	uint32_t CacheRoundTrips;	// through an 8 slot Pixxi_SectorCache4D, up to its flush()
+	float CacheMs;
+	uint32_t Hits;
+	uint32_t Misses;
+	float ScanMs;				// 300 sectors read in order, without read-ahead
+	float ScanAheadMs;			// with ReadAhead 8
+	float ScanWireMs;			// time the 300 sector replies alone take on the wire
+	bool Same;					// every read saw what was written, and the media ended up right
+} Pixxi_SectorBench4D;
+
+/*
+ * A ring log on raw media at Baud, with media_RdSector taking 400us and media_WrSector 800us:
+ * 600 records appended, the header sector read and rewritten after each, and the last 40
+ * records read back every 50. Then a sequential scan. Needs a PIXXI_RX_RING_SIZE of 1024 or more.
+ */
+void Pixxi_BenchSectors4D(uint32_t baud, Pixxi_SectorBench4D * result);
+
+typedef struct {
+	uint32_t Cases;
+	uint32_t WellFormed;		// ACK or NAK with a correct count and payload
+	uint32_t Exact;				// of those, calls which returned exactly what was sent
+	uint32_t Truncated;			// well formed replies cut short
+	uint32_t Random;			// replies of random bytes
+	uint32_t Timeouts;
+	uint32_t Overruns;			// calls which wrote outside the caller's buffer, must be 0
+} Pixxi_FuzzBench4D;
+
+/*
+ * Fuzz the data replies: Cases calls of file_Read, readString and media_RdSector with random
+ * buffer sizes, each answered by the loopback link with a well formed reply (or NAK), the
+ * same cut short, or random bytes. Every buffer has canary bytes on both sides. Well formed
+ * replies have to come back exactly; whatever the reply, nothing may be written outside the
+ * buffer. Build with -fsanitize=address,undefined to catch what the canaries cannot.
+ * Needs a PIXXI_RX_RING_SIZE of 1024 or more.
+ */
+void Pixxi_BenchFuzz4D(uint32_t cases, uint32_t seed, Pixxi_FuzzBench4D * result);
+
+//How Pixxi_BenchVideo4D shows the frames
+#define PIXXI_BENCH_VIDEO_LOOP		0	// media_VideoFrame then a fixed delay, as a main loop would
+#define PIXXI_BENCH_VIDEO_PLAYER	1	// Pixxi_VideoPlayer4D ticked from the loop
+#define PIXXI_BENCH_VIDEO_NO_SKIP	2	// the same with Skip off
+#define PIXXI_BENCH_VIDEO_QUEUE		3	// ticked at 1kHz, frames through a Pixxi_CommandQueue4D
+
+typedef struct {
+	uint8_t Mode;
+	uint32_t Shown;
+	uint32_t Dropped;
+	uint32_t Failed;
+	float Fps;
+	float IntervalSdMs;			// spread of the time between frames
+	float WorstOffMs;			// furthest any interval was from the frame period
+	float Ms;					// for the whole clip, 6000 of video
+	uint32_t SettersSent;		// of the txt_FGcolour the loop calls with the same value each time, ideally 1
+} Pixxi_VideoBench4D;
+
+/*
+ * 150 frames at 25fps over a 600000 baud link, each taking the display FrameUs plus up to 6ms,
+ * from a loop which does 0 to 20ms of other work between its turns.
+ */
+void Pixxi_BenchVideo4D(uint8_t mode, uint32_t frameUs, Pixxi_VideoBench4D * result);
+
+typedef struct {
+	bool Pooled;
+	uint32_t Screens;			// built and torn down, out of 200
+	bool OutOfRam;				// stopped early because an allocation failed
+	float ScreenMs;				// per screen
+	uint32_t MemCalls;			// mem_Alloc and mem_Free commands the display got
+	uint8_t Fragmentation;		// worst fragmentation() with a screen up, pooled only
+	uint32_t Overlaps;			// random run: blocks overlapping another or outside display RAM, must be 0
+	uint32_t Clobbered;			// random run: blocks whose contents changed before they were freed, must be 0
+} Pixxi_HeapBench4D;
+
+/*
+ * Screens of 10 widgets (widget_Init and widget_InitString) built and freed at 115200 baud,
+ * with mem_Alloc or through a Pixxi_DisplayHeap4D. Pooled, also a run of 20000 random allocs
+ * and frees, each block filled with a pattern which is checked before it is freed.
+ */
+void Pixxi_BenchHeap4D(bool pooled, Pixxi_HeapBench4D * result);
+
+//Vertices in the polyline Pixxi_BenchPolyline4D draws
+#ifndef PIXXI_BENCH_VERTICES
+#define PIXXI_BENCH_VERTICES 1000
+#endif
+
+typedef struct {
+	uint32_t Baud;
+	uint32_t Calls;				// polylines sent over the loopback link
+	float CallUs;				// wall time per polyline on the link
+	float WireBusy;				// share of that time the wire was sending, 0 to 1
+	float EncodeUs;				// CPU time to encode and queue one polyline, with the link taking it at once
+	uint32_t Unknown;			// commands the simulator could not decode, should be 0
+} Pixxi_PolylineBench4D;
+
+/*
+ * gfx_Polyline of PIXXI_BENCH_VERTICES vertices, back to back for about a second of wire time
+ * at Baud, and then on an in-memory link to time the encoding alone.
+ */
+void Pixxi_BenchPolyline4D(uint32_t baud, Pixxi_PolylineBench4D * result);
+
+#endif
+
+#endif
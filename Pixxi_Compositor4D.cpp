@@ -0,0 +1,194 @@
+/**
+ * Dirty rectangle compositor for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_Compositor4D.h"
+#include <string.h>
+
+Pixxi_Compositor4D::Pixxi_Compositor4D(Pixxi_Serial_4DLib * display, uint16_t width, uint16_t height, uint16_t * strip, uint32_t stripPixels) {
+	_display = display;
+	_strip = strip;
+	_stripPixels = stripPixels;
+	_framebuffer = NULL;
+	_render = NULL;
+	_renderContext = NULL;
+	_count = 0;
+	Width = width;
+	Height = height;
+	OverheadBytes = PIXXI_BLIT_OVERHEAD;
+	Frames = 0;
+	Blits = 0;
+	Merges = 0;
+	PixelsSent = 0;
+}
+
+void Pixxi_Compositor4D::setFramebuffer(uint16_t * pixels)
+{
+	_framebuffer = pixels;
+	_render = NULL;
+}
+
+void Pixxi_Compositor4D::setRenderer(Trender4D render, void * context)
+{
+	_render = render;
+	_renderContext = context;
+	_framebuffer = NULL;
+}
+
+uint8_t Pixxi_Compositor4D::dirty(void)
+{
+	return _count;
+}
+
+Pixxi_Rect4D * Pixxi_Compositor4D::rect(uint8_t index)
+{
+	return index < _count ? &_rects[index] : NULL;
+}
+
+uint32_t Pixxi_Compositor4D::cost(Pixxi_Rect4D * rect)
+{
+	return OverheadBytes + (uint32_t) rect->Width * rect->Height * 2;
+}
+
+static Pixxi_Rect4D boundingBox(Pixxi_Rect4D * a, Pixxi_Rect4D * b)
+{
+	Pixxi_Rect4D box;
+	uint16_t right = a->X + a->Width > b->X + b->Width ? a->X + a->Width : b->X + b->Width;
+	uint16_t bottom = a->Y + a->Height > b->Y + b->Height ? a->Y + a->Height : b->Y + b->Height;
+
+	box.X = a->X < b->X ? a->X : b->X;
+	box.Y = a->Y < b->Y ? a->Y : b->Y;
+	box.Width = right - box.X;
+	box.Height = bottom - box.Y;
+	return box;
+}
+
+void Pixxi_Compositor4D::invalidate(int16_t x, int16_t y, uint16_t width, uint16_t height)
+{
+	int32_t left = x < 0 ? 0 : x;
+	int32_t top = y < 0 ? 0 : y;
+	int32_t right = (int32_t) x + width;
+	int32_t bottom = (int32_t) y + height;
+
+	if (right > Width)
+		right = Width;
+	if (bottom > Height)
+		bottom = Height;
+	if (right <= left || bottom <= top)
+		return;
+
+	Pixxi_Rect4D rect;
+	rect.X = left;
+	rect.Y = top;
+	rect.Width = right - left;
+	rect.Height = bottom - top;
+	add(rect);
+}
+
+void Pixxi_Compositor4D::invalidateAll(void)
+{
+	_count = 0;
+	invalidate(0, 0, Width, Height);
+}
+
+void Pixxi_Compositor4D::add(Pixxi_Rect4D rect)
+{
+	if (_count == PIXXI_DIRTY_RECTS)
+		mergeCheapest();
+	_rects[_count++] = rect;
+	merge();
+}
+
+void Pixxi_Compositor4D::merge(void)
+{
+	bool merged = true;
+
+	//Merge any pair which costs no more as one blit than as two, until none are left. Each
+	//merge can make its result worth merging with a rectangle already passed over.
+	while (merged)
+	{
+		merged = false;
+		for (uint8_t i = 0; i < _count && !merged; i++)
+		{
+			for (uint8_t j = i + 1; j < _count; j++)
+			{
+				Pixxi_Rect4D box = boundingBox(&_rects[i], &_rects[j]);
+				if (cost(&box) <= cost(&_rects[i]) + cost(&_rects[j]))
+				{
+					_rects[i] = box;
+					_rects[j] = _rects[--_count];
+					Merges++;
+					merged = true;
+					break;
+				}
+			}
+		}
+	}
+}
+
+void Pixxi_Compositor4D::mergeCheapest(void)
+{
+	uint8_t bestI = 0;
+	uint8_t bestJ = 1;
+	int64_t best = INT64_MAX;
+
+	//Full, so merge the pair which adds the fewest bytes by doing so
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		for (uint8_t j = i + 1; j < _count; j++)
+		{
+			Pixxi_Rect4D box = boundingBox(&_rects[i], &_rects[j]);
+			int64_t extra = (int64_t) cost(&box) - cost(&_rects[i]) - cost(&_rects[j]);
+			if (extra < best)
+			{
+				best = extra;
+				bestI = i;
+				bestJ = j;
+			}
+		}
+	}
+
+	_rects[bestI] = boundingBox(&_rects[bestI], &_rects[bestJ]);
+	_rects[bestJ] = _rects[--_count];
+	Merges++;
+}
+
+/*
+ * Source for blitStream when the pixels are in a framebuffer
+ */
+void Pixxi_Compositor4D::copy(void * context, uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t * pixels)
+{
+	Pixxi_Compositor4D * screen = (Pixxi_Compositor4D *) context;
+
+	for (uint16_t row = 0; row < height; row++)
+		memcpy(pixels + row * width, screen->_framebuffer + (uint32_t) (y + row) * screen->Width + x, 2 * width);
+}
+
+void Pixxi_Compositor4D::send(Pixxi_Rect4D * rect)
+{
+	//One blit per rectangle, streamed through the two halves of the strip
+	if (_framebuffer != NULL)
+		_display->blitStream(rect->X, rect->Y, rect->Width, rect->Height, copy, this, _strip, _stripPixels);
+	else
+		_display->blitStream(rect->X, rect->Y, rect->Width, rect->Height, _render, _renderContext, _strip, _stripPixels);
+	Blits++;
+	PixelsSent += (uint32_t) rect->Width * rect->Height;
+}
+
+uint16_t Pixxi_Compositor4D::flush(void)
+{
+	uint32_t blits = Blits;
+
+	if (_count == 0 || (_framebuffer == NULL && _render == NULL) || _stripPixels < 2)
+	{
+		_count = 0;
+		return 0;
+	}
+
+	for (uint8_t i = 0; i < _count; i++)
+		send(&_rects[i]);
+	_count = 0;
+	Frames++;
+	return Blits - blits;
+}
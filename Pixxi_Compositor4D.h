@@ -0,0 +1,97 @@
+/**
+ * Dirty rectangle compositor for the Pixxi serial library.
+ *
+ * Keeps track of which parts of the screen have changed and sends only those, as
+ * blitComtoDisplay regions, when flushed. Pixels come from one of two places:
+ *
+ *	- a full RGB565 framebuffer in our memory (setFramebuffer), e.g. on a PC or an MCU with
+ *	  the RAM for it, or
+ *	- a render callback (setRenderer) which is asked to draw any rectangle into the strip
+ *	  buffer, so only a few lines of the screen ever need to be in RAM at once.
+ *
+ * Either way each rectangle is sent as one blitStream, a few lines at a time through the two
+ * halves of the strip buffer:
+ *
+ *	uint16_t strip[240 * 16];
+ *	Pixxi_Compositor4D screen(&Display, 240, 320, strip, 240 * 16);
+ *	screen.setRenderer(DrawDashboard, NULL);
+ *	screen.invalidate(10, 40, 100, 20);		// the speed readout changed
+ *	screen.flush();
+ *
+ * Dirty rectangles are merged whenever sending their bounding box would cost no more than
+ * sending them apart, with each blit costing OverheadBytes (command header plus the ACK
+ * turnaround, in byte times on the wire) on top of its pixels. Raise OverheadBytes on slow
+ * links or with long turnarounds, lower it when pipelining.
+ */
+#ifndef Pixxi_Compositor4D_h
+#define Pixxi_Compositor4D_h
+
+#include "Pixxi_Serial_4Dlib.h"
+
+//Most dirty rectangles kept apart. Past this the two cheapest to merge are merged.
+#ifndef PIXXI_DIRTY_RECTS
+#define PIXXI_DIRTY_RECTS 16
+#endif
+
+//Default cost of a blit beyond its pixels, in bytes: 10 header bytes plus about 2ms of turnaround at 115200
+#ifndef PIXXI_BLIT_OVERHEAD
+#define PIXXI_BLIT_OVERHEAD 32
+#endif
+
+typedef struct {
+	uint16_t X;
+	uint16_t Y;
+	uint16_t Width;
+	uint16_t Height;
+} Pixxi_Rect4D;
+
+class Pixxi_Compositor4D
+{
+	public:
+		Pixxi_Compositor4D(Pixxi_Serial_4DLib * display, uint16_t width, uint16_t height, uint16_t * strip, uint32_t stripPixels);
+
+		//Where the pixels come from, see above. The framebuffer is Width * Height, row by row.
+		void setFramebuffer(uint16_t * pixels);
+		void setRenderer(Trender4D render, void * context);
+
+		//Mark part of the screen (clipped to it) as changed
+		void invalidate(int16_t x, int16_t y, uint16_t width, uint16_t height);
+		void invalidateAll(void);
+		//Send everything marked since the last flush. Returns the number of blits.
+		uint16_t flush(void);
+
+		//Dirty rectangles waiting for the next flush
+		uint8_t dirty(void);
+		Pixxi_Rect4D * rect(uint8_t index);
+		//Wire cost of sending a rectangle as one blit, in bytes
+		uint32_t cost(Pixxi_Rect4D * rect);
+
+		uint16_t Width;
+		uint16_t Height;
+		uint32_t OverheadBytes;		// cost of a blit beyond its pixels
+
+		//Statistics
+		uint32_t Frames;			// flushes which sent something
+		uint32_t Blits;				// blits sent, one per rectangle
+		uint32_t Merges;			// rectangles merged into another
+		uint64_t PixelsSent;
+
+	private:
+		void add(Pixxi_Rect4D rect);
+		void merge(void);
+		void mergeCheapest(void);
+		void send(Pixxi_Rect4D * rect);
+		static void copy(void * context, uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t * pixels);
+
+		Pixxi_Serial_4DLib * _display;
+		uint16_t * _strip;
+		uint32_t _stripPixels;
+		uint16_t * _framebuffer;
+		Trender4D _render;
+		void * _renderContext;
+
+		Pixxi_Rect4D _rects[PIXXI_DIRTY_RECTS];
+		uint8_t _count;
+};
+
+#endif
@@ -0,0 +1,363 @@
+/**
+ * Pixel format conversion for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_Convert4D.h"
+#include "Pixxi_Pack4D.h"
+#include <string.h>
+
+#if defined(PIXXI_HOST) && defined(__SSE2__)
+#include <immintrin.h>
+#include <x86intrin.h>
+#elif defined(PIXXI_HOST)
+#include <time.h>
+#endif
+
+//4x4 Bayer matrix, thresholds 0 to 15
+static const uint8_t Bayer[4][4] = {
+	{0, 8, 2, 10},
+	{12, 4, 14, 6},
+	{3, 11, 1, 9},
+	{15, 7, 13, 5},
+};
+
+void Pixxi_DitherRow4D(uint32_t * dither, uint16_t x, uint16_t y)
+{
+	//Red and blue lose 3 bits, green 2
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		uint32_t t = Bayer[y & 3][(x + i) & 3];
+		dither[i] = (t >> 1) << 16 | (t >> 2) << 8 | (t >> 1);
+	}
+}
+
+/**
+ * Building blocks, one pixel at a time as 0x00RRGGBB
+ */
+
+static inline uint32_t qadd8(uint32_t a, uint32_t b)
+{
+#ifndef PIXXI_HOST
+	return __UQADD8(a, b);
+#else
+	//Add each byte without carrying into the next, then saturate the ones which overflowed
+	uint32_t sum = ((a & 0x7F7F7F7F) + (b & 0x7F7F7F7F)) ^ ((a ^ b) & 0x80808080);
+	uint32_t over = ((a & b) | ((a | b) & ~sum)) & 0x80808080;
+	return sum | ((over >> 7) * 0xFF);
+#endif
+}
+
+static inline uint32_t to565(uint32_t p)
+{
+	return ((p >> 8) & 0xF800) | ((p >> 5) & 0x07E0) | ((p >> 3) & 0x001F);
+}
+
+static inline uint32_t expand565(uint16_t c)
+{
+	uint32_t r = (c >> 11) & 0x1F;
+	uint32_t g = (c >> 5) & 0x3F;
+	uint32_t b = c & 0x1F;
+	return (r << 3 | r >> 2) << 16 | (g << 2 | g >> 4) << 8 | (b << 3 | b >> 2);
+}
+
+//Source over background, rounded exactly, red and blue together in one multiply
+static inline uint32_t blend(uint32_t p, uint32_t background)
+{
+	uint32_t a = p >> 24;
+	uint32_t rb = (p & 0xFF00FF) * a + (background & 0xFF00FF) * (255 - a) + 0x800080;
+	uint32_t g = (p & 0x00FF00) * a + (background & 0x00FF00) * (255 - a) + 0x008000;
+
+	rb = ((rb + ((rb >> 8) & 0xFF00FF)) >> 8) & 0xFF00FF;
+	g = ((g + ((g >> 8) & 0x00FF00)) >> 8) & 0x00FF00;
+	return rb | g;
+}
+
+/*
+ * Store pixels i and i + 1 big-endian. On the MCU that is one PKHBT, one REV16 and one store.
+ */
+static inline void put2(uint8_t * dest, uint32_t i, uint32_t p0, uint32_t p1, const uint32_t * dither)
+{
+	if (dither != NULL)
+	{
+		p0 = qadd8(p0, dither[i & 3]);
+		p1 = qadd8(p1, dither[(i + 1) & 3]);
+	}
+#ifndef PIXXI_HOST
+	uint32_t pair = __REV16(__PKHBT(to565(p0), to565(p1), 16));
+	memcpy(dest + 2 * i, &pair, 4);
+#else
+	uint32_t c0 = to565(p0);
+	uint32_t c1 = to565(p1);
+	dest[2 * i] = c0 >> 8;
+	dest[2 * i + 1] = c0 & 0xFF;
+	dest[2 * i + 2] = c1 >> 8;
+	dest[2 * i + 3] = c1 & 0xFF;
+#endif
+}
+
+static inline void put1(uint8_t * dest, uint32_t i, uint32_t p, const uint32_t * dither)
+{
+	if (dither != NULL)
+		p = qadd8(p, dither[i & 3]);
+	uint32_t c = to565(p);
+	dest[2 * i] = c >> 8;
+	dest[2 * i + 1] = c & 0xFF;
+}
+
+/**
+ * Host vector versions, eight pixels (sixteen with AVX2) at a time
+ */
+
+#if defined(PIXXI_HOST) && defined(__SSE2__)
+
+static inline __m128i ditherVector(const uint32_t * dither)
+{
+	return dither != NULL ? _mm_loadu_si128((const __m128i *) dither) : _mm_setzero_si128();
+}
+
+//Two vectors of four 0x00RRGGBB pixels to eight big-endian RGB565 words
+static inline __m128i pack565(__m128i lo, __m128i hi)
+{
+	const __m128i red = _mm_set1_epi32(0xF800);
+	const __m128i green = _mm_set1_epi32(0x07E0);
+	const __m128i blue = _mm_set1_epi32(0x001F);
+	const __m128i bias = _mm_set1_epi32(0x8000);
+
+	lo = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(lo, 8), red), _mm_and_si128(_mm_srli_epi32(lo, 5), green)), _mm_and_si128(_mm_srli_epi32(lo, 3), blue));
+	hi = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(hi, 8), red), _mm_and_si128(_mm_srli_epi32(hi, 5), green)), _mm_and_si128(_mm_srli_epi32(hi, 3), blue));
+	//SSE2 only packs signed, so move 0..0xFFFF into range and back
+	__m128i v = _mm_packs_epi32(_mm_sub_epi32(lo, bias), _mm_sub_epi32(hi, bias));
+	v = _mm_xor_si128(v, _mm_set1_epi16((short) 0x8000));
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+//Four ARGB pixels blended over the background, 16 bits per channel in between
+static inline __m128i blend4(__m128i p, __m128i background)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(255);
+	const __m128i round = _mm_set1_epi16(128);
+	__m128i bg = _mm_unpacklo_epi8(background, zero);
+	__m128i halves[2] = {_mm_unpacklo_epi8(p, zero), _mm_unpackhi_epi8(p, zero)};
+
+	for (uint8_t h = 0; h < 2; h++)
+	{
+		__m128i s = halves[h];
+		__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+		__m128i x = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(bg, _mm_sub_epi16(full, a))), round);
+		halves[h] = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+	}
+	return _mm_packus_epi16(halves[0], halves[1]);
+}
+
+#ifdef __AVX2__
+static inline __m256i pack565x16(__m256i lo, __m256i hi)
+{
+	const __m256i red = _mm256_set1_epi32(0xF800);
+	const __m256i green = _mm256_set1_epi32(0x07E0);
+	const __m256i blue = _mm256_set1_epi32(0x001F);
+
+	lo = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(lo, 8), red), _mm256_and_si256(_mm256_srli_epi32(lo, 5), green)), _mm256_and_si256(_mm256_srli_epi32(lo, 3), blue));
+	hi = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(hi, 8), red), _mm256_and_si256(_mm256_srli_epi32(hi, 5), green)), _mm256_and_si256(_mm256_srli_epi32(hi, 3), blue));
+	//The pack works within each 128 bit lane, put the quarters back in order
+	__m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+	return _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+}
+
+static inline __m256i blend8(__m256i p, __m256i background)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i full = _mm256_set1_epi16(255);
+	const __m256i round = _mm256_set1_epi16(128);
+	const __m256i alpha = _mm256_setr_epi8(6, -1, 6, -1, 6, -1, 6, -1, 14, -1, 14, -1, 14, -1, 14, -1,
+		6, -1, 6, -1, 6, -1, 6, -1, 14, -1, 14, -1, 14, -1, 14, -1);
+	__m256i bg = _mm256_unpacklo_epi8(background, zero);
+	__m256i halves[2] = {_mm256_unpacklo_epi8(p, zero), _mm256_unpackhi_epi8(p, zero)};
+
+	for (uint8_t h = 0; h < 2; h++)
+	{
+		__m256i s = halves[h];
+		__m256i a = _mm256_shuffle_epi8(s, alpha);
+		__m256i x = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(s, a), _mm256_mullo_epi16(bg, _mm256_sub_epi16(full, a))), round);
+		halves[h] = _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+	}
+	return _mm256_packus_epi16(halves[0], halves[1]);
+}
+#endif
+
+#endif
+
+/**
+ * Kernels
+ */
+
+void Pixxi_Rgb888To565(uint8_t * dest, const uint8_t * source, uint32_t count, const uint32_t * dither)
+{
+	uint32_t i = 0;
+
+#if defined(PIXXI_HOST) && defined(__SSSE3__)
+	//Spread 3 byte pixels out to 4, twelve bytes at a time. Each load reads 16, so stop short of the end.
+	const __m128i spread = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	__m128i d = ditherVector(dither);
+	for (; i + 10 <= count; i += 8)
+	{
+		__m128i lo = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (source + 3 * i)), spread);
+		__m128i hi = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (source + 3 * i + 12)), spread);
+		_mm_storeu_si128((__m128i *) (dest + 2 * i), pack565(_mm_adds_epu8(lo, d), _mm_adds_epu8(hi, d)));
+	}
+#endif
+
+	for (; i + 2 <= count; i += 2)
+	{
+		const uint8_t * s = source + 3 * i;
+		put2(dest, i, s[0] << 16 | s[1] << 8 | s[2], s[3] << 16 | s[4] << 8 | s[5], dither);
+	}
+	if (i < count)
+	{
+		const uint8_t * s = source + 3 * i;
+		put1(dest, i, s[0] << 16 | s[1] << 8 | s[2], dither);
+	}
+}
+
+void Pixxi_Argb8888To565(uint8_t * dest, const uint32_t * source, uint32_t count, uint16_t background, const uint32_t * dither)
+{
+	uint32_t bg = expand565(background);
+	uint32_t i = 0;
+
+#if defined(PIXXI_HOST) && defined(__AVX2__)
+	__m256i d16 = _mm256_broadcastsi128_si256(ditherVector(dither));
+	__m256i bg16 = _mm256_set1_epi32(bg);
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i lo = blend8(_mm256_loadu_si256((const __m256i *) (source + i)), bg16);
+		__m256i hi = blend8(_mm256_loadu_si256((const __m256i *) (source + i + 8)), bg16);
+		_mm256_storeu_si256((__m256i *) (dest + 2 * i), pack565x16(_mm256_adds_epu8(lo, d16), _mm256_adds_epu8(hi, d16)));
+	}
+#endif
+#if defined(PIXXI_HOST) && defined(__SSE2__)
+	__m128i d = ditherVector(dither);
+	__m128i bg4 = _mm_set1_epi32(bg);
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i lo = blend4(_mm_loadu_si128((const __m128i *) (source + i)), bg4);
+		__m128i hi = blend4(_mm_loadu_si128((const __m128i *) (source + i + 4)), bg4);
+		_mm_storeu_si128((__m128i *) (dest + 2 * i), pack565(_mm_adds_epu8(lo, d), _mm_adds_epu8(hi, d)));
+	}
+#endif
+
+	for (; i + 2 <= count; i += 2)
+		put2(dest, i, blend(source[i], bg), blend(source[i + 1], bg), dither);
+	if (i < count)
+		put1(dest, i, blend(source[i], bg), dither);
+}
+
+void Pixxi_Gray8To565(uint8_t * dest, const uint8_t * source, uint32_t count, const uint32_t * dither)
+{
+	uint32_t i = 0;
+
+#if defined(PIXXI_HOST) && defined(__SSE2__)
+	__m128i d = ditherVector(dither);
+	for (; i + 8 <= count; i += 8)
+	{
+		//Each gray byte repeated into all four bytes of its pixel
+		__m128i g = _mm_loadl_epi64((const __m128i *) (source + i));
+		g = _mm_unpacklo_epi8(g, g);
+		__m128i lo = _mm_unpacklo_epi16(g, g);
+		__m128i hi = _mm_unpackhi_epi16(g, g);
+		_mm_storeu_si128((__m128i *) (dest + 2 * i), pack565(_mm_adds_epu8(lo, d), _mm_adds_epu8(hi, d)));
+	}
+#endif
+
+	for (; i + 2 <= count; i += 2)
+		put2(dest, i, source[i] * 0x010101, source[i + 1] * 0x010101, dither);
+	if (i < count)
+		put1(dest, i, source[i] * 0x010101, dither);
+}
+
+void Pixxi_ConvertRect4D(void * context, uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t * pixels)
+{
+	Pixxi_Image4D * image = (Pixxi_Image4D *) context;
+	uint32_t dither[4];
+	uint8_t * dest = (uint8_t *) pixels;
+
+	for (uint16_t row = 0; row < height; row++, dest += 2 * width)
+	{
+		uint16_t ix = x - image->X;
+		uint16_t iy = y + row - image->Y;
+		const uint8_t * line = (const uint8_t *) image->Pixels + (uint32_t) iy * image->Stride;
+
+		if (image->Dither)
+			Pixxi_DitherRow4D(dither, x, y + row);
+
+		switch (image->Format)
+		{
+			case PIXXI_RGB888:
+				Pixxi_Rgb888To565(dest, line + 3 * ix, width, image->Dither ? dither : NULL);
+				break;
+			case PIXXI_ARGB8888:
+				Pixxi_Argb8888To565(dest, (const uint32_t *) line + ix, width, image->Background, image->Dither ? dither : NULL);
+				break;
+			case PIXXI_GRAY8:
+				Pixxi_Gray8To565(dest, line + ix, width, image->Dither ? dither : NULL);
+				break;
+			default:
+				Pixxi_PackWords4D(dest, (const uint16_t *) line + ix, width);
+				break;
+		}
+	}
+}
+
+/**
+ * Benchmark
+ */
+
+static uint32_t cycles(void)
+{
+#if defined(PIXXI_HOST) && defined(__SSE2__)
+	return (uint32_t) __rdtsc();
+#elif defined(PIXXI_HOST)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#else
+	return DWT->CYCCNT;
+#endif
+}
+
+uint32_t Pixxi_ConvertBench4D(uint8_t format, bool dither, const void * source, uint8_t * dest, uint32_t count)
+{
+	uint32_t pattern[4];
+	uint32_t best = 0xFFFFFFFF;
+
+#ifndef PIXXI_HOST
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+	Pixxi_DitherRow4D(pattern, 0, 0);
+
+	//Best of several runs, the first one warms the caches
+	for (uint8_t run = 0; run < 8; run++)
+	{
+		uint32_t start = cycles();
+		switch (format)
+		{
+			case PIXXI_RGB888:
+				Pixxi_Rgb888To565(dest, (const uint8_t *) source, count, dither ? pattern : NULL);
+				break;
+			case PIXXI_ARGB8888:
+				Pixxi_Argb8888To565(dest, (const uint32_t *) source, count, 0, dither ? pattern : NULL);
+				break;
+			case PIXXI_GRAY8:
+				Pixxi_Gray8To565(dest, (const uint8_t *) source, count, dither ? pattern : NULL);
+				break;
+			default:
+				Pixxi_PackWords4D(dest, (const uint16_t *) source, count);
+				break;
+		}
+		uint32_t spent = cycles() - start;
+		if (spent < best)
+			best = spent;
+	}
+	return best == 0 ? 0 : (uint32_t) ((uint64_t) count * 1000 / best);
+}
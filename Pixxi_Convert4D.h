@@ -0,0 +1,67 @@
+/**
+ * Pixel format conversion for the Pixxi serial library.
+ *
+ * The display takes RGB565, big-endian. These kernels turn RGB888, ARGB8888 (alpha blended
+ * over a background colour) and 8 bit grayscale into exactly that in one pass, optionally
+ * with a 4x4 ordered dither in place of plain truncation, so images can be kept in whatever
+ * format they came in and converted a piece at a time as blitStream sends them:
+ *
+ *	Pixxi_Image4D logo = {logoPixels, 3 * 120, 120, 80, PIXXI_RGB888, true, BLACK};
+ *	uint16_t buffer[120 * 8];
+ *	Display.blitImage(60, 40, &logo, buffer, 120 * 8);
+ *
+ * The MCU version works two pixels at a time with the Cortex-M4 DSP instructions (UQADD8
+ * to dither all three channels at once, PKHBT and REV16 to pack and swap a pair); the host
+ * version uses SSE2 / SSSE3, and AVX2 where the compiler is allowed it.
+ */
+#ifndef Pixxi_Convert4D_h
+#define Pixxi_Convert4D_h
+
+#include "Pixxi_Transport4D.h"
+
+//Source pixel formats
+#define PIXXI_RGB888	0	// 3 bytes per pixel: red, green, blue
+#define PIXXI_ARGB8888	1	// one uint32_t per pixel, 0xAARRGGBB
+#define PIXXI_GRAY8		2	// 1 byte per pixel
+#define PIXXI_RGB565	3	// one uint16_t per pixel, native byte order
+
+/*
+ * An image in memory, for blitImage / Pixxi_ConvertRect4D.
+ */
+typedef struct {
+	const void * Pixels;	// top left pixel
+	uint32_t Stride;		// bytes from the start of one row to the next
+	uint16_t Width;
+	uint16_t Height;
+	uint8_t Format;			// one of the formats above
+	bool Dither;			// ordered dither rather than truncating to 565
+	uint16_t Background;	// RGB565 colour ARGB8888 pixels are blended over
+	uint16_t X;				// where it is on the screen, set by blitImage
+	uint16_t Y;
+} Pixxi_Image4D;
+
+/*
+ * Dither offsets for four pixels in a row starting at screen position x, y: one 0x00RRGGBB
+ * word per pixel, added with saturation before the channels are truncated.
+ */
+void Pixxi_DitherRow4D(uint32_t * dither, uint16_t x, uint16_t y);
+
+/*
+ * Convert count pixels to big-endian RGB565 at dest (2 * count bytes). dither is four words
+ * from Pixxi_DitherRow4D for the first pixel's position, or NULL not to dither.
+ */
+void Pixxi_Rgb888To565(uint8_t * dest, const uint8_t * source, uint32_t count, const uint32_t * dither);
+void Pixxi_Argb8888To565(uint8_t * dest, const uint32_t * source, uint32_t count, uint16_t background, const uint32_t * dither);
+void Pixxi_Gray8To565(uint8_t * dest, const uint8_t * source, uint32_t count, const uint32_t * dither);
+
+//Trender4D for blitStream with Packed set, context is a Pixxi_Image4D
+void Pixxi_ConvertRect4D(void * context, uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t * pixels);
+
+/*
+ * Throughput of one of the kernels on this CPU, converting count pixels from source into
+ * dest several times over. Returns pixels per 1000 cycles: DWT cycles on the MCU, TSC
+ * cycles on an x86 host (nanoseconds elsewhere).
+ */
+uint32_t Pixxi_ConvertBench4D(uint8_t format, bool dither, const void * source, uint8_t * dest, uint32_t count);
+
+#endif
@@ -0,0 +1,185 @@
+/**
+ * C++20 coroutine front-end for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_Coroutine4D.h"
+
+#if defined(__cpp_impl_coroutine)
+
+/**
+ * Frame pool
+ */
+
+alignas(8) uint8_t Pixxi_FramePool4D::_frames[PIXXI_CO_FRAMES][PIXXI_CO_FRAME_SIZE];
+uint32_t Pixxi_FramePool4D::_used = 0;
+uint8_t Pixxi_FramePool4D::InUse = 0;
+uint8_t Pixxi_FramePool4D::HighWater = 0;
+uint32_t Pixxi_FramePool4D::Failures = 0;
+uint16_t Pixxi_FramePool4D::LargestFrame = 0;
+
+void * Pixxi_FramePool4D::alloc(size_t size)
+{
+	void * frame = NULL;
+
+	if (size > LargestFrame)
+		LargestFrame = size;
+
+	PIXXI_ENTER_CRITICAL();
+	if (size <= PIXXI_CO_FRAME_SIZE)
+	{
+		for (uint8_t i = 0; i < PIXXI_CO_FRAMES; i++)
+		{
+			if (!(_used & (1UL << i)))
+			{
+				_used |= 1UL << i;
+				frame = _frames[i];
+				InUse++;
+				if (InUse > HighWater)
+					HighWater = InUse;
+				break;
+			}
+		}
+	}
+	PIXXI_EXIT_CRITICAL();
+
+	if (frame == NULL)
+		Failures++;
+	return frame;
+}
+
+void Pixxi_FramePool4D::free(void * frame)
+{
+	uint8_t index = ((uint8_t *) frame - &_frames[0][0]) / PIXXI_CO_FRAME_SIZE;
+
+	PIXXI_ENTER_CRITICAL();
+	_used &= ~(1UL << index);
+	InUse--;
+	PIXXI_EXIT_CRITICAL();
+}
+
+/**
+ * Task
+ */
+
+std::coroutine_handle<> Pixxi_Task4D::promise_type::FinalAwaiter::await_suspend(std::coroutine_handle<promise_type> h) noexcept
+{
+	promise_type & promise = h.promise();
+
+	//Carry on with whoever was waiting for us, they own our frame
+	if (promise.Continuation)
+		return promise.Continuation;
+
+	//Spawned, nobody else is going to free it
+	if (promise.Detached)
+	{
+		promise.Scheduler->_active--;
+		h.destroy();
+	}
+	return std::noop_coroutine();
+}
+
+/**
+ * Scheduler
+ */
+
+Pixxi_Scheduler4D::Pixxi_Scheduler4D(Pixxi_Serial_4DLib * display) {
+	_display = display;
+	_readyHead = 0;
+	_readyTail = 0;
+	_readyCount = 0;
+	_active = 0;
+}
+
+bool Pixxi_Scheduler4D::spawn(Pixxi_Task4D && task)
+{
+	if (!task._h || _readyCount >= PIXXI_CO_FRAMES)
+		return false;
+
+	//The scheduler owns it from now on
+	std::coroutine_handle<Pixxi_Task4D::promise_type> h = task._h;
+	task._h = NULL;
+	h.promise().Scheduler = this;
+	h.promise().Detached = true;
+	_active++;
+
+	ready(h);
+	return true;
+}
+
+void Pixxi_Scheduler4D::run(void)
+{
+	_display->service();
+
+	//Only run what is ready now, anything readied while we go waits for the next pass
+	uint8_t count = _readyCount;
+	while (count-- > 0)
+	{
+		PIXXI_ENTER_CRITICAL();
+		std::coroutine_handle<> h = _ready[_readyTail];
+		_readyTail = (_readyTail + 1) % PIXXI_CO_FRAMES;
+		_readyCount--;
+		PIXXI_EXIT_CRITICAL();
+
+		h.resume();
+	}
+}
+
+uint8_t Pixxi_Scheduler4D::active(void)
+{
+	return _active;
+}
+
+void Pixxi_Scheduler4D::ready(std::coroutine_handle<> h)
+{
+	//Every coroutine is in here at most once, so there is always room for it
+	PIXXI_ENTER_CRITICAL();
+	_ready[_readyHead] = h;
+	_readyHead = (_readyHead + 1) % PIXXI_CO_FRAMES;
+	_readyCount++;
+	PIXXI_EXIT_CRITICAL();
+}
+
+void Pixxi_Scheduler4D::Wake(void * context, Pixxi_Future4D * future)
+{
+	Pixxi_Task4D::promise_type * promise = (Pixxi_Task4D::promise_type *) context;
+
+	promise->Scheduler->ready(std::coroutine_handle<Pixxi_Task4D::promise_type>::from_promise(*promise));
+}
+
+/**
+ * Multi-step sequences
+ */
+
+Pixxi_Task4D Pixxi_CoDisplay4D::widget_Init(uint16_t len, uint16_t * data, uint16_t * hndl, uint16_t * param)
+{
+	*param = co_await mem_Alloc(len << 1);
+	co_await SendWordArrayToRAM(*param, len, data);
+	*hndl = co_await mem_Alloc(24);
+}
+
+Pixxi_Task4D Pixxi_CoDisplay4D::widget_InitString(char * str, uint16_t * addr)
+{
+	uint16_t len = strlen(str);
+
+	*addr = co_await mem_Alloc(len);
+	co_await SendByteArrayToRAM(*addr, len, (uint8_t *) str);
+}
+
+Pixxi_Task4D Pixxi_CoDisplay4D::widget_InitStringPtr(char * str, uint16_t * ptr)
+{
+	uint16_t addr;
+
+	co_await widget_InitString(str, &addr);
+	*ptr = co_await str_Ptr(addr);
+}
+
+Pixxi_Task4D Pixxi_CoDisplay4D::widget_InitStringArray(char * str, uint16_t len, uint16_t * ptr)
+{
+	uint16_t addr = co_await mem_Alloc(len);
+
+	co_await SendByteArrayToRAM(addr, len, (uint8_t *) str);
+	*ptr = co_await str_Ptr(addr);
+}
+
+#endif
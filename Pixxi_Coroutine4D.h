@@ -0,0 +1,283 @@
+/**
+ * C++20 coroutine front-end for the Pixxi serial library.
+ *
+ * Multi-step sequences (widget_Init and friends) are written as coroutines returning
+ * Pixxi_Task4D, which co_await the display instead of blocking on each reply:
+ *
+ *	Pixxi_Task4D setup(Pixxi_CoDisplay4D & co) {
+ *		uint16_t handle = co_await co.mem_Alloc(64);
+ *		co_await co.SendByteArrayToRAM(handle, 64, data);
+ *	}
+ *	Scheduler.spawn(setup(Co));
+ *	while (1) { Scheduler.run(); ReadSensors(); }
+ *
+ * The scheduler takes in replies as they arrive (through the async calls and their
+ * completion handles) and resumes whichever coroutine was waiting on them. Resuming is
+ * done from run(), never from an interrupt, as the resumed code goes on to write to the display.
+ *
+ * Coroutine frames come from a fixed pool, nothing here touches the heap. A coroutine whose
+ * frame does not fit (or when the pool is empty) is simply not started: spawn() returns false.
+ *
+ * Only compiled when the compiler supports coroutines (e.g. -std=gnu++20).
+ */
+#ifndef Pixxi_Coroutine4D_h
+#define Pixxi_Coroutine4D_h
+
+#if defined(__cpp_impl_coroutine)
+
+#include "Pixxi_Serial_4Dlib.h"
+#include <coroutine>
+
+//Number of coroutine frames, at most 32
+#ifndef PIXXI_CO_FRAMES
+#define PIXXI_CO_FRAMES 8
+#endif
+
+//Size of each frame in bytes. Locals and awaited calls live in the frame, see LargestFrame.
+#ifndef PIXXI_CO_FRAME_SIZE
+#define PIXXI_CO_FRAME_SIZE 512
+#endif
+
+#if PIXXI_CO_FRAMES > 32
+#error "PIXXI_CO_FRAMES must be 32 or less"
+#endif
+
+class Pixxi_Scheduler4D;
+
+/*
+ * Fixed pool every coroutine frame is allocated from.
+ */
+class Pixxi_FramePool4D
+{
+	public:
+		static void * alloc(size_t size);
+		static void free(void * frame);
+
+		//Statistics
+		static uint8_t InUse;
+		static uint8_t HighWater;
+		static uint32_t Failures;		// frames refused, too big or none left
+		static uint16_t LargestFrame;	// biggest frame asked for, to help size PIXXI_CO_FRAME_SIZE
+
+	private:
+		alignas(8) static uint8_t _frames[PIXXI_CO_FRAMES][PIXXI_CO_FRAME_SIZE];
+		static uint32_t _used;
+};
+
+/*
+ * Coroutine type for display sequences. Does nothing until spawned or awaited.
+ */
+class Pixxi_Task4D
+{
+	public:
+		struct promise_type
+		{
+			Pixxi_Scheduler4D * Scheduler = NULL;
+			std::coroutine_handle<> Continuation;	// whoever co_awaited us
+			bool Detached = false;					// spawned, frees itself when done
+
+			Pixxi_Task4D get_return_object() { return Pixxi_Task4D(std::coroutine_handle<promise_type>::from_promise(*this)); }
+			static Pixxi_Task4D get_return_object_on_allocation_failure() { return Pixxi_Task4D(); }
+			std::suspend_always initial_suspend() noexcept { return {}; }
+
+			struct FinalAwaiter
+			{
+				bool await_ready() noexcept { return false; }
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept;
+				void await_resume() noexcept {}
+			};
+			FinalAwaiter final_suspend() noexcept { return {}; }
+
+			void return_void() {}
+			//Built without exceptions, nothing can get here
+			void unhandled_exception() {}
+
+			static void * operator new(size_t size) noexcept { return Pixxi_FramePool4D::alloc(size); }
+			static void operator delete(void * frame) { Pixxi_FramePool4D::free(frame); }
+		};
+
+		Pixxi_Task4D() {}
+		explicit Pixxi_Task4D(std::coroutine_handle<promise_type> h) : _h(h) {}
+		Pixxi_Task4D(Pixxi_Task4D && other) : _h(other._h) { other._h = NULL; }
+		Pixxi_Task4D(const Pixxi_Task4D &) = delete;
+		Pixxi_Task4D & operator=(const Pixxi_Task4D &) = delete;
+		~Pixxi_Task4D() { if (_h) _h.destroy(); }
+
+		//False if the frame could not be allocated
+		bool valid(void) { return (bool) _h; }
+
+		//Awaiting a task runs it to completion before carrying on
+		struct Awaiter
+		{
+			std::coroutine_handle<promise_type> Child;
+
+			bool await_ready() { return !Child || Child.done(); }
+			template <typename P>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<P> parent) {
+				Child.promise().Continuation = parent;
+				Child.promise().Scheduler = parent.promise().Scheduler;
+				return Child;
+			}
+			void await_resume() {}
+		};
+		Awaiter operator co_await() { return Awaiter{_h}; }
+
+	private:
+		friend class Pixxi_Scheduler4D;
+		std::coroutine_handle<promise_type> _h;
+};
+
+/*
+ * Runs spawned coroutines. Call run() from the main loop (or the host event loop).
+ */
+class Pixxi_Scheduler4D
+{
+	public:
+		Pixxi_Scheduler4D(Pixxi_Serial_4DLib * display);
+
+		//Start a coroutine, returns false if it could not be allocated or there is no room
+		bool spawn(Pixxi_Task4D && task);
+		//Take in any replies which have arrived and resume whatever was waiting on them
+		void run(void);
+		//Number of spawned coroutines which have not finished yet
+		uint8_t active(void);
+
+		//Mark a suspended coroutine as ready to carry on
+		void ready(std::coroutine_handle<> h);
+		//Completion handle hook, context is the waiting promise
+		static void Wake(void * context, Pixxi_Future4D * future);
+
+	private:
+		friend struct Pixxi_Task4D::promise_type::FinalAwaiter;
+
+		Pixxi_Serial_4DLib * _display;
+		std::coroutine_handle<> _ready[PIXXI_CO_FRAMES];
+		uint8_t _readyHead;
+		uint8_t _readyTail;
+		uint8_t _readyCount;
+		uint8_t _active;
+};
+
+/*
+ * Awaitable for one display call. The command is only sent when it is awaited,
+ * once the completion handle is sitting at its final address in the coroutine frame.
+ */
+template <typename F>
+class Pixxi_Op4D
+{
+	public:
+		Pixxi_Op4D(F start) : _start(start) {}
+
+		bool await_ready() {
+			_start(&Future);
+			return Future.ready();
+		}
+		bool await_suspend(std::coroutine_handle<Pixxi_Task4D::promise_type> h) {
+			//Collected while the command was going out
+			if (Future.ready())
+				return false;
+			Future.Notify = Pixxi_Scheduler4D::Wake;
+			Future.NotifyContext = &h.promise();
+			return true;
+		}
+		uint16_t await_resume() { return Future.Result; }
+
+		Pixxi_Future4D Future;
+
+	private:
+		F _start;
+};
+
+/*
+ * Awaitable for a completion handle which has already been started.
+ */
+class Pixxi_Wait4D
+{
+	public:
+		Pixxi_Wait4D(Pixxi_Future4D * future) : _future(future) {}
+
+		bool await_ready() { return _future->State != PIXXI_FUTURE_PENDING; }
+		void await_suspend(std::coroutine_handle<Pixxi_Task4D::promise_type> h) {
+			_future->Notify = Pixxi_Scheduler4D::Wake;
+			_future->NotifyContext = &h.promise();
+		}
+		uint16_t await_resume() { return _future->Result; }
+
+	private:
+		Pixxi_Future4D * _future;
+};
+
+/*
+ * Let every other ready coroutine run before carrying on.
+ */
+class Pixxi_Yield4D
+{
+	public:
+		bool await_ready() { return false; }
+		void await_suspend(std::coroutine_handle<Pixxi_Task4D::promise_type> h) { h.promise().Scheduler->ready(h); }
+		void await_resume() {}
+};
+
+/*
+ * Awaitable versions of the Pixxi_Serial_4DLib calls.
+ */
+class Pixxi_CoDisplay4D
+{
+	public:
+		Pixxi_CoDisplay4D(Pixxi_Serial_4DLib * display) : Display(display) {}
+
+		auto file_Open(char * Filename, char Mode) {
+			Pixxi_Serial_4DLib * d = Display;
+			return Pixxi_Op4D([=](Pixxi_Future4D * f) { d->file_OpenAsync(Filename, Mode, f); });
+		}
+		auto file_Read(uint8_t * Data, uint16_t Size, uint16_t Handle) {
+			Pixxi_Serial_4DLib * d = Display;
+			return Pixxi_Op4D([=](Pixxi_Future4D * f) { d->file_ReadAsync(Data, Size, Handle, f); });
+		}
+		auto gfx_GetPixel(uint16_t X, uint16_t Y) {
+			Pixxi_Serial_4DLib * d = Display;
+			return Pixxi_Op4D([=](Pixxi_Future4D * f) { d->gfx_GetPixelAsync(X, Y, f); });
+		}
+		auto img_Touched(uint16_t Handle, uint16_t Index) {
+			Pixxi_Serial_4DLib * d = Display;
+			return Pixxi_Op4D([=](Pixxi_Future4D * f) { d->img_TouchedAsync(Handle, Index, f); });
+		}
+		auto media_Init(void) {
+			Pixxi_Serial_4DLib * d = Display;
+			return Pixxi_Op4D([=](Pixxi_Future4D * f) { d->media_InitAsync(f); });
+		}
+		auto mem_Alloc(uint16_t Size) {
+			Pixxi_Serial_4DLib * d = Display;
+			return Pixxi_Op4D([=](Pixxi_Future4D * f) { d->mem_AllocAsync(Size, f); });
+		}
+		auto SendByteArrayToRAM(uint16_t hndl, uint16_t length, uint8_t * data) {
+			Pixxi_Serial_4DLib * d = Display;
+			return Pixxi_Op4D([=](Pixxi_Future4D * f) { d->SendByteArrayToRAMAsync(hndl, length, data, f); });
+		}
+		auto SendWordArrayToRAM(uint16_t hndl, uint16_t length, uint16_t * data) {
+			Pixxi_Serial_4DLib * d = Display;
+			return Pixxi_Op4D([=](Pixxi_Future4D * f) { d->SendWordArrayToRAMAsync(hndl, length, data, f); });
+		}
+		auto str_Ptr(uint16_t buffer) {
+			Pixxi_Serial_4DLib * d = Display;
+			return Pixxi_Op4D([=](Pixxi_Future4D * f) { d->str_PtrAsync(buffer, f); });
+		}
+		auto touch_Get(uint16_t Mode) {
+			Pixxi_Serial_4DLib * d = Display;
+			return Pixxi_Op4D([=](Pixxi_Future4D * f) { d->touch_GetAsync(Mode, f); });
+		}
+		Pixxi_Wait4D wait(Pixxi_Future4D * future) { return Pixxi_Wait4D(future); }
+		Pixxi_Yield4D yield(void) { return Pixxi_Yield4D(); }
+
+		//Multi-step sequences, results are written out as the blocking versions return them
+		Pixxi_Task4D widget_Init(uint16_t len, uint16_t * data, uint16_t * hndl, uint16_t * param);
+		Pixxi_Task4D widget_InitString(char * str, uint16_t * addr);
+		Pixxi_Task4D widget_InitStringPtr(char * str, uint16_t * ptr);
+		Pixxi_Task4D widget_InitStringArray(char * str, uint16_t len, uint16_t * ptr);
+
+		Pixxi_Serial_4DLib * Display;
+};
+
+#endif
+
+#endif
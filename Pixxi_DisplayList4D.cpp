@@ -0,0 +1,131 @@
+/**
+ * Display list for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_DisplayList4D.h"
+#include <string.h>
+
+Pixxi_DisplayList4D::Pixxi_DisplayList4D(uint8_t * buffer, uint16_t size) {
+	Buffer = buffer;
+	Size = size;
+
+	Replays = 0;
+	Patched = 0;
+	Unchanged = 0;
+
+	clear();
+}
+
+void Pixxi_DisplayList4D::clear(void)
+{
+	Length = 0;
+	Valid = true;
+	_count = 0;
+}
+
+uint16_t Pixxi_DisplayList4D::commands(void)
+{
+	return _count;
+}
+
+uint16_t Pixxi_DisplayList4D::mark(void)
+{
+	return _count;
+}
+
+/*
+ * Find where a word argument sits in the buffer, 0 if that command does not have it.
+ */
+static uint16_t argOffset(uint16_t start, uint16_t end, uint8_t arg)
+{
+	uint16_t offset = start + 2 + (arg << 1);
+
+	if (offset + 2 > end)
+		return 0;
+	return offset;
+}
+
+bool Pixxi_DisplayList4D::set(uint16_t command, uint8_t arg, uint16_t value)
+{
+	if (command >= _count)
+		return false;
+
+	uint16_t end = command + 1 < _count ? _offsets[command + 1] : Length;
+	uint16_t offset = argOffset(_offsets[command], end, arg);
+	if (offset == 0)
+		return false;
+
+	uint8_t hi = value >> 8;
+	uint8_t lo = value & 0xFF;
+	if (Buffer[offset] == hi && Buffer[offset + 1] == lo)
+	{
+		Unchanged++;
+		return false;
+	}
+
+	Buffer[offset] = hi;
+	Buffer[offset + 1] = lo;
+	Patched++;
+	return true;
+}
+
+uint16_t Pixxi_DisplayList4D::get(uint16_t command, uint8_t arg)
+{
+	if (command >= _count)
+		return 0;
+
+	uint16_t end = command + 1 < _count ? _offsets[command + 1] : Length;
+	uint16_t offset = argOffset(_offsets[command], end, arg);
+	if (offset == 0)
+		return 0;
+
+	return Buffer[offset] << 8 | Buffer[offset + 1];
+}
+
+void Pixxi_DisplayList4D::startCommand(void)
+{
+	if (_count >= PIXXI_DLIST_CMDS)
+	{
+		Valid = false;
+		return;
+	}
+
+	_offsets[_count] = Length;
+	_replies[_count] = 0;
+	_count++;
+}
+
+void Pixxi_DisplayList4D::append(const uint8_t * data, uint32_t size)
+{
+	if (!Valid || Length + size > Size)
+	{
+		Valid = false;
+		return;
+	}
+
+	memcpy(&Buffer[Length], data, size);
+	Length += size;
+}
+
+void Pixxi_DisplayList4D::setReply(uint8_t kind)
+{
+	if (_count > 0)
+		_replies[_count - 1] = kind;
+}
+
+void Pixxi_DisplayList4D::reject(void)
+{
+	Valid = false;
+}
+
+uint16_t Pixxi_DisplayList4D::opcode(uint16_t command)
+{
+	uint16_t offset = _offsets[command];
+	return Buffer[offset] << 8 | Buffer[offset + 1];
+}
+
+uint8_t Pixxi_DisplayList4D::reply(uint16_t command)
+{
+	return _replies[command];
+}
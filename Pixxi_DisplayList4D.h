@@ -0,0 +1,73 @@
+/**
+ * Display list for the Pixxi serial library.
+ *
+ * Records a sequence of calls as the bytes which would have been sent, so a frame that
+ * is mostly the same every time is encoded once and then replayed as a single transfer:
+ *
+ *	uint8_t frameBuf[512];
+ *	Pixxi_DisplayList4D frame(frameBuf, sizeof(frameBuf));
+ *	Display.beginList(&frame);
+ *	Display.gfx_Cls();
+ *	uint16_t needle = frame.mark();
+ *	Display.gfx_Line(120, 120, 200, 120, WHITE);
+ *	Display.endList();
+ *	...
+ *	frame.set(needle, 2, x);		// only rewrites the words that changed
+ *	frame.set(needle, 3, y);
+ *	Display.replay(&frame);
+ *
+ * Only calls which return an ACK or an ACK and a word can be recorded, and they return 0
+ * while recording. Anything else marks the list as not Valid. The Async forms are recorded
+ * too, but their futures fail with Err4D_Invalid, as the replies are only counted by replay().
+ */
+#ifndef Pixxi_DisplayList4D_h
+#define Pixxi_DisplayList4D_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Most commands one list can hold
+#ifndef PIXXI_DLIST_CMDS
+#define PIXXI_DLIST_CMDS 64
+#endif
+
+class Pixxi_DisplayList4D
+{
+	public:
+		Pixxi_DisplayList4D(uint8_t * buffer, uint16_t size);
+		//Forget everything recorded
+		void clear(void);
+
+		//Number of commands recorded
+		uint16_t commands(void);
+		//Index the next recorded command will get, keep it to patch that command later
+		uint16_t mark(void);
+		//Change word Arg (0 is the first after the opcode) of a command. Returns true if it changed.
+		bool set(uint16_t command, uint8_t arg, uint16_t value);
+		uint16_t get(uint16_t command, uint8_t arg);
+
+		//Used by Pixxi_Serial_4DLib while recording and replaying
+		void startCommand(void);
+		void append(const uint8_t * data, uint32_t size);
+		void setReply(uint8_t kind);
+		void reject(void);
+		uint16_t opcode(uint16_t command);
+		uint8_t reply(uint16_t command);
+
+		uint8_t * Buffer;
+		uint16_t Size;
+		uint16_t Length;		// bytes recorded
+		bool Valid;				// false if anything could not be recorded or did not fit
+
+		//Statistics
+		uint32_t Replays;
+		uint32_t Patched;		// words rewritten by set()
+		uint32_t Unchanged;		// set() calls which found the word already right
+
+	private:
+		uint16_t _offsets[PIXXI_DLIST_CMDS];	// where each command starts in Buffer
+		uint8_t _replies[PIXXI_DLIST_CMDS];		// PIXXI_REPLY_ shape of each reply
+		uint16_t _count;
+};
+
+#endif
@@ -0,0 +1,153 @@
+/**
+ * Several displays on several UARTs for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_FanOut4D.h"
+#include <string.h>
+
+Pixxi_FanOut4D::Pixxi_FanOut4D() {
+	memset(Panels, 0, sizeof(Panels));
+	Count = 0;
+	Quantum = 1;
+	Passes = 0;
+	_next = 0;
+}
+
+int8_t Pixxi_FanOut4D::add(Pixxi_Serial_4DLib * display)
+{
+	if (Count == PIXXI_FANOUT_DISPLAYS)
+		return -1;
+
+	Pixxi_Panel4D * panel = &Panels[Count];
+	memset(panel, 0, sizeof(Pixxi_Panel4D));
+	panel->Display = display;
+	panel->TxStart = display->txBytes();
+	panel->ErrorStart = display->Errors4D;
+
+	//A display with pipelining off would hold up the pass on every command
+	if (display->pipelineDepth() == 0)
+		display->setPipelineDepth(PIXXI_FANOUT_DEPTH);
+
+	return Count++;
+}
+
+bool Pixxi_FanOut4D::post(uint8_t index, Tjob4D job, void * context)
+{
+	if (index >= Count)
+		return false;
+
+	Pixxi_Panel4D * panel = &Panels[index];
+	if (panel->Count == PIXXI_FANOUT_QUEUE)
+	{
+		panel->Refused++;
+		return false;
+	}
+
+	panel->Queue[panel->Head].Job = job;
+	panel->Queue[panel->Head].Context = context;
+	panel->Head = (panel->Head + 1) % PIXXI_FANOUT_QUEUE;
+	panel->Count++;
+	panel->Posted++;
+	return true;
+}
+
+bool Pixxi_FanOut4D::broadcast(Tjob4D job, void * context)
+{
+	bool ok = true;
+
+	for (uint8_t i = 0; i < Count; i++)
+		ok = post(i, job, context) && ok;
+	return ok;
+}
+
+uint16_t Pixxi_FanOut4D::run(void)
+{
+	uint16_t started = 0;
+
+	Passes++;
+	for (uint8_t n = 0; n < Count; n++)
+	{
+		Pixxi_Panel4D * panel = &Panels[(_next + n) % Count];
+
+		for (uint8_t q = 0; q < Quantum && panel->Count > 0; q++)
+		{
+			//Leave it to its DMA and try the next one rather than wait
+			if (!panel->Display->ready(PIXXI_FANOUT_JOB_BYTES))
+			{
+				panel->Deferred++;
+				break;
+			}
+
+			Pixxi_Job4D * job = &panel->Queue[panel->Tail];
+			panel->Tail = (panel->Tail + 1) % PIXXI_FANOUT_QUEUE;
+			panel->Count--;
+
+			job->Job(panel->Display, job->Context);
+			panel->Run++;
+			started++;
+		}
+		panel->Errors = panel->Display->Errors4D - panel->ErrorStart;
+	}
+	if (Count > 0)
+		_next = (_next + 1) % Count;
+	return started;
+}
+
+void Pixxi_FanOut4D::drain(void)
+{
+	while (queued() > 0)
+		run();
+
+	for (uint8_t i = 0; i < Count; i++)
+	{
+		Panels[i].Display->CollectAcks();
+		Panels[i].Display->TxFlush();
+		Panels[i].Errors = Panels[i].Display->Errors4D - Panels[i].ErrorStart;
+	}
+}
+
+uint16_t Pixxi_FanOut4D::queued(void)
+{
+	uint16_t total = 0;
+
+	for (uint8_t i = 0; i < Count; i++)
+		total += Panels[i].Count;
+	return total;
+}
+
+uint32_t Pixxi_FanOut4D::jobs(void)
+{
+	uint32_t total = 0;
+
+	for (uint8_t i = 0; i < Count; i++)
+		total += Panels[i].Run;
+	return total;
+}
+
+uint32_t Pixxi_FanOut4D::deferred(void)
+{
+	uint32_t total = 0;
+
+	for (uint8_t i = 0; i < Count; i++)
+		total += Panels[i].Deferred;
+	return total;
+}
+
+uint32_t Pixxi_FanOut4D::errors(void)
+{
+	uint32_t total = 0;
+
+	for (uint8_t i = 0; i < Count; i++)
+		total += Panels[i].Errors;
+	return total;
+}
+
+uint64_t Pixxi_FanOut4D::bytes(void)
+{
+	uint64_t total = 0;
+
+	for (uint8_t i = 0; i < Count; i++)
+		total += Panels[i].Display->txBytes() - Panels[i].TxStart;
+	return total;
+}
@@ -0,0 +1,109 @@
+/**
+ * Several displays on several UARTs for the Pixxi serial library.
+ *
+ * Each display has its own queue of jobs: functions which write a few commands to it. run()
+ * goes round the displays and starts a job on each one whose link can take it without
+ * waiting (room in its transmit ring and in its reply pipeline), so while one UART's DMA is
+ * busy sending, the CPU moves on to fill the next one instead of waiting on the first:
+ *
+ *	Pixxi_FanOut4D Panels;
+ *	Panels.add(&Left);
+ *	Panels.add(&Right);
+ *	Panels.post(0, DrawGauge, &speed);
+ *	Panels.post(1, DrawGauge, &revs);
+ *	while (1) { Panels.run(); ReadSensors(); }
+ *
+ * add() turns on ACK pipelining (depth PIXXI_FANOUT_DEPTH) on displays which do not have it,
+ * as without it every command waits for its ACK. Jobs should stick to calls which return an
+ * ACK only, or the Async ones; anything which returns a value still works, it just waits.
+ *
+ * A pipelined reply fails after its job has returned, often during a later one, so Errors counts
+ * the display's failed replies (Errors4D) rather than blaming whichever job was running.
+ *
+ * Fairness: each pass starts at the next display along, and gives each at most Quantum jobs.
+ * On a PC, give each display its own Pixxi_LoopbackTransport4D and Pixxi_Simulator4D to
+ * benchmark any number of panels.
+ */
+#ifndef Pixxi_FanOut4D_h
+#define Pixxi_FanOut4D_h
+
+#include "Pixxi_Serial_4Dlib.h"
+
+//Most displays one scheduler drives
+#ifndef PIXXI_FANOUT_DISPLAYS
+#define PIXXI_FANOUT_DISPLAYS 4
+#endif
+
+//Jobs queued per display
+#ifndef PIXXI_FANOUT_QUEUE
+#define PIXXI_FANOUT_QUEUE 16
+#endif
+
+//Bytes a job is expected to write, a display with less room than this is skipped
+#ifndef PIXXI_FANOUT_JOB_BYTES
+#define PIXXI_FANOUT_JOB_BYTES 64
+#endif
+
+//Pipeline depth add() sets on displays without one
+#ifndef PIXXI_FANOUT_DEPTH
+#define PIXXI_FANOUT_DEPTH 8
+#endif
+
+typedef void (*Tjob4D)(Pixxi_Serial_4DLib * display, void * context);
+
+typedef struct {
+	Tjob4D Job;
+	void * Context;
+} Pixxi_Job4D;
+
+typedef struct {
+	Pixxi_Serial_4DLib * Display;
+	Pixxi_Job4D Queue[PIXXI_FANOUT_QUEUE];
+	uint8_t Head;
+	uint8_t Tail;
+	uint8_t Count;
+
+	//Statistics
+	uint32_t Posted;
+	uint32_t Run;
+	uint32_t Refused;			// post() found the queue full
+	uint32_t Deferred;			// turns skipped because the link was busy
+	uint32_t Errors;			// replies from this display which failed
+	uint32_t TxStart;			// txBytes() when added, for Bytes()
+	uint32_t ErrorStart;		// Errors4D when added
+} Pixxi_Panel4D;
+
+class Pixxi_FanOut4D
+{
+	public:
+		Pixxi_FanOut4D();
+
+		//Returns the display's index, -1 if there is no room
+		int8_t add(Pixxi_Serial_4DLib * display);
+		//Queue a job for one display, or for all of them. False if a queue was full.
+		bool post(uint8_t index, Tjob4D job, void * context);
+		bool broadcast(Tjob4D job, void * context);
+
+		//One pass round the displays, never waits. Returns the number of jobs started.
+		uint16_t run(void);
+		//Run until every queue is empty and every reply is in
+		void drain(void);
+		//Jobs still queued across all displays
+		uint16_t queued(void);
+
+		uint8_t Quantum;			// most jobs one display gets per pass
+		Pixxi_Panel4D Panels[PIXXI_FANOUT_DISPLAYS];
+		uint8_t Count;
+
+		//Statistics, summed over the displays
+		uint32_t Passes;
+		uint32_t jobs(void);
+		uint32_t deferred(void);
+		uint32_t errors(void);
+		uint64_t bytes(void);		// sent since they were added
+
+	private:
+		uint8_t _next;				// display the next pass starts with
+};
+
+#endif
@@ -0,0 +1,460 @@
+/**
+ * Buffered file access on the display's uSD card for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_File4D.h"
+
+/**
+ * Reader
+ */
+
+Pixxi_FileReader4D::Pixxi_FileReader4D(Pixxi_Serial_4DLib * display, uint8_t * buffer, uint32_t size) {
+	_display = display;
+	_half = size / 2 > 0xFFFF ? 0xFFFF : size / 2;
+	_buffer[0] = buffer;
+	_buffer[1] = buffer + _half;
+	_handle = 0;
+	BlockSize = _half;
+	Error = Err4D_OK;
+	Blocks = 0;
+	Stalls = 0;
+	Bytes = 0;
+	restart(0);
+}
+
+/*
+ * Block size for the link as it is now, see header.
+ */
+uint16_t Pixxi_FileReader4D::tune(void)
+{
+	Pixxi_OpTiming4D * timing = _display->Timing.find(F_file_Read);
+	uint32_t latency = PIXXI_READ_LATENCY_US;
+	if (timing != NULL && timing->Count >= PIXXI_TIMING_SAMPLES)
+		latency = timing->ExecUs + _display->Timing.wireUs(9);
+
+	//8N1, ten bits a byte
+	uint64_t bytes = (uint64_t) _display->Timing.Baud / 10 * latency * PIXXI_READ_AHEAD / 1000000;
+	if (bytes < PIXXI_READ_BLOCK_MIN)
+		bytes = PIXXI_READ_BLOCK_MIN;
+	return bytes > _half ? _half : bytes;
+}
+
+bool Pixxi_FileReader4D::open(char * name)
+{
+	close();
+	Error = Err4D_OK;
+
+	_handle = _display->file_Open(name, 'r');
+	if (_handle == 0)
+	{
+		Error = _display->Error4D != Err4D_OK ? _display->Error4D : Err4D_Invalid;
+		return false;
+	}
+
+	BlockSize = tune();
+	restart(0);
+	fetch(0);
+	fetch(1);
+	return true;
+}
+
+void Pixxi_FileReader4D::close(void)
+{
+	if (_handle == 0)
+		return;
+
+	//The buffers are the caller's again once we return
+	drain();
+	_display->file_Close(_handle);
+	_handle = 0;
+	restart(0);
+}
+
+bool Pixxi_FileReader4D::isOpen(void)
+{
+	return _handle != 0;
+}
+
+/*
+ * Forget what is buffered, reading carries on from Position.
+ */
+void Pixxi_FileReader4D::restart(uint32_t position)
+{
+	_fetch[0].State = PIXXI_FUTURE_IDLE;
+	_fetch[1].State = PIXXI_FUTURE_IDLE;
+	_cur = 0;
+	_loaded = false;
+	_at = 0;
+	_len = 0;
+	_base = position;
+	_last = false;
+	_poll = 0;
+}
+
+/*
+ * Wait for any blocks still on their way, their data is not wanted.
+ */
+void Pixxi_FileReader4D::drain(void)
+{
+	for (uint8_t half = 0; half < 2; half++)
+	{
+		if (_fetch[half].State == PIXXI_FUTURE_PENDING)
+			_display->wait(&_fetch[half]);
+	}
+}
+
+void Pixxi_FileReader4D::fetch(uint8_t half)
+{
+	_asked[half] = BlockSize < _half ? BlockSize : _half;
+	if (_asked[half] == 0)
+		_asked[half] = 1;
+	_display->file_ReadAsync(_buffer[half], _asked[half], _handle, &_fetch[half]);
+	Blocks++;
+}
+
+/*
+ * The current half has been read to the end: hand it back for the block after next and move
+ * on to the other one, waiting for it if it is not in yet. False at the end of the file.
+ */
+bool Pixxi_FileReader4D::next(void)
+{
+	if (_handle == 0)
+		return false;
+
+	if (_loaded)
+	{
+		_base += _len;
+		_at = 0;
+		_len = 0;
+		if (!_last)
+			fetch(_cur);
+		_cur ^= 1;
+		_loaded = false;
+	}
+
+	Pixxi_Future4D * block = &_fetch[_cur];
+	if (block->State == PIXXI_FUTURE_IDLE)
+		return false;
+	if (block->State == PIXXI_FUTURE_PENDING)
+	{
+		_display->service();
+		if (block->State == PIXXI_FUTURE_PENDING)
+		{
+			Stalls++;
+			_display->wait(block);
+		}
+	}
+
+	if (block->State != PIXXI_FUTURE_DONE)
+	{
+		if (Error == Err4D_OK)
+			Error = block->Error;
+		block->State = PIXXI_FUTURE_IDLE;
+		_last = true;
+		return false;
+	}
+
+	//The count the display sent, never more than it was asked for
+	_len = block->Result < _asked[_cur] ? block->Result : _asked[_cur];
+	if (_len < _asked[_cur])
+		_last = true;
+	block->State = PIXXI_FUTURE_IDLE;
+	_loaded = true;
+	return _len > 0;
+}
+
+int Pixxi_FileReader4D::getc(void)
+{
+	if (_at >= _len && !next())
+		return -1;
+
+	//Keep the next block moving out of the receive ring
+	if (++_poll == PIXXI_READ_POLL)
+	{
+		_poll = 0;
+		_display->service();
+	}
+	Bytes++;
+	return _buffer[_cur][_at++];
+}
+
+uint32_t Pixxi_FileReader4D::read(uint8_t * data, uint32_t size)
+{
+	uint32_t done = 0;
+
+	_display->service();
+	while (done < size)
+	{
+		if (_at >= _len && !next())
+			break;
+
+		uint32_t n = _len - _at < size - done ? _len - _at : size - done;
+		memcpy(data + done, _buffer[_cur] + _at, n);
+		_at += n;
+		done += n;
+	}
+	Bytes += done;
+	return done;
+}
+
+int32_t Pixxi_FileReader4D::getline(char * line, uint32_t size)
+{
+	uint32_t length = 0;
+	bool any = false;
+
+	_display->service();
+	while (1)
+	{
+		if (_at >= _len && !next())
+			break;
+		any = true;
+
+		//Up to the end of the line or of the block, whichever comes first
+		const uint8_t * from = _buffer[_cur] + _at;
+		const uint8_t * end = (const uint8_t *) memchr(from, '\n', _len - _at);
+		uint32_t n = end != NULL ? end - from : _len - _at;
+		uint32_t room = size > 0 ? size - 1 - length : 0;
+		uint32_t keep = n < room ? n : room;
+
+		memcpy(line + length, from, keep);
+		length += keep;
+		_at += n;
+		Bytes += n;
+
+		if (end != NULL)
+		{
+			_at++;
+			Bytes++;
+			break;
+		}
+	}
+
+	if (!any)
+		return -1;
+	if (length > 0 && line[length - 1] == '\r')
+		length--;
+	if (size > 0)
+		line[length] = 0;
+	return length;
+}
+
+bool Pixxi_FileReader4D::seek(uint32_t position)
+{
+	if (_handle == 0)
+		return false;
+
+	//Still in the buffer, nothing to send
+	if (_loaded && position >= _base && position <= _base + _len)
+	{
+		_at = position - _base;
+		return true;
+	}
+
+	drain();
+	restart(position);
+	if (_display->file_Seek(_handle, position >> 16, position & 0xFFFF) == 0)
+	{
+		_last = true;
+		return false;
+	}
+	Error = Err4D_OK;
+	fetch(0);
+	fetch(1);
+	return true;
+}
+
+uint32_t Pixxi_FileReader4D::tell(void)
+{
+	return _base + _at;
+}
+
+bool Pixxi_FileReader4D::eof(void)
+{
+	return _at >= _len && !next();
+}
+
+/**
+ * Writer
+ */
+
+Pixxi_FileWriter4D::Pixxi_FileWriter4D(Pixxi_Serial_4DLib * display, uint8_t * buffer, uint32_t size) {
+	_display = display;
+	_half = size / 2 > 0xFFFF ? 0xFFFF : size / 2;
+	_buffer[0] = buffer;
+	_buffer[1] = buffer + _half;
+	_handle = 0;
+	_cur = 0;
+	_fill = 0;
+	_first = 0;
+	HighWater = _half;
+	MaxAgeMs = PIXXI_WRITE_AGE_MS;
+	Block = true;
+	Error = Err4D_OK;
+	Writes = 0;
+	Stalls = 0;
+	Dropped = 0;
+	Bytes = 0;
+}
+
+bool Pixxi_FileWriter4D::open(char * name, char mode)
+{
+	close();
+	Error = Err4D_OK;
+	_cur = 0;
+	_fill = 0;
+
+	_handle = _display->file_Open(name, mode);
+	if (_handle == 0)
+	{
+		Error = _display->Error4D != Err4D_OK ? _display->Error4D : Err4D_Invalid;
+		return false;
+	}
+	return true;
+}
+
+bool Pixxi_FileWriter4D::close(void)
+{
+	if (_handle == 0)
+		return Error == Err4D_OK;
+
+	flush();
+	_display->file_Close(_handle);
+	_handle = 0;
+	return Error == Err4D_OK;
+}
+
+bool Pixxi_FileWriter4D::isOpen(void)
+{
+	return _handle != 0;
+}
+
+/*
+ * Note how a finished write went, once.
+ */
+void Pixxi_FileWriter4D::finished(uint8_t half)
+{
+	Pixxi_Future4D * write = &_write[half];
+
+	if (write->State != PIXXI_FUTURE_DONE && write->State != PIXXI_FUTURE_FAILED)
+		return;
+
+	if (Error == Err4D_OK)
+	{
+		if (write->State == PIXXI_FUTURE_FAILED)
+			Error = write->Error;
+		else if (write->Result != _sent[half])
+			Error = Err4D_Invalid;
+	}
+	write->State = PIXXI_FUTURE_IDLE;
+}
+
+/*
+ * Start writing the half being filled and move on to the other one, which has to be free.
+ * If it is not, either wait for it or leave everything as it is and return false.
+ */
+bool Pixxi_FileWriter4D::send(bool wait)
+{
+	uint8_t other = _cur ^ 1;
+
+	if (_fill == 0 || _handle == 0)
+		return true;
+
+	if (_write[other].State == PIXXI_FUTURE_PENDING)
+	{
+		_display->service();
+		if (_write[other].State == PIXXI_FUTURE_PENDING)
+		{
+			if (!wait)
+				return false;
+			Stalls++;
+			_display->wait(&_write[other]);
+		}
+	}
+	finished(other);
+
+	_sent[_cur] = _fill;
+	_display->file_WriteAsync(_fill, _buffer[_cur], _handle, &_write[_cur]);
+	Writes++;
+	_cur = other;
+	_fill = 0;
+	return true;
+}
+
+bool Pixxi_FileWriter4D::write(const uint8_t * data, uint32_t size)
+{
+	uint32_t done = 0;
+
+	if (_handle == 0)
+	{
+		Dropped += size;
+		return false;
+	}
+
+	while (done < size)
+	{
+		//Full, and the other half is still on its way
+		if (_fill == _half && !send(Block))
+		{
+			Dropped += size - done;
+			break;
+		}
+
+		uint32_t n = _half - _fill < size - done ? _half - _fill : size - done;
+		if (_fill == 0)
+			_first = _display->millis();
+		memcpy(_buffer[_cur] + _fill, data + done, n);
+		_fill += n;
+		done += n;
+
+		if (_fill >= HighWater)
+			send(false);
+	}
+	Bytes += done;
+
+	poll();
+	return done == size;
+}
+
+bool Pixxi_FileWriter4D::putc(char c)
+{
+	return write((const uint8_t *) &c, 1);
+}
+
+bool Pixxi_FileWriter4D::puts(const char * text)
+{
+	return write((const uint8_t *) text, strlen(text));
+}
+
+bool Pixxi_FileWriter4D::putw(uint16_t word)
+{
+	uint8_t bytes[2] = {(uint8_t) (word & 0xFF), (uint8_t) (word >> 8)};
+	return write(bytes, 2);
+}
+
+void Pixxi_FileWriter4D::poll(void)
+{
+	_display->service();
+	finished(0);
+	finished(1);
+
+	if (MaxAgeMs > 0 && _fill > 0 && _display->millis() - _first >= MaxAgeMs)
+		send(false);
+}
+
+bool Pixxi_FileWriter4D::flush(void)
+{
+	send(true);
+	for (uint8_t half = 0; half < 2; half++)
+	{
+		if (_write[half].State == PIXXI_FUTURE_PENDING)
+			_display->wait(&_write[half]);
+		finished(half);
+	}
+	return Error == Err4D_OK;
+}
+
+uint32_t Pixxi_FileWriter4D::buffered(void)
+{
+	return _fill;
+}
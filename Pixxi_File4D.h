@@ -0,0 +1,181 @@
+/**
+ * Buffered file access on the display's uSD card for the Pixxi serial library.
+ *
+ * file_Read costs a round trip per call, and file_GetC / file_GetS one per character or line.
+ * Pixxi_FileReader4D reads the file in large blocks into a buffer of the caller's and serves
+ * getc(), getline() and read() from it. The buffer is used in two halves: while one is being
+ * read from, the next block is already on its way into the other with file_ReadAsync, so a
+ * parser going through a file keeps the link busy instead of waiting on it:
+ *
+ *	uint8_t buffer[2048];
+ *	Pixxi_FileReader4D config(&Display, buffer, sizeof(buffer));
+ *	char line[80];
+ *	if (config.open("CONFIG.CSV"))
+ *		while (config.getline(line, sizeof(line)) >= 0)
+ *			parse(line);
+ *	config.close();
+ *
+ * open() sizes BlockSize from the link: PIXXI_READ_AHEAD times the bytes the link moves while the
+ * display turns a file_Read round (learned by Timing, PIXXI_READ_LATENCY_US until it has been),
+ * so the next block is asked for well before the last one has arrived. It is never more than
+ * half the buffer; a bigger buffer only helps up to that point.
+ *
+ * The blocks come in through the receive ring, and are taken out of it whenever the reader is
+ * called. If the application stops reading for longer than the ring takes to fill, it should
+ * call Display.service() meanwhile. Nothing else may be sent to the display's file system
+ * through the same handle while it is open.
+ *
+ * Pixxi_FileWriter4D goes the other way, for logging: file_PutC / file_PutS cost a round trip
+ * each, so bytes are gathered into one half of the buffer and go out in a single file_Write
+ * while the other half fills up. The write is sent by DMA straight from the buffer, so starting
+ * one does not hold up the caller either:
+ *
+ *	uint8_t logBuffer[4096];
+ *	Pixxi_FileWriter4D Log(&Display, logBuffer, sizeof(logBuffer));
+ *	Log.open("TELEMETRY.CSV");		// appends
+ *	Log.MaxAgeMs = 500;
+ *	while (1) {
+ *		Log.puts(sample);
+ *		Log.poll();
+ *	}
+ *
+ * A write is started once HighWater bytes are waiting (half the buffer unless set lower), or once
+ * the oldest has waited MaxAgeMs, checked on every call and by poll(). If the other half is still
+ * being written, bytes carry on gathering; only when the current half is full too does the
+ * writer wait (Block, the default) or throw the new bytes away and count them in Dropped, for
+ * loops which must never stall. flush() and close() wait until the display has written it all.
+ */
+#ifndef Pixxi_File4D_h
+#define Pixxi_File4D_h
+
+#include "Pixxi_Serial_4Dlib.h"
+
+//Time from asking for a block to it starting to arrive, in us, until Timing has learned file_Read
+#ifndef PIXXI_READ_LATENCY_US
+#define PIXXI_READ_LATENCY_US 3000
+#endif
+
+//How many round trips' worth of bytes a block holds
+#ifndef PIXXI_READ_AHEAD
+#define PIXXI_READ_AHEAD 4
+#endif
+
+//Smallest block worth asking for, the reply header is three bytes of each
+#ifndef PIXXI_READ_BLOCK_MIN
+#define PIXXI_READ_BLOCK_MIN 256
+#endif
+
+//Bytes getc() serves between looks at the receive ring
+#ifndef PIXXI_READ_POLL
+#define PIXXI_READ_POLL 64
+#endif
+
+class Pixxi_FileReader4D
+{
+	public:
+		Pixxi_FileReader4D(Pixxi_Serial_4DLib * display, uint8_t * buffer, uint32_t size);
+
+		//Open for reading and start fetching the first blocks. Closes whatever was open before.
+		bool open(char * name);
+		void close(void);
+		bool isOpen(void);
+
+		//Next byte, -1 at the end of the file or once a read has failed
+		int getc(void);
+		//Up to Size bytes, fewer only at the end. Returns the number read.
+		uint32_t read(uint8_t * data, uint32_t size);
+		//Next line without its line ending, cut to Size - 1 characters (the rest of it is skipped).
+		//Returns its length, -1 at the end of the file.
+		int32_t getline(char * line, uint32_t size);
+		bool seek(uint32_t position);
+		uint32_t tell(void);
+		bool eof(void);
+
+		uint16_t BlockSize;		// bytes per file_Read, set by open(), can be changed between calls
+		int Error;				// Err4D_ code of the read which failed, nothing is read after it
+
+		//Statistics
+		uint32_t Blocks;		// file_Reads made
+		uint32_t Stalls;		// times the caller had to wait for a block to arrive
+		uint64_t Bytes;			// handed to the caller
+
+	private:
+		bool next(void);
+		void fetch(uint8_t half);
+		void drain(void);
+		void restart(uint32_t position);
+		uint16_t tune(void);
+
+		Pixxi_Serial_4DLib * _display;
+		uint8_t * _buffer[2];
+		uint32_t _half;				// size of each half
+		Pixxi_Future4D _fetch[2];	// block on its way into each half, idle if none
+		uint16_t _asked[2];			// bytes asked for into each half
+		uint8_t _cur;				// half being read from
+		bool _loaded;				// whether it holds a block yet
+		uint32_t _at;				// position in it
+		uint32_t _len;				// bytes in it
+		uint32_t _base;				// file position of its first byte
+		bool _last;					// a short block came back, no more to ask for
+		uint16_t _handle;
+		uint8_t _poll;
+};
+
+//MaxAgeMs to start with
+#ifndef PIXXI_WRITE_AGE_MS
+#define PIXXI_WRITE_AGE_MS 250
+#endif
+
+class Pixxi_FileWriter4D
+{
+	public:
+		Pixxi_FileWriter4D(Pixxi_Serial_4DLib * display, uint8_t * buffer, uint32_t size);
+
+		//Mode 'a' carries on at the end of the file, 'w' starts it afresh. Closes whatever was open before.
+		bool open(char * name, char mode = 'a');
+		//Flushes, then closes. False if anything could not be written.
+		bool close(void);
+		bool isOpen(void);
+
+		//False if the bytes were dropped
+		bool putc(char c);
+		//Without the terminator, as file_PutS
+		bool puts(const char * text);
+		//Low byte first, as file_PutW
+		bool putw(uint16_t word);
+		bool write(const uint8_t * data, uint32_t size);
+
+		//Start a write if the age limit has been reached, and take in finished ones. Never waits.
+		void poll(void);
+		//Write everything out and wait for it. False if anything could not be written.
+		bool flush(void);
+		//Bytes not yet handed to the display
+		uint32_t buffered(void);
+
+		uint32_t HighWater;		// bytes gathered before a write is started
+		uint32_t MaxAgeMs;		// longest a byte waits before a write is started, 0 for no limit
+		bool Block;				// wait for room rather than drop
+		int Error;				// Err4D_ code of the first write which failed, Err4D_Invalid if one was short
+
+		//Statistics
+		uint32_t Writes;		// file_Writes made
+		uint32_t Stalls;		// times the caller had to wait for room
+		uint32_t Dropped;		// bytes thrown away with Block off
+		uint64_t Bytes;			// taken from the caller
+
+	private:
+		bool send(bool wait);
+		void finished(uint8_t half);
+
+		Pixxi_Serial_4DLib * _display;
+		uint8_t * _buffer[2];
+		uint32_t _half;				// size of each half
+		Pixxi_Future4D _write[2];	// write of each half, idle if none
+		uint16_t _sent[2];			// bytes in it
+		uint8_t _cur;				// half being filled
+		uint32_t _fill;				// bytes in it
+		uint32_t _first;			// millis() when its first byte went in
+		uint16_t _handle;
+};
+
+#endif
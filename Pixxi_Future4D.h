@@ -0,0 +1,65 @@
+/**
+ * Completion handle for the asynchronous Pixxi calls.
+ *
+ * The *Async routines send their command and return straight away with a pointer to the
+ * handle they were given. The reply is filled in later, in the order the display answers,
+ * whenever the library gets round to reading it: from service() in a superloop, or from any
+ * later blocking call. The handle must stay alive (and must not be reused) until it is ready.
+ *
+ * Under an RTOS set Notify to wake the waiting task (e.g. xTaskNotifyGive / osThreadFlagsSet)
+ * and have whichever task owns the display call service() or wait().
+ */
+#ifndef Pixxi_Future4D_h
+#define Pixxi_Future4D_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PIXXI_FUTURE_IDLE		0	// never been used
+#define PIXXI_FUTURE_PENDING	1	// command sent, reply not in yet
+#define PIXXI_FUTURE_DONE		2	// reply received, Result is valid
+#define PIXXI_FUTURE_FAILED		3	// NAK or timeout, see Error / ErrorInv
+
+class Pixxi_Future4D;
+
+//Called once the reply is in (or has failed). Runs in whichever context collected it.
+typedef void (*Tnotify4D)(void * context, Pixxi_Future4D * future);
+
+class Pixxi_Future4D
+{
+	public:
+		Pixxi_Future4D(uint8_t * data = NULL, uint16_t size = 0) {
+			State = PIXXI_FUTURE_IDLE;
+			Cmd = 0;
+			Result = 0;
+			Word1 = 0;
+			Word2 = 0;
+			Error = 0;
+			ErrorInv = 0;
+			Data = data;
+			Size = size;
+			Notify = NULL;
+			NotifyContext = NULL;
+		}
+
+		//Safe to call from another task than the one collecting the reply: once true, the rest is filled in
+		bool ready(void) { uint8_t state = __atomic_load_n(&State, __ATOMIC_ACQUIRE); return state == PIXXI_FUTURE_DONE || state == PIXXI_FUTURE_FAILED; }
+		bool ok(void) { return __atomic_load_n(&State, __ATOMIC_ACQUIRE) == PIXXI_FUTURE_DONE; }
+
+		volatile uint8_t State;
+		uint16_t Cmd;			// opcode the reply belongs to
+		uint16_t Result;		// returned word (byte count for file_Read)
+		uint16_t Word1;			// extra words for replies which carry them
+		uint16_t Word2;
+		int Error;				// Err4D_ code, as Error4D
+		unsigned char ErrorInv;	// byte received instead of the ACK, as Error4D_Inv
+
+		//Destination for replies carrying data (file_Read), anything past Size is discarded
+		uint8_t * Data;
+		uint16_t Size;
+
+		Tnotify4D Notify;
+		void * NotifyContext;
+};
+
+#endif
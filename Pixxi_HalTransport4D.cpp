@@ -0,0 +1,195 @@
+/**
+ * STM32 HAL transport for the Pixxi serial library.
+ * See header for description.
+ */
+
+#ifndef PIXXI_HOST
+
+#include "Pixxi_HalTransport4D.h"
+#include "Pixxi_TxRing4D.h"
+#include "Pixxi_RxRing4D.h"
+
+Pixxi_HalTransport4D * Pixxi_HalTransport4D::_ports[PIXXI_MAX_PORTS];
+
+Pixxi_HalTransport4D::Pixxi_HalTransport4D(UART_HandleTypeDef * huart) {
+	Huart = huart;
+	_rxBuf = NULL;
+	_rxSize = 0;
+	_rxPos = 0;
+	_registered = false;
+
+	//Register so the HAL callbacks can find us again
+	for (int i = 0; huart != NULL && i < PIXXI_MAX_PORTS; i++)
+	{
+		if (_ports[i] == NULL)
+		{
+			_ports[i] = this;
+			_registered = true;
+			break;
+		}
+	}
+}
+
+Pixxi_HalTransport4D::~Pixxi_HalTransport4D() {
+	if (!_registered)
+		return;
+
+	//Nothing may call back into us once we are gone
+	HAL_UART_Abort(Huart);
+	for (int i = 0; i < PIXXI_MAX_PORTS; i++)
+	{
+		if (_ports[i] == this)
+			_ports[i] = NULL;
+	}
+}
+
+bool Pixxi_HalTransport4D::startTx(const uint8_t * data, uint16_t size)
+{
+	//Too many ports, the completion would never be reported
+	if (!_registered)
+		return false;
+
+	if (Huart->hdmatx != NULL
+			&& HAL_UART_Transmit_DMA(Huart, (uint8_t *) data, size) == HAL_OK)
+		return true;
+
+	//No DMA linked to this UART (or it refused), send it the slow way
+	if (HAL_UART_Transmit(Huart, (uint8_t *) data, size, HAL_MAX_DELAY) != HAL_OK)
+		return false;
+
+	if (TxRing != NULL)
+		TxRing->TxCplt();
+	return true;
+}
+
+bool Pixxi_HalTransport4D::startRx(uint8_t * buffer, uint16_t size)
+{
+	if (!_registered)
+		return false;
+
+	_rxBuf = buffer;
+	_rxSize = size;
+	_rxPos = 0;
+
+	//Drop anything half finished from before
+	HAL_UART_AbortReceive(Huart);
+
+	if (Huart->hdmarx != NULL)
+		return HAL_UARTEx_ReceiveToIdle_DMA(Huart, buffer, size) == HAL_OK;
+
+	//No DMA, take it a byte at a time
+	return HAL_UART_Receive_IT(Huart, buffer, 1) == HAL_OK;
+}
+
+uint32_t Pixxi_HalTransport4D::millis(void)
+{
+	return HAL_GetTick();
+}
+
+void Pixxi_HalTransport4D::poll(void)
+{
+	//Pick up bytes the DMA has stored since the last IDLE / half / complete event
+	if (Huart->hdmarx != NULL && _rxBuf != NULL && RxRing != NULL)
+		RxRing->RxEvent((_rxSize - __HAL_DMA_GET_COUNTER(Huart->hdmarx)) % _rxSize);
+}
+
+bool Pixxi_HalTransport4D::setBaud(uint32_t baud)
+{
+	//Re-initialising stops reception, the receive ring re-arms it afterwards
+	HAL_UART_AbortReceive(Huart);
+	Huart->Init.BaudRate = baud;
+	return HAL_UART_Init(Huart) == HAL_OK;
+}
+
+uint32_t Pixxi_HalTransport4D::baud(void)
+{
+	return Huart->Init.BaudRate;
+}
+
+/*
+ * Works out the divider the way HAL_UART_Init would, from the clock the UART runs on.
+ */
+bool Pixxi_HalTransport4D::supportsBaud(uint32_t baud)
+{
+	UART_ClockSourceTypeDef source;
+	uint32_t clock;
+	uint32_t divider;
+
+	if (baud == 0)
+		return false;
+
+	UART_GETCLOCKSOURCE(Huart, source);
+	switch (source)
+	{
+		case UART_CLOCKSOURCE_PCLK1: clock = HAL_RCC_GetPCLK1Freq(); break;
+		case UART_CLOCKSOURCE_PCLK2: clock = HAL_RCC_GetPCLK2Freq(); break;
+		case UART_CLOCKSOURCE_HSI: clock = HSI_VALUE; break;
+		case UART_CLOCKSOURCE_SYSCLK: clock = HAL_RCC_GetSysClockFreq(); break;
+		case UART_CLOCKSOURCE_LSE: clock = LSE_VALUE; break;
+		default: return false;
+	}
+
+	if (UART_INSTANCE_LOWPOWER(Huart))
+	{
+		divider = ((uint64_t) clock * 256 + baud / 2) / baud;
+		return divider >= LPUART_BRR_MIN && divider <= LPUART_BRR_MAX;
+	}
+	if (Huart->Init.OverSampling == UART_OVERSAMPLING_8)
+		divider = ((uint64_t) clock * 2 + baud / 2) / baud;
+	else
+		divider = (clock + baud / 2) / baud;
+	return divider >= UART_BRR_MIN && divider <= UART_BRR_MAX;
+}
+
+Pixxi_HalTransport4D * Pixxi_HalTransport4D::find(UART_HandleTypeDef * huart)
+{
+	for (int i = 0; i < PIXXI_MAX_PORTS; i++)
+	{
+		if (_ports[i] != NULL && _ports[i]->Huart == huart)
+			return _ports[i];
+	}
+	return NULL;
+}
+
+void Pixxi_HalTransport4D::TxCpltCallback(UART_HandleTypeDef * huart)
+{
+	Pixxi_HalTransport4D * port = find(huart);
+	if (port != NULL && port->TxRing != NULL)
+		port->TxRing->TxCplt();
+}
+
+void Pixxi_HalTransport4D::TxHalfCpltCallback(UART_HandleTypeDef * huart)
+{
+	Pixxi_HalTransport4D * port = find(huart);
+	if (port != NULL && port->TxRing != NULL)
+		port->TxRing->TxHalfCplt();
+}
+
+void Pixxi_HalTransport4D::RxEventCallback(UART_HandleTypeDef * huart, uint16_t size)
+{
+	Pixxi_HalTransport4D * port = find(huart);
+	if (port != NULL && port->RxRing != NULL)
+		port->RxRing->RxEvent(size % port->_rxSize);
+}
+
+void Pixxi_HalTransport4D::RxCpltCallback(UART_HandleTypeDef * huart)
+{
+	Pixxi_HalTransport4D * port = find(huart);
+	if (port == NULL || port->RxRing == NULL || port->_rxBuf == NULL)
+		return;
+
+	//Interrupt mode only, one more byte has landed. Re-arm for the next one.
+	port->_rxPos = (port->_rxPos + 1) % port->_rxSize;
+	port->RxRing->RxEvent(port->_rxPos);
+	HAL_UART_Receive_IT(huart, &port->_rxBuf[port->_rxPos], 1);
+}
+
+void Pixxi_HalTransport4D::ErrorCallback(UART_HandleTypeDef * huart)
+{
+	//The HAL stops receiving on overrun / framing errors, start it again
+	Pixxi_HalTransport4D * port = find(huart);
+	if (port != NULL && port->RxRing != NULL && port->_rxBuf != NULL)
+		port->RxRing->RxError();
+}
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ * STM32 HAL transport for the Pixxi serial library.
+ *
+ * Transmits with HAL_UART_Transmit_DMA when a DMA channel is linked to the UART,
+ * otherwise falls back to a blocking HAL_UART_Transmit.
+ *
+ * Receives continuously with HAL_UARTEx_ReceiveToIdle_DMA when a DMA channel is linked
+ * (set the RX channel to CIRCULAR mode), otherwise one byte at a time by interrupt.
+ *
+ * The HAL completion callbacks are global, so forward them from your own code:
+ *
+ * void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+ *     Pixxi_HalTransport4D::TxCpltCallback(huart);
+ * }
+ * void HAL_UART_TxHalfCpltCallback(UART_HandleTypeDef *huart) {
+ *     Pixxi_HalTransport4D::TxHalfCpltCallback(huart);
+ * }
+ * void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size) {
+ *     Pixxi_HalTransport4D::RxEventCallback(huart, Size);
+ * }
+ * void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
+ *     Pixxi_HalTransport4D::RxCpltCallback(huart);
+ * }
+ * void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+ *     Pixxi_HalTransport4D::ErrorCallback(huart);
+ * }
+ */
+#ifndef Pixxi_HalTransport4D_h
+#define Pixxi_HalTransport4D_h
+
+#ifndef PIXXI_HOST
+
+#include "stm32l4xx_hal.h"
+#include "Pixxi_Transport4D.h"
+
+//Maximum number of UARTs which can have a display on them at once. A transport made beyond that
+//refuses to start, as the HAL callbacks could not reach it.
+#ifndef PIXXI_MAX_PORTS
+#define PIXXI_MAX_PORTS 4
+#endif
+
+class Pixxi_HalTransport4D final : public Pixxi_Transport4D
+{
+	public:
+		Pixxi_HalTransport4D(UART_HandleTypeDef * huart);
+		~Pixxi_HalTransport4D();
+
+		bool startTx(const uint8_t * data, uint16_t size) override;
+		bool startRx(uint8_t * buffer, uint16_t size) override;
+		uint32_t millis(void) override;
+		void poll(void) override;
+		bool setBaud(uint32_t baud) override;
+		uint32_t baud(void) override;
+		bool supportsBaud(uint32_t baud) override;
+
+		//Forward the HAL weak callbacks to these
+		static void TxCpltCallback(UART_HandleTypeDef * huart);
+		static void TxHalfCpltCallback(UART_HandleTypeDef * huart);
+		static void RxEventCallback(UART_HandleTypeDef * huart, uint16_t size);
+		static void RxCpltCallback(UART_HandleTypeDef * huart);
+		static void ErrorCallback(UART_HandleTypeDef * huart);
+
+		UART_HandleTypeDef * Huart;
+
+	private:
+		uint8_t * _rxBuf;
+		uint16_t _rxSize;
+		uint16_t _rxPos;		// next byte in interrupt mode
+		bool _registered;		// false if _ports was full, the callbacks would never find us
+
+		static Pixxi_HalTransport4D * find(UART_HandleTypeDef * huart);
+		static Pixxi_HalTransport4D * _ports[PIXXI_MAX_PORTS];
+};
+
+#endif
+
+#endif
@@ -0,0 +1,341 @@
+/**
+ * Pooled allocator for display RAM, for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_Heap4D.h"
+
+Pixxi_DisplayHeap4D::Pixxi_DisplayHeap4D(Pixxi_Serial_4DLib * display) {
+	_display = display;
+	_arenaCount = 0;
+	_serial = 0;
+	Screen = 0;
+
+	Allocs = 0;
+	Frees = 0;
+	RoundTrips = 0;
+	Failed = 0;
+	HighWater = 0;
+	ArenaBytes = 0;
+	for (uint16_t i = 0; i < PIXXI_HEAP_BLOCKS; i++)
+		_blocks[i].Used = false;
+	reset();
+}
+
+uint8_t Pixxi_DisplayHeap4D::classOf(uint16_t size)
+{
+	uint8_t sizeClass = 0;
+	uint32_t bytes = PIXXI_HEAP_MIN;
+
+	while (bytes < size && sizeClass < PIXXI_HEAP_CLASSES)
+	{
+		bytes <<= 1;
+		sizeClass++;
+	}
+	return sizeClass;
+}
+
+uint16_t Pixxi_DisplayHeap4D::classSize(uint8_t sizeClass)
+{
+	return PIXXI_HEAP_MIN << sizeClass;
+}
+
+int16_t Pixxi_DisplayHeap4D::find(uint16_t handle)
+{
+	for (uint16_t i = 0; i < PIXXI_HEAP_BLOCKS; i++)
+	{
+		if (_blocks[i].Used && _blocks[i].Handle == handle)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * An unused entry of _blocks, PIXXI_HEAP_NONE if they are all taken.
+ */
+uint8_t Pixxi_DisplayHeap4D::entry(void)
+{
+	uint8_t index = _unused;
+
+	if (index != PIXXI_HEAP_NONE)
+		_unused = _blocks[index].Next;
+	return index;
+}
+
+/*
+ * A new block of the class from the arenas, asking the display for another arena if they are
+ * all carved up. PIXXI_HEAP_NONE if there is no room or no entry left for it.
+ */
+uint8_t Pixxi_DisplayHeap4D::carve(uint8_t sizeClass)
+{
+	uint16_t size = classSize(sizeClass);
+
+	while (_current >= _arenaCount || _top + size > PIXXI_HEAP_ARENA)
+	{
+		//Put what is left of this arena on the free lists, biggest blocks first
+		for (int8_t c = PIXXI_HEAP_CLASSES - 1; c >= 0 && _current < _arenaCount; c--)
+		{
+			while (_top + classSize(c) <= PIXXI_HEAP_ARENA && _unused != PIXXI_HEAP_NONE)
+			{
+				uint8_t index = entry();
+				_blocks[index].Handle = _arenas[_current] + _top / 2;
+				_blocks[index].Class = c;
+				_blocks[index].Used = false;
+				_blocks[index].Next = _free[c];
+				_free[c] = index;
+				_top += classSize(c);
+				_carved += classSize(c);
+			}
+		}
+
+		if (_current + 1 < _arenaCount)
+			_current++;
+		else if (_arenaCount < PIXXI_HEAP_ARENAS)
+		{
+			uint16_t handle = _display->mem_Alloc(PIXXI_HEAP_ARENA);
+			RoundTrips++;
+			if (handle == 0 || _display->Error4D != Err4D_OK)
+				return PIXXI_HEAP_NONE;
+			_arenas[_arenaCount] = handle;
+			_current = _arenaCount++;
+			ArenaBytes += PIXXI_HEAP_ARENA;
+		}
+		else
+			return PIXXI_HEAP_NONE;
+		_top = 0;
+	}
+
+	uint8_t index = entry();
+	if (index == PIXXI_HEAP_NONE)
+		return PIXXI_HEAP_NONE;
+
+	_blocks[index].Handle = _arenas[_current] + _top / 2;
+	_blocks[index].Class = sizeClass;
+	_top += size;
+	_carved += size;
+	return index;
+}
+
+/*
+ * A block of the class which is not in use: a freed one, a new one, or failing both
+ * a freed one of a bigger class. PIXXI_HEAP_NONE if there is none.
+ */
+uint8_t Pixxi_DisplayHeap4D::take(uint8_t sizeClass)
+{
+	uint8_t index;
+
+	if (_free[sizeClass] == PIXXI_HEAP_NONE)
+	{
+		index = carve(sizeClass);
+		if (index != PIXXI_HEAP_NONE)
+			return index;
+	}
+
+	for (uint8_t c = sizeClass; c < PIXXI_HEAP_CLASSES; c++)
+	{
+		index = _free[c];
+		if (index != PIXXI_HEAP_NONE)
+		{
+			_free[c] = _blocks[index].Next;
+			return index;
+		}
+	}
+	return PIXXI_HEAP_NONE;
+}
+
+uint16_t Pixxi_DisplayHeap4D::alloc(uint16_t size)
+{
+	uint8_t sizeClass = classOf(size);
+	uint8_t index;
+
+	Allocs++;
+	if (size == 0)
+	{
+		Failed++;
+		return 0;
+	}
+
+	if (sizeClass == PIXXI_HEAP_LARGE)
+	{
+		index = entry();
+		if (index != PIXXI_HEAP_NONE)
+		{
+			uint16_t handle = _display->mem_Alloc(size);
+			RoundTrips++;
+			if (handle == 0 || _display->Error4D != Err4D_OK)
+			{
+				_blocks[index].Next = _unused;
+				_unused = index;
+				index = PIXXI_HEAP_NONE;
+			}
+			else
+			{
+				_blocks[index].Handle = handle;
+				_blocks[index].Class = PIXXI_HEAP_LARGE;
+			}
+		}
+	}
+	else
+		index = take(sizeClass);
+
+	if (index == PIXXI_HEAP_NONE)
+	{
+		Failed++;
+		return 0;
+	}
+
+	Pixxi_HeapBlock4D * block = &_blocks[index];
+	block->Size = size;
+	block->Serial = _serial++;
+	block->Screen = Screen;
+	block->Used = true;
+
+	InUse += size;
+	if (InUse > HighWater)
+		HighWater = InUse;
+	return block->Handle;
+}
+
+/*
+ * Back on its free list, or back to the display if it has a mem_Alloc of its own.
+ */
+void Pixxi_DisplayHeap4D::drop(uint8_t index)
+{
+	Pixxi_HeapBlock4D * block = &_blocks[index];
+
+	block->Used = false;
+	InUse -= block->Size;
+	Frees++;
+
+	if (block->Class == PIXXI_HEAP_LARGE)
+	{
+		_display->mem_Free(block->Handle);
+		RoundTrips++;
+		block->Class = PIXXI_HEAP_NONE;
+		block->Next = _unused;
+		_unused = index;
+	}
+	else
+	{
+		block->Next = _free[block->Class];
+		_free[block->Class] = index;
+	}
+}
+
+bool Pixxi_DisplayHeap4D::free(uint16_t handle)
+{
+	int16_t index = find(handle);
+
+	if (index < 0)
+		return false;
+	drop(index);
+	settle();
+	return true;
+}
+
+/*
+ * Once nothing is in use, the free lists are thrown away and the arenas carved afresh,
+ * so memory freed in one size class is not kept from the others.
+ */
+void Pixxi_DisplayHeap4D::settle(void)
+{
+	for (uint16_t i = 0; i < PIXXI_HEAP_BLOCKS; i++)
+	{
+		if (_blocks[i].Used)
+			return;
+	}
+	reset();
+}
+
+uint16_t Pixxi_DisplayHeap4D::freeScreen(uint8_t screen)
+{
+	uint16_t count = 0;
+
+	for (uint16_t i = 0; i < PIXXI_HEAP_BLOCKS; i++)
+	{
+		if (_blocks[i].Used && _blocks[i].Screen == screen)
+		{
+			drop(i);
+			count++;
+		}
+	}
+	settle();
+	return count;
+}
+
+void Pixxi_DisplayHeap4D::reset(void)
+{
+	//Blocks of their own go back to the display, the arenas are simply carved again
+	for (uint16_t i = 0; i < PIXXI_HEAP_BLOCKS; i++)
+	{
+		if (_blocks[i].Used)
+			drop(i);
+	}
+
+	for (uint16_t i = 0; i < PIXXI_HEAP_BLOCKS; i++)
+	{
+		_blocks[i].Used = false;
+		_blocks[i].Class = PIXXI_HEAP_NONE;
+		_blocks[i].Next = i + 1 < PIXXI_HEAP_BLOCKS ? i + 1 : PIXXI_HEAP_NONE;
+	}
+	_unused = 0;
+	for (uint8_t c = 0; c < PIXXI_HEAP_CLASSES; c++)
+		_free[c] = PIXXI_HEAP_NONE;
+
+	_current = 0;
+	_top = 0;
+	_carved = 0;
+	InUse = 0;
+}
+
+void Pixxi_DisplayHeap4D::release(void)
+{
+	reset();
+
+	for (uint8_t i = 0; i < _arenaCount; i++)
+	{
+		_display->mem_Free(_arenas[i]);
+		RoundTrips++;
+	}
+	_arenaCount = 0;
+	ArenaBytes = 0;
+}
+
+uint16_t Pixxi_DisplayHeap4D::report(Tleak4D leak, void * context)
+{
+	uint16_t count = 0;
+	uint32_t after = 0;
+
+	//Oldest first, there are few enough to just look for the next one each time
+	while (1)
+	{
+		int16_t next = -1;
+		for (uint16_t i = 0; i < PIXXI_HEAP_BLOCKS; i++)
+		{
+			if (_blocks[i].Used && _blocks[i].Serial >= after && (next < 0 || _blocks[i].Serial < _blocks[next].Serial))
+				next = i;
+		}
+		if (next < 0)
+			return count;
+
+		if (leak != NULL)
+			leak(context, &_blocks[next]);
+		after = _blocks[next].Serial + 1;
+		count++;
+	}
+}
+
+uint8_t Pixxi_DisplayHeap4D::fragmentation(void)
+{
+	uint32_t live = 0;
+
+	if (_carved == 0)
+		return 0;
+
+	for (uint16_t i = 0; i < PIXXI_HEAP_BLOCKS; i++)
+	{
+		if (_blocks[i].Used && _blocks[i].Class != PIXXI_HEAP_LARGE)
+			live += _blocks[i].Size;
+	}
+	return 100 * (_carved - live) / _carved;
+}
@@ -0,0 +1,137 @@
+/**
+ * Pooled allocator for display RAM, for the Pixxi serial library.
+ *
+ * mem_Alloc and mem_Free cost a round trip each, and the widget_Init routines call mem_Alloc for
+ * every widget without ever giving the memory back, so a program which keeps building screens
+ * runs the display out of heap. Pixxi_DisplayHeap4D takes display RAM a whole arena at a time and
+ * hands out blocks from it without asking the display, keeping its books on this side:
+ *
+ *	Pixxi_DisplayHeap4D Heap(&Display);
+ *	Display.setHeap(&Heap);					// widget_Init* allocate from it from now on
+ *
+ *	Heap.Screen = MENU;
+ *	Display.widget_Init(n, data, &hndl, &param);
+ *	...
+ *	Heap.freeScreen(MENU);					// everything the menu took, without a round trip
+ *
+ * Blocks come in PIXXI_HEAP_CLASSES size classes, doubling from PIXXI_HEAP_MIN bytes, and a freed
+ * block goes on its class's free list for the next request of that class; once no block is in use
+ * at all the arenas are carved afresh. Anything bigger than the largest class is a mem_Alloc of its
+ * own. New arenas are only asked for when nothing free is left, and are kept for reuse; release()
+ * gives them all back to the display.
+ *
+ * Display RAM handles are word addresses, so a block handle is its arena's handle plus the
+ * block's offset in words; every class size is even, so blocks always start on a word.
+ *
+ * Each block is tagged with Screen when it is handed out. freeScreen() frees every block of a
+ * screen at once, and report() lists whatever is still held, to find what should have been freed.
+ */
+#ifndef Pixxi_Heap4D_h
+#define Pixxi_Heap4D_h
+
+#include "Pixxi_Serial_4Dlib.h"
+
+//Bytes asked of mem_Alloc for each arena
+#ifndef PIXXI_HEAP_ARENA
+#define PIXXI_HEAP_ARENA 1024
+#endif
+
+//Most arenas taken from the display
+#ifndef PIXXI_HEAP_ARENAS
+#define PIXXI_HEAP_ARENAS 8
+#endif
+
+//Most blocks, in arenas or of their own, held at once
+#ifndef PIXXI_HEAP_BLOCKS
+#define PIXXI_HEAP_BLOCKS 128
+#endif
+
+#if PIXXI_HEAP_BLOCKS > 255
+#error "PIXXI_HEAP_BLOCKS must be under 256"
+#endif
+
+//Smallest size class in bytes, and how many classes there are, each twice the last
+#ifndef PIXXI_HEAP_MIN
+#define PIXXI_HEAP_MIN 8
+#endif
+#ifndef PIXXI_HEAP_CLASSES
+#define PIXXI_HEAP_CLASSES 6
+#endif
+
+#if (PIXXI_HEAP_MIN & 1) != 0 || (PIXXI_HEAP_ARENA & 1) != 0
+#error "PIXXI_HEAP_MIN and PIXXI_HEAP_ARENA must be even, blocks are addressed in words"
+#endif
+
+//Class of a block which has a mem_Alloc of its own
+#define PIXXI_HEAP_LARGE PIXXI_HEAP_CLASSES
+
+#define PIXXI_HEAP_NONE 0xFF
+
+typedef struct {
+	uint16_t Handle;
+	uint16_t Size;				// as asked for
+	uint32_t Serial;			// order of the allocation, to tell leaks apart
+	uint8_t Class;				// PIXXI_HEAP_LARGE if it has a mem_Alloc of its own
+	uint8_t Screen;
+	bool Used;
+	uint8_t Next;				// next on its free list, or on the list of unused entries
+} Pixxi_HeapBlock4D;
+
+//Handed each block still in use by report()
+typedef void (*Tleak4D)(void * context, const Pixxi_HeapBlock4D * block);
+
+class Pixxi_DisplayHeap4D
+{
+	public:
+		Pixxi_DisplayHeap4D(Pixxi_Serial_4DLib * display);
+
+		//Display RAM handle of at least Size bytes, tagged with Screen. 0 if there is none to be had.
+		uint16_t alloc(uint16_t size);
+		//False if Handle did not come from alloc(), or was freed already
+		bool free(uint16_t handle);
+		//Free every block tagged with Screen. Returns how many there were.
+		uint16_t freeScreen(uint8_t screen);
+		//Free every block, the arenas are kept
+		void reset(void);
+		//Free every block and give the arenas back to the display
+		void release(void);
+
+		//Blocks still in use, oldest first, through Leak if given. Returns how many.
+		uint16_t report(Tleak4D leak, void * context);
+		//Share of the arena bytes carved into blocks which holds nothing: class rounding and blocks on free lists, in percent
+		uint8_t fragmentation(void);
+
+		uint8_t Screen;				// tag for the blocks alloc() hands out
+
+		//Statistics
+		uint32_t InUse;				// bytes asked for by the blocks in use
+		uint32_t HighWater;			// most InUse has been
+		uint32_t ArenaBytes;		// display RAM held in arenas
+		uint32_t Allocs;
+		uint32_t Frees;
+		uint32_t RoundTrips;		// mem_Alloc and mem_Free sent
+		uint32_t Failed;			// allocations which could not be met
+
+	private:
+		uint8_t classOf(uint16_t size);
+		uint16_t classSize(uint8_t sizeClass);
+		int16_t find(uint16_t handle);
+		uint8_t entry(void);
+		uint8_t carve(uint8_t sizeClass);
+		uint8_t take(uint8_t sizeClass);
+		void drop(uint8_t index);
+		void settle(void);
+
+		Pixxi_Serial_4DLib * _display;
+		Pixxi_HeapBlock4D _blocks[PIXXI_HEAP_BLOCKS];
+		uint8_t _free[PIXXI_HEAP_CLASSES];	// first free block of each class
+		uint8_t _unused;			// first unused entry of _blocks
+		uint16_t _arenas[PIXXI_HEAP_ARENAS];
+		uint8_t _arenaCount;
+		uint8_t _current;			// arena blocks are being carved from
+		uint16_t _top;				// bytes of it carved so far
+		uint32_t _carved;			// bytes carved from all the arenas
+		uint32_t _serial;
+};
+
+#endif
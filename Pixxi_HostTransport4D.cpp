@@ -0,0 +1,563 @@
+/**
+ * Host (Linux) transports for the Pixxi serial library.
+ * See header for description.
+ */
+
+#ifdef PIXXI_HOST
+
+#include "Pixxi_HostTransport4D.h"
+#include "Pixxi_TxRing4D.h"
+#include "Pixxi_RxRing4D.h"
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+uint64_t Pixxi_HostNanos(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint32_t Pixxi_HostMillis(void)
+{
+	return (uint32_t) (Pixxi_HostNanos() / 1000000ULL);
+}
+
+//*********************************************************************************************//
+//****************************************Byte Stream******************************************//
+//*********************************************************************************************//
+
+Pixxi_ByteStream4D::Pixxi_ByteStream4D(const uint8_t * script, uint32_t size, uint32_t seed) {
+	_script = script;
+	_size = size;
+	//xorshift must never be seeded with zero
+	_seed = seed ? seed : 0x4D5953;
+	NoiseOneIn = 0;
+	rewind();
+}
+
+uint32_t Pixxi_ByteStream4D::random(void)
+{
+	_state ^= _state << 13;
+	_state ^= _state >> 17;
+	_state ^= _state << 5;
+	return _state;
+}
+
+uint32_t Pixxi_ByteStream4D::read(uint8_t * dest, uint32_t max)
+{
+	uint32_t left = _size - Position;
+	if (left == 0 || max == 0)
+		return 0;
+
+	uint32_t count = 1 + random() % max;
+	if (count > left)
+		count = left;
+
+	memcpy(dest, &_script[Position], count);
+	Position += count;
+
+	if (NoiseOneIn != 0)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (random() % NoiseOneIn == 0)
+				dest[i] ^= (uint8_t) (1 << (random() & 7));
+		}
+	}
+
+	return count;
+}
+
+bool Pixxi_ByteStream4D::done(void)
+{
+	return Position >= _size;
+}
+
+void Pixxi_ByteStream4D::rewind(void)
+{
+	Position = 0;
+	_state = _seed;
+}
+
+//*********************************************************************************************//
+//***************************************Simulated Link****************************************//
+//*********************************************************************************************//
+
+Pixxi_SimTransport4D::Pixxi_SimTransport4D() {
+	Responder = NULL;
+	ResponderContext = NULL;
+	LatencyUs = 0;
+	Baud = 0;
+	TxBytes = 0;
+	RxBytes = 0;
+	Dropped = 0;
+	CaptureLen = 0;
+	_capture = NULL;
+	_captureSize = 0;
+	_delayHead = 0;
+	_delayTail = 0;
+	_delayLast = 0;
+}
+
+bool Pixxi_SimTransport4D::startRx(uint8_t * buffer, uint16_t size)
+{
+	//Bytes are pushed into the ring by feed() / poll(), nothing to set up
+	return true;
+}
+
+bool Pixxi_SimTransport4D::setBaud(uint32_t baud)
+{
+	Baud = baud;
+	return true;
+}
+
+uint32_t Pixxi_SimTransport4D::baud(void)
+{
+	return Baud;
+}
+
+bool Pixxi_SimTransport4D::supportsBaud(uint32_t baud)
+{
+	return baud != 0;
+}
+
+uint32_t Pixxi_SimTransport4D::millis(void)
+{
+	return Pixxi_HostMillis();
+}
+
+void Pixxi_SimTransport4D::feed(const uint8_t * data, uint32_t size)
+{
+	if (LatencyUs == 0 && _delayHead == _delayTail)
+	{
+		RxBytes += size;
+		if (RxRing != NULL)
+			RxRing->RxPush(data, size);
+		return;
+	}
+
+	//Hold them back until the turnaround time has passed
+	feedAt(data, size, Pixxi_HostNanos() + LatencyUs * 1000ULL, 0);
+}
+
+void Pixxi_SimTransport4D::feedAt(const uint8_t * data, uint32_t size, uint64_t at, uint64_t spacing)
+{
+	//Bytes come out in order, so nothing can overtake what is already waiting
+	if (at < _delayLast)
+		at = _delayLast;
+
+	for (uint32_t i = 0; i < size; i++)
+	{
+		if (_delayHead - _delayTail == PIXXI_SIM_DELAY_SIZE)
+		{
+			//A reply with a hole in it, which should show up as a failed command
+			Dropped += size - i;
+			break;
+		}
+		at += spacing;
+		_delayed[_delayHead % PIXXI_SIM_DELAY_SIZE] = data[i];
+		_delayedAt[_delayHead % PIXXI_SIM_DELAY_SIZE] = at;
+		_delayHead++;
+	}
+	_delayLast = at;
+}
+
+void Pixxi_SimTransport4D::poll(void)
+{
+	if (_delayHead == _delayTail)
+		return;
+
+	uint64_t now = Pixxi_HostNanos();
+	while (_delayHead != _delayTail && _delayedAt[_delayTail % PIXXI_SIM_DELAY_SIZE] <= now)
+	{
+		RxBytes++;
+		if (RxRing != NULL)
+			RxRing->RxPush(&_delayed[_delayTail % PIXXI_SIM_DELAY_SIZE], 1);
+		_delayTail++;
+	}
+}
+
+void Pixxi_SimTransport4D::setCapture(uint8_t * buffer, uint32_t size)
+{
+	_capture = buffer;
+	_captureSize = size;
+	CaptureLen = 0;
+}
+
+void Pixxi_SimTransport4D::delivered(const uint8_t * data, uint16_t size)
+{
+	//Keep a copy of what went out
+	if (_capture != NULL)
+	{
+		uint32_t count = size;
+		if (count > _captureSize - CaptureLen)
+			count = _captureSize - CaptureLen;
+		memcpy(&_capture[CaptureLen], data, count);
+		CaptureLen += count;
+	}
+
+	TxBytes += size;
+	if (Responder != NULL)
+		Responder(ResponderContext, this, data, size);
+}
+
+//*********************************************************************************************//
+//*************************************Loopback Transport**************************************//
+//*********************************************************************************************//
+
+Pixxi_LoopbackTransport4D::Pixxi_LoopbackTransport4D(uint32_t baud) {
+	Baud = baud;
+	_data = NULL;
+	_size = 0;
+	_halfAt = 0;
+	_doneAt = 0;
+	_busy = false;
+	_halfFired = false;
+	_rxSource = NULL;
+	_rxStartNs = 0;
+	_rxDelivered = 0;
+	resetStats();
+}
+
+uint64_t Pixxi_LoopbackTransport4D::wireTime(uint32_t bytes)
+{
+	if (Baud == 0)
+		return 0;
+	//8N1 framing, 10 bits per byte
+	return (uint64_t) bytes * 10ULL * 1000000000ULL / Baud;
+}
+
+bool Pixxi_LoopbackTransport4D::startTx(const uint8_t * data, uint16_t size)
+{
+	if (_busy)
+		return false;
+
+	uint64_t now = Pixxi_HostNanos();
+	_data = data;
+	_size = size;
+	_halfAt = now + wireTime(size >> 1);
+	_doneAt = now + wireTime(size);
+	_halfFired = false;
+	_busy = true;
+	return true;
+}
+
+void Pixxi_LoopbackTransport4D::poll(void)
+{
+	uint64_t now = Pixxi_HostNanos();
+
+	//Replies which have waited out their latency
+	Pixxi_SimTransport4D::poll();
+
+	//Feed the receive side at the line rate
+	if (_rxSource != NULL && RxRing != NULL)
+	{
+		uint64_t due = Baud ? (now - _rxStartNs) * Baud / 10ULL / 1000000000ULL : ~0ULL;
+		while (_rxDelivered < due && !_rxSource->done())
+		{
+			uint8_t chunk[64];
+			uint64_t want = due - _rxDelivered;
+			uint32_t count = _rxSource->read(chunk, want < sizeof(chunk) ? (uint32_t) want : sizeof(chunk));
+			RxRing->RxPush(chunk, count);
+			_rxDelivered += count;
+			RxBytes += count;
+		}
+	}
+
+	if (!_busy)
+		return;
+
+	//Each half is handed over before the ring is told it can reuse it
+	if (!_halfFired && now >= _halfAt)
+	{
+		_halfFired = true;
+		delivered(_data, _size >> 1);
+		if (TxRing != NULL)
+			TxRing->TxHalfCplt();
+	}
+
+	if (now >= _doneAt)
+	{
+		WireNs += wireTime(_size);
+		_busy = false;
+		if (!_halfFired)
+			delivered(_data, _size >> 1);
+		delivered(_data + (_size >> 1), _size - (_size >> 1));
+		if (TxRing != NULL)
+			TxRing->TxCplt();
+	}
+}
+
+void Pixxi_LoopbackTransport4D::waitTx(void)
+{
+	uint64_t start = Pixxi_HostNanos();
+	poll();
+	StallNs += Pixxi_HostNanos() - start;
+}
+
+void Pixxi_LoopbackTransport4D::setRxSource(Pixxi_ByteStream4D * source)
+{
+	_rxSource = source;
+	_rxStartNs = Pixxi_HostNanos();
+	_rxDelivered = 0;
+}
+
+void Pixxi_LoopbackTransport4D::resetStats(void)
+{
+	TxBytes = 0;
+	RxBytes = 0;
+	WireNs = 0;
+	StallNs = 0;
+	CaptureLen = 0;
+	StartNs = Pixxi_HostNanos();
+}
+
+double Pixxi_LoopbackTransport4D::idleFraction(void)
+{
+	uint64_t elapsed = Pixxi_HostNanos() - StartNs;
+	if (elapsed == 0)
+		return 1.0;
+	return 1.0 - (double) StallNs / (double) elapsed;
+}
+
+//*********************************************************************************************//
+//**************************************Memory Transport***************************************//
+//*********************************************************************************************//
+
+bool Pixxi_MemoryTransport4D::startTx(const uint8_t * data, uint16_t size)
+{
+	delivered(data, size);
+
+	//Nothing to wait for
+	if (TxRing != NULL)
+		TxRing->TxCplt();
+	return true;
+}
+
+//*********************************************************************************************//
+//**************************************POSIX Transport****************************************//
+//*********************************************************************************************//
+
+/*
+ * termios only knows a fixed set of rates
+ */
+static speed_t BaudToSpeed(uint32_t baud)
+{
+	switch (baud)
+	{
+		case 110: return B110;
+		case 300: return B300;
+		case 600: return B600;
+		case 1200: return B1200;
+		case 2400: return B2400;
+		case 4800: return B4800;
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 500000: return B500000;
+		case 576000: return B576000;
+		case 921600: return B921600;
+		case 1000000: return B1000000;
+		case 1500000: return B1500000;
+		case 2000000: return B2000000;
+		default: return 0;
+	}
+}
+
+Pixxi_PosixTransport4D::Pixxi_PosixTransport4D() {
+	Fd = -1;
+	Baud = 0;
+	TxBytes = 0;
+	RxBytes = 0;
+	_data = NULL;
+	_size = 0;
+	_sent = 0;
+	_busy = false;
+}
+
+bool Pixxi_PosixTransport4D::open(const char * path, uint32_t baud)
+{
+	int fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0)
+		return false;
+	return attachFd(fd, baud);
+}
+
+bool Pixxi_PosixTransport4D::attachFd(int fd, uint32_t baud)
+{
+	struct termios tio;
+
+	Fd = fd;
+	fcntl(Fd, F_SETFL, fcntl(Fd, F_GETFL) | O_NONBLOCK);
+
+	//Raw 8N1, no flow control
+	if (tcgetattr(Fd, &tio) == 0)
+	{
+		cfmakeraw(&tio);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+		tio.c_cc[VMIN] = 0;
+		tio.c_cc[VTIME] = 0;
+		tcsetattr(Fd, TCSANOW, &tio);
+	}
+
+	return setBaud(baud);
+}
+
+bool Pixxi_PosixTransport4D::openPty(char * slaveName, uint32_t nameSize)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0)
+		return false;
+
+	if (grantpt(fd) != 0 || unlockpt(fd) != 0 || ptsname_r(fd, slaveName, nameSize) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	//A pty has no real baud rate, 0 skips the speed setting
+	return attachFd(fd, 0);
+}
+
+void Pixxi_PosixTransport4D::close(void)
+{
+	if (Fd >= 0)
+		::close(Fd);
+	Fd = -1;
+	_busy = false;
+}
+
+bool Pixxi_PosixTransport4D::setBaud(uint32_t baud)
+{
+	struct termios tio;
+
+	if (baud == 0)
+	{
+		Baud = baud;
+		return true;
+	}
+
+	speed_t speed = BaudToSpeed(baud);
+	if (speed == 0 || tcgetattr(Fd, &tio) != 0)
+		return false;
+
+	//Let anything queued at the old rate get out first
+	tcdrain(Fd);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	if (tcsetattr(Fd, TCSANOW, &tio) != 0)
+		return false;
+
+	Baud = baud;
+	return true;
+}
+
+uint32_t Pixxi_PosixTransport4D::baud(void)
+{
+	return Baud;
+}
+
+bool Pixxi_PosixTransport4D::supportsBaud(uint32_t baud)
+{
+	return BaudToSpeed(baud) != 0;
+}
+
+bool Pixxi_PosixTransport4D::startTx(const uint8_t * data, uint16_t size)
+{
+	if (_busy || Fd < 0)
+		return false;
+
+	_data = data;
+	_size = size;
+	_sent = 0;
+	_busy = true;
+
+	//Get as much out as the kernel will take right now
+	poll();
+	return true;
+}
+
+bool Pixxi_PosixTransport4D::startRx(uint8_t * buffer, uint16_t size)
+{
+	//poll() reads straight into the ring
+	return Fd >= 0;
+}
+
+uint32_t Pixxi_PosixTransport4D::millis(void)
+{
+	return Pixxi_HostMillis();
+}
+
+void Pixxi_PosixTransport4D::poll(void)
+{
+	if (Fd < 0)
+		return;
+
+	//Receive whatever has arrived
+	if (RxRing != NULL)
+	{
+		uint8_t chunk[256];
+		ssize_t count;
+		while ((count = ::read(Fd, chunk, sizeof(chunk))) > 0)
+		{
+			RxRing->RxPush(chunk, count);
+			RxBytes += count;
+		}
+	}
+
+	//Push out more of the current transfer
+	if (_busy)
+	{
+		ssize_t count = ::write(Fd, &_data[_sent], _size - _sent);
+		if (count > 0)
+		{
+			_sent += count;
+			TxBytes += count;
+		}
+
+		if (_sent >= _size)
+		{
+			_busy = false;
+			if (TxRing != NULL)
+				TxRing->TxCplt();
+		}
+	}
+}
+
+void Pixxi_PosixTransport4D::wait(bool forWrite)
+{
+	struct pollfd pfd;
+
+	if (Fd < 0)
+		return;
+
+	pfd.fd = Fd;
+	pfd.events = POLLIN | (forWrite && _busy ? POLLOUT : 0);
+	pfd.revents = 0;
+	::poll(&pfd, 1, 1);
+	poll();
+}
+
+void Pixxi_PosixTransport4D::waitTx(void)
+{
+	wait(true);
+}
+
+void Pixxi_PosixTransport4D::waitRx(void)
+{
+	wait(false);
+}
+
+#endif
@@ -0,0 +1,205 @@
+/**
+ * Host (Linux) transports for the Pixxi serial library.
+ *
+ * Only built with PIXXI_HOST defined. These let the library be exercised and timed on a PC
+ * without a display attached.
+ */
+#ifndef Pixxi_HostTransport4D_h
+#define Pixxi_HostTransport4D_h
+
+#ifdef PIXXI_HOST
+
+#include "Pixxi_Transport4D.h"
+
+//Monotonic clock in nanoseconds / milliseconds
+uint64_t Pixxi_HostNanos(void);
+uint32_t Pixxi_HostMillis(void);
+
+/*
+ * Simulated byte stream, used as the receive side of the host transports.
+ * Plays back a script of bytes in randomly sized chunks, optionally corrupting some of them,
+ * so the response parsers can be fuzzed against awkward chunk boundaries and line noise.
+ * The same seed always gives the same stream.
+ */
+class Pixxi_ByteStream4D
+{
+	public:
+		Pixxi_ByteStream4D(const uint8_t * script, uint32_t size, uint32_t seed);
+
+		//Copy out the next chunk, between 1 and max bytes. Returns 0 at the end of the script.
+		uint32_t read(uint8_t * dest, uint32_t max);
+		bool done(void);
+		void rewind(void);
+
+		uint32_t NoiseOneIn;	// corrupt roughly one byte in this many, 0 for none
+		uint32_t Position;		// bytes played so far
+
+	private:
+		uint32_t random(void);
+
+		const uint8_t * _script;
+		uint32_t _size;
+		uint32_t _seed;
+		uint32_t _state;
+};
+
+/*
+ * Common base for the simulated links below.
+ * Whatever is sent can be captured, and is handed to an optional responder once it has
+ * "arrived" - this is how a simulated display is plugged in. The responder (or the test)
+ * answers with feed(), and the answer turns up LatencyUs later to model the display's
+ * turnaround time.
+ */
+class Pixxi_SimTransport4D;
+typedef void (*Tresponder4D)(void * context, Pixxi_SimTransport4D * port, const uint8_t * data, uint16_t size);
+
+//Bytes which can be waiting out their latency at once, enough for a burst of pipelined sector reads
+#ifndef PIXXI_SIM_DELAY_SIZE
+#define PIXXI_SIM_DELAY_SIZE 16384
+#endif
+
+class Pixxi_SimTransport4D : public Pixxi_Transport4D
+{
+	public:
+		Pixxi_SimTransport4D();
+
+		bool startRx(uint8_t * buffer, uint16_t size) override;
+		uint32_t millis(void) override;
+		void poll(void) override;
+		bool setBaud(uint32_t baud) override;
+		uint32_t baud(void) override;
+		bool supportsBaud(uint32_t baud) override;
+
+		//Deliver bytes to the receive side, LatencyUs from now
+		void feed(const uint8_t * data, uint32_t size);
+		//Deliver bytes at a given Pixxi_HostNanos() time, Spacing ns apart. Never ahead of bytes already fed.
+		//Bytes which do not fit in PIXXI_SIM_DELAY_SIZE are counted in Dropped.
+		void feedAt(const uint8_t * data, uint32_t size, uint64_t at, uint64_t spacing);
+		void setCapture(uint8_t * buffer, uint32_t size);
+
+		Tresponder4D Responder;
+		void * ResponderContext;
+		uint32_t LatencyUs;		// turnaround before fed bytes appear
+		uint32_t Baud;			// line rate, 0 for an infinitely fast link
+
+		uint64_t TxBytes;		// bytes which have completed on the wire
+		uint64_t RxBytes;		// bytes handed to the receive ring
+		uint64_t Dropped;		// fed bytes lost because the delay buffer was full
+		uint32_t CaptureLen;	// bytes stored in the capture buffer
+
+	protected:
+		//Subclasses call this once a transfer has reached the far end
+		void delivered(const uint8_t * data, uint16_t size);
+
+	private:
+		uint8_t * _capture;
+		uint32_t _captureSize;
+		uint8_t _delayed[PIXXI_SIM_DELAY_SIZE];
+		uint64_t _delayedAt[PIXXI_SIM_DELAY_SIZE];
+		uint32_t _delayHead;
+		uint32_t _delayTail;
+		uint64_t _delayLast;		// release time of the newest delayed byte
+};
+
+/*
+ * Loopback transport.
+ * Pretends to be a UART at the given baud rate: each transfer "takes" the time it would
+ * on the wire (10 bits per byte) and completes when poll() notices that time has passed.
+ * Received bytes come from feed() or from an optional Pixxi_ByteStream4D paced at the same
+ * baud rate. A baud rate of 0 means an infinitely fast link.
+ *
+ * Time spent in waitTx() is time the CPU was stuck waiting on the link, so
+ * idleFraction() gives the share of the run the CPU was free to do other work.
+ */
+class Pixxi_LoopbackTransport4D : public Pixxi_SimTransport4D
+{
+	public:
+		Pixxi_LoopbackTransport4D(uint32_t baud);
+
+		bool startTx(const uint8_t * data, uint16_t size) override;
+		void poll(void) override;
+		void waitTx(void) override;
+
+		void setRxSource(Pixxi_ByteStream4D * source);
+		void resetStats(void);
+		double idleFraction(void);
+
+		uint64_t WireNs;		// time the simulated wire was busy
+		uint64_t StallNs;		// time spent blocked in waitTx()
+		uint64_t StartNs;		// when the statistics were last reset
+
+	private:
+		uint64_t wireTime(uint32_t bytes);
+
+		const uint8_t * _data;
+		uint16_t _size;
+		uint64_t _halfAt;
+		uint64_t _doneAt;
+		bool _busy;
+		bool _halfFired;
+		Pixxi_ByteStream4D * _rxSource;
+		uint64_t _rxStartNs;
+		uint64_t _rxDelivered;
+};
+
+/*
+ * In-memory transport.
+ * Transfers complete immediately. Replies can be queued up front with feed(), or produced by
+ * the responder as commands go out.
+ */
+class Pixxi_MemoryTransport4D : public Pixxi_SimTransport4D
+{
+	public:
+		bool startTx(const uint8_t * data, uint16_t size) override;
+};
+
+/*
+ * POSIX serial transport.
+ * Talks to a real serial port (/dev/ttyUSB0 and friends) through termios, or to one side of a
+ * pseudo terminal so the library can run against a display simulator in another process.
+ * Writes are non-blocking and completed from poll(); waiting uses poll(2) rather than spinning,
+ * so the process shows up idle in perf/top while it waits on the link.
+ */
+class Pixxi_PosixTransport4D : public Pixxi_Transport4D
+{
+	public:
+		Pixxi_PosixTransport4D();
+
+		//Open a serial device at the given baud rate. Returns false on failure.
+		bool open(const char * path, uint32_t baud);
+		//Use an already open descriptor (e.g. a pty master)
+		bool attachFd(int fd, uint32_t baud);
+		/*
+		 * Create a pseudo terminal and attach to its master side.
+		 * The slave device name (for the simulator to open) is copied to SlaveName.
+		 */
+		bool openPty(char * slaveName, uint32_t nameSize);
+		void close(void);
+		bool setBaud(uint32_t baud) override;
+		uint32_t baud(void) override;
+		bool supportsBaud(uint32_t baud) override;
+
+		bool startTx(const uint8_t * data, uint16_t size) override;
+		bool startRx(uint8_t * buffer, uint16_t size) override;
+		uint32_t millis(void) override;
+		void poll(void) override;
+		void waitTx(void) override;
+		void waitRx(void) override;
+
+		int Fd;
+		uint32_t Baud;
+		uint64_t TxBytes;
+		uint64_t RxBytes;
+
+	private:
+		void wait(bool forWrite);
+
+		const uint8_t * _data;
+		uint16_t _size;
+		uint16_t _sent;
+		bool _busy;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+/**
+ * Bulk encoding of word arrays for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_Pack4D.h"
+#include <string.h>
+
+#if defined(PIXXI_HOST) && defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(PIXXI_HOST) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+void Pixxi_PackWords4D(uint8_t * dest, const uint16_t * source, uint32_t count)
+{
+	uint32_t i = 0;
+
+#if defined(PIXXI_HOST) && defined(__SSE2__)
+	//Eight words at a time, swap the bytes of each 16 bit lane
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (source + i));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *) (dest + 2 * i), v);
+	}
+#elif defined(PIXXI_HOST) && defined(__ARM_NEON)
+	for (; i + 8 <= count; i += 8)
+	{
+		uint8x16_t v = vld1q_u8((const uint8_t *) (source + i));
+		vst1q_u8(dest + 2 * i, vrev16q_u8(v));
+	}
+#elif !defined(PIXXI_HOST)
+	//Two words at a time. memcpy keeps it legal for any alignment and compiles to LDR / STR.
+	for (; i + 2 <= count; i += 2)
+	{
+		uint32_t pair;
+		memcpy(&pair, source + i, 4);
+		pair = __REV16(pair);
+		memcpy(dest + 2 * i, &pair, 4);
+	}
+#endif
+
+	//Whatever is left over
+	for (; i < count; i++)
+	{
+		uint16_t word = source[i];
+		dest[2 * i] = word >> 8;
+		dest[2 * i + 1] = word & 0xFF;
+	}
+}
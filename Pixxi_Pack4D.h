@@ -0,0 +1,30 @@
+/**
+ * Bulk encoding of word arrays for the Pixxi serial library.
+ *
+ * The display takes every word big-endian, so arrays of coordinates, arguments and RAM
+ * contents are byte swapped on the way out. Doing it here a block at a time (REV16 on the
+ * MCU, SSE2 / NEON on the host) instead of a word at a time lets WriteWords hand the
+ * transmit ring a whole chunk per call.
+ */
+#ifndef Pixxi_Pack4D_h
+#define Pixxi_Pack4D_h
+
+#include "Pixxi_Transport4D.h"
+
+/*
+ * Size in bytes of the staging buffer WriteWords swaps into, on the stack.
+ * Longer arrays go out in chunks of this size.
+ */
+#ifndef PIXXI_PACK_CHUNK
+#define PIXXI_PACK_CHUNK 128
+#endif
+
+#if (PIXXI_PACK_CHUNK & 3) != 0
+#error "PIXXI_PACK_CHUNK must be a multiple of 4"
+#endif
+
+//Write count words to dest as big-endian bytes (2 * count of them). Neither needs to be aligned,
+//and dest may be the source itself to swap in place.
+void Pixxi_PackWords4D(uint8_t * dest, const uint16_t * source, uint32_t count);
+
+#endif
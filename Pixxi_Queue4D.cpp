@@ -0,0 +1,177 @@
+/**
+ * Command queue for sharing a display between RTOS tasks, for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_Queue4D.h"
+
+#define QUEUE_MASK (PIXXI_QUEUE_SIZE - 1)
+
+/**
+ * Encoding
+ */
+
+Pixxi_Command4D::Pixxi_Command4D() {
+	Length = 0;
+	Overflow = false;
+	Reply = PIXXI_REPLY_ACK;
+	Result = NULL;
+	Payload = NULL;
+	PayloadSize = 0;
+}
+
+Pixxi_Command4D & Pixxi_Command4D::begin(uint16_t opcode)
+{
+	Length = 0;
+	Overflow = false;
+	Reply = PIXXI_REPLY_ACK;
+	Result = NULL;
+	Payload = NULL;
+	PayloadSize = 0;
+	return word(opcode);
+}
+
+Pixxi_Command4D & Pixxi_Command4D::word(uint16_t value)
+{
+	byte(value >> 8);
+	return byte(value & 0xFF);
+}
+
+Pixxi_Command4D & Pixxi_Command4D::byte(uint8_t value)
+{
+	if (Length < PIXXI_QUEUE_CMD_SIZE)
+		Bytes[Length++] = value;
+	else
+		Overflow = true;
+	return *this;
+}
+
+Pixxi_Command4D & Pixxi_Command4D::string(const char * text)
+{
+	do
+		byte(*text);
+	while (*text++ != 0);
+	return *this;
+}
+
+Pixxi_Command4D & Pixxi_Command4D::payload(const uint8_t * data, uint32_t size)
+{
+	Payload = data;
+	PayloadSize = size;
+	return *this;
+}
+
+Pixxi_Command4D & Pixxi_Command4D::reply(uint8_t kind, Pixxi_Future4D * result)
+{
+	Reply = kind;
+	Result = result;
+	return *this;
+}
+
+/**
+ * Queue
+ */
+
+Pixxi_CommandQueue4D::Pixxi_CommandQueue4D(Pixxi_Serial_4DLib * display) {
+	_display = display;
+
+	for (uint8_t lane = 0; lane < PIXXI_LANES; lane++)
+	{
+		Pixxi_Lane4D * l = &Lanes[lane];
+		for (uint32_t i = 0; i < PIXXI_QUEUE_SIZE; i++)
+			l->Slots[i].Sequence = i;
+		l->Head = 0;
+		l->Tail = 0;
+		l->Pushed = 0;
+		l->Refused = 0;
+		l->Sent = 0;
+	}
+}
+
+bool Pixxi_CommandQueue4D::push(const Pixxi_Command4D * command, uint8_t lane)
+{
+	Pixxi_Lane4D * l = &Lanes[lane < PIXXI_LANES ? lane : PIXXI_LANE_BULK];
+	uint32_t pos = __atomic_load_n(&l->Head, __ATOMIC_RELAXED);
+	Pixxi_QueueSlot4D * slot;
+
+	if (command->Overflow || command->Length < 2)
+		goto refused;
+
+	//Claim the slot at Head once the consumer has finished with it on the previous lap
+	while (1)
+	{
+		slot = &l->Slots[pos & QUEUE_MASK];
+		int32_t lap = (int32_t) (__atomic_load_n(&slot->Sequence, __ATOMIC_ACQUIRE) - pos);
+
+		if (lap == 0)
+		{
+			if (__atomic_compare_exchange_n(&l->Head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (lap < 0)
+			goto refused;
+		else
+			pos = __atomic_load_n(&l->Head, __ATOMIC_RELAXED);
+	}
+
+	if (command->Result != NULL)
+		__atomic_store_n(&command->Result->State, PIXXI_FUTURE_PENDING, __ATOMIC_RELAXED);
+	slot->Command = *command;
+	//Hand it to the consumer
+	__atomic_store_n(&slot->Sequence, pos + 1, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&l->Pushed, 1, __ATOMIC_RELAXED);
+	return true;
+
+refused:
+	__atomic_fetch_add(&l->Refused, 1, __ATOMIC_RELAXED);
+	if (command->Result != NULL)
+	{
+		command->Result->Cmd = command->Length >= 2 ? (command->Bytes[0] << 8 | command->Bytes[1]) : 0;
+		command->Result->Error = Err4D_Invalid;
+		__atomic_store_n(&command->Result->State, PIXXI_FUTURE_FAILED, __ATOMIC_RELEASE);
+	}
+	return false;
+}
+
+bool Pixxi_CommandQueue4D::pop(uint8_t lane, Pixxi_Command4D * command)
+{
+	Pixxi_Lane4D * l = &Lanes[lane];
+	Pixxi_QueueSlot4D * slot = &l->Slots[l->Tail & QUEUE_MASK];
+
+	if (__atomic_load_n(&slot->Sequence, __ATOMIC_ACQUIRE) != l->Tail + 1)
+		return false;
+
+	*command = slot->Command;
+	//Free for the producers' next lap
+	__atomic_store_n(&slot->Sequence, l->Tail + PIXXI_QUEUE_SIZE, __ATOMIC_RELEASE);
+	__atomic_store_n(&l->Tail, l->Tail + 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+uint32_t Pixxi_CommandQueue4D::waiting(uint8_t lane)
+{
+	return __atomic_load_n(&Lanes[lane].Head, __ATOMIC_RELAXED) - __atomic_load_n(&Lanes[lane].Tail, __ATOMIC_RELAXED);
+}
+
+uint16_t Pixxi_CommandQueue4D::pump(uint16_t max)
+{
+	Pixxi_Command4D command;
+	uint16_t sent = 0;
+
+	while (sent < max)
+	{
+		//Urgent first, looked at again before every bulk command
+		uint8_t lane = 0;
+		while (lane < PIXXI_LANES && !pop(lane, &command))
+			lane++;
+		if (lane == PIXXI_LANES)
+			break;
+
+		_display->submit(command.Bytes, command.Length, command.Payload, command.PayloadSize, command.Reply, command.Result);
+		Lanes[lane].Sent++;
+		sent++;
+	}
+
+	_display->service();
+	return sent;
+}
@@ -0,0 +1,124 @@
+/**
+ * Command queue for sharing a display between RTOS tasks, for the Pixxi serial library.
+ *
+ * Pixxi_Serial_4DLib is not thread safe: two tasks drawing at once interleave their words on
+ * the wire and share Error4D. Instead, one task owns the display and pumps this queue, and
+ * the others encode their commands themselves and push them, without any locks:
+ *
+ *	//Any task
+ *	Pixxi_Command4D line;
+ *	line.begin(F_gfx_Line).word(x1).word(y1).word(x2).word(y2).word(RED);
+ *	Queue.push(&line, PIXXI_LANE_BULK);
+ *
+ *	Pixxi_Future4D touched;
+ *	Pixxi_Command4D touch;
+ *	touch.begin(F_touch_Get).word(TOUCH_STATUS).reply(PIXXI_REPLY_WORD, &touched);
+ *	Queue.push(&touch, PIXXI_LANE_URGENT);
+ *	while (!touched.ready()) vTaskDelay(1);		// or set touched.Notify
+ *	if (touched.ok()) ... touched.Result ...
+ *
+ *	//Display task
+ *	while (1) { Queue.pump(); vTaskDelay(1); }
+ *
+ * Each lane is a bounded multi-producer, single-consumer ring (a sequence number per slot,
+ * producers claim slots with compare-and-swap), so push() never blocks and is safe from any
+ * task. Commands are copied in, the caller's Pixxi_Command4D can be reused straight away;
+ * only a payload (pixels, file data) has to stay put until its Result is ready.
+ *
+ * pump() always empties the urgent lane before taking the next bulk command, so touch
+ * feedback overtakes a queue of image strips. A command already on the wire is never cut
+ * short, so send big uploads as several smaller commands to keep that wait short.
+ *
+ * Every command's outcome goes to its own Result (Error, ErrorInv, Result), never to the
+ * shared Error4D, which only the display task should look at.
+ */
+#ifndef Pixxi_Queue4D_h
+#define Pixxi_Queue4D_h
+
+#include "Pixxi_Serial_4Dlib.h"
+
+//Bytes one encoded command can hold, not counting a payload
+#ifndef PIXXI_QUEUE_CMD_SIZE
+#define PIXXI_QUEUE_CMD_SIZE 28
+#endif
+
+//Commands each lane holds, must be a power of two
+#ifndef PIXXI_QUEUE_SIZE
+#define PIXXI_QUEUE_SIZE 16
+#endif
+
+#if (PIXXI_QUEUE_SIZE & (PIXXI_QUEUE_SIZE - 1)) != 0
+#error "PIXXI_QUEUE_SIZE must be a power of two"
+#endif
+
+//Lanes, in the order pump() serves them
+#define PIXXI_LANE_URGENT	0
+#define PIXXI_LANE_BULK		1
+#define PIXXI_LANES			2
+
+/*
+ * One command encoded for the wire, as Pixxi_Serial_4DLib would have sent it.
+ */
+class Pixxi_Command4D
+{
+	public:
+		Pixxi_Command4D();
+
+		Pixxi_Command4D & begin(uint16_t opcode);
+		Pixxi_Command4D & word(uint16_t value);
+		Pixxi_Command4D & byte(uint8_t value);
+		//Null terminated, as WriteChars sends it
+		Pixxi_Command4D & string(const char * text);
+		//Sent after the rest without being copied, must stay put until Result is ready
+		Pixxi_Command4D & payload(const uint8_t * data, uint32_t size);
+		//Shape of the reply (PIXXI_REPLY_ACK if not set), and where it goes. For PIXXI_REPLY_DATA set Result->Data / Size.
+		Pixxi_Command4D & reply(uint8_t kind, Pixxi_Future4D * result = NULL);
+
+		uint8_t Bytes[PIXXI_QUEUE_CMD_SIZE];
+		uint8_t Length;
+		bool Overflow;				// something did not fit, push() refuses it
+		uint8_t Reply;
+		Pixxi_Future4D * Result;
+		const uint8_t * Payload;
+		uint32_t PayloadSize;
+};
+
+typedef struct {
+	volatile uint32_t Sequence;		// which lap of the ring the slot is ready for
+	Pixxi_Command4D Command;
+} Pixxi_QueueSlot4D;
+
+typedef struct {
+	Pixxi_QueueSlot4D Slots[PIXXI_QUEUE_SIZE];
+	volatile uint32_t Head;			// next slot a producer claims
+	volatile uint32_t Tail;			// next slot the consumer takes, only it moves this
+
+	//Statistics
+	volatile uint32_t Pushed;
+	volatile uint32_t Refused;		// lane full, or the command had overflowed
+	uint32_t Sent;
+} Pixxi_Lane4D;
+
+class Pixxi_CommandQueue4D
+{
+	public:
+		Pixxi_CommandQueue4D(Pixxi_Serial_4DLib * display);
+
+		//From any task. False if the lane is full or the command overflowed, and then Result is failed with Err4D_Invalid.
+		bool push(const Pixxi_Command4D * command, uint8_t lane = PIXXI_LANE_BULK);
+
+		//From the display task only. Sends up to max commands, urgent first, then takes in
+		//whatever replies have arrived. Returns the number sent.
+		uint16_t pump(uint16_t max = 0xFFFF);
+		//Commands waiting in a lane
+		uint32_t waiting(uint8_t lane);
+
+		Pixxi_Lane4D Lanes[PIXXI_LANES];
+
+	private:
+		bool pop(uint8_t lane, Pixxi_Command4D * command);
+
+		Pixxi_Serial_4DLib * _display;
+};
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ * Compressed image uploads for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_Rle4D.h"
+
+//Shortest run worth its own control word in the middle of literals
+#define RLE_MIN_RUN		3
+#define RLE_MAX_COUNT	0x7FFF		// the decoder's counters are signed 16 bit
+
+/*
+ * Append count literals from source, split as needed. Returns the new length, or room + 1 if they do not fit.
+ */
+static uint32_t literals(uint16_t * dest, uint32_t out, uint32_t room, const uint16_t * source, uint32_t count)
+{
+	while (count > 0)
+	{
+		uint32_t n = count < RLE_MAX_COUNT ? count : RLE_MAX_COUNT;
+		if (dest != NULL)
+		{
+			if (out + 1 + n > room)
+				return room + 1;
+			dest[out] = n - 1;
+			memcpy(dest + out + 1, source, 2 * n);
+		}
+		out += 1 + n;
+		source += n;
+		count -= n;
+	}
+	return out;
+}
+
+uint32_t Pixxi_RleEncode4D(uint16_t * dest, uint32_t room, const uint16_t * source, uint32_t count)
+{
+	uint32_t out = 0;
+	uint32_t pending = 0;		// start of literals not written yet
+	uint32_t i = 0;
+
+	while (i < count)
+	{
+		uint16_t colour = source[i];
+		uint32_t run = 1;
+		while (i + run < count && source[i + run] == colour && run < RLE_MAX_COUNT)
+			run++;
+
+		//A short run costs less left among the literals around it
+		if (run >= RLE_MIN_RUN || (run == 2 && pending == i))
+		{
+			out = literals(dest, out, room, source + pending, i - pending);
+			if (dest != NULL)
+			{
+				if (out + 2 > room)
+					return 0;
+				dest[out] = 0x8000 | (run - 1);
+				dest[out + 1] = colour;
+			}
+			out += 2;
+			pending = i + run;
+		}
+		i += run;
+	}
+
+	out = literals(dest, out, room, source + pending, count - pending);
+	return out > room && dest != NULL ? 0 : out;
+}
+
+uint32_t Pixxi_RleSize4D(const uint16_t * pixels, uint16_t width, uint16_t height)
+{
+	uint32_t words = 0;
+
+	for (uint16_t row = 0; row < height; row++)
+		words += Pixxi_RleEncode4D(NULL, 0, pixels + (uint32_t) row * width, width);
+	return words;
+}
+
+Pixxi_RleBlit4D::Pixxi_RleBlit4D(Pixxi_Serial_4DLib * display, uint16_t * scratch, uint16_t scratchWords) {
+	_display = display;
+	_scratch = scratch;
+	//mem_Alloc takes the size in bytes as a word
+	_words = scratchWords > 32767 ? 32767 : scratchWords;
+	_decoder = 0;
+	_ram = 0;
+	_pixels = NULL;
+	_x = 0;
+	_y = 0;
+	_width = 0;
+
+	Compressed = 0;
+	Raw = 0;
+	PixelBytes = 0;
+	WireBytes = 0;
+}
+
+bool Pixxi_RleBlit4D::begin(const char * decoder)
+{
+	end();
+
+	_decoder = _display->file_LoadFunction((char *) decoder);
+	if (_display->Error4D != Err4D_OK)
+		_decoder = 0;
+	if (_decoder == 0)
+		return false;
+
+	_ram = _display->mem_Alloc(2 * _words);
+	if (_display->Error4D != Err4D_OK || _ram == 0)
+	{
+		end();
+		return false;
+	}
+	return true;
+}
+
+void Pixxi_RleBlit4D::end(void)
+{
+	if (_ram != 0)
+		_display->mem_Free(_ram);
+	if (_decoder != 0)
+		_display->mem_Free(_decoder);
+	_ram = 0;
+	_decoder = 0;
+}
+
+uint32_t Pixxi_RleBlit4D::rawBytes(uint16_t width, uint16_t height)
+{
+	return 10 + 2 * (uint32_t) width * height;
+}
+
+uint32_t Pixxi_RleBlit4D::compressedBytes(uint16_t width, uint16_t height, const uint16_t * pixels)
+{
+	uint32_t words = Pixxi_RleSize4D(pixels, width, height);
+	uint32_t pieces = (words + _words - 1) / _words;
+
+	return 2 * words + pieces * PIXXI_RLE_PIECE_BYTES;
+}
+
+/*
+ * Source for blitStream when an image goes raw
+ */
+void Pixxi_RleBlit4D::copy(void * context, uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t * pixels)
+{
+	Pixxi_RleBlit4D * rle = (Pixxi_RleBlit4D *) context;
+
+	for (uint16_t row = 0; row < height; row++)
+		memcpy(pixels + row * width, rle->_pixels + (uint32_t) (y - rle->_y + row) * rle->_width + (x - rle->_x), 2 * width);
+}
+
+void Pixxi_RleBlit4D::piece(uint16_t x, uint16_t y, uint16_t width, uint16_t rows, uint16_t words)
+{
+	uint16_t args[6] = {_ram, words, x, y, width, rows};
+
+	//The scratch words are copied out before this returns, so coding the next piece can start
+	_display->SendWordArrayToRAM(_ram, words, _scratch);
+	_display->file_CallFunction(_decoder, 6, args);
+	WireBytes += 6 + 2 * (uint32_t) words + 4 + 2 * 6;
+}
+
+bool Pixxi_RleBlit4D::blit(uint16_t x, uint16_t y, uint16_t width, uint16_t height, const uint16_t * pixels)
+{
+	if (width == 0 || height == 0)
+		return false;
+
+	PixelBytes += 2 * (uint32_t) width * height;
+
+	//Every row has to fit a piece even if nothing in it repeats
+	bool coded = _decoder != 0 && width > 0 && _words >= width + (width + RLE_MAX_COUNT - 1) / RLE_MAX_COUNT
+		&& compressedBytes(width, height, pixels) < rawBytes(width, height);
+
+	if (!coded)
+	{
+		_pixels = pixels;
+		_x = x;
+		_y = y;
+		_width = width;
+		_display->blitStream(x, y, width, height, copy, this, _scratch, _words);
+		WireBytes += rawBytes(width, height);
+		Raw++;
+		return false;
+	}
+
+	uint16_t first = 0;
+	uint32_t used = 0;
+
+	for (uint16_t row = 0; row < height; row++)
+	{
+		uint32_t words = Pixxi_RleEncode4D(_scratch + used, _words - used, pixels + (uint32_t) row * width, width);
+		if (words == 0)
+		{
+			//Full, send what there is and start this row again in an empty piece
+			piece(x, y + first, width, row - first, used);
+			first = row;
+			used = 0;
+			row--;
+			continue;
+		}
+		used += words;
+	}
+	piece(x, y + first, width, height - first, used);
+
+	Compressed++;
+	return true;
+}
@@ -0,0 +1,92 @@
+/**
+ * Compressed image uploads for the Pixxi serial library.
+ *
+ * Raw RGB565 costs two bytes a pixel on the wire. UI images are mostly flat colour, so here
+ * they are run length coded a few rows at a time, the coded words are put in display RAM with
+ * SendWordArrayToRAM, and a small 4DGL function on the display's uSD card (Pixxi_RleDecode4D.4dg,
+ * compiled to PIXXI_RLE_DECODER) draws them with file_CallFunction:
+ *
+ *	uint16_t scratch[PIXXI_RLE_CHUNK];
+ *	Pixxi_RleBlit4D Rle(&Display, scratch, PIXXI_RLE_CHUNK);
+ *	Rle.begin();					// after media_Init / file_Mount
+ *	Rle.blit(0, 100, 480, 128, banner);
+ *
+ * Each image is first sized with Pixxi_RleSize4D, and sent raw through blitStream instead if
+ * coding it would not save anything (photos, noise), or if the decoder could not be loaded.
+ *
+ * The code is a stream of 16 bit words. A control word with the top bit set is a run: the next
+ * word is a colour, repeated (control & 0x7FFF) + 1 times. Otherwise it is followed by
+ * control + 1 literal colours. Pixels go left to right, top to bottom through the given rows.
+ */
+#ifndef Pixxi_Rle4D_h
+#define Pixxi_Rle4D_h
+
+#include "Pixxi_Serial_4Dlib.h"
+
+//Name of the compiled decoder on the uSD card
+#ifndef PIXXI_RLE_DECODER
+#define PIXXI_RLE_DECODER "RLE4D.4FN"
+#endif
+
+//Words of display RAM a piece is coded into. Needs to be more than the widest image.
+#ifndef PIXXI_RLE_CHUNK
+#define PIXXI_RLE_CHUNK 1024
+#endif
+
+/*
+ * Wire cost of each piece beyond its coded words, in bytes: the SendWordArrayToRAM header and
+ * ACK, the file_CallFunction with six arguments and its reply, plus the decoder's start up
+ * time counted as bytes at the line rate.
+ */
+#ifndef PIXXI_RLE_PIECE_BYTES
+#define PIXXI_RLE_PIECE_BYTES 48
+#endif
+
+/*
+ * Code count pixels into dest. Returns the number of words written, or 0 if they need more
+ * than room. With dest NULL only counts them.
+ */
+uint32_t Pixxi_RleEncode4D(uint16_t * dest, uint32_t room, const uint16_t * source, uint32_t count);
+//Number of words an image codes to, rows coded separately as blit() does
+uint32_t Pixxi_RleSize4D(const uint16_t * pixels, uint16_t width, uint16_t height);
+
+class Pixxi_RleBlit4D
+{
+	public:
+		//Pieces are coded into Scratch, and as many words of display RAM are claimed for them, at most 32767
+		Pixxi_RleBlit4D(Pixxi_Serial_4DLib * display, uint16_t * scratch, uint16_t scratchWords);
+
+		//Load the decoder and claim display RAM for it. False (and raw blits only) if either fails.
+		bool begin(const char * decoder = PIXXI_RLE_DECODER);
+		void end(void);
+
+		//Draw an image of native RGB565 pixels, row by row. Returns true if it went compressed.
+		bool blit(uint16_t x, uint16_t y, uint16_t width, uint16_t height, const uint16_t * pixels);
+		//Bytes blit() would send either way
+		uint32_t compressedBytes(uint16_t width, uint16_t height, const uint16_t * pixels);
+		uint32_t rawBytes(uint16_t width, uint16_t height);
+
+		//Statistics
+		uint32_t Compressed;		// images sent compressed
+		uint32_t Raw;				// images sent raw
+		uint64_t PixelBytes;		// bytes of RGB565 drawn (2 per pixel)
+		uint64_t WireBytes;			// bytes sent to draw them
+
+	private:
+		void piece(uint16_t x, uint16_t y, uint16_t width, uint16_t rows, uint16_t words);
+		static void copy(void * context, uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t * pixels);
+
+		Pixxi_Serial_4DLib * _display;
+		uint16_t * _scratch;
+		uint16_t _words;
+		uint16_t _decoder;			// file_LoadFunction handle, 0 if not loaded
+		uint16_t _ram;				// mem_Alloc handle for the coded words
+
+		//Image being sent raw, for copy()
+		const uint16_t * _pixels;
+		uint16_t _x;
+		uint16_t _y;
+		uint16_t _width;
+};
+
+#endif
@@ -0,0 +1,151 @@
+/**
+ * Receive ring buffer for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_RxRing4D.h"
+#include <string.h>
+
+#define RX_RING_MASK (PIXXI_RX_RING_SIZE - 1)
+
+Pixxi_RxRing4D::Pixxi_RxRing4D() {
+	_port = NULL;
+	_head = 0;
+	_tail = 0;
+	_armed = 0;
+
+	Overruns = 0;
+	Errors = 0;
+}
+
+void Pixxi_RxRing4D::attach(PIXXI_TRANSPORT * port) {
+	_port = port;
+	_port->RxRing = this;
+}
+
+bool Pixxi_RxRing4D::arm(void)
+{
+	//Hardware always restarts at the beginning of the buffer
+	PIXXI_ENTER_CRITICAL();
+	_head = 0;
+	_tail = 0;
+	PIXXI_EXIT_CRITICAL();
+
+	_armed = _port->startRx(_buf, PIXXI_RX_RING_SIZE);
+	return _armed;
+}
+
+uint32_t Pixxi_RxRing4D::available(void)
+{
+	return _head - _tail;
+}
+
+uint32_t Pixxi_RxRing4D::readAvailable(uint8_t * dest, uint32_t size)
+{
+	uint32_t done = 0;
+
+	PIXXI_ENTER_CRITICAL();
+	uint32_t count = _head - _tail;
+	PIXXI_EXIT_CRITICAL();
+
+	if (size > count)
+		size = count;
+
+	while (done < size)
+	{
+		//Copy up to the end of the buffer, then wrap
+		uint32_t index = _tail & RX_RING_MASK;
+		uint32_t chunk = size - done;
+		if (chunk > PIXXI_RX_RING_SIZE - index)
+			chunk = PIXXI_RX_RING_SIZE - index;
+
+		memcpy(&dest[done], &_buf[index], chunk);
+		_tail = _tail + chunk;
+		done += chunk;
+	}
+
+	return done;
+}
+
+uint32_t Pixxi_RxRing4D::read(uint8_t * dest, uint32_t size, uint32_t timeout)
+{
+	uint32_t done = 0;
+	uint32_t start = _port->millis();
+
+	if (!_armed)
+		arm();
+
+	while (done < size)
+	{
+		_port->poll();
+		uint32_t count = readAvailable(&dest[done], size - done);
+		done += count;
+
+		if (count == 0)
+		{
+			if (_port->millis() - start >= timeout)
+				break;
+			_port->waitRx();
+		}
+	}
+
+	return done;
+}
+
+int Pixxi_RxRing4D::peek(uint32_t offset)
+{
+	_port->poll();
+	if (offset >= _head - _tail)
+		return -1;
+	return _buf[(_tail + offset) & RX_RING_MASK];
+}
+
+void Pixxi_RxRing4D::clear(void)
+{
+	_port->poll();
+	_tail = _head;
+}
+
+void Pixxi_RxRing4D::RxEvent(uint16_t position)
+{
+	PIXXI_ENTER_CRITICAL();
+	//Work out how far the hardware has moved since we last looked
+	uint32_t advance = (position - (_head & RX_RING_MASK)) & RX_RING_MASK;
+	_head = _head + advance;
+	checkOverrun();
+	PIXXI_EXIT_CRITICAL();
+}
+
+void Pixxi_RxRing4D::RxPush(const uint8_t * data, uint32_t size)
+{
+	//A software producer is already running, no need to arm anything
+	_armed = 1;
+
+	PIXXI_ENTER_CRITICAL();
+	for (uint32_t i = 0; i < size; i++)
+	{
+		_buf[_head & RX_RING_MASK] = data[i];
+		_head = _head + 1;
+	}
+	checkOverrun();
+	PIXXI_EXIT_CRITICAL();
+}
+
+void Pixxi_RxRing4D::RxError(void)
+{
+	Errors++;
+	arm();
+}
+
+/*
+ * The producer never waits for us. If it has lapped the reader, the oldest bytes
+ * have already been overwritten, so skip past them.
+ */
+void Pixxi_RxRing4D::checkOverrun(void)
+{
+	if (_head - _tail > PIXXI_RX_RING_SIZE)
+	{
+		Overruns++;
+		_tail = _head - PIXXI_RX_RING_SIZE;
+	}
+}
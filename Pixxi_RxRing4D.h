@@ -0,0 +1,63 @@
+/**
+ * Receive ring buffer for the Pixxi serial library.
+ *
+ * Reception is armed once and left running (circular DMA with IDLE line events on the MCU),
+ * so bytes arriving between commands are kept instead of lost. The ACK and response
+ * parsers take their bytes out of this ring rather than calling HAL_UART_Receive.
+ */
+#ifndef Pixxi_RxRing4D_h
+#define Pixxi_RxRing4D_h
+
+#include "Pixxi_Transport4D.h"
+
+/*
+ * Size of the receive ring in bytes, must be a power of two.
+ * Responses are small apart from sectors and strings, which are read out as they arrive.
+ */
+#ifndef PIXXI_RX_RING_SIZE
+#define PIXXI_RX_RING_SIZE 256
+#endif
+
+#if (PIXXI_RX_RING_SIZE & (PIXXI_RX_RING_SIZE - 1)) != 0
+#error "PIXXI_RX_RING_SIZE must be a power of two"
+#endif
+
+class Pixxi_RxRing4D
+{
+	public:
+		Pixxi_RxRing4D();
+		void attach(PIXXI_TRANSPORT * port);
+		//Start (or restart) reception. Called automatically on first read if needed.
+		bool arm(void);
+
+		//Number of unread bytes
+		uint32_t available(void);
+		//Copy out up to size bytes without waiting, returns the number copied
+		uint32_t readAvailable(uint8_t * dest, uint32_t size);
+		//Copy out size bytes, waiting up to timeout ms. Returns the number copied.
+		uint32_t read(uint8_t * dest, uint32_t size, uint32_t timeout);
+		//Look at an unread byte without taking it, -1 if not there yet
+		int peek(uint32_t offset);
+		//Throw away everything received so far
+		void clear(void);
+
+		//Called by the transport, usually from an interrupt
+		void RxEvent(uint16_t position);			// hardware has written up to position in the buffer
+		void RxPush(const uint8_t * data, uint32_t size);	// software producer
+		void RxError(void);							// reception stopped, restart it
+
+		//Statistics
+		uint32_t Overruns;		// times unread data was overwritten
+		uint32_t Errors;		// times reception had to be restarted
+
+	private:
+		void checkOverrun(void);
+
+		PIXXI_TRANSPORT * _port;
+		uint8_t _buf[PIXXI_RX_RING_SIZE];
+		volatile uint32_t _head;	// free running count of bytes received
+		volatile uint32_t _tail;	// free running count of bytes consumed
+		volatile uint8_t _armed;
+};
+
+#endif
@@ -0,0 +1,300 @@
+/**
+ * Sector cache for raw media access with the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_Sector4D.h"
+
+Pixxi_SectorCache4D::Pixxi_SectorCache4D(Pixxi_Serial_4DLib * display, uint8_t * memory, uint16_t sectors) {
+	_display = display;
+	_memory = memory;
+	_count = sectors < PIXXI_SECTOR_SLOTS ? sectors : PIXXI_SECTOR_SLOTS;
+	_clock = 0;
+	_at = PIXXI_NO_SECTOR;
+	_lastRead = PIXXI_NO_SECTOR;
+
+	for (uint16_t i = 0; i < PIXXI_SECTOR_SLOTS; i++)
+	{
+		_slots[i].Sector = PIXXI_NO_SECTOR;
+		_slots[i].Used = 0;
+		_slots[i].Dirty = false;
+	}
+
+	ReadAhead = PIXXI_SECTOR_READ_AHEAD;
+	Error = Err4D_OK;
+	Hits = 0;
+	Misses = 0;
+	Seeks = 0;
+	SeeksSaved = 0;
+	SectorsRead = 0;
+	SectorsWritten = 0;
+	WriteBacks = 0;
+}
+
+uint8_t * Pixxi_SectorCache4D::data(uint16_t slot)
+{
+	return _memory + 512 * (uint32_t) slot;
+}
+
+int16_t Pixxi_SectorCache4D::find(uint32_t sector)
+{
+	for (uint16_t i = 0; i < _count; i++)
+	{
+		if (_slots[i].Sector == sector)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Point the display at Sector, unless it is there already.
+ */
+void Pixxi_SectorCache4D::seek(uint32_t sector)
+{
+	if (_at == sector)
+	{
+		SeeksSaved++;
+		return;
+	}
+
+	_display->media_SetSectorAsync(sector >> 16, sector & 0xFFFF, NULL);
+	Seeks++;
+	_at = sector;
+}
+
+/*
+ * Wait for a slot's sector to come in. False, and the slot emptied, if it could not be read.
+ */
+bool Pixxi_SectorCache4D::settle(uint16_t slot)
+{
+	Pixxi_CacheSlot4D * s = &_slots[slot];
+
+	if (s->Read.State == PIXXI_FUTURE_IDLE)
+		return s->Sector != PIXXI_NO_SECTOR;
+	if (s->Read.State == PIXXI_FUTURE_PENDING)
+		_display->wait(&s->Read);
+
+	bool ok = s->Read.State == PIXXI_FUTURE_DONE && s->Read.Result != 0;
+	if (!ok)
+	{
+		if (Error == Err4D_OK)
+			Error = s->Read.State == PIXXI_FUTURE_DONE ? Err4D_Invalid : s->Read.Error;
+		s->Sector = PIXXI_NO_SECTOR;
+		//Whatever happened, we no longer know where the display is
+		_at = PIXXI_NO_SECTOR;
+	}
+	s->Read.State = PIXXI_FUTURE_IDLE;
+	return ok;
+}
+
+/*
+ * Wait for a slot's last write back to be done with. False if it failed.
+ */
+bool Pixxi_SectorCache4D::written(uint16_t slot)
+{
+	Pixxi_CacheSlot4D * s = &_slots[slot];
+
+	if (s->Write.State == PIXXI_FUTURE_IDLE)
+		return true;
+	if (s->Write.State == PIXXI_FUTURE_PENDING)
+		_display->wait(&s->Write);
+
+	bool ok = s->Write.State == PIXXI_FUTURE_DONE && s->Write.Result != 0;
+	if (!ok)
+	{
+		if (Error == Err4D_OK)
+			Error = s->Write.State == PIXXI_FUTURE_DONE ? Err4D_Invalid : s->Write.Error;
+		_at = PIXXI_NO_SECTOR;
+	}
+	s->Write.State = PIXXI_FUTURE_IDLE;
+	return ok;
+}
+
+void Pixxi_SectorCache4D::writeBack(uint16_t slot)
+{
+	Pixxi_CacheSlot4D * s = &_slots[slot];
+
+	//Its future is about to be used again
+	written(slot);
+
+	seek(s->Sector);
+	_display->media_WrSectorAsync(data(slot), &s->Write);
+	SectorsWritten++;
+	_at++;
+	s->Dirty = false;
+}
+
+/*
+ * Least recently used slot, emptied and ready for another sector.
+ */
+uint16_t Pixxi_SectorCache4D::victim(void)
+{
+	uint16_t best = 0;
+
+	for (uint16_t i = 0; i < _count; i++)
+	{
+		if (_slots[i].Sector == PIXXI_NO_SECTOR)
+		{
+			best = i;
+			break;
+		}
+		if (_slots[i].Used < _slots[best].Used)
+			best = i;
+	}
+
+	Pixxi_CacheSlot4D * s = &_slots[best];
+	if (s->Read.State != PIXXI_FUTURE_IDLE)
+		settle(best);
+	if (s->Sector != PIXXI_NO_SECTOR && s->Dirty)
+	{
+		writeBack(best);
+		WriteBacks++;
+	}
+
+	s->Sector = PIXXI_NO_SECTOR;
+	s->Dirty = false;
+	s->Used = ++_clock;
+	return best;
+}
+
+/*
+ * Ask for up to Count sectors from Sector on, stopping at one which is already held, as one
+ * burst behind a single seek. Returns the number asked for.
+ */
+uint16_t Pixxi_SectorCache4D::fetch(uint32_t sector, uint16_t count)
+{
+	uint16_t slots[PIXXI_SECTOR_SLOTS];
+	uint16_t n = 0;
+
+	if (count > _count)
+		count = _count;
+
+	//Make room first, as writing back moves the display's sector address
+	while (n < count && (n == 0 || find(sector + n) < 0))
+	{
+		slots[n] = victim();
+		_slots[slots[n]].Sector = sector + n;
+		n++;
+	}
+
+	seek(sector);
+	for (uint16_t i = 0; i < n; i++)
+	{
+		_display->media_RdSectorAsync(data(slots[i]), &_slots[slots[i]].Read);
+		SectorsRead++;
+		_at++;
+	}
+	return n;
+}
+
+bool Pixxi_SectorCache4D::read(uint32_t sector, uint8_t * dest, uint16_t count)
+{
+	bool sequential = _lastRead != PIXXI_NO_SECTOR && sector == _lastRead + 1;
+	uint16_t missed = 0;		// sectors ahead which this call fetched
+	bool ok = true;
+
+	//Take in whatever read-ahead has arrived since the last call
+	_display->service();
+
+	for (uint16_t i = 0; i < count; i++)
+	{
+		int16_t slot = find(sector + i);
+		if (slot < 0)
+		{
+			uint16_t got = fetch(sector + i, count - i + (sequential ? ReadAhead : 0));
+			missed = got < count - i ? got : count - i;
+			slot = find(sector + i);
+		}
+
+		if (missed > 0)
+		{
+			Misses++;
+			missed--;
+		}
+		else
+			Hits++;
+
+		if (settle(slot))
+		{
+			memcpy(dest + 512 * (uint32_t) i, data(slot), 512);
+			_slots[slot].Used = ++_clock;
+		}
+		else
+		{
+			memset(dest + 512 * (uint32_t) i, 0, 512);
+			ok = false;
+		}
+	}
+
+	_lastRead = sector + count - 1;
+	return ok;
+}
+
+bool Pixxi_SectorCache4D::write(uint32_t sector, const uint8_t * source, uint16_t count)
+{
+	for (uint16_t i = 0; i < count; i++)
+	{
+		int16_t slot = find(sector + i);
+		if (slot < 0)
+		{
+			slot = victim();
+			_slots[slot].Sector = sector + i;
+		}
+		//A read still on its way in would land on top
+		else if (_slots[slot].Read.State != PIXXI_FUTURE_IDLE)
+			settle(slot);
+
+		memcpy(data(slot), source + 512 * (uint32_t) i, 512);
+		_slots[slot].Sector = sector + i;
+		_slots[slot].Dirty = true;
+		_slots[slot].Used = ++_clock;
+	}
+	return true;
+}
+
+bool Pixxi_SectorCache4D::flush(void)
+{
+	uint16_t order[PIXXI_SECTOR_SLOTS];
+	uint16_t n = 0;
+
+	//Changed sectors in ascending order, so neighbours go out without seeks in between
+	for (uint16_t i = 0; i < _count; i++)
+	{
+		if (_slots[i].Sector == PIXXI_NO_SECTOR || !_slots[i].Dirty)
+			continue;
+
+		uint16_t j = n++;
+		while (j > 0 && _slots[order[j - 1]].Sector > _slots[i].Sector)
+		{
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = i;
+	}
+
+	for (uint16_t i = 0; i < n; i++)
+		writeBack(order[i]);
+	for (uint16_t i = 0; i < _count; i++)
+		written(i);
+
+	return Error == Err4D_OK;
+}
+
+bool Pixxi_SectorCache4D::invalidate(void)
+{
+	bool ok = flush();
+
+	for (uint16_t i = 0; i < _count; i++)
+	{
+		settle(i);
+		_slots[i].Sector = PIXXI_NO_SECTOR;
+		_slots[i].Dirty = false;
+	}
+	_lastRead = PIXXI_NO_SECTOR;
+	return ok;
+}
+
+void Pixxi_SectorCache4D::resync(void)
+{
+	_at = PIXXI_NO_SECTOR;
+}
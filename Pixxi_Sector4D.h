@@ -0,0 +1,104 @@
+/**
+ * Sector cache for raw media access with the Pixxi serial library.
+ *
+ * media_RdSector and media_WrSector move one sector per command, and reaching any other sector
+ * than the next one takes a media_SetSector first. Pixxi_SectorCache4D keeps the most recently
+ * used sectors in memory of the caller's, writes changed ones back only when they are pushed out
+ * or on flush(), and turns runs of consecutive sectors into one media_SetSector followed by a
+ * burst of pipelined reads or writes:
+ *
+ *	uint8_t sectors[8 * 512];
+ *	Pixxi_SectorCache4D Disk(&Display, sectors, 8);
+ *	Display.media_Init();
+ *	Disk.read(lba, header);
+ *	Disk.write(logSector, record);
+ *	Disk.flush();						// before power down or swapping cards
+ *
+ * The display moves its sector address on by one after every sector read or written, and the
+ * cache keeps track of where it is, so media_SetSector is only sent when the next sector is not
+ * the one the display is pointing at anyway. After calling media_ routines directly, call
+ * resync() so it is sent again. When reads go from one sector to the next, ReadAhead sectors are
+ * fetched in the same burst.
+ *
+ * A sector comes back as 515 bytes, twice what the default receive ring holds, and with read-ahead
+ * or write-backs several are on their way while the caller gets on with something else. Build
+ * with PIXXI_RX_RING_SIZE of 1024 or more, and call Display.service() in any long gap between
+ * calls, or sectors are lost to Overruns and their reads time out.
+ *
+ * Hits and Misses count the sectors asked for; Seeks, SectorsRead and SectorsWritten count
+ * the commands sent, so their sum is the number of round trips the media took.
+ */
+#ifndef Pixxi_Sector4D_h
+#define Pixxi_Sector4D_h
+
+#include "Pixxi_Serial_4Dlib.h"
+
+//Most sectors a cache holds
+#ifndef PIXXI_SECTOR_SLOTS
+#define PIXXI_SECTOR_SLOTS 16
+#endif
+
+//ReadAhead to start with
+#ifndef PIXXI_SECTOR_READ_AHEAD
+#define PIXXI_SECTOR_READ_AHEAD 4
+#endif
+
+#define PIXXI_NO_SECTOR 0xFFFFFFFF
+
+typedef struct {
+	uint32_t Sector;			// PIXXI_NO_SECTOR if empty
+	uint32_t Used;				// when it was last used, for LRU
+	bool Dirty;					// changed since it was read or written
+	Pixxi_Future4D Read;		// pending while it is on its way in
+	Pixxi_Future4D Write;		// pending until the display has written it
+} Pixxi_CacheSlot4D;
+
+class Pixxi_SectorCache4D
+{
+	public:
+		//Memory holds Sectors * 512 bytes, at most PIXXI_SECTOR_SLOTS of them are used
+		Pixxi_SectorCache4D(Pixxi_Serial_4DLib * display, uint8_t * memory, uint16_t sectors);
+
+		//Count whole sectors from Sector on. False if any could not be read.
+		bool read(uint32_t sector, uint8_t * data, uint16_t count = 1);
+		//Only goes into the cache; written to the media when pushed out or on flush()
+		bool write(uint32_t sector, const uint8_t * data, uint16_t count = 1);
+		//Write back every changed sector, in order, and wait for them. False if any failed.
+		bool flush(void);
+		//Flush, then forget everything held
+		bool invalidate(void);
+		//The display's sector address is no longer known, media_ routines were called directly
+		void resync(void);
+
+		uint8_t ReadAhead;		// extra sectors fetched when reads are sequential, 0 for none
+		int Error;				// Err4D_ code of the first failure, Err4D_Invalid if the display reported one
+
+		//Statistics
+		uint32_t Hits;
+		uint32_t Misses;
+		uint32_t Seeks;				// media_SetSectors sent
+		uint32_t SeeksSaved;		// ones left out as the display already pointed there
+		uint32_t SectorsRead;		// media_RdSectors sent
+		uint32_t SectorsWritten;	// media_WrSectors sent
+		uint32_t WriteBacks;		// changed sectors pushed out to make room
+
+	private:
+		int16_t find(uint32_t sector);
+		uint16_t victim(void);
+		uint16_t fetch(uint32_t sector, uint16_t count);
+		bool settle(uint16_t slot);
+		void seek(uint32_t sector);
+		void writeBack(uint16_t slot);
+		bool written(uint16_t slot);
+		uint8_t * data(uint16_t slot);
+
+		Pixxi_Serial_4DLib * _display;
+		uint8_t * _memory;
+		Pixxi_CacheSlot4D _slots[PIXXI_SECTOR_SLOTS];
+		uint16_t _count;
+		uint32_t _clock;			// stamps for Used
+		uint32_t _at;				// sector the display points at, PIXXI_NO_SECTOR if not known
+		uint32_t _lastRead;			// last sector asked for by read(), to spot sequential reads
+};
+
+#endif
@@ -13,13 +13,102 @@
  * TODO: Include license.
  */
 
-#include "stm32l4xx_hal.h"
 #include <Pixxi_Serial_4Dlib.h>
+#include <Pixxi_Heap4D.h>
 
-Pixxi_Serial_4DLib::Pixxi_Serial_4DLib(UART_HandleTypeDef * port) {
-	_huart = port;
-	//Flush the buffer
-	HAL_UART_AbortReceive(_huart);
+/*
+ * Render state shadowed by the setters, one bit of _stateKnown each.
+ */
+#define STATE_TXT_FGCOLOUR			0
+#define STATE_TXT_BGCOLOUR			1
+#define STATE_TXT_FONTID			2
+#define STATE_TXT_WIDTH				3
+#define STATE_TXT_HEIGHT			4
+#define STATE_TXT_XGAP				5
+#define STATE_TXT_YGAP				6
+#define STATE_TXT_OPACITY			7
+#define STATE_TXT_WRAP				8
+#define STATE_TXT_BOLD				9
+#define STATE_TXT_ITALIC			10
+#define STATE_TXT_INVERSE			11
+#define STATE_TXT_UNDERLINE			12
+#define STATE_TXT_ATTRIBUTES		13
+#define STATE_GFX_BGCOLOUR			14
+#define STATE_GFX_OUTLINECOLOUR		15
+#define STATE_GFX_LINEPATTERN		16
+#define STATE_GFX_TRANSPARENCY		17
+#define STATE_GFX_TRANSPARENTCOLOUR	18
+#define STATE_GFX_BEVELSHADOW		19
+#define STATE_GFX_BEVELWIDTH		20
+#define STATE_GFX_CONTRAST			21
+#define STATE_GFX_CLIPPING			22
+
+//txt_Attributes sets the same bits as the individual bold/italic/inverse/underline calls
+#define STATE_TXT_ATTRIBUTE_BITS	((1UL << STATE_TXT_BOLD) | (1UL << STATE_TXT_ITALIC) | (1UL << STATE_TXT_INVERSE) | \
+									(1UL << STATE_TXT_UNDERLINE) | (1UL << STATE_TXT_ATTRIBUTES))
+
+//Most decimals print() and printFixed() will show, 10^9 still fits in 32 bits
+#define TEXT_MAX_DIGITS				9
+//Room for any number print() formats: a long in binary, or a float with all its decimals
+#define TEXT_NUMBER_SIZE			(8 * sizeof(long) + 2)
+
+#ifndef PIXXI_HOST
+Pixxi_Serial_4DLib::Pixxi_Serial_4DLib(UART_HandleTypeDef * port) : _halPort(port) {
+	_port = &_halPort;
+	init();
+}
+#endif
+
+/*
+ * Use any transport, e.g. one of the host transports for testing on a PC.
+ */
+Pixxi_Serial_4DLib::Pixxi_Serial_4DLib(PIXXI_TRANSPORT * transport)
+#ifndef PIXXI_HOST
+	: _halPort(NULL)
+#endif
+{
+	_port = transport;
+	init();
+}
+
+void Pixxi_Serial_4DLib::init(void) {
+	Callback4D = NULL;
+	CallbackCmd4D = NULL;
+	Error4D = Err4D_OK;
+	Error4D_Inv = 0;
+	Error4D_Cmd = 0;
+	Errors4D = 0;
+	PipelineErrors = 0;
+
+	_replyCmd = 0;
+	_cmdMs = 0;
+	_cmdBytes = 0;
+	PIXXI_STAT(_cmdStart = 0);
+	_pipeDepth = 0;
+	_replyStart = 0;
+	_pipeHead = 0;
+	_pipeTail = 0;
+	_pipeCount = 0;
+	_list = NULL;
+	_draining = false;
+
+	_stateOn = true;
+	_stateKnown = 0;
+	StateSkipped = 0;
+	StateSent = 0;
+	_heap = NULL;
+
+	_tx.attach(_port);
+	_rx.attach(_port);
+}
+
+/*
+ * Start the background receiver. Call once the UART has been initialised.
+ * (The first read will do it anyway, but replies to anything sent before then could be missed.)
+ */
+void Pixxi_Serial_4DLib::begin(void) {
+	Timing.Baud = _port->baud();
+	_rx.arm();
 }
 
 /**
@@ -28,12 +117,79 @@ Pixxi_Serial_4DLib::Pixxi_Serial_4DLib(UART_HandleTypeDef * port) {
 
 /*
  * Generic method to write a (uint16_t) command to the display.
+ * The data is queued in the transmit ring and sent by DMA in the background.
  */
 void Pixxi_Serial_4DLib::WriteInt(uint16_t data) {
 	//Separate the upper and lower bytes
 	uint8_t thisData[] = {(uint8_t) (data >> 8), (uint8_t) (data & 0xFF)};
-    //Write the data
-	HAL_UART_Transmit(_huart, thisData, 2, 10);
+    //Queue the data
+	Emit(thisData, 2);
+}
+
+/*
+ * Start a new command.
+ * This is where we wait for room in the window of outstanding replies.
+ */
+void Pixxi_Serial_4DLib::WriteCmd(uint16_t cmd) {
+	if (_list != NULL)
+	{
+		_list->startCommand();
+		_replyCmd = cmd;
+		WriteInt(cmd);
+		return;
+	}
+
+	while (!Drained())
+		_port->waitRx();
+	if (_pipeCount >= (_pipeDepth > 0 ? _pipeDepth : PIXXI_PIPELINE_MAX))
+		CollectAck();
+
+	PIXXI_STAT(_cmdStart = Pixxi_Stats4D::now());
+	_cmdMs = _port->millis();
+	_cmdBytes = _tx.pending();
+
+	_replyCmd = cmd;
+	WriteInt(cmd);
+}
+
+/*
+ * Everything written ends up here, and goes to the display unless a list is being recorded.
+ */
+void Pixxi_Serial_4DLib::Emit(const uint8_t * data, uint32_t size) {
+	if (_list != NULL)
+	{
+		_list->append(data, size);
+		return;
+	}
+
+	PIXXI_STAT(uint32_t start = Pixxi_Stats4D::now());
+	_cmdBytes += size;
+	_tx.write(data, size);
+	PIXXI_STAT(Stats.tx(_replyCmd, size, Pixxi_Stats4D::now() - start));
+}
+
+/*
+ * As Emit, but sent straight from the caller's buffer once everything before it has gone.
+ * The buffer must be left alone until _tx.pending() says it has been sent.
+ */
+void Pixxi_Serial_4DLib::EmitDirect(const uint8_t * data, uint32_t size) {
+	if (_list != NULL)
+	{
+		_list->append(data, size);
+		return;
+	}
+
+	PIXXI_STAT(uint32_t start = Pixxi_Stats4D::now());
+	_cmdBytes += size;
+	_tx.writeDirect(data, size);
+	PIXXI_STAT(Stats.tx(_replyCmd, size, Pixxi_Stats4D::now() - start));
+}
+
+/*
+ * Wait until everything queued so far has been sent.
+ */
+void Pixxi_Serial_4DLib::TxFlush(void) {
+	_tx.flush();
 }
 
 //*********************************************************************************************//
@@ -44,245 +200,863 @@ void Pixxi_Serial_4DLib::WriteChars(char * charsout)
 {
 	//Count how many bytes to write
 	int numBytes = 0;
-	while(*charsout++) {
+	while(charsout[numBytes]) {
 		numBytes++;
 		//Protect against overrun somewhat
 		if(numBytes > 1000)
 			break;
 	}
 
-	HAL_UART_Transmit(_huart, (uint8_t *) charsout, numBytes, 10) ;
+	//The display expects the null terminator as well
+	uint8_t terminator = 0;
+	Emit((uint8_t *) charsout, numBytes);
+	Emit(&terminator, 1);
 }
 
-void Pixxi_Serial_4DLib::WriteBytes(uint8_t * source, int size)
+void Pixxi_Serial_4DLib::WriteBytes(uint8_t * source, uint32_t size)
 {
-	HAL_UART_Transmit(_huart, source, size, 10);
+	Emit(source, size);
 }
 
 void Pixxi_Serial_4DLib::WriteWords(uint16_t * Source, int Size)
 {
-  uint16_t wk ;
-  for (int i = 0; i < Size; i++)
-  {
-    wk = *Source++ ;
-	//Separate the upper and lower bytes
-	uint8_t thisData[] = {(uint8_t) (wk >> 8), (uint8_t) (wk & 0xFF)};
-    HAL_UART_Transmit(_huart, (uint8_t *) thisData, 2, 10) ;
-  }
+	uint8_t staging[PIXXI_PACK_CHUNK];
+
+	//Swap a chunk at a time into big-endian and queue each one in a single write
+	while (Size > 0)
+	{
+		int words = Size < PIXXI_PACK_CHUNK / 2 ? Size : PIXXI_PACK_CHUNK / 2;
+		Pixxi_PackWords4D(staging, Source, words);
+		Emit(staging, 2 * words);
+		Source += words;
+		Size -= words;
+	}
+}
+
+/*
+ * Take the next Size bytes of a response out of the receive ring, waiting up to the
+ * command's time limit. Returns false and flags a timeout if they did not all arrive.
+ */
+bool Pixxi_Serial_4DLib::ReadBytes(uint8_t * data, int size)
+{
+	//Nothing is sent while recording, and a list cannot hold a reply of this shape
+	if (_list != NULL)
+	{
+		_list->reject();
+		memset(data, 0, size);
+		return false;
+	}
+
+	uint32_t got = _rx.read(data, size, ReplyLimit(size));
+	PIXXI_STAT(Stats.rx(_replyCmd, got));
+	if (got == (uint32_t) size)
+		return true;
+
+	//Drop the rest of this response so it cannot be mistaken for the next one
+	Resync();
+
+	Error4D = Err4D_Timeout;
+	ReportError();
+	return false;
 }
 
-void Pixxi_Serial_4DLib::getbytes(uint8_t * data, int size)
+/*
+ * When the current command's reply could start arriving: when it was started, or once the
+ * replies queued ahead of it were in.
+ */
+uint32_t Pixxi_Serial_4DLib::ReplyFrom(void)
 {
-	int response = HAL_UART_Receive(_huart, data, size, TimeLimit4D);
+	return (int32_t) (_replyStart - _cmdMs) > 0 ? _replyStart : _cmdMs;
+}
+
+/*
+ * Time left for the current command's reply, once Size more bytes of it are counted.
+ */
+uint32_t Pixxi_Serial_4DLib::ReplyLimit(uint32_t size)
+{
+	_cmdBytes += size;
+	if (!Timing.Enabled)
+		return TimeLimit4D;
+
+	uint32_t limit = Timing.limit(_replyCmd, _cmdBytes, TimeLimit4D);
+	uint32_t spent = _port->millis() - ReplyFrom();
+	return spent < limit ? limit - spent : 0;
+}
 
-	if (response != HAL_OK)
+/*
+ * After a timeout, throw away whatever is in the receive ring and whatever still arrives
+ * until the line has been quiet for PIXXI_TIMING_QUIET_MS. The display says nothing while
+ * it is still busy with the command, so the late reply can come well after the limit.
+ */
+void Pixxi_Serial_4DLib::Resync(void)
+{
+	_rx.clear();
+	_draining = true;
+	_drainStart = _port->millis();
+	_drainFrom = _drainStart;
+}
+
+/*
+ * True once the line has gone quiet after a timeout. Never waits. A line which never goes
+ * quiet is given up on after TimeLimit4D.
+ */
+bool Pixxi_Serial_4DLib::Drained(void)
+{
+	if (!_draining)
+		return true;
+
+	_port->poll();
+	uint32_t now = _port->millis();
+	if (_rx.available() > 0)
 	{
-		Error4D = Err4D_Timeout;
-		if (Callback4D != NULL)
-			Callback4D(Error4D, Error4D_Inv) ;
+		_rx.clear();
+		_drainFrom = now;
 	}
+	if (now - _drainFrom < PIXXI_TIMING_QUIET_MS && now - _drainStart < TimeLimit4D)
+		return false;
+
+	_draining = false;
+	return true;
 }
 
-void Pixxi_Serial_4DLib::GetAck(void)
+/*
+ * The current command's reply is all in, or has failed. Feeds the statistics and the timeout model.
+ */
+void Pixxi_Serial_4DLib::CommandDone(void)
 {
-	uint8_t readx = 0;
-	Error4D = Err4D_OK;
+	PIXXI_STAT(Stats.done(_replyCmd, _cmdStart, Error4D));
+	if (Error4D == Err4D_OK)
+		Timing.learn(_replyCmd, _port->millis() - ReplyFrom(), _cmdBytes);
+}
 
-	int response = HAL_UART_Receive(_huart, &readx, 1, TimeLimit4D);
+void Pixxi_Serial_4DLib::ReportError(void)
+{
+	//Whatever failed may or may not have changed something
+	invalidateState();
+
+	Error4D_Cmd = _replyCmd;
+	Errors4D++;
+	if (CallbackCmd4D != NULL)
+		CallbackCmd4D(Error4D, Error4D_Inv, Error4D_Cmd);
+	if (Callback4D != NULL)
+		Callback4D(Error4D, Error4D_Inv);
+}
 
-	if (response != HAL_OK)
+/*
+ * Let routines which only return an ACK carry on without waiting for it.
+ * Up to Depth commands can then be outstanding; any of them failing is reported through
+ * CallbackCmd4D / Callback4D with Error4D_Cmd set to its opcode. Anything returning a value
+ * collects all outstanding ACKs first. 0 (the default) waits for every ACK as before.
+ */
+void Pixxi_Serial_4DLib::setPipelineDepth(uint8_t depth)
+{
+	CollectAcks();
+	if (depth > PIXXI_PIPELINE_MAX)
+		depth = PIXXI_PIPELINE_MAX;
+	_pipeDepth = depth;
+}
+
+uint8_t Pixxi_Serial_4DLib::pipelineDepth(void)
+{
+	return _pipeDepth;
+}
+
+/*
+ * Wait for every outstanding reply. Returns the number of them which failed.
+ */
+uint16_t Pixxi_Serial_4DLib::CollectAcks(void)
+{
+	uint16_t failed = 0;
+	while (_pipeCount > 0)
 	{
-		//Flush the buffer
-		HAL_UART_AbortReceive(_huart);
+		CollectAck();
+		if (Error4D != Err4D_OK)
+			failed++;
+	}
+	return failed;
+}
+
+/*
+ * Wait for the oldest outstanding reply.
+ */
+void Pixxi_Serial_4DLib::CollectAck(void)
+{
+	uint16_t current = _replyCmd;
+
+	while (_pipeCount > 0 && !ServiceReply())
+		_port->waitRx();
 
-		Error4D = Err4D_Timeout;
-		if (Callback4D != NULL)
-			Callback4D(Error4D, Error4D_Inv);
+	_replyCmd = current;
+}
+
+/*
+ * Take in whatever replies have already arrived, without waiting.
+ * Call this from the main loop while async calls are outstanding.
+ */
+void Pixxi_Serial_4DLib::service(void)
+{
+	uint16_t current = _replyCmd;
+
+	Drained();
+	while (_pipeCount > 0 && ServiceReply())
+		;
+
+	_replyCmd = current;
+}
+
+/*
+ * Wait for an async call to finish. Returns true if it succeeded.
+ */
+bool Pixxi_Serial_4DLib::wait(Pixxi_Future4D * result)
+{
+	while (result->State == PIXXI_FUTURE_PENDING && _pipeCount > 0)
+		CollectAck();
+
+	return result->State == PIXXI_FUTURE_DONE;
+}
+
+/*
+ * Number of replies still owed by the display.
+ */
+uint8_t Pixxi_Serial_4DLib::pending(void)
+{
+	return _pipeCount;
+}
+
+bool Pixxi_Serial_4DLib::ready(uint32_t bytes)
+{
+	//Without pipelining every command waits for its ACK, so only an idle display is ready
+	uint8_t depth = _pipeDepth > 0 ? _pipeDepth : 1;
+
+	_port->poll();
+	service();
+	return _pipeCount < depth && _tx.pending() + bytes <= PIXXI_TX_RING_SIZE;
+}
+
+uint32_t Pixxi_Serial_4DLib::txBytes(void)
+{
+	return _tx.BytesQueued;
+}
+
+uint32_t Pixxi_Serial_4DLib::millis(void)
+{
+	return _port->millis();
+}
+
+/*
+ * Record everything written from here until endList() into List instead of sending it.
+ */
+void Pixxi_Serial_4DLib::beginList(Pixxi_DisplayList4D * list)
+{
+	list->clear();
+	_list = list;
+}
+
+void Pixxi_Serial_4DLib::endList(void)
+{
+	_list = NULL;
+}
+
+/*
+ * Send a recorded list in one transfer, straight from its buffer.
+ * Returns once it has been sent; in pipelined mode the replies are collected later like
+ * any other ACK, otherwise they are waited for and the number which failed is returned.
+ * The list must not be patched before this returns, nor re-recorded while its replies are outstanding.
+ */
+uint16_t Pixxi_Serial_4DLib::replay(Pixxi_DisplayList4D * list)
+{
+	Error4D = Err4D_OK;
+	if (!list->Valid || _list != NULL)
+	{
+		Error4D = Err4D_Invalid;
+		ReportError();
+		return 0;
 	}
-	else if (readx != 6)
+	if (list->commands() == 0)
+		return 0;
+
+	while (!Drained())
+		_port->waitRx();
+	if (_pipeCount >= (_pipeDepth > 0 ? _pipeDepth : PIXXI_PIPELINE_MAX))
+		CollectAck();
+
+	//The list is free to set whatever it likes
+	invalidateState();
+
+	_replyCmd = list->opcode(0);
+	PIXXI_STAT(_cmdStart = Pixxi_Stats4D::now());
+	QueueReply(NULL, PIXXI_REPLY_LIST);
+	_replies[(_pipeHead + PIXXI_PIPELINE_MAX - 1) % PIXXI_PIPELINE_MAX].List = list;
+	list->Replays++;
+
+	//Keep taking replies in as they come so a long list cannot overrun the receive ring
+	PIXXI_STAT(uint32_t start = Pixxi_Stats4D::now());
+	_tx.writeDirect(list->Buffer, list->Length);
+	PIXXI_STAT(Stats.tx(_replyCmd, list->Length, Pixxi_Stats4D::now() - start));
+	while (_tx.pending() > 0)
 	{
-		Error4D = Err4D_NAK;
-		Error4D_Inv = readx;
-		if (Callback4D != NULL)
-			Callback4D(Error4D, Error4D_Inv);
+		_port->waitTx();
+		service();
 	}
+
+	if (_pipeDepth > 0)
+		return 0;
+
+	uint32_t failed = PipelineErrors;
+	CollectAcks();
+	return PipelineErrors - failed;
 }
 
-uint16_t Pixxi_Serial_4DLib::GetWord(void)
+/*
+ * Send a command which was encoded elsewhere, typically by another task into a Pixxi_CommandQueue4D.
+ * The reply is collected in the background like the Async calls, and its outcome goes to Result.
+ * Unless it is one of the commands which only draw or move data (StateKept), we cannot tell what
+ * it changes, so the render state shadow is dropped.
+ */
+Pixxi_Future4D * Pixxi_Serial_4DLib::submit(const uint8_t * Command, uint16_t Size, const uint8_t * Payload, uint32_t PayloadSize, uint8_t Reply, Pixxi_Future4D * Result)
 {
-	uint8_t readx[2] = {0, 0};
+	if (Size < 2 || _list != NULL || Reply > PIXXI_REPLY_3WORDS)
+	{
+		if (Result != NULL)
+		{
+			Result->Error = Err4D_Invalid;
+			__atomic_store_n(&Result->State, PIXXI_FUTURE_FAILED, __ATOMIC_RELEASE);
+		}
+		return Result;
+	}
 
-	if (Error4D != Err4D_OK)
-		return 0 ;
+	uint16_t opcode = Command[0] << 8 | Command[1];
 
-	//Receive 2 bytes
-	int response = HAL_UART_Receive(_huart, readx, 2, TimeLimit4D);
+	if (!StateKept(opcode))
+		invalidateState();
+	WriteCmd(opcode);
+	Emit(Command + 2, Size - 2);
+	if (PayloadSize > 0)
+		Emit(Payload, PayloadSize);
+	return QueueReply(Result, Reply);
+}
 
-	if (response != HAL_OK)
+/*
+ * Remember that the command just written owes us a reply of the given shape.
+ * WriteCmd has already made sure there is room.
+ * While recording, the command went into the list instead and its reply only comes when the
+ * list is replayed, so Future fails at once; replies the list cannot hold make it not Valid.
+ */
+Pixxi_Future4D * Pixxi_Serial_4DLib::QueueReply(Pixxi_Future4D * future, uint8_t kind)
+{
+	if (_list != NULL)
 	{
-		//Flush the buffer
-		HAL_UART_AbortReceive(_huart);
+		if (kind == PIXXI_REPLY_ACK || kind == PIXXI_REPLY_WORD)
+			_list->setReply(kind);
+		else
+			_list->reject();
+		if (future != NULL)
+		{
+			future->Cmd = _replyCmd;
+			future->Result = 0;
+			future->Error = Err4D_Invalid;
+			__atomic_store_n(&future->State, PIXXI_FUTURE_FAILED, __ATOMIC_RELEASE);
+		}
+		return future;
+	}
 
-		Error4D  = Err4D_Timeout ;
-		if (Callback4D != NULL)
-			Callback4D(Error4D, Error4D_Inv) ;
-		return 0 ;
+	Reply4D * reply = &_replies[_pipeHead];
+
+	reply->Cmd = _replyCmd;
+	reply->Kind = kind;
+	reply->Stage = 0;
+	reply->Words[0] = 0;
+	reply->Words[1] = 0;
+	reply->Words[2] = 0;
+	reply->Got = 0;
+	reply->Future = future;
+	reply->List = NULL;
+	reply->Bytes = _cmdBytes;
+	PIXXI_STAT(reply->Start = _cmdStart);
+
+	if (future != NULL)
+	{
+		future->Cmd = _replyCmd;
+		future->Result = 0;
+		future->Error = Err4D_OK;
+		future->ErrorInv = 0;
+		__atomic_store_n(&future->State, PIXXI_FUTURE_PENDING, __ATOMIC_RELAXED);
 	}
-	else
-		return readx[0] << 8 | readx[1] ;
+
+	//The timeout for a reply runs from when we start waiting on it, not from when it was sent
+	if (_pipeCount == 0)
+		_replyStart = _port->millis();
+
+	_pipeHead = (_pipeHead + 1) % PIXXI_PIPELINE_MAX;
+	_pipeCount++;
+	return future;
 }
 
-void Pixxi_Serial_4DLib::getString(char * outStr, int strLen)
+/*
+ * Move the oldest outstanding reply along with whatever bytes are in the receive ring.
+ * Never waits. Returns true once it has been completed (or has failed) and removed.
+ */
+bool Pixxi_Serial_4DLib::ServiceReply(void)
 {
-	if (Error4D != Err4D_OK)
+	Reply4D * reply = &_replies[_pipeTail];
+	uint8_t words = reply->Kind == PIXXI_REPLY_3WORDS ? 3 : (reply->Kind == PIXXI_REPLY_ACK ? 0 : 1);
+	uint8_t readx[2];
+
+	_port->poll();
+
+	if (reply->Kind == PIXXI_REPLY_LIST)
+		return ServiceList(reply);
+
+	if (reply->Stage == 0)
 	{
-		outStr[0] = 0 ;
-		return ;
+		if (_rx.available() < 1)
+			return ReplyTimedOut();
+
+		RxTake(reply, readx, 1);
+		if (readx[0] != 6)
+		{
+			//A NAK is all we get, nothing follows it
+			Error4D_Inv = readx[0];
+			FinishReply(Err4D_NAK);
+			return true;
+		}
+		reply->Stage = 1;
 	}
 
-	int response = HAL_UART_Receive(_huart, (uint8_t *) outStr, strLen, TimeLimit4D);
+	while (reply->Stage <= words)
+	{
+		if (_rx.available() < 2)
+			return ReplyTimedOut();
+
+		RxTake(reply, readx, 2);
+		reply->Words[reply->Stage - 1] = readx[0] << 8 | readx[1];
+		reply->Stage++;
+	}
 
-	if (response != HAL_OK)
+	if (reply->Kind == PIXXI_REPLY_DATA || reply->Kind == PIXXI_REPLY_SECTOR)
 	{
-		//Flush the buffer
-		HAL_UART_AbortReceive(_huart);
+		Pixxi_Future4D * future = reply->Future;
+		uint16_t count = reply->Kind == PIXXI_REPLY_SECTOR ? 512 : reply->Words[0];
+
+		while (reply->Got < count)
+		{
+			uint8_t scratch[16];
+			uint16_t wanted = count - reply->Got;
+			uint8_t * dest = scratch;
+
+			//Copy into the caller's buffer while it has room, throw the rest away
+			if (future != NULL && future->Data != NULL && reply->Got < future->Size)
+			{
+				dest = &future->Data[reply->Got];
+				if (wanted > future->Size - reply->Got)
+					wanted = future->Size - reply->Got;
+			}
+			else if (wanted > sizeof(scratch))
+				wanted = sizeof(scratch);
+
+			uint32_t got = RxTake(reply, dest, wanted);
+			if (got == 0)
+				return ReplyTimedOut();
+			reply->Got += got;
+			_replyStart = _port->millis();
+		}
+	}
+
+	FinishReply(Err4D_OK);
+	return true;
+}
+
+/*
+ * As ServiceReply, for the replies to a display list. A NAK is reported against the
+ * command which caused it and the rest of the list carries on.
+ */
+bool Pixxi_Serial_4DLib::ServiceList(Reply4D * reply)
+{
+	Pixxi_DisplayList4D * list = reply->List;
+	uint8_t readx[2];
 
-		Error4D  = Err4D_Timeout ;
-		if (Callback4D != NULL)
-			Callback4D(Error4D, Error4D_Inv) ;
+	while (reply->Words[0] < list->commands())
+	{
+		uint16_t command = reply->Words[0];
+
+		if (reply->Stage == 0)
+		{
+			if (_rx.available() < 1)
+				return ReplyTimedOut();
+
+			RxTake(reply, readx, 1);
+			if (readx[0] != 6)
+			{
+				_replyCmd = list->opcode(command);
+				Error4D = Err4D_NAK;
+				Error4D_Inv = readx[0];
+				PipelineErrors++;
+				reply->Words[1]++;
+				ReportError();
+				PIXXI_STAT(Stats.done(_replyCmd, reply->Start, Err4D_NAK));
+
+				reply->Words[0]++;
+				_replyStart = _port->millis();
+				continue;
+			}
+			reply->Stage = 1;
+		}
+
+		if (list->reply(command) == PIXXI_REPLY_WORD)
+		{
+			if (_rx.available() < 2)
+				return ReplyTimedOut();
+			RxTake(reply, readx, 2);
+		}
+
+		PIXXI_STAT(Stats.done(list->opcode(command), reply->Start, Err4D_OK));
+		reply->Stage = 0;
+		reply->Words[0]++;
+		_replyStart = _port->millis();
 	}
 
-	//Add a terminator
-	//TODO: Not sure if this is required?
-	outStr[strLen - 1] = 0 ;
+	FinishReply(Err4D_OK);
+	//Already reported one by one, just let CollectAcks count it
+	if (reply->Words[1] > 0)
+		Error4D = Err4D_NAK;
+	return true;
 }
 
-int Pixxi_Serial_4DLib::GetAckResp(void)
+/*
+ * The oldest reply is incomplete. Returns false if it still has time left, otherwise fails it.
+ */
+bool Pixxi_Serial_4DLib::ReplyTimedOut(void)
 {
-	uint8_t readx[3] = {0, 0, 0};
-	Error4D = Err4D_OK;
+	Reply4D * reply = &_replies[_pipeTail];
+	uint32_t limit = TimeLimit4D;
 
-	int response = HAL_UART_Receive(_huart, readx, 3, TimeLimit4D);
+	if (reply->Kind != PIXXI_REPLY_LIST)
+		limit = Timing.limit(reply->Cmd, reply->Bytes, TimeLimit4D);
+	if (_port->millis() - _replyStart < limit)
+		return false;
 
-	if (response != HAL_OK)
-	{
-		//Flush the buffer
-		HAL_UART_AbortReceive(_huart);
+	//After a timeout we no longer know which reply is which, fail them all
+	Resync();
+	while (_pipeCount > 0)
+		FinishReply(Err4D_Timeout);
+	return true;
+}
+
+/*
+ * Take up to Size bytes of a queued reply out of the receive ring, without waiting.
+ */
+uint32_t Pixxi_Serial_4DLib::RxTake(Reply4D * reply, uint8_t * dest, uint32_t size)
+{
+	uint32_t got = _rx.readAvailable(dest, size);
+	PIXXI_STAT(Stats.rx(reply->Cmd, got));
+	return got;
+}
+
+/*
+ * Hand the oldest outstanding reply to its owner and remove it.
+ */
+void Pixxi_Serial_4DLib::FinishReply(int error)
+{
+	Reply4D * reply = &_replies[_pipeTail];
+	Pixxi_Future4D * future = reply->Future;
+
+	_pipeTail = (_pipeTail + 1) % PIXXI_PIPELINE_MAX;
+	_pipeCount--;
+	_replyStart = _port->millis();
 
-		Error4D = Err4D_Timeout;
-		if (Callback4D != NULL)
-			Callback4D(Error4D, Error4D_Inv);
+	_replyCmd = reply->Cmd;
+	Error4D = error;
+	PIXXI_STAT(if (reply->Kind != PIXXI_REPLY_LIST) Stats.done(reply->Cmd, reply->Start, error));
+	if (error != Err4D_OK)
+	{
+		PipelineErrors++;
+		ReportError();
 	}
-	else if (readx[0] != 6)
+
+	if (future != NULL)
 	{
-		Error4D = Err4D_NAK;
-		Error4D_Inv = readx[0];
-		if (Callback4D != NULL)
-			Callback4D(Error4D, Error4D_Inv);
+		future->Result = reply->Words[0];
+		future->Word1 = reply->Words[1];
+		future->Word2 = reply->Words[2];
+		future->Error = error;
+		future->ErrorInv = error == Err4D_NAK ? Error4D_Inv : 0;
+		//Last of the fields, for a task polling ready()
+		__atomic_store_n(&future->State, error == Err4D_OK ? PIXXI_FUTURE_DONE : PIXXI_FUTURE_FAILED, __ATOMIC_RELEASE);
+
+		//Last, as the owner may well queue its next call from here
+		if (future->Notify != NULL)
+			future->Notify(future->NotifyContext, future);
 	}
+}
 
-	return ((readx[1] << 8) | (readx[2] & 0xFF));
+/*
+ * Skip txt_ and gfx_ setters whose value is already current on the display, saving the round trip.
+ * The library keeps track of everything set through it; call invalidateState() after resetting
+ * the display or changing its state by any other route. On by default.
+ */
+void Pixxi_Serial_4DLib::setStateCache(bool on)
+{
+	_stateOn = on;
+	invalidateState();
+}
+
+void Pixxi_Serial_4DLib::invalidateState(void)
+{
+	_stateKnown = 0;
 }
 
 /*
- * TODO: These next five GET functions probably won't work and I have not tested them yet.
- * Suggest using the native HAL_Receive function with the specified number of bytes.
+ * True if Slot is known to hold Value already, in which case the setter has nothing to send.
  */
-uint16_t Pixxi_Serial_4DLib::GetAckRes2Words(uint16_t * word1, uint16_t * word2)
+bool Pixxi_Serial_4DLib::StateIs(uint8_t slot, uint16_t value)
 {
+	//A list being recorded has to contain every call
+	if (!_stateOn || _list != NULL)
+		return false;
+
+	if (!(_stateKnown & (1UL << slot)) || _stateValue[slot] != value)
+		return false;
 
-	uint8_t readx[7] = {0, 0, 0, 0, 0, 0, 0};
 	Error4D = Err4D_OK;
+	StateSkipped++;
+	return true;
+}
 
-	int response = HAL_UART_Receive(_huart, readx, 7, TimeLimit4D);
+/*
+ * Commands which leave every setter as it was, so submit() need not forget them. Video frames
+ * come this way at 25 or more a second.
+ */
+bool Pixxi_Serial_4DLib::StateKept(uint16_t opcode)
+{
+	switch (opcode)
+	{
+		case F_blitComtoDisplay:
+		case F_gfx_Circle:
+		case F_gfx_CircleFilled:
+		case F_gfx_Ellipse:
+		case F_gfx_EllipseFilled:
+		case F_gfx_Line:
+		case F_gfx_PutPixel:
+		case F_gfx_Rectangle:
+		case F_gfx_RectangleFilled:
+		case F_gfx_Triangle:
+		case F_gfx_TriangleFilled:
+		case F_media_Image:
+		case F_media_RdSector:
+		case F_media_SetAdd:
+		case F_media_SetSector:
+		case F_media_Video:
+		case F_media_VideoFrame:
+		case F_media_WrSector:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ * Remember what a setter has just sent.
+ */
+void Pixxi_Serial_4DLib::StateSet(uint8_t slot, uint16_t value)
+{
+	uint32_t bit = 1UL << slot;
+
+	if (bit & STATE_TXT_ATTRIBUTE_BITS)
+		_stateKnown &= ~STATE_TXT_ATTRIBUTE_BITS;
+	else
+		_stateKnown &= ~bit;
+
+	StateSent++;
+	if (!_stateOn || _list != NULL || Error4D != Err4D_OK)
+		return;
+
+	_stateValue[slot] = value;
+	_stateKnown |= bit;
+}
+
+void Pixxi_Serial_4DLib::GetAck(void)
+{
+	Error4D = Err4D_OK;
 
-	if (response != HAL_OK)
+	if (_list != NULL)
 	{
-		//Flush the buffer
-		HAL_UART_AbortReceive(_huart);
+		_list->setReply(PIXXI_REPLY_ACK);
+		return;
+	}
 
-		Error4D = Err4D_Timeout;
-		if (Callback4D != NULL)
-			Callback4D(Error4D, Error4D_Inv);
+	if (_pipeDepth > 0)
+	{
+		//Don't wait, just remember whose ACK is next in the stream
+		QueueReply(NULL, PIXXI_REPLY_ACK);
+		return;
 	}
-	else if (readx[0] != 6)
+
+	//Anything still owed to async calls arrives ahead of our ACK
+	CollectAcks();
+	WaitAck();
+	CommandDone();
+}
+
+void Pixxi_Serial_4DLib::WaitAck(void)
+{
+	uint8_t readx = 0;
+	Error4D = Err4D_OK;
+
+	if (!ReadBytes(&readx, 1))
+		return;
+
+	if (readx != 6)
 	{
 		Error4D = Err4D_NAK;
-		Error4D_Inv = readx[0];
-		if (Callback4D != NULL)
-			Callback4D(Error4D, Error4D_Inv);
+		Error4D_Inv = readx;
+		ReportError();
 	}
+}
 
-	//Update the provided buffers
-	*word1 = (readx[3] << 8) | (readx[4] & 0xFF);
-	*word2 = (readx[5] << 8) | (readx[6] & 0xFF);
+int Pixxi_Serial_4DLib::GetAckResp(void)
+{
+	uint16_t result = 0;
+
+	if (_list != NULL)
+	{
+		_list->setReply(PIXXI_REPLY_WORD);
+		return 0;
+	}
 
-	//Return result code
-	return (readx[1] << 8) | (readx[2] & 0xFF);
+	GetAckFrame(&result, 1, NULL, 0, 0);
+	return result;
 }
 
-void Pixxi_Serial_4DLib::GetAck2Words(uint16_t * word1, uint16_t * word2)
+/*
+ * Collect the reply to the command just sent: the ACK, Count words, then a payload of Payload
+ * bytes, or as many as the first word says if Payload is PIXXI_FRAME_COUNTED. The words go to
+ * Words and the payload straight from the receive ring into Dest, never more than Capacity
+ * bytes of it; the rest is read and thrown away so the next reply still lines up. A NAK is a
+ * single byte, so nothing more is waited for after one. Returns the payload bytes put in Dest.
+ */
+uint32_t Pixxi_Serial_4DLib::GetAckFrame(uint16_t * words, uint8_t count, uint8_t * dest, uint32_t capacity, int32_t payload)
 {
-	uint8_t readx[5] = {0, 0, 0, 0, 0};
-	Error4D = Err4D_OK;
+	uint8_t header[2 * 3];
+	uint32_t size;
+	uint32_t stored = 0;
 
-	int response = HAL_UART_Receive(_huart, readx, 5, TimeLimit4D);
+	for (uint8_t i = 0; i < count; i++)
+		words[i] = 0;
 
-	if (response != HAL_OK)
+	//Nothing is sent while recording, and a list cannot hold a reply of this shape
+	if (_list != NULL)
 	{
-		//Flush the buffer
-		HAL_UART_AbortReceive(_huart);
-
-		Error4D = Err4D_Timeout;
-		if (Callback4D != NULL)
-			Callback4D(Error4D, Error4D_Inv);
+		_list->reject();
+		return 0;
 	}
-	else if (readx[0] != 6)
+
+	CollectAcks();
+	Error4D = Err4D_OK;
+
+	if (!ReadBytes(header, 1))
+		goto done;
+	if (header[0] != 6)
 	{
 		Error4D = Err4D_NAK;
-		Error4D_Inv = readx[0];
-		if (Callback4D != NULL)
-			Callback4D(Error4D, Error4D_Inv);
+		Error4D_Inv = header[0];
+		ReportError();
+		goto done;
 	}
 
-	//Update the provided buffers
-	*word1 = (readx[1] << 8) | (readx[2] & 0xFF);
-	*word2 = (readx[3] << 8) | (readx[4] & 0xFF);
+	if (count > 0 && !ReadBytes(header, 2 * count))
+		goto done;
+	for (uint8_t i = 0; i < count; i++)
+		words[i] = header[2 * i] << 8 | header[2 * i + 1];
+
+	size = payload == PIXXI_FRAME_COUNTED ? words[0] : payload;
+	stored = size < capacity ? size : capacity;
+	if (stored > 0 && !ReadBytes(dest, stored))
+	{
+		stored = 0;
+		goto done;
+	}
+
+	//More than the caller has room for
+	for (size -= stored; size > 0; )
+	{
+		uint8_t scratch[16];
+		uint32_t chunk = size < sizeof(scratch) ? size : sizeof(scratch);
+		if (!ReadBytes(scratch, chunk))
+			break;
+		size -= chunk;
+	}
+
+done:
+	CommandDone();
+	return stored;
 }
 
-//TODO: Fix this
+uint16_t Pixxi_Serial_4DLib::GetAckRes2Words(uint16_t * word1, uint16_t * word2)
+{
+	uint16_t words[3];
+
+	GetAckFrame(words, 3, NULL, 0, 0);
+	*word1 = words[1];
+	*word2 = words[2];
+	return words[0];
+}
+
+void Pixxi_Serial_4DLib::GetAck2Words(uint16_t * word1, uint16_t * word2)
+{
+	uint16_t words[2];
+
+	GetAckFrame(words, 2, NULL, 0, 0);
+	*word1 = words[0];
+	*word2 = words[1];
+}
+
+/*
+ * ACK, status, then the 512 bytes of the sector whatever the status. Returns the status.
+ */
 uint16_t Pixxi_Serial_4DLib::GetAckResSector(uint8_t * Sector)
 {
-	int Result ;
-	GetAck() ;
-	Result = GetWord() ;
-	getbytes(Sector, 512) ;
-	return Result ;
+	uint16_t result;
+
+	GetAckFrame(&result, 1, Sector, 512, 512);
+	return result;
 }
 
-//TODO: Fix this
-uint16_t Pixxi_Serial_4DLib::GetAckResStr(char * OutStr)
+/*
+ * ACK, length, then that many characters without a terminator. Out holds Size bytes; the string
+ * is cut to Size - 1 characters and always terminated. Returns its length as stored.
+ */
+uint16_t Pixxi_Serial_4DLib::GetAckResStr(char * OutStr, uint16_t size)
 {
-	int Result ;
-	GetAck() ;
-	Result = GetWord() ;
-	getString(OutStr, Result) ;
-	return Result ;
+	uint16_t result;
+
+	if (size == 0)
+	{
+		GetAckFrame(&result, 1, NULL, 0, PIXXI_FRAME_COUNTED);
+		return 0;
+	}
+
+	uint32_t length = GetAckFrame(&result, 1, (uint8_t *) OutStr, size - 1, PIXXI_FRAME_COUNTED);
+	OutStr[length] = 0;
+	return length;
 }
 
-//TODO: Fix this
+/*
+ * ACK, byte count, then that many bytes, of which up to Size are kept. Returns the number kept.
+ */
 uint16_t Pixxi_Serial_4DLib::GetAckResData(uint8_t * OutData, uint16_t size)
 {
-	int Result ;
-	GetAck() ;
-	Result = GetWord() ;
-	getbytes(OutData, size) ;
-	return Result ;
+	uint16_t result;
+
+	return GetAckFrame(&result, 1, OutData, size, PIXXI_FRAME_COUNTED);
 }
 
 void Pixxi_Serial_4DLib::SetThisBaudrate(int Newrate)
 {
-	//this probably isn't needed on this MCU, I dunno
+	//Everything at the old rate has to be out before the UART changes
+	TxFlush();
+	_port->setBaud(baudRate(Newrate));
+	Timing.Baud = _port->baud();
+	_rx.arm();
 }
 
 //*********************************************************************************************//
@@ -291,61 +1065,56 @@ void Pixxi_Serial_4DLib::SetThisBaudrate(int Newrate)
 
 uint16_t Pixxi_Serial_4DLib::bus_In()
 {
-	HAL_UART_Transmit(_huart, (uint8_t *) (F_bus_In >> 8), 1, 10) ;
-	HAL_UART_Transmit(_huart, (uint8_t *) (F_bus_In), 1, 10) ;
+	WriteCmd(F_bus_In);
 	return GetAckResp() ;
 }
 
 void Pixxi_Serial_4DLib::bus_Out(uint16_t bits)
 {
-	WriteInt(F_bus_Out);
+	WriteCmd(F_bus_Out);
 	WriteInt(bits);
 	GetAck() ;
 }
 
 uint16_t Pixxi_Serial_4DLib::bus_Read()
 {
-	WriteInt(F_bus_Read);
+	WriteCmd(F_bus_Read);
 	return GetAckResp() ;
 }
 
 void Pixxi_Serial_4DLib::bus_Set(uint16_t IOMap)
 {
-	HAL_UART_Transmit(_huart, (uint8_t *) (F_bus_Set >> 8), 1, 10) ;
-	HAL_UART_Transmit(_huart, (uint8_t *) (F_bus_Set), 1, 10) ;
-	HAL_UART_Transmit(_huart, (uint8_t *) (IOMap >> 8), 1, 10) ;
-	HAL_UART_Transmit(_huart, (uint8_t *) (IOMap & 0xFF), 1, 10) ;
+	WriteCmd(F_bus_Set);
+	WriteInt(IOMap);
 	GetAck() ;
 }
 
 void Pixxi_Serial_4DLib::bus_Write(uint16_t bits)
 {
-	HAL_UART_Transmit(_huart, (uint8_t *) (F_bus_Write >> 8), 1, 10) ;
-	HAL_UART_Transmit(_huart, (uint8_t *) (F_bus_Write), 1, 10) ;
-	HAL_UART_Transmit(_huart, (uint8_t *) (bits >> 8), 1, 10) ;
-	HAL_UART_Transmit(_huart, (uint8_t *) (bits & 0xFF), 1, 10) ;
+	WriteCmd(F_bus_Write);
+	WriteInt(bits);
 	GetAck() ;
 }
 
 uint16_t Pixxi_Serial_4DLib::charheight(char  testChar)
 {
-	WriteInt(F_charheight);
-	WriteBytes((uint8_t *) testChar, 1);
+	WriteCmd(F_charheight);
+	WriteBytes((uint8_t *) &testChar, 1);
 
 	return GetAckResp();
 }
 
 uint16_t Pixxi_Serial_4DLib::charwidth(char testChar)
 {
-	WriteInt(F_charwidth);
-	WriteBytes((uint8_t *) testChar, 1);
+	WriteCmd(F_charwidth);
+	WriteBytes((uint8_t *) &testChar, 1);
 
 	return GetAckResp();
 }
 
 uint16_t Pixxi_Serial_4DLib::file_Close(uint16_t  handle)
 {
-	WriteInt(F_file_Close);
+	WriteCmd(F_file_Close);
 	WriteInt(handle);
 
 	return GetAckResp();
@@ -353,7 +1122,7 @@ uint16_t Pixxi_Serial_4DLib::file_Close(uint16_t  handle)
 
 uint16_t Pixxi_Serial_4DLib::file_Count(char *  filename)
 {
-	WriteInt(F_file_Count);
+	WriteCmd(F_file_Count);
 	WriteChars(filename);
 
 	return GetAckResp();
@@ -361,7 +1130,7 @@ uint16_t Pixxi_Serial_4DLib::file_Count(char *  filename)
 
 uint16_t Pixxi_Serial_4DLib::file_Dir(char *  filename)
 {
-	WriteInt(F_file_Dir);
+	WriteCmd(F_file_Dir);
 	WriteChars(filename);
 
 	return GetAckResp();
@@ -369,7 +1138,7 @@ uint16_t Pixxi_Serial_4DLib::file_Dir(char *  filename)
 
 uint16_t Pixxi_Serial_4DLib::file_Erase(char *  filename)
 {
-	WriteInt(F_file_Erase);
+	WriteCmd(F_file_Erase);
 	WriteChars(filename);
 
 	return GetAckResp();
@@ -377,7 +1146,7 @@ uint16_t Pixxi_Serial_4DLib::file_Erase(char *  filename)
 
 uint16_t Pixxi_Serial_4DLib::file_Error()
 {
-	WriteInt(F_file_Error);
+	WriteCmd(F_file_Error);
 
 	return GetAckResp();
 }
@@ -385,17 +1154,19 @@ uint16_t Pixxi_Serial_4DLib::file_Error()
 
 uint16_t Pixxi_Serial_4DLib::file_Exec(char *  filename, uint16_t  argCount, t4DWordArray  args)
 {
-	WriteInt(F_file_Exec);
+	WriteCmd(F_file_Exec);
 	WriteChars(filename);
 	WriteInt(argCount);
 	WriteWords(args, argCount);
 
+	//Code running on the display can change anything
+	invalidateState();
 	return GetAckResp();
 }
 
 uint16_t Pixxi_Serial_4DLib::file_Exists(char *  filename)
 {
-	WriteInt(F_file_Exists);
+	WriteCmd(F_file_Exists);
 	WriteChars(filename);
 
 	return GetAckResp();
@@ -403,7 +1174,7 @@ uint16_t Pixxi_Serial_4DLib::file_Exists(char *  filename)
 
 uint16_t Pixxi_Serial_4DLib::file_FindFirst(char *  filename)
 {
-	WriteInt(F_file_FindFirst);
+	WriteCmd(F_file_FindFirst);
 	WriteChars(filename);
 
 	return GetAckResp();
@@ -411,14 +1182,14 @@ uint16_t Pixxi_Serial_4DLib::file_FindFirst(char *  filename)
 
 uint16_t Pixxi_Serial_4DLib::file_FindNext()
 {
-	WriteInt(F_file_FindNext);
+	WriteCmd(F_file_FindNext);
 
 	return GetAckResp();
 }
 
 char Pixxi_Serial_4DLib::file_GetC(uint16_t  handle)
 {
-	WriteInt(F_file_GetC);
+	WriteCmd(F_file_GetC);
 	WriteInt(handle);
 
 	return GetAckResp();
@@ -426,16 +1197,16 @@ char Pixxi_Serial_4DLib::file_GetC(uint16_t  handle)
 
 uint16_t Pixxi_Serial_4DLib::file_GetS(char *  stringIn, uint16_t  size, uint16_t  handle)
 {
-	WriteInt(F_file_GetS);
+	WriteCmd(F_file_GetS);
 	WriteInt(size);
 	WriteInt(handle);
 
-	return GetAckResStr(stringIn);
+	return GetAckResStr(stringIn, size);
 }
 
 uint16_t Pixxi_Serial_4DLib::file_GetW(uint16_t  handle)
 {
-	WriteInt(F_file_GetW);
+	WriteCmd(F_file_GetW);
 	WriteInt(handle);
 
 	return GetAckResp();
@@ -443,7 +1214,7 @@ uint16_t Pixxi_Serial_4DLib::file_GetW(uint16_t  handle)
 
 uint16_t Pixxi_Serial_4DLib::file_Image(uint16_t  X, uint16_t  Y, uint16_t  handle)
 {
-	WriteInt(F_file_Image);
+	WriteCmd(F_file_Image);
 	WriteInt(X);
 	WriteInt(Y);
 	WriteInt(handle);
@@ -453,7 +1224,7 @@ uint16_t Pixxi_Serial_4DLib::file_Image(uint16_t  X, uint16_t  Y, uint16_t  hand
 
 uint16_t Pixxi_Serial_4DLib::file_Index(uint16_t  handle, uint16_t  hiSize, uint16_t  loSize, uint16_t  recordNum)
 {
-	WriteInt(F_file_Index);
+	WriteCmd(F_file_Index);
 	WriteInt(handle);
 	WriteInt(hiSize);
 	WriteInt(loSize);
@@ -464,7 +1235,7 @@ uint16_t Pixxi_Serial_4DLib::file_Index(uint16_t  handle, uint16_t  hiSize, uint
 
 uint16_t Pixxi_Serial_4DLib::file_LoadFunction(char *  filename)
 {
-	WriteInt(F_file_LoadFunction);
+	WriteCmd(F_file_LoadFunction);
 	WriteChars(filename);
 
 	return GetAckResp();
@@ -472,7 +1243,7 @@ uint16_t Pixxi_Serial_4DLib::file_LoadFunction(char *  filename)
 
 uint16_t Pixxi_Serial_4DLib::file_LoadImageControl(char *  datname, char *  GCIName, uint16_t  mode)
 {
-	WriteInt(F_file_LoadImageControl);
+	WriteCmd(F_file_LoadImageControl);
 	WriteChars(datname);
 	WriteChars(GCIName);
 	WriteInt(mode);
@@ -482,7 +1253,7 @@ uint16_t Pixxi_Serial_4DLib::file_LoadImageControl(char *  datname, char *  GCIN
 
 uint16_t Pixxi_Serial_4DLib::file_LoadImageControl(uint16_t hiOffset, uint16_t loOffset, uint16_t mode)
 {
-	WriteInt(F_file_LoadImageControl);
+	WriteCmd(F_file_LoadImageControl);
 	WriteInt(hiOffset);
 	WriteInt(loOffset);
 	WriteInt(mode);
@@ -497,23 +1268,23 @@ uint16_t Pixxi_Serial_4DLib::file_LoadImageControl(int hiOffset, int loOffset, i
 
 uint16_t Pixxi_Serial_4DLib::file_Mount()
 {
-	WriteInt(F_file_Mount);
+	WriteCmd(F_file_Mount);
 
 	return GetAckResp();
 }
 
 uint16_t Pixxi_Serial_4DLib::file_Open(char *  filename, char  mode)
 {
-	WriteInt(F_file_Open);
+	WriteCmd(F_file_Open);
 	WriteChars(filename);
-	WriteBytes((uint8_t *) mode, 1);
+	WriteBytes((uint8_t *) &mode, 1);
 
 	return GetAckResp();
 }
 
 uint16_t Pixxi_Serial_4DLib::file_PlayWAV(char *  filename)
 {
-	WriteInt(F_file_PlayWAV);
+	WriteCmd(F_file_PlayWAV);
 	WriteChars(filename);
 
 	return GetAckResp();
@@ -521,7 +1292,7 @@ uint16_t Pixxi_Serial_4DLib::file_PlayWAV(char *  filename)
 
 uint16_t Pixxi_Serial_4DLib::file_PutC(char  character, uint16_t  handle)
 {
-	WriteInt(F_file_PutC);
+	WriteCmd(F_file_PutC);
 	WriteInt(character);
 	WriteInt(handle);
 
@@ -530,7 +1301,7 @@ uint16_t Pixxi_Serial_4DLib::file_PutC(char  character, uint16_t  handle)
 
 uint16_t Pixxi_Serial_4DLib::file_PutS(char *  stringOut, uint16_t  handle)
 {
-	WriteInt(F_file_PutS);
+	WriteCmd(F_file_PutS);
 	WriteChars(stringOut);
 	WriteInt(handle);
 
@@ -539,7 +1310,7 @@ uint16_t Pixxi_Serial_4DLib::file_PutS(char *  stringOut, uint16_t  handle)
 
 uint16_t Pixxi_Serial_4DLib::file_PutW(uint16_t  word, uint16_t  handle)
 {
-	WriteInt(F_file_PutW);
+	WriteCmd(F_file_PutW);
 	WriteInt(word);
 	WriteInt(handle);
 
@@ -548,7 +1319,7 @@ uint16_t Pixxi_Serial_4DLib::file_PutW(uint16_t  word, uint16_t  handle)
 
 uint16_t Pixxi_Serial_4DLib::file_Read(uint8_t *  data, uint16_t  size, uint16_t  handle)
 {
-	WriteInt(F_file_Read);
+	WriteCmd(F_file_Read);
 	WriteInt(size);
 	WriteInt(handle);
 
@@ -557,7 +1328,7 @@ uint16_t Pixxi_Serial_4DLib::file_Read(uint8_t *  data, uint16_t  size, uint16_t
 
 uint16_t Pixxi_Serial_4DLib::file_Rewind(uint16_t  handle)
 {
-	WriteInt(F_file_Rewind);
+	WriteCmd(F_file_Rewind);
 	WriteInt(handle);
 
 	return GetAckResp();
@@ -565,17 +1336,19 @@ uint16_t Pixxi_Serial_4DLib::file_Rewind(uint16_t  handle)
 
 uint16_t Pixxi_Serial_4DLib::file_Run(char *  filename, uint16_t  argCount, t4DWordArray  args)
 {
-	WriteInt(F_file_Run);
+	WriteCmd(F_file_Run);
 	WriteChars(filename);
 	WriteInt(argCount);
 	WriteWords(args, argCount);
 
+	//Code running on the display can change anything
+	invalidateState();
 	return GetAckResp();
 }
 
 uint16_t Pixxi_Serial_4DLib::file_ScreenCapture(uint16_t  X, uint16_t  Y, uint16_t  width, uint16_t  height, uint16_t  handle)
 {
-	WriteInt(F_file_ScreenCapture);
+	WriteCmd(F_file_ScreenCapture);
 	WriteInt(X);
 	WriteInt(Y);
 	WriteInt(width);
@@ -587,7 +1360,7 @@ uint16_t Pixxi_Serial_4DLib::file_ScreenCapture(uint16_t  X, uint16_t  Y, uint16
 
 uint16_t Pixxi_Serial_4DLib::file_Seek(uint16_t  handle, uint16_t  hiWord, uint16_t  loWord)
 {
-	WriteInt(F_file_Seek);
+	WriteCmd(F_file_Seek);
 	WriteInt(handle);
 	WriteInt(hiWord);
 	WriteInt(loWord);
@@ -597,7 +1370,7 @@ uint16_t Pixxi_Serial_4DLib::file_Seek(uint16_t  handle, uint16_t  hiWord, uint1
 
 uint16_t Pixxi_Serial_4DLib::file_Size(uint16_t  handle, uint16_t *  hiWord, uint16_t *  loWord)
 {
-	WriteInt(F_file_Size);
+	WriteCmd(F_file_Size);
 	WriteInt(handle);
 
 	return GetAckRes2Words(hiWord, loWord);
@@ -605,7 +1378,7 @@ uint16_t Pixxi_Serial_4DLib::file_Size(uint16_t  handle, uint16_t *  hiWord, uin
 
 uint16_t Pixxi_Serial_4DLib::file_Tell(uint16_t  handle, uint16_t *  hiWord, uint16_t *  loWord)
 {
-	WriteInt(F_file_Tell);
+	WriteCmd(F_file_Tell);
 	WriteInt(handle);
 
 
@@ -614,13 +1387,13 @@ uint16_t Pixxi_Serial_4DLib::file_Tell(uint16_t  handle, uint16_t *  hiWord, uin
 
 void Pixxi_Serial_4DLib::file_Unmount()
 {
-	WriteInt(F_file_Unmount);
+	WriteCmd(F_file_Unmount);
 	GetAck();
 }
 
 uint16_t Pixxi_Serial_4DLib::file_Write(uint16_t  size, uint8_t * source, uint16_t  handle)
 {
-	WriteInt(F_file_Write);
+	WriteCmd(F_file_Write);
 	WriteInt(size);
 	WriteBytes(source, size);
 	WriteInt(handle);
@@ -630,31 +1403,46 @@ uint16_t Pixxi_Serial_4DLib::file_Write(uint16_t  size, uint8_t * source, uint16
 
 uint16_t Pixxi_Serial_4DLib::gfx_BevelShadow(uint16_t  value)
 {
-	WriteInt(F_gfx_BevelShadow);
+	if (StateIs(STATE_GFX_BEVELSHADOW, value))
+		return value;
+
+	WriteCmd(F_gfx_BevelShadow);
 	WriteInt(value);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_GFX_BEVELSHADOW, value);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::gfx_BevelWidth(uint16_t  value)
 {
-	WriteInt(F_gfx_BevelWidth);
+	if (StateIs(STATE_GFX_BEVELWIDTH, value))
+		return value;
+
+	WriteCmd(F_gfx_BevelWidth);
 	WriteInt(value);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_GFX_BEVELWIDTH, value);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::gfx_BGcolour(uint16_t  colour)
 {
-	WriteInt(F_gfx_BGcolour);
+	if (StateIs(STATE_GFX_BGCOLOUR, colour))
+		return colour;
+
+	WriteCmd(F_gfx_BGcolour);
 	WriteInt(colour);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_GFX_BGCOLOUR, colour);
+	return previous;
 }
 
 void Pixxi_Serial_4DLib::gfx_Button(uint16_t  up, uint16_t  x, uint16_t  y, uint16_t  buttonColour, uint16_t  txtColour, uint16_t  font, uint16_t  txtWidth, uint16_t  txtHeight, char *   text)
 {
-	WriteInt(F_gfx_Button);
+	WriteCmd(F_gfx_Button);
 	WriteInt(up);
 	WriteInt(x);
 	WriteInt(y);
@@ -670,7 +1458,7 @@ void Pixxi_Serial_4DLib::gfx_Button(uint16_t  up, uint16_t  x, uint16_t  y, uint
 
 void Pixxi_Serial_4DLib::gfx_ChangeColour(uint16_t  oldColour, uint16_t  newColour)
 {
-	WriteInt(F_gfx_ChangeColour);
+	WriteCmd(F_gfx_ChangeColour);
 	WriteInt(oldColour);
 	WriteInt(newColour);
 	GetAck();
@@ -678,7 +1466,7 @@ void Pixxi_Serial_4DLib::gfx_ChangeColour(uint16_t  oldColour, uint16_t  newColo
 
 void Pixxi_Serial_4DLib::gfx_Circle(uint16_t  X, uint16_t  Y, uint16_t  radius, uint16_t  colour)
 {
-	WriteInt(F_gfx_Circle);
+	WriteCmd(F_gfx_Circle);
 	WriteInt(X);
 	WriteInt(Y);
 	WriteInt(radius);
@@ -688,7 +1476,7 @@ void Pixxi_Serial_4DLib::gfx_Circle(uint16_t  X, uint16_t  Y, uint16_t  radius,
 
 void Pixxi_Serial_4DLib::gfx_CircleFilled(uint16_t  X, uint16_t  Y, uint16_t  radius, uint16_t  colour)
 {
-	WriteInt(F_gfx_CircleFilled);
+	WriteCmd(F_gfx_CircleFilled);
 	WriteInt(X);
 	WriteInt(Y);
 	WriteInt(radius);
@@ -698,14 +1486,18 @@ void Pixxi_Serial_4DLib::gfx_CircleFilled(uint16_t  X, uint16_t  Y, uint16_t  ra
 
 void Pixxi_Serial_4DLib::gfx_Clipping(uint16_t  onOff)
 {
-	WriteInt(F_gfx_Clipping);
+	if (StateIs(STATE_GFX_CLIPPING, onOff))
+		return;
+
+	WriteCmd(F_gfx_Clipping);
 	WriteInt(onOff);
 	GetAck();
+	StateSet(STATE_GFX_CLIPPING, onOff);
 }
 
 void Pixxi_Serial_4DLib::gfx_ClipWindow(uint16_t  X1, uint16_t  Y1, uint16_t  X2, uint16_t  Y2)
 {
-	WriteInt(F_gfx_ClipWindow);
+	WriteCmd(F_gfx_ClipWindow);
 	WriteInt(X1);
 	WriteInt(Y1);
 	WriteInt(X2);
@@ -715,21 +1507,27 @@ void Pixxi_Serial_4DLib::gfx_ClipWindow(uint16_t  X1, uint16_t  Y1, uint16_t  X2
 
 void Pixxi_Serial_4DLib::gfx_Cls()
 {
-	WriteInt(F_gfx_Cls);
+	WriteCmd(F_gfx_Cls);
 	GetAck();
+	invalidateState();
 }
 
 uint16_t Pixxi_Serial_4DLib::gfx_Contrast(uint16_t  Contrast)
 {
-	WriteInt(F_gfx_Contrast);
+	if (StateIs(STATE_GFX_CONTRAST, Contrast))
+		return Contrast;
+
+	WriteCmd(F_gfx_Contrast);
 	WriteInt(Contrast);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_GFX_CONTRAST, Contrast);
+	return previous;
 }
 
 void Pixxi_Serial_4DLib::gfx_Ellipse(uint16_t  X, uint16_t  Y, uint16_t  Xrad, uint16_t  Yrad, uint16_t  colour)
 {
-	WriteInt(F_gfx_Ellipse);
+	WriteCmd(F_gfx_Ellipse);
 	WriteInt(X);
 	WriteInt(Y);
 	WriteInt(Xrad);
@@ -741,7 +1539,7 @@ void Pixxi_Serial_4DLib::gfx_Ellipse(uint16_t  X, uint16_t  Y, uint16_t  Xrad, u
 
 void Pixxi_Serial_4DLib::gfx_EllipseFilled(uint16_t  X, uint16_t  Y, uint16_t  Xrad, uint16_t  Yrad, uint16_t  colour)
 {
-	WriteInt(F_gfx_EllipseFilled);
+	WriteCmd(F_gfx_EllipseFilled);
 	WriteInt(X);
 	WriteInt(Y);
 	WriteInt(Xrad);
@@ -753,7 +1551,7 @@ void Pixxi_Serial_4DLib::gfx_EllipseFilled(uint16_t  X, uint16_t  Y, uint16_t  X
 
 uint16_t Pixxi_Serial_4DLib::gfx_FrameDelay(uint16_t  Msec)
 {
-	WriteInt(F_gfx_FrameDelay);
+	WriteCmd(F_gfx_FrameDelay);
 	WriteInt(Msec);
 
 	return GetAckResp();
@@ -761,7 +1559,7 @@ uint16_t Pixxi_Serial_4DLib::gfx_FrameDelay(uint16_t  Msec)
 
 uint16_t Pixxi_Serial_4DLib::gfx_Get(uint16_t  Mode)
 {
-	WriteInt(F_gfx_Get);
+	WriteCmd(F_gfx_Get);
 	WriteInt(Mode);
 
 	return GetAckResp();
@@ -769,7 +1567,7 @@ uint16_t Pixxi_Serial_4DLib::gfx_Get(uint16_t  Mode)
 
 uint16_t Pixxi_Serial_4DLib::gfx_GetPixel(uint16_t  X, uint16_t  Y)
 {
-	WriteInt(F_gfx_GetPixel);
+	WriteCmd(F_gfx_GetPixel);
 	WriteInt(X);
 	WriteInt(Y);
 
@@ -778,7 +1576,7 @@ uint16_t Pixxi_Serial_4DLib::gfx_GetPixel(uint16_t  X, uint16_t  Y)
 
 void Pixxi_Serial_4DLib::gfx_Line(uint16_t  X1, uint16_t  Y1, uint16_t  X2, uint16_t  Y2, uint16_t  colour)
 {
-	WriteInt(F_gfx_Line);
+	WriteCmd(F_gfx_Line);
 	WriteInt(X1);
 	WriteInt(Y1);
 	WriteInt(X2);
@@ -790,15 +1588,20 @@ void Pixxi_Serial_4DLib::gfx_Line(uint16_t  X1, uint16_t  Y1, uint16_t  X2, uint
 
 uint16_t Pixxi_Serial_4DLib::gfx_LinePattern(uint16_t  Pattern)
 {
-	WriteInt(F_gfx_LinePattern);
+	if (StateIs(STATE_GFX_LINEPATTERN, Pattern))
+		return Pattern;
+
+	WriteCmd(F_gfx_LinePattern);
 	WriteInt(Pattern);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_GFX_LINEPATTERN, Pattern);
+	return previous;
 }
 
 void Pixxi_Serial_4DLib::gfx_LineTo(uint16_t  X, uint16_t  Y)
 {
-	WriteInt(F_gfx_LineTo);
+	WriteCmd(F_gfx_LineTo);
 	WriteInt(X);
 	WriteInt(Y);
 
@@ -807,7 +1610,7 @@ void Pixxi_Serial_4DLib::gfx_LineTo(uint16_t  X, uint16_t  Y)
 
 void Pixxi_Serial_4DLib::gfx_MoveTo(uint16_t  X, uint16_t  Y)
 {
-	WriteInt(F_gfx_MoveTo);
+	WriteCmd(F_gfx_MoveTo);
 	WriteInt(X);
 	WriteInt(Y);
 
@@ -816,7 +1619,7 @@ void Pixxi_Serial_4DLib::gfx_MoveTo(uint16_t  X, uint16_t  Y)
 
 uint16_t Pixxi_Serial_4DLib::gfx_Orbit(uint16_t  Angle, uint16_t  Distance, uint16_t *  Xdest, uint16_t *  Ydest)
 {
-	WriteInt(F_gfx_Orbit);
+	WriteCmd(F_gfx_Orbit);
 	WriteInt(Angle);
 	WriteInt(Distance);
 	GetAck2Words(Xdest,Ydest);
@@ -826,15 +1629,20 @@ uint16_t Pixxi_Serial_4DLib::gfx_Orbit(uint16_t  Angle, uint16_t  Distance, uint
 
 uint16_t Pixxi_Serial_4DLib::gfx_OutlineColour(uint16_t  colour)
 {
-	WriteInt(F_gfx_OutlineColour);
+	if (StateIs(STATE_GFX_OUTLINECOLOUR, colour))
+		return colour;
+
+	WriteCmd(F_gfx_OutlineColour);
 	WriteInt(colour);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_GFX_OUTLINECOLOUR, colour);
+	return previous;
 }
 
 void Pixxi_Serial_4DLib::gfx_Panel(uint16_t  Raised, uint16_t  X, uint16_t  Y, uint16_t  Width, uint16_t  Height, uint16_t  colour)
 {
-	WriteInt(F_gfx_Panel);
+	WriteCmd(F_gfx_Panel);
 	WriteInt(Raised);
 	WriteInt(X);
 	WriteInt(Y);
@@ -847,7 +1655,7 @@ void Pixxi_Serial_4DLib::gfx_Panel(uint16_t  Raised, uint16_t  X, uint16_t  Y, u
 
 void Pixxi_Serial_4DLib::gfx_Polygon(uint16_t  n, t4DWordArray  Xvalues, t4DWordArray  Yvalues, uint16_t  colour)
 {
-	WriteInt(F_gfx_Polygon);
+	WriteCmd(F_gfx_Polygon);
 	WriteInt(n);
 	WriteWords(Xvalues, n);
 	WriteWords(Yvalues, n);
@@ -858,7 +1666,7 @@ void Pixxi_Serial_4DLib::gfx_Polygon(uint16_t  n, t4DWordArray  Xvalues, t4DWord
 
 void Pixxi_Serial_4DLib::gfx_PolygonFilled(uint16_t  n, t4DWordArray  Xvalues, t4DWordArray  Yvalues, uint16_t  colour)
 {
-	WriteInt(F_gfx_PolygonFilled);
+	WriteCmd(F_gfx_PolygonFilled);
 	WriteInt(n);
 	WriteWords(Xvalues, n);
 	WriteWords(Yvalues, n);
@@ -869,7 +1677,7 @@ void Pixxi_Serial_4DLib::gfx_PolygonFilled(uint16_t  n, t4DWordArray  Xvalues, t
 
 void Pixxi_Serial_4DLib::gfx_Polyline(uint16_t  n, t4DWordArray  Xvalues, t4DWordArray  Yvalues, uint16_t  colour)
 {
-	WriteInt(F_gfx_Polyline);
+	WriteCmd(F_gfx_Polyline);
 	WriteInt(n);
 	WriteWords(Xvalues, n);
 	WriteWords(Yvalues, n);
@@ -880,7 +1688,7 @@ void Pixxi_Serial_4DLib::gfx_Polyline(uint16_t  n, t4DWordArray  Xvalues, t4DWor
 
 void Pixxi_Serial_4DLib::gfx_PutPixel(uint16_t  X, uint16_t  Y, uint16_t  colour)
 {
-	WriteInt(F_gfx_PutPixel);
+	WriteCmd(F_gfx_PutPixel);
 	WriteInt(X);
 	WriteInt(Y);
 	WriteInt(colour);
@@ -890,7 +1698,7 @@ void Pixxi_Serial_4DLib::gfx_PutPixel(uint16_t  X, uint16_t  Y, uint16_t  colour
 
 void Pixxi_Serial_4DLib::gfx_Rectangle(uint16_t  X1, uint16_t  Y1, uint16_t  X2, uint16_t  Y2, uint16_t  colour)
 {
-	WriteInt(F_gfx_Rectangle);
+	WriteCmd(F_gfx_Rectangle);
 	WriteInt(X1);
 	WriteInt(Y1);
 	WriteInt(X2);
@@ -902,7 +1710,7 @@ void Pixxi_Serial_4DLib::gfx_Rectangle(uint16_t  X1, uint16_t  Y1, uint16_t  X2,
 
 void Pixxi_Serial_4DLib::gfx_RectangleFilled(uint16_t  X1, uint16_t  Y1, uint16_t  X2, uint16_t  Y2, uint16_t  colour)
 {
-	WriteInt(F_gfx_RectangleFilled);
+	WriteCmd(F_gfx_RectangleFilled);
 	WriteInt(X1);
 	WriteInt(Y1);
 	WriteInt(X2);
@@ -913,7 +1721,7 @@ void Pixxi_Serial_4DLib::gfx_RectangleFilled(uint16_t  X1, uint16_t  Y1, uint16_
 }
 void Pixxi_Serial_4DLib::gfx_ScreenCopyPaste(uint16_t  Xs, uint16_t  Ys, uint16_t  Xd, uint16_t  Yd, uint16_t  width, uint16_t  height)
 {
-	WriteInt(F_gfx_ScreenCopyPaste);
+	WriteCmd(F_gfx_ScreenCopyPaste);
 	WriteInt(Xs);
 	WriteInt(Ys);
 	WriteInt(Xd);
@@ -926,31 +1734,34 @@ void Pixxi_Serial_4DLib::gfx_ScreenCopyPaste(uint16_t  Xs, uint16_t  Ys, uint16_
 
 uint16_t Pixxi_Serial_4DLib::gfx_ScreenMode(uint16_t  screenMode)
 {
-	WriteInt(F_gfx_ScreenMode);
+	WriteCmd(F_gfx_ScreenMode);
 	WriteInt(screenMode);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	invalidateState();
+	return previous;
 }
 
 void Pixxi_Serial_4DLib::gfx_Set(uint16_t  Func, uint16_t  Value)
 {
-	WriteInt(F_gfx_Set);
+	WriteCmd(F_gfx_Set);
 	WriteInt(Func);
 	WriteInt(Value);
 
 	GetAck();
+	invalidateState();
 }
 
 void Pixxi_Serial_4DLib::gfx_SetClipRegion()
 {
-	WriteInt(F_gfx_SetClipRegion);
+	WriteCmd(F_gfx_SetClipRegion);
 
 	GetAck();
 }
 
 uint16_t Pixxi_Serial_4DLib::gfx_Slider(uint16_t  Mode, uint16_t  X1, uint16_t  Y1, uint16_t  X2, uint16_t  Y2, uint16_t  colour, uint16_t  Scale, uint16_t  Value)
 {
-	WriteInt(F_gfx_Slider);
+	WriteCmd(F_gfx_Slider);
 	WriteInt(Mode);
 	WriteInt(X1);
 	WriteInt(Y1);
@@ -965,23 +1776,33 @@ uint16_t Pixxi_Serial_4DLib::gfx_Slider(uint16_t  Mode, uint16_t  X1, uint16_t
 
 uint16_t Pixxi_Serial_4DLib::gfx_Transparency(uint16_t  OnOff)
 {
-	WriteInt(F_gfx_Transparency);
+	if (StateIs(STATE_GFX_TRANSPARENCY, OnOff))
+		return OnOff;
+
+	WriteCmd(F_gfx_Transparency);
 	WriteInt(OnOff);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_GFX_TRANSPARENCY, OnOff);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::gfx_TransparentColour(uint16_t  colour)
 {
-	WriteInt(F_gfx_TransparentColour);
+	if (StateIs(STATE_GFX_TRANSPARENTCOLOUR, colour))
+		return colour;
+
+	WriteCmd(F_gfx_TransparentColour);
 	WriteInt(colour);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_GFX_TRANSPARENTCOLOUR, colour);
+	return previous;
 }
 
 void Pixxi_Serial_4DLib::gfx_Triangle(uint16_t  X1, uint16_t  Y1, uint16_t  X2, uint16_t  Y2, uint16_t  X3, uint16_t  Y3, uint16_t  colour)
 {
-	WriteInt(F_gfx_Triangle);
+	WriteCmd(F_gfx_Triangle);
 	WriteInt(X1);
 	WriteInt(Y1);
 	WriteInt(X2);
@@ -995,7 +1816,7 @@ void Pixxi_Serial_4DLib::gfx_Triangle(uint16_t  X1, uint16_t  Y1, uint16_t  X2,
 
 void Pixxi_Serial_4DLib::gfx_TriangleFilled(uint16_t  X1, uint16_t  Y1, uint16_t  X2, uint16_t  Y2, uint16_t  X3, uint16_t  Y3, uint16_t  colour)
 {
-	WriteInt(F_gfx_TriangleFilled);
+	WriteCmd(F_gfx_TriangleFilled);
 	WriteInt(X1);
 	WriteInt(Y1);
 	WriteInt(X2);
@@ -1009,7 +1830,7 @@ void Pixxi_Serial_4DLib::gfx_TriangleFilled(uint16_t  X1, uint16_t  Y1, uint16_t
 
 void Pixxi_Serial_4DLib::gfx_Button4(uint16_t value, uint16_t hndl, uint16_t params)
 {
-    WriteInt(F_gfx_Button4);
+    WriteCmd(F_gfx_Button4);
     WriteInt(value);
     WriteInt(hndl);
     WriteInt(params);
@@ -1019,7 +1840,7 @@ void Pixxi_Serial_4DLib::gfx_Button4(uint16_t value, uint16_t hndl, uint16_t par
 
 void Pixxi_Serial_4DLib::gfx_Switch(uint16_t value, uint16_t hndl, uint16_t params)
 {
-    WriteInt(F_gfx_Switch);
+    WriteCmd(F_gfx_Switch);
     WriteInt(value);
     WriteInt(hndl);
     WriteInt(params);
@@ -1029,7 +1850,7 @@ void Pixxi_Serial_4DLib::gfx_Switch(uint16_t value, uint16_t hndl, uint16_t para
 
 void Pixxi_Serial_4DLib::gfx_Slider5(uint16_t value, uint16_t hndl, uint16_t params)
 {
-    WriteInt(F_gfx_Slider5);
+    WriteCmd(F_gfx_Slider5);
     WriteInt(value);
     WriteInt(hndl);
     WriteInt(params);
@@ -1039,7 +1860,7 @@ void Pixxi_Serial_4DLib::gfx_Slider5(uint16_t value, uint16_t hndl, uint16_t par
 
 void Pixxi_Serial_4DLib::gfx_Dial(uint16_t value, uint16_t hndl, uint16_t params)
 {
-    WriteInt(F_gfx_Dial);
+    WriteCmd(F_gfx_Dial);
     WriteInt(value);
     WriteInt(hndl);
     WriteInt(params);
@@ -1049,7 +1870,7 @@ void Pixxi_Serial_4DLib::gfx_Dial(uint16_t value, uint16_t hndl, uint16_t params
 
 void Pixxi_Serial_4DLib::gfx_Led(uint16_t value, uint16_t hndl, uint16_t params)
 {
-    WriteInt(F_gfx_Led);
+    WriteCmd(F_gfx_Led);
     WriteInt(value);
     WriteInt(hndl);
     WriteInt(params);
@@ -1059,7 +1880,7 @@ void Pixxi_Serial_4DLib::gfx_Led(uint16_t value, uint16_t hndl, uint16_t params)
 
 void Pixxi_Serial_4DLib::gfx_Gauge(uint16_t value, uint16_t hndl, uint16_t params)
 {
-    WriteInt(F_gfx_Gauge);
+    WriteCmd(F_gfx_Gauge);
     WriteInt(value);
     WriteInt(hndl);
     WriteInt(params);
@@ -1069,7 +1890,7 @@ void Pixxi_Serial_4DLib::gfx_Gauge(uint16_t value, uint16_t hndl, uint16_t param
 
 void Pixxi_Serial_4DLib::gfx_AngularMeter(uint16_t value, uint16_t hndl, uint16_t params)
 {
-    WriteInt(F_gfx_AngularMeter);
+    WriteCmd(F_gfx_AngularMeter);
     WriteInt(value);
     WriteInt(hndl);
     WriteInt(params);
@@ -1079,7 +1900,7 @@ void Pixxi_Serial_4DLib::gfx_AngularMeter(uint16_t value, uint16_t hndl, uint16_
 
 void Pixxi_Serial_4DLib::gfx_LedDigit(uint16_t x, uint16_t y, uint16_t digitSize, uint16_t onColour, uint16_t offColour, uint16_t value)
 {
-    WriteInt(F_gfx_LedDigit);
+    WriteCmd(F_gfx_LedDigit);
     WriteInt(x);
     WriteInt(y);
     WriteInt(digitSize);
@@ -1092,7 +1913,7 @@ void Pixxi_Serial_4DLib::gfx_LedDigit(uint16_t x, uint16_t y, uint16_t digitSize
 
 void Pixxi_Serial_4DLib::gfx_LedDigits(uint16_t value, uint16_t hndl, uint16_t params)
 {
-    WriteInt(F_gfx_LedDigits);
+    WriteCmd(F_gfx_LedDigits);
     WriteInt(value);
     WriteInt(hndl);
     WriteInt(params);
@@ -1102,7 +1923,7 @@ void Pixxi_Serial_4DLib::gfx_LedDigits(uint16_t value, uint16_t hndl, uint16_t p
 
 void Pixxi_Serial_4DLib::gfx_RulerGauge(uint16_t value, uint16_t hndl, uint16_t params)
 {
-    WriteInt(F_gfx_RulerGauge);
+    WriteCmd(F_gfx_RulerGauge);
     WriteInt(value);
     WriteInt(hndl);
     WriteInt(params);
@@ -1112,7 +1933,7 @@ void Pixxi_Serial_4DLib::gfx_RulerGauge(uint16_t value, uint16_t hndl, uint16_t
 
 int Pixxi_Serial_4DLib::img_ClearAttributes(uint16_t  Handle, uint16_t  Index, uint16_t  Value)
 {
-	WriteInt(F_img_ClearAttributes);
+	WriteCmd(F_img_ClearAttributes);
 	WriteInt(Handle);
 	WriteInt(Index);
 	WriteInt(Value);
@@ -1122,7 +1943,7 @@ int Pixxi_Serial_4DLib::img_ClearAttributes(uint16_t  Handle, uint16_t  Index, u
 
 int Pixxi_Serial_4DLib::img_Darken(uint16_t  Handle, uint16_t  Index)
 {
-	WriteInt(F_img_Darken);
+	WriteCmd(F_img_Darken);
 	WriteInt(Handle);
 	WriteInt(Index);
 
@@ -1131,7 +1952,7 @@ int Pixxi_Serial_4DLib::img_Darken(uint16_t  Handle, uint16_t  Index)
 
 int Pixxi_Serial_4DLib::img_Disable(uint16_t  Handle, uint16_t  Index)
 {
-	WriteInt(F_img_Disable);
+	WriteCmd(F_img_Disable);
 	WriteInt(Handle);
 	WriteInt(Index);
 
@@ -1140,7 +1961,7 @@ return GetAckResp();
 
 int Pixxi_Serial_4DLib::img_Enable(uint16_t  Handle, uint16_t  Index)
 {
-	WriteInt(F_img_Enable);
+	WriteCmd(F_img_Enable);
 	WriteInt(Handle);
 	WriteInt(Index);
 
@@ -1149,7 +1970,7 @@ int Pixxi_Serial_4DLib::img_Enable(uint16_t  Handle, uint16_t  Index)
 
 int Pixxi_Serial_4DLib::img_GetWord(uint16_t  Handle, uint16_t  Index, uint16_t  Offset )
 {
-	WriteInt(F_img_GetWord);
+	WriteCmd(F_img_GetWord);
 	WriteInt(Handle);
 	WriteInt(Index);
 	WriteInt(Offset );
@@ -1159,7 +1980,7 @@ int Pixxi_Serial_4DLib::img_GetWord(uint16_t  Handle, uint16_t  Index, uint16_t
 
 int Pixxi_Serial_4DLib::img_Lighten(uint16_t  Handle, uint16_t  Index)
 {
-	WriteInt(F_img_Lighten);
+	WriteCmd(F_img_Lighten);
 	WriteInt(Handle);
 	WriteInt(Index);
 
@@ -1168,7 +1989,7 @@ int Pixxi_Serial_4DLib::img_Lighten(uint16_t  Handle, uint16_t  Index)
 
 int Pixxi_Serial_4DLib::img_SetAttributes(uint16_t  Handle, uint16_t  Index, uint16_t  Value)
 {
-	WriteInt(F_img_SetAttributes);
+	WriteCmd(F_img_SetAttributes);
 	WriteInt(Handle);
 	WriteInt(Index);
 	WriteInt(Value);
@@ -1178,7 +1999,7 @@ int Pixxi_Serial_4DLib::img_SetAttributes(uint16_t  Handle, uint16_t  Index, uin
 
 int Pixxi_Serial_4DLib::img_SetPosition(uint16_t  Handle, uint16_t  Index, uint16_t  Xpos, uint16_t  Ypos)
 {
-	WriteInt(F_img_SetPosition);
+	WriteCmd(F_img_SetPosition);
 	WriteInt(Handle);
 	WriteInt(Index);
 	WriteInt(Xpos);
@@ -1189,7 +2010,7 @@ int Pixxi_Serial_4DLib::img_SetPosition(uint16_t  Handle, uint16_t  Index, uint1
 
 int Pixxi_Serial_4DLib::img_SetWord(uint16_t  Handle, uint16_t  Index, uint16_t  Offset , uint16_t  Word)
 {
-	WriteInt(F_img_SetWord);
+	WriteCmd(F_img_SetWord);
 	WriteInt(Handle);
 	WriteInt(Index);
 	WriteInt(Offset);
@@ -1200,7 +2021,7 @@ int Pixxi_Serial_4DLib::img_SetWord(uint16_t  Handle, uint16_t  Index, uint16_t
 
 int Pixxi_Serial_4DLib::img_Show(uint16_t  Handle, uint16_t  Index)
 {
-	WriteInt(F_img_Show);
+	WriteCmd(F_img_Show);
 	WriteInt(Handle);
 	WriteInt(Index);
 
@@ -1209,7 +2030,7 @@ int Pixxi_Serial_4DLib::img_Show(uint16_t  Handle, uint16_t  Index)
 
 int Pixxi_Serial_4DLib::img_Touched(uint16_t  Handle, uint16_t  Index)
 {
-	WriteInt(F_img_Touched);
+	WriteCmd(F_img_Touched);
 	WriteInt(Handle);
 	WriteInt(Index);
 
@@ -1218,7 +2039,7 @@ int Pixxi_Serial_4DLib::img_Touched(uint16_t  Handle, uint16_t  Index)
 
 void Pixxi_Serial_4DLib::img_FunctionCall(uint16_t imgHndl, uint16_t index, uint16_t value, uint16_t hndl, uint16_t params, uint16_t argCount, uint16_t strMap)
 {
-    WriteInt(F_img_FunctionCall);
+    WriteCmd(F_img_FunctionCall);
     WriteInt(imgHndl);
     WriteInt(index);
     WriteInt(value);
@@ -1232,14 +2053,14 @@ void Pixxi_Serial_4DLib::img_FunctionCall(uint16_t imgHndl, uint16_t index, uint
 
 int Pixxi_Serial_4DLib::media_Flush()
 {
-	WriteInt(F_media_Flush);
+	WriteCmd(F_media_Flush);
 
 	return GetAckResp();
 }
 
 void Pixxi_Serial_4DLib::media_Image(uint16_t  X, uint16_t  Y)
 {
-	WriteInt(F_media_Image);
+	WriteCmd(F_media_Image);
 	WriteInt(X);
 	WriteInt(Y);
 
@@ -1248,35 +2069,35 @@ void Pixxi_Serial_4DLib::media_Image(uint16_t  X, uint16_t  Y)
 
 int Pixxi_Serial_4DLib::media_Init()
 {
-	WriteInt(F_media_Init);
+	WriteCmd(F_media_Init);
 
 	return GetAckResp();
 }
 
 uint16_t Pixxi_Serial_4DLib::media_RdSector(uint8_t *  SectorIn)
 {
-	WriteInt(F_media_RdSector);
+	WriteCmd(F_media_RdSector);
 
 	return GetAckResSector(SectorIn);
 }
 
 int Pixxi_Serial_4DLib::media_ReadByte()
 {
-	WriteInt(F_media_ReadByte);
+	WriteCmd(F_media_ReadByte);
 
 	return GetAckResp();
 }
 
 int Pixxi_Serial_4DLib::media_ReadWord()
 {
-	WriteInt(F_media_ReadWord);
+	WriteCmd(F_media_ReadWord);
 
 	return GetAckResp();
 }
 
 void Pixxi_Serial_4DLib::media_SetAdd(uint16_t  HiWord, uint16_t  LoWord)
 {
-	WriteInt(F_media_SetAdd);
+	WriteCmd(F_media_SetAdd);
 	WriteInt(HiWord);
 	WriteInt(LoWord);
 
@@ -1285,7 +2106,7 @@ void Pixxi_Serial_4DLib::media_SetAdd(uint16_t  HiWord, uint16_t  LoWord)
 
 void Pixxi_Serial_4DLib::media_SetSector(uint16_t  HiWord, uint16_t  LoWord)
 {
-	WriteInt(F_media_SetSector);
+	WriteCmd(F_media_SetSector);
 	WriteInt(HiWord);
 	WriteInt(LoWord);
 
@@ -1294,7 +2115,7 @@ void Pixxi_Serial_4DLib::media_SetSector(uint16_t  HiWord, uint16_t  LoWord)
 
 void Pixxi_Serial_4DLib::media_Video(uint16_t  X, uint16_t  Y)
 {
-	WriteInt(F_media_Video);
+	WriteCmd(F_media_Video);
 	WriteInt(X);
 	WriteInt(Y);
 
@@ -1303,7 +2124,7 @@ void Pixxi_Serial_4DLib::media_Video(uint16_t  X, uint16_t  Y)
 
 void Pixxi_Serial_4DLib::media_VideoFrame(uint16_t  X, uint16_t  Y, uint16_t  Framenumber)
 {
-	WriteInt(F_media_VideoFrame);
+	WriteCmd(F_media_VideoFrame);
 	WriteInt(X);
 	WriteInt(Y);
 	WriteInt(Framenumber);
@@ -1313,7 +2134,7 @@ void Pixxi_Serial_4DLib::media_VideoFrame(uint16_t  X, uint16_t  Y, uint16_t  Fr
 
 int Pixxi_Serial_4DLib::media_WriteByte(uint16_t  Byte)
 {
-	WriteInt(F_media_WriteByte);
+	WriteCmd(F_media_WriteByte);
 	WriteInt(Byte);
 
 	return GetAckResp();
@@ -1321,7 +2142,7 @@ int Pixxi_Serial_4DLib::media_WriteByte(uint16_t  Byte)
 
 int Pixxi_Serial_4DLib::media_WriteWord(uint16_t  Word)
 {
-	WriteInt(F_media_WriteWord);
+	WriteCmd(F_media_WriteWord);
 	WriteInt(Word);
 
 	return GetAckResp();
@@ -1329,7 +2150,7 @@ int Pixxi_Serial_4DLib::media_WriteWord(uint16_t  Word)
 
 int Pixxi_Serial_4DLib::media_WrSector(uint8_t *  SectorOut)
 {
-	WriteInt(F_media_WrSector);
+	WriteCmd(F_media_WrSector);
 	WriteBytes(SectorOut, 512);
 
 	return GetAckResp();
@@ -1337,7 +2158,7 @@ int Pixxi_Serial_4DLib::media_WrSector(uint8_t *  SectorOut)
 
 int Pixxi_Serial_4DLib::mem_Alloc(uint16_t size)
 {
-	WriteInt(F_mem_Alloc);
+	WriteCmd(F_mem_Alloc);
 	WriteInt(size);
 
 	return GetAckResp();
@@ -1345,124 +2166,316 @@ int Pixxi_Serial_4DLib::mem_Alloc(uint16_t size)
 
 int Pixxi_Serial_4DLib::mem_Free(uint16_t  Handle)
 {
-	WriteInt(F_mem_Free);
+	WriteCmd(F_mem_Free);
 	WriteInt(Handle);
 
-	return GetAckResp();
+	return GetAckResp();
+}
+
+int Pixxi_Serial_4DLib::mem_Heap()
+{
+	WriteCmd(F_mem_Heap);
+	return GetAckResp();
+}
+
+int Pixxi_Serial_4DLib::pin_HI(uint16_t Pin)
+{
+	WriteCmd(F_pin_HI);
+	WriteInt(Pin);
+
+	return GetAckResp();
+}
+
+int Pixxi_Serial_4DLib::peekM(uint16_t  Address)
+{
+	WriteCmd(F_peekM);
+	WriteInt(Address);
+
+	return GetAckResp();
+}
+
+int Pixxi_Serial_4DLib::pin_LO(uint16_t Pin)
+{
+	WriteCmd(F_pin_LO);
+	WriteInt(Pin);
+
+	return GetAckResp() ;
+}
+
+int Pixxi_Serial_4DLib::pin_Read(uint16_t Pin)
+{
+	WriteCmd(F_pin_Read);
+	WriteInt(Pin);
+
+	return GetAckResp() ;
+}
+
+int Pixxi_Serial_4DLib::pin_Set(uint16_t Mode, uint16_t Pin)
+{
+	WriteCmd(F_pin_Set);
+	WriteInt(Mode);
+	WriteInt(Pin);
+
+	return GetAckResp() ;
+}
+
+void Pixxi_Serial_4DLib::putCH(uint16_t  WordChar)
+{
+	WriteCmd(F_putCH);
+	WriteInt(WordChar);
+
+	GetAck() ;
+}
+
+void Pixxi_Serial_4DLib::pokeM(uint16_t  Address, uint16_t  WordValue)
+{
+	WriteCmd(F_pokeM);
+	WriteInt(Address);
+	WriteInt(WordValue);
+
+	GetAck() ;
+}
+
+uint16_t Pixxi_Serial_4DLib::putstr(char *  InString)
+{
+	WriteCmd(F_putstr);
+	WriteChars(InString);
+
+	return GetAckResp();
+}
+
+void Pixxi_Serial_4DLib::print(const char str[])
+{
+	WriteText(str, strlen(str), false);
+}
+
+void Pixxi_Serial_4DLib::print(char c)
+{
+	WriteText(&c, 1, false);
+}
+
+void Pixxi_Serial_4DLib::print(int n, uint8_t base)
+{
+	print((long) n, base);
+}
+
+void Pixxi_Serial_4DLib::print(unsigned int n, uint8_t base)
+{
+	print((unsigned long) n, base);
+}
+
+void Pixxi_Serial_4DLib::print(long n, uint8_t base)
+{
+	char buf[TEXT_NUMBER_SIZE];
+	WriteText(buf, printSigned(buf, n, base), false);
+}
+
+void Pixxi_Serial_4DLib::print(unsigned long n, uint8_t base)
+{
+	char buf[TEXT_NUMBER_SIZE];
+	WriteText(buf, printNumber(buf, n, base), false);
+}
+
+void Pixxi_Serial_4DLib::print(double n, uint8_t digits)
+{
+	char buf[TEXT_NUMBER_SIZE];
+	WriteText(buf, printFloat(buf, n, digits), false);
+}
+
+void Pixxi_Serial_4DLib::printFixed(long value, uint8_t decimals)
+{
+	char buf[TEXT_NUMBER_SIZE];
+	unsigned long scale = 1;
+	unsigned long magnitude = value < 0 ? 0UL - (unsigned long) value : (unsigned long) value;
+	uint8_t count = 0;
+
+	if (decimals > TEXT_MAX_DIGITS)
+		decimals = TEXT_MAX_DIGITS;
+	for (uint8_t i = 0; i < decimals; i++)
+		scale *= 10;
+
+	if (value < 0)
+		buf[count++] = '-';
+	count += printNumber(&buf[count], magnitude / scale, DEC);
+
+	if (decimals > 0)
+	{
+		//Fraction with its leading zeros
+		unsigned long fraction = magnitude % scale;
+		buf[count++] = '.';
+		for (uint8_t i = decimals; i > 0; i--)
+		{
+			buf[count + i - 1] = '0' + fraction % 10;
+			fraction /= 10;
+		}
+		count += decimals;
+	}
+
+	WriteText(buf, count, false);
 }
 
-int Pixxi_Serial_4DLib::mem_Heap()
+void Pixxi_Serial_4DLib::println(void)
 {
-	WriteInt(F_mem_Heap);
-	return GetAckResp();
+	WriteText("", 0, true);
 }
 
-int Pixxi_Serial_4DLib::pin_HI(uint16_t Pin)
+void Pixxi_Serial_4DLib::println(const char c[])
 {
-	WriteInt(F_pin_HI);
-	WriteInt(Pin);
-
-	return GetAckResp();
+	WriteText(c, strlen(c), true);
 }
 
-int Pixxi_Serial_4DLib::peekM(uint16_t  Address)
+void Pixxi_Serial_4DLib::println(char c)
 {
-	WriteInt(F_peekM);
-	WriteInt(Address);
-
-	return GetAckResp();
+	WriteText(&c, 1, true);
 }
 
-int Pixxi_Serial_4DLib::pin_LO(uint16_t Pin)
+void Pixxi_Serial_4DLib::println(int n, uint8_t base)
 {
-	WriteInt(F_pin_LO);
-	WriteInt(Pin);
-
-	return GetAckResp() ;
+	println((long) n, base);
 }
 
-int Pixxi_Serial_4DLib::pin_Read(uint16_t Pin)
+void Pixxi_Serial_4DLib::println(unsigned int n, uint8_t base)
 {
-	WriteInt(F_pin_Read);
-	WriteInt(Pin);
-
-	return GetAckResp() ;
+	println((unsigned long) n, base);
 }
 
-int Pixxi_Serial_4DLib::pin_Set(uint16_t Mode, uint16_t Pin)
+void Pixxi_Serial_4DLib::println(long n, uint8_t base)
 {
-	WriteInt(F_pin_Set);
-	WriteInt(Mode);
-	WriteInt(Pin);
-
-	return GetAckResp() ;
+	char buf[TEXT_NUMBER_SIZE];
+	WriteText(buf, printSigned(buf, n, base), true);
 }
 
-void Pixxi_Serial_4DLib::putCH(uint16_t  WordChar)
+void Pixxi_Serial_4DLib::println(unsigned long n, uint8_t base)
 {
-	WriteInt(F_putCH);
-	WriteInt(WordChar);
-
-	GetAck() ;
+	char buf[TEXT_NUMBER_SIZE];
+	WriteText(buf, printNumber(buf, n, base), true);
 }
 
-void Pixxi_Serial_4DLib::pokeM(uint16_t  Address, uint16_t  WordValue)
+void Pixxi_Serial_4DLib::println(double n, uint8_t digits)
 {
-	WriteInt(F_pokeM);
-	WriteInt(Address);
-	WriteInt(WordValue);
-
-	GetAck() ;
+	char buf[TEXT_NUMBER_SIZE];
+	WriteText(buf, printFloat(buf, n, digits), true);
 }
 
-uint16_t Pixxi_Serial_4DLib::putstr(char *  InString)
+//-Private:
+
+/*
+ * Send text as putstr commands of up to PIXXI_STR_MAX characters, optionally followed by "\n\r".
+ * Their replies are only waited for when not pipelining.
+ */
+void Pixxi_Serial_4DLib::WriteText(const char * text, uint32_t size, bool newline)
 {
-	WriteInt(F_putstr);
-	WriteChars(InString);
+	const uint8_t ending[] = {'\n', '\r', 0};
 
-	return GetAckResp();
+	if (size == 0 && !newline)
+		return;
+
+	do
+	{
+		uint32_t count = size < PIXXI_STR_MAX ? size : PIXXI_STR_MAX;
+		bool last = count == size;
+
+		WriteCmd(F_putstr);
+		Emit((const uint8_t *) text, count);
+		//The line ending rides along with the last piece, if there is room for it
+		if (last && newline && count + 2 <= PIXXI_STR_MAX)
+		{
+			Emit(ending, 3);
+			newline = false;
+		}
+		else
+			Emit(&ending[2], 1);
+
+		if (_pipeDepth > 0 && _list == NULL)
+			QueueReply(NULL, PIXXI_REPLY_WORD);
+		else
+			GetAckResp();
+
+		text += count;
+		size -= count;
+	} while (size > 0 || newline);
 }
 
-void Pixxi_Serial_4DLib::print(const char str[])
+uint8_t Pixxi_Serial_4DLib::printNumber(char * dest, unsigned long n, uint8_t base)
 {
-  int len = strlen(str);
-  for(int x = 0; x<len; x++)
-  {
-	putCH(str[x]);
-  }
+	char buf[8 * sizeof(long)];
+	uint8_t count = 0;
+
+	if (base < 2)
+		base = DEC;
+	do {
+		unsigned long m = n;
+		n /= base;
+		char c = m - base * n;
+		buf[count++] = c < 10 ? c + '0' : c + 'A' - 10;
+	} while (n);
+
+	for (uint8_t x = 0; x < count; x++)
+		dest[x] = buf[count - 1 - x];
+	return count;
 }
 
-void Pixxi_Serial_4DLib::println(const char c[])
+uint8_t Pixxi_Serial_4DLib::printSigned(char * dest, long n, uint8_t base)
 {
-  print(c);
-  putCH('\n');
-  putCH('\r');
+	//Only decimal gets a sign, other bases show the two's complement
+	if (n < 0 && base == DEC)
+	{
+		dest[0] = '-';
+		return 1 + printNumber(&dest[1], 0UL - (unsigned long) n, base);
+	}
+	return printNumber(dest, n, base);
 }
 
-//-Private:
+uint8_t Pixxi_Serial_4DLib::printFloat(char * dest, double number, uint8_t digits)
+{
+	uint8_t count = 0;
 
-void Pixxi_Serial_4DLib::printNumber(unsigned long n, uint8_t base) {
-  char buf[8 * sizeof(long) + 1]; // Assumes 8-bit chars plus zero byte.
-  int count = 0;
-  do {
-    unsigned long m = n;
-    n /= base;
-    char c = m - base * n;
-    buf[count] = c < 10 ? c + '0' : c + 'A' - 10;
-    count++;
-  } while(n);
+	if (number != number)
+	{
+		memcpy(dest, "nan", 3);
+		return 3;
+	}
+	if (number > 4294967040.0 || number < -4294967040.0)
+	{
+		memcpy(dest, "ovf", 3);
+		return 3;
+	}
 
-  for(int x = count - 1; x>=0; x--)
-  {
-	putCH(buf[x]);
-  }
+	if (number < 0.0)
+	{
+		dest[count++] = '-';
+		number = -number;
+	}
+	if (digits > TEXT_MAX_DIGITS)
+		digits = TEXT_MAX_DIGITS;
+
+	//Round at the last digit shown, so 1.999 with two digits is 2.00
+	double rounding = 0.5;
+	for (uint8_t i = 0; i < digits; i++)
+		rounding /= 10.0;
+	number += rounding;
+
+	uint32_t whole = (uint32_t) number;
+	double remainder = number - (double) whole;
+	count += printNumber(&dest[count], whole, DEC);
+
+	if (digits > 0)
+		dest[count++] = '.';
+	while (digits-- > 0)
+	{
+		remainder *= 10.0;
+		uint8_t digit = (uint8_t) remainder;
+		dest[count++] = '0' + digit;
+		remainder -= digit;
+	}
+	return count;
 }
 
 //--------------------------------------------------------
 
 void Pixxi_Serial_4DLib::snd_BufSize(uint16_t  Bufsize)
 {
-	WriteInt(F_snd_BufSize);
+	WriteCmd(F_snd_BufSize);
 	WriteInt(Bufsize);
 
 	GetAck();
@@ -1470,21 +2483,21 @@ void Pixxi_Serial_4DLib::snd_BufSize(uint16_t  Bufsize)
 
 void Pixxi_Serial_4DLib::snd_Continue()
 {
-	WriteInt(F_snd_Continue);
+	WriteCmd(F_snd_Continue);
 
 	GetAck();
 }
 
 void Pixxi_Serial_4DLib::snd_Pause()
 {
-	WriteInt(F_snd_Pause);
+	WriteCmd(F_snd_Pause);
 
 	GetAck();
 }
 
 uint16_t Pixxi_Serial_4DLib::snd_Pitch(uint16_t  Pitch)
 {
-	WriteInt(F_snd_Pitch);
+	WriteCmd(F_snd_Pitch);
 	WriteInt(Pitch);
 
 	return GetAckResp();
@@ -1492,21 +2505,21 @@ uint16_t Pixxi_Serial_4DLib::snd_Pitch(uint16_t  Pitch)
 
 uint16_t Pixxi_Serial_4DLib::snd_Playing()
 {
-	WriteInt(F_snd_Playing);
+	WriteCmd(F_snd_Playing);
 
 	return GetAckResp();
 }
 
 void Pixxi_Serial_4DLib::snd_Stop()
 {
-	WriteInt(F_snd_Stop);
+	WriteCmd(F_snd_Stop);
 
 	GetAck();
 }
 
 void Pixxi_Serial_4DLib::snd_Volume(uint16_t  Volume)
 {
-	WriteInt(F_snd_Volume);
+	WriteCmd(F_snd_Volume);
 	WriteInt(Volume);
 
 	GetAck();
@@ -1514,7 +2527,7 @@ void Pixxi_Serial_4DLib::snd_Volume(uint16_t  Volume)
 
 uint16_t Pixxi_Serial_4DLib::sys_Sleep(uint16_t  Units)
 {
-	WriteInt(F_sys_Sleep);
+	WriteCmd(F_sys_Sleep);
 	WriteInt(Units);
 
 	return GetAckResp();
@@ -1522,7 +2535,7 @@ uint16_t Pixxi_Serial_4DLib::sys_Sleep(uint16_t  Units)
 
 void Pixxi_Serial_4DLib::touch_DetectRegion(uint16_t  X1, uint16_t  Y1, uint16_t  X2, uint16_t  Y2)
 {
-	WriteInt(F_touch_DetectRegion);
+	WriteCmd(F_touch_DetectRegion);
 	WriteInt(X1);
 	WriteInt(Y1);
 	WriteInt(X2);
@@ -1533,7 +2546,7 @@ void Pixxi_Serial_4DLib::touch_DetectRegion(uint16_t  X1, uint16_t  Y1, uint16_t
 
 uint16_t Pixxi_Serial_4DLib::touch_Get(uint16_t  Mode)
 {
-	WriteInt(F_touch_Get);
+	WriteCmd(F_touch_Get);
 	WriteInt(Mode);
 
 	return GetAckResp();
@@ -1541,7 +2554,7 @@ uint16_t Pixxi_Serial_4DLib::touch_Get(uint16_t  Mode)
 
 void Pixxi_Serial_4DLib::touch_Set(uint16_t  Mode)
 {
-	WriteInt(F_touch_Set);
+	WriteCmd(F_touch_Set);
 	WriteInt(Mode);
 
 	GetAck();
@@ -1549,71 +2562,111 @@ void Pixxi_Serial_4DLib::touch_Set(uint16_t  Mode)
 
 uint16_t Pixxi_Serial_4DLib::txt_Attributes(uint16_t  Attribs)
 {
-	WriteInt(F_txt_Attributes);
+	if (StateIs(STATE_TXT_ATTRIBUTES, Attribs))
+		return Attribs;
+
+	WriteCmd(F_txt_Attributes);
 	WriteInt(Attribs);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_ATTRIBUTES, Attribs);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::txt_BGcolour(uint16_t  colour)
 {
-	WriteInt(F_txt_BGcolour);
+	if (StateIs(STATE_TXT_BGCOLOUR, colour))
+		return colour;
+
+	WriteCmd(F_txt_BGcolour);
 	WriteInt(colour);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_BGCOLOUR, colour);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::txt_Bold(uint16_t  Bold)
 {
-	WriteInt(F_txt_Bold);
+	if (StateIs(STATE_TXT_BOLD, Bold))
+		return Bold;
+
+	WriteCmd(F_txt_Bold);
 	WriteInt(Bold);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_BOLD, Bold);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::txt_FGcolour(uint16_t  colour)
 {
-	WriteInt(F_txt_FGcolour);
+	if (StateIs(STATE_TXT_FGCOLOUR, colour))
+		return colour;
+
+	WriteCmd(F_txt_FGcolour);
 	WriteInt(colour);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_FGCOLOUR, colour);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::txt_FontID(uint16_t  FontNumber)
 {
-	WriteInt(F_txt_FontID);
+	if (StateIs(STATE_TXT_FONTID, FontNumber))
+		return FontNumber;
+
+	WriteCmd(F_txt_FontID);
 	WriteInt(FontNumber);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_FONTID, FontNumber);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::txt_Height(uint16_t  Multiplier)
 {
-	WriteInt(F_txt_Height);
+	if (StateIs(STATE_TXT_HEIGHT, Multiplier))
+		return Multiplier;
+
+	WriteCmd(F_txt_Height);
 	WriteInt(Multiplier);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_HEIGHT, Multiplier);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::txt_Inverse(uint16_t  Inverse)
 {
-	WriteInt(F_txt_Inverse);
+	if (StateIs(STATE_TXT_INVERSE, Inverse))
+		return Inverse;
+
+	WriteCmd(F_txt_Inverse);
 	WriteInt(Inverse);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_INVERSE, Inverse);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::txt_Italic(uint16_t  Italic)
 {
-	WriteInt(F_txt_Italic);
+	if (StateIs(STATE_TXT_ITALIC, Italic))
+		return Italic;
+
+	WriteCmd(F_txt_Italic);
 	WriteInt(Italic);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_ITALIC, Italic);
+	return previous;
 }
 
 void Pixxi_Serial_4DLib::txt_MoveCursor(uint16_t  Line, uint16_t  Column)
 {
-	WriteInt(F_txt_MoveCursor);
+	WriteCmd(F_txt_MoveCursor);
 	WriteInt(Line);
 	WriteInt(Column);
 
@@ -1622,148 +2675,403 @@ void Pixxi_Serial_4DLib::txt_MoveCursor(uint16_t  Line, uint16_t  Column)
 
 uint16_t Pixxi_Serial_4DLib::txt_Opacity(uint16_t  TransparentOpaque)
 {
-	WriteInt(F_txt_Opacity);
+	if (StateIs(STATE_TXT_OPACITY, TransparentOpaque))
+		return TransparentOpaque;
+
+	WriteCmd(F_txt_Opacity);
 	WriteInt(TransparentOpaque);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_OPACITY, TransparentOpaque);
+	return previous;
 }
 
 void Pixxi_Serial_4DLib::txt_Set(uint16_t  Func, uint16_t  Value)
 {
-	WriteInt(F_txt_Set);
+	WriteCmd(F_txt_Set);
 	WriteInt(Func);
 	WriteInt(Value);
 
 	GetAck();
+	invalidateState();
 }
 
 uint16_t Pixxi_Serial_4DLib::txt_Underline(uint16_t  Underline)
 {
-	WriteInt(F_txt_Underline);
+	if (StateIs(STATE_TXT_UNDERLINE, Underline))
+		return Underline;
+
+	WriteCmd(F_txt_Underline);
 	WriteInt(Underline);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_UNDERLINE, Underline);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::txt_Width(uint16_t  Multiplier)
 {
-	WriteInt(F_txt_Width);
+	if (StateIs(STATE_TXT_WIDTH, Multiplier))
+		return Multiplier;
+
+	WriteCmd(F_txt_Width);
 	WriteInt(Multiplier);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_WIDTH, Multiplier);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::txt_Wrap(uint16_t  Position)
 {
-	WriteInt(F_txt_Wrap);
+	if (StateIs(STATE_TXT_WRAP, Position))
+		return Position;
+
+	WriteCmd(F_txt_Wrap);
 	WriteInt(Position);
 
-	return GetAckResp();
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_WRAP, Position);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::txt_Xgap(uint16_t  Pixels)
 {
-	WriteInt(F_txt_Xgap);
+	if (StateIs(STATE_TXT_XGAP, Pixels))
+		return Pixels;
+
+	WriteCmd(F_txt_Xgap);
 	WriteInt(Pixels);
 
-	return GetAckResp() ;
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_XGAP, Pixels);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::txt_Ygap(uint16_t  Pixels)
 {
-	WriteInt(F_txt_Ygap);
+	if (StateIs(STATE_TXT_YGAP, Pixels))
+		return Pixels;
+
+	WriteCmd(F_txt_Ygap);
 	WriteInt(Pixels);
 
-	return GetAckResp() ;
+	uint16_t previous = GetAckResp();
+	StateSet(STATE_TXT_YGAP, Pixels);
+	return previous;
 }
 
 uint16_t Pixxi_Serial_4DLib::file_CallFunction(uint16_t  Handle, uint16_t  ArgCount, t4DWordArray  Args)
 {
-	WriteInt(F_file_CallFunction);
+	WriteCmd(F_file_CallFunction);
 	WriteInt(Handle);
 	WriteInt(ArgCount);
 	WriteWords(Args, ArgCount);
 
+	//Code running on the display can change anything
+	invalidateState();
 	return GetAckResp();
 }
 
-uint16_t Pixxi_Serial_4DLib::sys_GetModel(char *  ModelStr)
+uint16_t Pixxi_Serial_4DLib::sys_GetModel(char *  ModelStr, uint16_t  Size)
 {
-	WriteInt(F_sys_GetModel);
+	WriteCmd(F_sys_GetModel);
 
-	return GetAckResStr(ModelStr);
+	return GetAckResStr(ModelStr, Size);
 }
 
 uint16_t Pixxi_Serial_4DLib::sys_GetVersion()
 {
-	WriteInt(F_sys_GetVersion);
+	WriteCmd(F_sys_GetVersion);
 
 	return GetAckResp();
 }
 
 uint16_t Pixxi_Serial_4DLib::sys_GetPmmC()
 {
-	WriteInt(F_sys_GetPmmC);
+	WriteCmd(F_sys_GetPmmC);
 
 	return GetAckResp();
 }
 
 uint16_t Pixxi_Serial_4DLib::writeString(uint16_t  Handle, char *  StringOut)
 {
-	WriteInt(F_writeString);
+	WriteCmd(F_writeString);
 	WriteInt(Handle);
 	WriteChars(StringOut);
 
 	return GetAckResp();
 }
 
-uint16_t Pixxi_Serial_4DLib::readString(uint16_t  Handle, char *  StringIn)
+uint16_t Pixxi_Serial_4DLib::readString(uint16_t  Handle, char *  StringIn, uint16_t  Size)
 {
-	WriteInt(F_readString);
+	WriteCmd(F_readString);
 	WriteInt(Handle);
 
-	return GetAckResStr(StringIn);
+	return GetAckResStr(StringIn, Size);
 }
 
 void Pixxi_Serial_4DLib::blitComtoDisplay(uint16_t  X, uint16_t  Y, uint16_t  Width, uint16_t  Height, uint8_t *  Pixels)
 {
-	WriteInt(F_blitComtoDisplay);
+	WriteCmd(F_blitComtoDisplay);
+	WriteInt(X);
+	WriteInt(Y);
+	WriteInt(Width);
+	WriteInt(Height);
+	WriteBytes(Pixels, (uint32_t) Width * Height * 2);
+
+	GetAck();
+	}
+
+/*
+ * blitComtoDisplay without the whole image in RAM. Source is asked for the image a piece at a time
+ * (whole rows where they fit in half of Buffer, otherwise parts of a row) and each piece is sent straight
+ * from Buffer, one half while the other is being filled, so drawing the next piece overlaps sending this one.
+ * Source gives native RGB565 unless Packed, in which case it writes the big-endian bytes itself.
+ * Buffer is free again when this returns.
+ */
+void Pixxi_Serial_4DLib::blitStream(uint16_t  X, uint16_t  Y, uint16_t  Width, uint16_t  Height, Trender4D Source, void * Context, uint16_t * Buffer, uint32_t BufferPixels, bool Packed)
+{
+	uint32_t half = BufferPixels / 2;
+
+	if (Width == 0 || Height == 0 || half == 0)
+	{
+		Error4D = Err4D_Invalid;
+		ReportError();
+		return;
+	}
+
+	uint16_t width = Width < half ? Width : half;
+	uint32_t rows = half / width;
+	uint8_t side = 0;
+
+	WriteCmd(F_blitComtoDisplay);
 	WriteInt(X);
 	WriteInt(Y);
 	WriteInt(Width);
 	WriteInt(Height);
-	WriteBytes(Pixels, Width*Height*2);
+
+	for (uint32_t y = 0; y < Height; y += rows)
+	{
+		uint16_t height = Height - y < rows ? Height - y : rows;
+
+		for (uint32_t x = 0; x < Width; x += width)
+		{
+			uint16_t w = Width - x < width ? Width - x : width;
+			uint16_t * pixels = Buffer + side * half;
+
+			//This half went out two pieces ago, and sending the last piece waited for that
+			Source(Context, X + x, Y + y, w, height, pixels);
+			if (!Packed)
+				Pixxi_PackWords4D((uint8_t *) pixels, pixels, (uint32_t) w * height);
+			EmitDirect((uint8_t *) pixels, 2 * (uint32_t) w * height);
+			side ^= 1;
+		}
+	}
+	_tx.flush();
 
 	GetAck();
 	}
 
-uint16_t Pixxi_Serial_4DLib::file_FindFirstRet(char *  Filename, char *  StringIn)
+/*
+ * Blit an image held in another pixel format, converting it as it goes (see Pixxi_Convert4D.h).
+ */
+void Pixxi_Serial_4DLib::blitImage(uint16_t  X, uint16_t  Y, Pixxi_Image4D * Image, uint16_t * Buffer, uint32_t BufferPixels)
+{
+	Image->X = X;
+	Image->Y = Y;
+	blitStream(X, Y, Image->Width, Image->Height, Pixxi_ConvertRect4D, Image, Buffer, BufferPixels, true);
+}
+
+uint16_t Pixxi_Serial_4DLib::file_FindFirstRet(char *  Filename, char *  StringIn, uint16_t  Size)
 {
-	WriteInt(F_file_FindFirstRet);
+	WriteCmd(F_file_FindFirstRet);
 	WriteChars(Filename);
 
-	return GetAckResStr(StringIn);
+	return GetAckResStr(StringIn, Size);
 }
 
-uint16_t Pixxi_Serial_4DLib::file_FindNextRet(char *  StringIn)
+uint16_t Pixxi_Serial_4DLib::file_FindNextRet(char *  StringIn, uint16_t  Size)
 {
-	WriteInt(F_file_FindNextRet);
+	WriteCmd(F_file_FindNextRet);
 
-	return GetAckResStr(StringIn);
+	return GetAckResStr(StringIn, Size);
 }
 
 void Pixxi_Serial_4DLib::setbaudWait(uint16_t  Newrate)
 {
-	WriteInt(F_setbaudWait);
+	CollectAcks();
+	TxFlush();
+
+	//Only send the display off to a rate this end can follow it to
+	if (!_port->supportsBaud(baudRate(Newrate)))
+	{
+		_replyCmd = F_setbaudWait;
+		Error4D = Err4D_Invalid;
+		ReportError();
+		return;
+	}
+
+	WriteCmd(F_setbaudWait);
 	WriteInt(Newrate);
 	SetThisBaudrate(Newrate); // change this systems baud rate to match new display rate, ACK is 100ms away
 
-	GetAck();
+	WaitAck();
+	CommandDone();
+}
+
+uint32_t Pixxi_Serial_4DLib::baudRate(uint16_t Newrate)
+{
+	switch (Newrate)
+	{
+		case BAUD_110: return 110;
+		case BAUD_300: return 300;
+		case BAUD_600: return 600;
+		case BAUD_1200: return 1200;
+		case BAUD_2400: return 2400;
+		case BAUD_4800: return 4800;
+		case BAUD_9600: return 9600;
+		case BAUD_14400: return 14400;
+		case BAUD_19200: return 19200;
+		case BAUD_31250: return 31250;
+		case BAUD_38400: return 38400;
+		case BAUD_56000: return 56000;
+		case BAUD_57600: return 57600;
+		case BAUD_115200: return 115200;
+		case BAUD_128000: return 128000;
+		case BAUD_256000: return 256000;
+		case BAUD_300000: return 300000;
+		case BAUD_375000: return 375000;
+		case BAUD_500000: return 500000;
+		case BAUD_600000: return 600000;
+		default: return 0;
+	}
+}
+
+/*
+ * BAUD_ code of a line rate, 0 if there is none.
+ */
+uint16_t Pixxi_Serial_4DLib::baudCode(uint32_t Rate)
+{
+	static const uint16_t codes[] = {BAUD_110, BAUD_300, BAUD_600, BAUD_1200, BAUD_2400, BAUD_4800, BAUD_9600,
+		BAUD_14400, BAUD_19200, BAUD_31250, BAUD_38400, BAUD_56000, BAUD_57600, BAUD_115200, BAUD_128000,
+		BAUD_256000, BAUD_300000, BAUD_375000, BAUD_500000, BAUD_600000};
+
+	for (uint8_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++)
+	{
+		if (baudRate(codes[i]) == Rate)
+			return codes[i];
+	}
+	return 0;
+}
+
+/*
+ * Put this end back on a rate after a failed switch, with the timing model following it.
+ */
+void Pixxi_Serial_4DLib::RestoreBaud(uint32_t rate)
+{
+	_port->setBaud(rate);
+	Timing.Baud = _port->baud();
+	_rx.arm();
+}
+
+uint32_t Pixxi_Serial_4DLib::negotiateBaud(const uint16_t * Rates, uint8_t Count)
+{
+	static const uint16_t defaults[] = {PIXXI_BAUD_RATES};
+	Tcallback4D callback = Callback4D;
+	Tcallback4DCmd callbackCmd = CallbackCmd4D;
+	unsigned long timeLimit = TimeLimit4D;
+	uint32_t working = 0;
+
+	if (Rates == NULL)
+	{
+		Rates = defaults;
+		Count = sizeof(defaults) / sizeof(defaults[0]);
+	}
+
+	//Failures are expected on the way down, only the outcome is reported
+	Callback4D = NULL;
+	CallbackCmd4D = NULL;
+	TimeLimit4D = PIXXI_BAUD_PROBE_MS;
+
+	for (uint8_t i = 0; i < Count && working == 0; i++)
+	{
+		uint32_t previous = _port->baud();
+
+		setbaudWait(Rates[i]);
+		if (Error4D == Err4D_Invalid)
+			continue;
+
+		//Nothing at all came back, so the display most likely never switched. A garbled
+		//reply means it did, and the next rate is asked for at this one.
+		if (Error4D == Err4D_Timeout)
+		{
+			RestoreBaud(previous);
+			continue;
+		}
+
+		bool acked = Error4D == Err4D_OK;
+		if (acked)
+			sys_GetVersion();
+		if (Error4D == Err4D_OK)
+		{
+			working = baudRate(Rates[i]);
+			continue;
+		}
+
+		//The display switched but the link is no good at this rate. Take it back to the last
+		//rate which worked, so the next one is not asked for over a bad link.
+		if (acked && baudCode(previous) != 0)
+			setbaudWait(baudCode(previous));
+		if (!acked || Error4D != Err4D_OK)
+			_rx.clear();
+		if (acked && _port->baud() != previous)
+			RestoreBaud(previous);
+	}
+
+	Callback4D = callback;
+	CallbackCmd4D = callbackCmd;
+	TimeLimit4D = timeLimit;
+
+	if (working == 0)
+	{
+		_replyCmd = F_setbaudWait;
+		ReportError();
+	}
+	return working;
+}
+
+/*
+ * Time a few round trips of each class to learn the link, then switch to per-command timeouts.
+ * Returns false (and leaves them off) if the display did not answer every probe.
+ */
+bool Pixxi_Serial_4DLib::calibrate(void)
+{
+	uint8_t depth = _pipeDepth;
+	bool ok = true;
+
+	//Each probe has to be waited for to be timed
+	setPipelineDepth(0);
+	Timing.Baud = _port->baud();
+	for (uint8_t i = 0; i < PIXXI_TIMING_PROBES; i++)
+	{
+		sys_GetVersion();
+		if (Error4D != Err4D_OK)
+			ok = false;
+		//Off the screen, so nothing is drawn
+		gfx_PutPixel(0xFFFF, 0xFFFF, 0);
+		if (Error4D != Err4D_OK)
+			ok = false;
+	}
+	setPipelineDepth(depth);
+
+	Timing.Enabled = ok;
+	return ok;
 }
 
 uint16_t Pixxi_Serial_4DLib::widget_Create(uint16_t count)
 {
-	WriteInt(F_widget_Create);
+	WriteCmd(F_widget_Create);
 	WriteInt(count);
 
 	return GetAckResp();
@@ -1771,7 +3079,7 @@ uint16_t Pixxi_Serial_4DLib::widget_Create(uint16_t count)
 
 void Pixxi_Serial_4DLib::widget_Add(uint16_t hndl, uint16_t index, uint16_t widget)
 {
-	WriteInt(F_widget_Add);
+	WriteCmd(F_widget_Add);
 	WriteInt(hndl);
 	WriteInt(index);
 	WriteInt(widget);
@@ -1781,7 +3089,7 @@ void Pixxi_Serial_4DLib::widget_Add(uint16_t hndl, uint16_t index, uint16_t widg
 
 void Pixxi_Serial_4DLib::widget_Delete(uint16_t hndl, uint16_t index)
 {
-	WriteInt(F_widget_Delete);
+	WriteCmd(F_widget_Delete);
 	WriteInt(hndl);
 	WriteInt(index);
 
@@ -1790,7 +3098,7 @@ void Pixxi_Serial_4DLib::widget_Delete(uint16_t hndl, uint16_t index)
 
 uint16_t Pixxi_Serial_4DLib::widget_Realloc(uint16_t hndl, uint16_t count)
 {
-	WriteInt(F_widget_Realloc);
+	WriteCmd(F_widget_Realloc);
 	WriteInt(hndl);
 	WriteInt(count);
 
@@ -1799,7 +3107,7 @@ uint16_t Pixxi_Serial_4DLib::widget_Realloc(uint16_t hndl, uint16_t count)
 
 uint16_t Pixxi_Serial_4DLib::widget_SetWord(uint16_t Handle, uint16_t  Index, uint16_t  Offset , uint16_t  Word)
 {
-	WriteInt(F_widget_SetWord);
+	WriteCmd(F_widget_SetWord);
 	WriteInt(Handle);
 	WriteInt(Index);
 	WriteInt(Offset);
@@ -1810,7 +3118,7 @@ uint16_t Pixxi_Serial_4DLib::widget_SetWord(uint16_t Handle, uint16_t  Index, ui
 
 uint16_t Pixxi_Serial_4DLib::widget_GetWord(uint16_t  Handle, uint16_t  Index, uint16_t  Offset )
 {
-	WriteInt(F_widget_GetWord);
+	WriteCmd(F_widget_GetWord);
 	WriteInt(Handle);
 	WriteInt(Index);
 	WriteInt(Offset);
@@ -1820,7 +3128,7 @@ uint16_t Pixxi_Serial_4DLib::widget_GetWord(uint16_t  Handle, uint16_t  Index, u
 
 uint16_t Pixxi_Serial_4DLib::widget_SetPosition(uint16_t  Handle, uint16_t  Index, uint16_t  Xpos, uint16_t  Ypos)
 {
-	WriteInt(F_widget_SetPosition);
+	WriteCmd(F_widget_SetPosition);
 	WriteInt(Handle);
 	WriteInt(Index);
 	WriteInt(Xpos);
@@ -1831,7 +3139,7 @@ uint16_t Pixxi_Serial_4DLib::widget_SetPosition(uint16_t  Handle, uint16_t  Inde
 
 uint16_t Pixxi_Serial_4DLib::widget_Enable(uint16_t  Handle, uint16_t  Index)
 {
-	WriteInt(F_widget_Enable);
+	WriteCmd(F_widget_Enable);
 	WriteInt(Handle);
 	WriteInt(Index);
 
@@ -1840,7 +3148,7 @@ uint16_t Pixxi_Serial_4DLib::widget_Enable(uint16_t  Handle, uint16_t  Index)
 
 uint16_t Pixxi_Serial_4DLib::widget_Disable(uint16_t  Handle, uint16_t  Index)
 {
-	WriteInt(F_widget_Disable);
+	WriteCmd(F_widget_Disable);
 	WriteInt(Handle);
 	WriteInt(Index);
 
@@ -1849,7 +3157,7 @@ uint16_t Pixxi_Serial_4DLib::widget_Disable(uint16_t  Handle, uint16_t  Index)
 
 uint16_t Pixxi_Serial_4DLib::widget_SetAttributes(uint16_t  Handle, uint16_t  Index, uint16_t  Value)
 {
-	WriteInt(F_widget_SetAttributes);
+	WriteCmd(F_widget_SetAttributes);
 	WriteInt(Handle);
 	WriteInt(Index);
 	WriteInt(Value);
@@ -1859,7 +3167,7 @@ uint16_t Pixxi_Serial_4DLib::widget_SetAttributes(uint16_t  Handle, uint16_t  In
 
 uint16_t Pixxi_Serial_4DLib::widget_ClearAttributes(uint16_t  Handle, uint16_t  Index, uint16_t  Value)
 {
-	WriteInt(F_widget_ClearAttributes);
+	WriteCmd(F_widget_ClearAttributes);
 	WriteInt(Handle);
 	WriteInt(Index);
 	WriteInt(Value);
@@ -1869,7 +3177,7 @@ uint16_t Pixxi_Serial_4DLib::widget_ClearAttributes(uint16_t  Handle, uint16_t
 
 uint16_t Pixxi_Serial_4DLib::widget_Touched(uint16_t  Handle, uint16_t  Index)
 {
-	WriteInt(F_widget_Touched);
+	WriteCmd(F_widget_Touched);
 	WriteInt(Handle);
 	WriteInt(Index);
 
@@ -1878,16 +3186,31 @@ uint16_t Pixxi_Serial_4DLib::widget_Touched(uint16_t  Handle, uint16_t  Index)
 
 void Pixxi_Serial_4DLib::widget_InitGradRAM(uint16_t hndl)
 {
-	WriteInt(F_widget_InitGradRAM);
+	WriteCmd(F_widget_InitGradRAM);
 	WriteInt(hndl);
 
 	GetAck();
 }
 
+void Pixxi_Serial_4DLib::setHeap(Pixxi_DisplayHeap4D * heap)
+{
+	_heap = heap;
+}
+
+/*
+ * Display RAM for the widget_Init routines, from the heap if there is one.
+ */
+uint16_t Pixxi_Serial_4DLib::Alloc(uint16_t size)
+{
+	if (_heap != NULL)
+		return _heap->alloc(size);
+	return mem_Alloc(size);
+}
+
 uint16_t Pixxi_Serial_4DLib::widget_InitString(char * str)
 {
 	uint16_t len = strlen(str);
-	uint16_t addr = mem_Alloc(len);
+	uint16_t addr = Alloc(len);
 	SendByteArrayToRAM(addr, len, (uint8_t *) str);
 
 	return addr;
@@ -1900,7 +3223,7 @@ uint16_t Pixxi_Serial_4DLib::widget_InitStringPtr(char * str)
 
 uint16_t Pixxi_Serial_4DLib::widget_InitStringArray(char * str, uint16_t len)
 {
-	uint16_t addr = mem_Alloc(len);
+	uint16_t addr = Alloc(len);
 	SendByteArrayToRAM(addr, len, (uint8_t *) str);
 	addr = str_Ptr(addr);
 
@@ -1909,14 +3232,14 @@ uint16_t Pixxi_Serial_4DLib::widget_InitStringArray(char * str, uint16_t len)
 
 void Pixxi_Serial_4DLib::widget_Init(uint16_t len, uint16_t * data, uint16_t * hndl, uint16_t * param)
 {
-	*param = mem_Alloc(len << 1);
+	*param = Alloc(len << 1);
 	SendWordArrayToRAM(*param, len, data);
-	*hndl = mem_Alloc(24);
+	*hndl = Alloc(24);
 }
 
 uint16_t Pixxi_Serial_4DLib::str_Ptr(uint16_t buffer)
 {
-	WriteInt(F_str_Ptr);
+	WriteCmd(F_str_Ptr);
 	WriteInt(buffer);
 
 	return GetAckResp();
@@ -1924,7 +3247,7 @@ uint16_t Pixxi_Serial_4DLib::str_Ptr(uint16_t buffer)
 
 void Pixxi_Serial_4DLib::SendWordArrayToRAM(uint16_t  hndl, uint16_t  length, uint16_t * data)
 {
-	WriteInt(F_sendWordArrayToRAM);
+	WriteCmd(F_sendWordArrayToRAM);
 	WriteInt(hndl);
 	WriteInt(length);
 	WriteWords(data, length);
@@ -1934,10 +3257,152 @@ void Pixxi_Serial_4DLib::SendWordArrayToRAM(uint16_t  hndl, uint16_t  length, ui
 
 void Pixxi_Serial_4DLib::SendByteArrayToRAM(uint16_t  hndl, uint16_t  length, uint8_t * data)
 {
-	WriteInt(F_sendByteArrayToRAM);
+	WriteCmd(F_sendByteArrayToRAM);
 	WriteInt(hndl);
 	WriteInt(length);
 	WriteBytes(data, length);
 
 	GetAck() ;
 }
+
+//*********************************************************************************************//
+//**********************************Asynchronous 4D Routines***********************************//
+//*********************************************************************************************//
+
+/*
+ * These send the same command as their blocking namesakes but return straight away.
+ * The reply is collected by service(), wait() or any later blocking call.
+ */
+
+Pixxi_Future4D * Pixxi_Serial_4DLib::file_OpenAsync(char *  filename, char  mode, Pixxi_Future4D * result)
+{
+	WriteCmd(F_file_Open);
+	WriteChars(filename);
+	WriteBytes((uint8_t *) &mode, 1);
+
+	return QueueReply(result, PIXXI_REPLY_WORD);
+}
+
+Pixxi_Future4D * Pixxi_Serial_4DLib::file_ReadAsync(uint8_t *  data, uint16_t  size, uint16_t  handle, Pixxi_Future4D * result)
+{
+	result->Data = data;
+	result->Size = size;
+
+	WriteCmd(F_file_Read);
+	WriteInt(size);
+	WriteInt(handle);
+
+	return QueueReply(result, PIXXI_REPLY_DATA);
+}
+
+/*
+ * The data goes out by DMA from Source while the caller carries on, so it is not copied into the ring.
+ */
+Pixxi_Future4D * Pixxi_Serial_4DLib::file_WriteAsync(uint16_t  size, uint8_t * source, uint16_t  handle, Pixxi_Future4D * result)
+{
+	WriteCmd(F_file_Write);
+	WriteInt(size);
+	EmitDirect(source, size);
+	WriteInt(handle);
+
+	return QueueReply(result, PIXXI_REPLY_WORD);
+}
+
+Pixxi_Future4D * Pixxi_Serial_4DLib::gfx_GetPixelAsync(uint16_t  X, uint16_t  Y, Pixxi_Future4D * result)
+{
+	WriteCmd(F_gfx_GetPixel);
+	WriteInt(X);
+	WriteInt(Y);
+
+	return QueueReply(result, PIXXI_REPLY_WORD);
+}
+
+Pixxi_Future4D * Pixxi_Serial_4DLib::img_TouchedAsync(uint16_t  Handle, uint16_t  Index, Pixxi_Future4D * result)
+{
+	WriteCmd(F_img_Touched);
+	WriteInt(Handle);
+	WriteInt(Index);
+
+	return QueueReply(result, PIXXI_REPLY_WORD);
+}
+
+Pixxi_Future4D * Pixxi_Serial_4DLib::media_InitAsync(Pixxi_Future4D * result)
+{
+	WriteCmd(F_media_Init);
+
+	return QueueReply(result, PIXXI_REPLY_WORD);
+}
+
+Pixxi_Future4D * Pixxi_Serial_4DLib::media_RdSectorAsync(uint8_t *  sectorIn, Pixxi_Future4D * result)
+{
+	result->Data = sectorIn;
+	result->Size = 512;
+
+	WriteCmd(F_media_RdSector);
+
+	return QueueReply(result, PIXXI_REPLY_SECTOR);
+}
+
+Pixxi_Future4D * Pixxi_Serial_4DLib::media_SetSectorAsync(uint16_t  hiWord, uint16_t  loWord, Pixxi_Future4D * result)
+{
+	WriteCmd(F_media_SetSector);
+	WriteInt(hiWord);
+	WriteInt(loWord);
+
+	return QueueReply(result, PIXXI_REPLY_ACK);
+}
+
+/*
+ * The sector is copied into the transmit ring, so SectorOut can be reused as soon as this returns.
+ */
+Pixxi_Future4D * Pixxi_Serial_4DLib::media_WrSectorAsync(uint8_t *  sectorOut, Pixxi_Future4D * result)
+{
+	WriteCmd(F_media_WrSector);
+	WriteBytes(sectorOut, 512);
+
+	return QueueReply(result, PIXXI_REPLY_WORD);
+}
+
+Pixxi_Future4D * Pixxi_Serial_4DLib::mem_AllocAsync(uint16_t  size, Pixxi_Future4D * result)
+{
+	WriteCmd(F_mem_Alloc);
+	WriteInt(size);
+
+	return QueueReply(result, PIXXI_REPLY_WORD);
+}
+
+Pixxi_Future4D * Pixxi_Serial_4DLib::SendByteArrayToRAMAsync(uint16_t  hndl, uint16_t  length, uint8_t * data, Pixxi_Future4D * result)
+{
+	WriteCmd(F_sendByteArrayToRAM);
+	WriteInt(hndl);
+	WriteInt(length);
+	WriteBytes(data, length);
+
+	return QueueReply(result, PIXXI_REPLY_ACK);
+}
+
+Pixxi_Future4D * Pixxi_Serial_4DLib::SendWordArrayToRAMAsync(uint16_t  hndl, uint16_t  length, uint16_t * data, Pixxi_Future4D * result)
+{
+	WriteCmd(F_sendWordArrayToRAM);
+	WriteInt(hndl);
+	WriteInt(length);
+	WriteWords(data, length);
+
+	return QueueReply(result, PIXXI_REPLY_ACK);
+}
+
+Pixxi_Future4D * Pixxi_Serial_4DLib::str_PtrAsync(uint16_t buffer, Pixxi_Future4D * result)
+{
+	WriteCmd(F_str_Ptr);
+	WriteInt(buffer);
+
+	return QueueReply(result, PIXXI_REPLY_WORD);
+}
+
+Pixxi_Future4D * Pixxi_Serial_4DLib::touch_GetAsync(uint16_t  Mode, Pixxi_Future4D * result)
+{
+	WriteCmd(F_touch_Get);
+	WriteInt(Mode);
+
+	return QueueReply(result, PIXXI_REPLY_WORD);
+}
@@ -10,20 +10,83 @@
  * Using constants available from 4D Systems, OR provide your own.
  * https://github.com/4dsystems/Pixxi-Serial-Arduino-Library/
  */
-#include "stm32l4xx_hal.h"
 #include "Pixxi_Const4D.h"
+#include "Pixxi_Transport4D.h"
+#include "Pixxi_TxRing4D.h"
+#include "Pixxi_RxRing4D.h"
+#include "Pixxi_Future4D.h"
+#include "Pixxi_DisplayList4D.h"
+#include "Pixxi_Stats4D.h"
+#include "Pixxi_Pack4D.h"
+#include "Pixxi_Convert4D.h"
+#include "Pixxi_Timing4D.h"
 #include <string.h>
 
 typedef void (*Tcallback4D)(int, unsigned char);
+typedef void (*Tcallback4DCmd)(int, unsigned char, uint16_t);
+//Draws the given rectangle into Pixels (Width * Height native RGB565, row by row)
+typedef void (*Trender4D)(void * context, uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t * pixels);
+
+//Most replies which can be outstanding (pipelined ACKs plus async calls)
+#ifndef PIXXI_PIPELINE_MAX
+#define PIXXI_PIPELINE_MAX 16
+#endif
+
+//Shapes of reply the receive path can collect in the background
+#define PIXXI_REPLY_ACK		0	// ACK only
+#define PIXXI_REPLY_WORD	1	// ACK, result
+#define PIXXI_REPLY_DATA	2	// ACK, byte count, that many bytes
+#define PIXXI_REPLY_3WORDS	3	// ACK, result, two more words
+#define PIXXI_REPLY_LIST	4	// one ACK or ACK, result per command of a display list
+#define PIXXI_REPLY_SECTOR	5	// ACK, result, 512 bytes
+
+//Longest string sent in one putstr, longer text is split. Also the size of the print() stack buffers.
+#ifndef PIXXI_STR_MAX
+#define PIXXI_STR_MAX 128
+#endif
+
+//Room assumed for a string read back by calls which are not given its size, terminator included
+#ifndef PIXXI_STR_IN_MAX
+#define PIXXI_STR_IN_MAX 256
+#endif
+
+//GetAckFrame payload whose length is the reply's first word
+#define PIXXI_FRAME_COUNTED -1
+
+//Rates negotiateBaud() tries by default, fastest first. End with one the link is known to manage.
+#ifndef PIXXI_BAUD_RATES
+#define PIXXI_BAUD_RATES BAUD_600000, BAUD_500000, BAUD_375000, BAUD_300000, BAUD_256000, BAUD_128000, BAUD_115200
+#endif
+
+//How long negotiateBaud() waits for each reply while trying a rate, in ms. The ACK comes 100ms after the switch.
+#ifndef PIXXI_BAUD_PROBE_MS
+#define PIXXI_BAUD_PROBE_MS 300
+#endif
+
+//Number bases for print()
+#ifndef DEC
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+#endif
+
+class Pixxi_DisplayHeap4D;
 
 class Pixxi_Serial_4DLib
 {
 	public:
+#ifndef PIXXI_HOST
 		Pixxi_Serial_4DLib(UART_HandleTypeDef * virtualPort);
+#endif
+		Pixxi_Serial_4DLib(PIXXI_TRANSPORT * transport);
 		Tcallback4D Callback4D ;
+		Tcallback4DCmd CallbackCmd4D;	// as Callback4D, plus the opcode of the command which failed
 
 		//STM specific routines
+		void begin(void);
 		void WriteInt(uint16_t data);
+		void TxFlush(void);
 
 		//Compound 4D Routines
 		uint16_t bus_In();
@@ -153,11 +216,27 @@ class Pixxi_Serial_4DLib
 		void pokeM(uint16_t  Address, uint16_t  WordValue) ;
 		uint16_t putstr(char *  InString);
 		/**
-		 * This orginal library includes a number of conversion functions
-		 * which I have chosen not to implement here out of laziness.
+		 * Text output. Each call formats into a buffer on the stack and goes out as a single
+		 * putstr (one per PIXXI_STR_MAX characters), so a whole line is one round trip, or
+		 * none when pipelining. println() adds "\n\r" in the same command.
 		 */
 		void print(const char[]);
+		void print(char c);
+		void print(int n, uint8_t base = DEC);
+		void print(unsigned int n, uint8_t base = DEC);
+		void print(long n, uint8_t base = DEC);
+		void print(unsigned long n, uint8_t base = DEC);
+		void print(double n, uint8_t digits = 2);
+		//value / 10^decimals, e.g. printFixed(2315, 2) prints 23.15
+		void printFixed(long value, uint8_t decimals);
+		void println(void);
 		void println(const char[]);
+		void println(char c);
+		void println(int n, uint8_t base = DEC);
+		void println(unsigned int n, uint8_t base = DEC);
+		void println(long n, uint8_t base = DEC);
+		void println(unsigned long n, uint8_t base = DEC);
+		void println(double n, uint8_t digits = 2);
 
 		void snd_BufSize(uint16_t  Bufsize);
 		void snd_Continue();
@@ -188,16 +267,18 @@ class Pixxi_Serial_4DLib
 		uint16_t txt_Xgap(uint16_t  Pixels);
 		uint16_t txt_Ygap(uint16_t  Pixels);
 		uint16_t file_CallFunction(uint16_t  Handle, uint16_t  ArgCount, uint16_t *  Args);
-		uint16_t sys_GetModel(char *  ModelStr);
+		uint16_t sys_GetModel(char *  ModelStr, uint16_t  Size = PIXXI_STR_IN_MAX);
 		uint16_t sys_GetVersion();
 		uint16_t sys_GetPmmC();
 		uint16_t writeString(uint16_t  Handle, char *  StringOut);
-		uint16_t readString(uint16_t  Handle, char *  StringIn);
+		uint16_t readString(uint16_t  Handle, char *  StringIn, uint16_t  Size = PIXXI_STR_IN_MAX);
 		void blitComtoDisplay(uint16_t  X, uint16_t  Y, uint16_t  Width, uint16_t  Height, uint8_t *  Pixels);
+		void blitStream(uint16_t  X, uint16_t  Y, uint16_t  Width, uint16_t  Height, Trender4D Source, void * Context, uint16_t * Buffer, uint32_t BufferPixels, bool Packed = false);
+		void blitImage(uint16_t  X, uint16_t  Y, Pixxi_Image4D * Image, uint16_t * Buffer, uint32_t BufferPixels);
 		void SendWordArrayToRAM(uint16_t  hndl, uint16_t  length, uint16_t * data);
 		void SendByteArrayToRAM(uint16_t  hndl, uint16_t  length, uint8_t * data);
-		uint16_t file_FindFirstRet(char *  Filename, char *  StringIn);
-		uint16_t file_FindNextRet(char *  StringIn);
+		uint16_t file_FindFirstRet(char *  Filename, char *  StringIn, uint16_t  Size = PIXXI_STR_IN_MAX);
+		uint16_t file_FindNextRet(char *  StringIn, uint16_t  Size = PIXXI_STR_IN_MAX);
 		void setbaudWait(uint16_t  Newrate);
 		uint16_t widget_Create(uint16_t count);
 		void widget_Add(uint16_t hndl, uint16_t index, uint16_t widget);
@@ -219,9 +300,80 @@ class Pixxi_Serial_4DLib
 
 		void GetAck(void);
 
+		//ACK pipelining
+		void setPipelineDepth(uint8_t depth);
+		uint8_t pipelineDepth(void);
+		uint16_t CollectAcks(void);
+		uint32_t PipelineErrors;	// number of pipelined commands which failed
+
+		//Asynchronous calls, see Pixxi_Future4D.h
+		Pixxi_Future4D * file_OpenAsync(char *  Filename, char  Mode, Pixxi_Future4D * Result);
+		Pixxi_Future4D * file_ReadAsync(uint8_t *  Data, uint16_t  Size, uint16_t  Handle, Pixxi_Future4D * Result);
+		//Source is sent straight from the caller's buffer, it must stay put until Result is ready
+		Pixxi_Future4D * file_WriteAsync(uint16_t  Size, uint8_t * Source, uint16_t  Handle, Pixxi_Future4D * Result);
+		Pixxi_Future4D * gfx_GetPixelAsync(uint16_t  X, uint16_t  Y, Pixxi_Future4D * Result);
+		Pixxi_Future4D * img_TouchedAsync(uint16_t  Handle, uint16_t  Index, Pixxi_Future4D * Result);
+		Pixxi_Future4D * media_InitAsync(Pixxi_Future4D * Result);
+		Pixxi_Future4D * media_RdSectorAsync(uint8_t *  SectorIn, Pixxi_Future4D * Result);
+		Pixxi_Future4D * media_SetSectorAsync(uint16_t  HiWord, uint16_t  LoWord, Pixxi_Future4D * Result);
+		Pixxi_Future4D * media_WrSectorAsync(uint8_t *  SectorOut, Pixxi_Future4D * Result);
+		Pixxi_Future4D * mem_AllocAsync(uint16_t  Size, Pixxi_Future4D * Result);
+		Pixxi_Future4D * SendByteArrayToRAMAsync(uint16_t  hndl, uint16_t  length, uint8_t * data, Pixxi_Future4D * Result);
+		Pixxi_Future4D * SendWordArrayToRAMAsync(uint16_t  hndl, uint16_t  length, uint16_t * data, Pixxi_Future4D * Result);
+		Pixxi_Future4D * str_PtrAsync(uint16_t buffer, Pixxi_Future4D * Result);
+		Pixxi_Future4D * touch_GetAsync(uint16_t  Mode, Pixxi_Future4D * Result);
+		void service(void);
+		bool wait(Pixxi_Future4D * Result);
+		uint8_t pending(void);
+		//True if a command of this many bytes could be written now without waiting for the link or a reply
+		bool ready(uint32_t Bytes);
+		//Total bytes handed to the transmit ring
+		uint32_t txBytes(void);
+		//The transport's millisecond clock, which the timeouts run on
+		uint32_t millis(void);
+
+		//Render state shadow
+		void setStateCache(bool on);
+		void invalidateState(void);
+		uint32_t StateSkipped;		// setters not sent as the value was already current (round trips saved)
+		uint32_t StateSent;			// setters which did go to the display
+
+		//Where widget_Init, widget_InitString and widget_InitStringArray get display RAM, see Pixxi_Heap4D.h. NULL for mem_Alloc.
+		void setHeap(Pixxi_DisplayHeap4D * heap);
+
+#ifdef PIXXI_STATS
+		//Instrumentation, see Pixxi_Stats4D.h
+		Pixxi_Stats4D Stats;
+#endif
+
+		/**
+		 * Move the link to the fastest of Rates (BAUD_ codes, fastest first, PIXXI_BAUD_RATES if NULL)
+		 * both ends manage: each is set with setbaudWait and checked with sys_GetVersion, stepping
+		 * down to the next if either fails. Returns the line rate in use afterwards, 0 if none worked.
+		 */
+		uint32_t negotiateBaud(const uint16_t * Rates = NULL, uint8_t Count = 0);
+		//Line rate of a BAUD_ code, 0 if unknown
+		static uint32_t baudRate(uint16_t Newrate);
+		//BAUD_ code of a line rate, 0 if there is none
+		static uint16_t baudCode(uint32_t Rate);
+
+		//Adaptive timeouts, see Pixxi_Timing4D.h. calibrate() learns the link and turns them on.
+		bool calibrate(void);
+		Pixxi_Timing4D Timing;
+
+		//Display lists, see Pixxi_DisplayList4D.h
+		void beginList(Pixxi_DisplayList4D * list);
+		void endList(void);
+		uint16_t replay(Pixxi_DisplayList4D * list);
+
+		//Send a command encoded elsewhere (see Pixxi_Queue4D.h), opcode first, with its reply going to Result
+		Pixxi_Future4D * submit(const uint8_t * Command, uint16_t Size, const uint8_t * Payload, uint32_t PayloadSize, uint8_t Reply, Pixxi_Future4D * Result);
+
 		//4D Global Variables Used
 		int Error4D;  				// Error indicator,  used and set by Intrinsic routines
 		unsigned char Error4D_Inv;	// Error byte returned from com port, onl set if error = Err_Invalid
+		uint16_t Error4D_Cmd;		// Opcode of the command the last error belongs to
+		uint32_t Errors4D;			// Errors reported so far, whenever their reply came in
 	//	int Error_Abort4D;  		// if true routines will abort when detecting an error
 
 		/**
@@ -234,25 +386,92 @@ class Pixxi_Serial_4DLib
 									// or indeterminate (eg file_exec, file_run, file_callFunction) commands
 
 	private:
-		UART_HandleTypeDef * _huart;
+#ifndef PIXXI_HOST
+		Pixxi_HalTransport4D _halPort;	// used when constructed from a UART handle
+#endif
+		PIXXI_TRANSPORT * _port;
+		Pixxi_TxRing4D _tx;
+		Pixxi_RxRing4D _rx;
+
+		//A reply the display still owes us
+		struct Reply4D {
+			uint16_t Cmd;
+			uint8_t Kind;			// PIXXI_REPLY_
+			uint8_t Stage;			// 0 waiting for the ACK, then one per word received
+			uint16_t Words[3];
+			uint16_t Got;			// data bytes received so far
+			Pixxi_Future4D * Future;	// NULL for pipelined ACKs
+			Pixxi_DisplayList4D * List;	// for PIXXI_REPLY_LIST, Words[0] is the command being read
+			uint32_t Bytes;			// sent for it, and queued ahead of it, for its timeout
+#ifdef PIXXI_STATS
+			uint32_t Start;			// Pixxi_Stats4D::now() when the command was started
+#endif
+		};
+
+		uint16_t _replyCmd;			// command whose reply is being read
+		uint32_t _cmdMs;			// when it was started
+		uint32_t _cmdBytes;			// bytes it moves, counting any queued ahead of it
+#ifdef PIXXI_STATS
+		uint32_t _cmdStart;			// Pixxi_Stats4D::now() when it was started
+#endif
+		uint8_t _pipeDepth;
+		Reply4D _replies[PIXXI_PIPELINE_MAX];	// outstanding replies, oldest at _pipeTail
+		uint32_t _replyStart;		// when the oldest one started being waited for
+		uint8_t _pipeHead;
+		uint8_t _pipeTail;
+		uint8_t _pipeCount;
+		Pixxi_DisplayList4D * _list;	// being recorded, everything written goes here instead
+		bool _draining;				// throwing away late bytes after a timeout
+		uint32_t _drainStart;
+		uint32_t _drainFrom;		// when the last of them came in
+
+		bool _stateOn;
+		uint32_t _stateKnown;		// bit per STATE_ slot whose value is known
+		uint16_t _stateValue[32];	// one per bit of _stateKnown
+		Pixxi_DisplayHeap4D * _heap;
+
+		void init(void);
 
 		//Intrinsic 4D Routines
+		void WriteCmd(uint16_t cmd);
+		void Emit(const uint8_t * data, uint32_t size);
+		void EmitDirect(const uint8_t * data, uint32_t size);
 		void WriteChars(char * charsout);
-		void WriteBytes(uint8_t * Source, int Size);
+		void WriteBytes(uint8_t * Source, uint32_t Size);
 		void WriteWords(uint16_t * Source, int Size);
-		void getbytes(uint8_t * data, int size);
-		uint16_t GetWord(void);
-		void getString(char * outStr, int strLen);
+		bool ReadBytes(uint8_t * data, int size);
+		uint32_t ReplyFrom(void);
+		uint32_t ReplyLimit(uint32_t size);
+		void Resync(void);
+		bool Drained(void);
+		void CommandDone(void);
+		void ReportError(void);
+		bool StateIs(uint8_t slot, uint16_t value);
+		static bool StateKept(uint16_t opcode);
+		void StateSet(uint8_t slot, uint16_t value);
+		void WaitAck(void);
+		void CollectAck(void);
+		Pixxi_Future4D * QueueReply(Pixxi_Future4D * future, uint8_t kind);
+		bool ServiceReply(void);
+		bool ServiceList(Reply4D * reply);
+		uint32_t RxTake(Reply4D * reply, uint8_t * dest, uint32_t size);
+		bool ReplyTimedOut(void);
+		void FinishReply(int error);
 		int GetAckResp(void);
+		uint32_t GetAckFrame(uint16_t * words, uint8_t count, uint8_t * dest, uint32_t capacity, int32_t payload);
 		uint16_t GetAckRes2Words(uint16_t * word1, uint16_t * word2);
 		void GetAck2Words(uint16_t * word1, uint16_t * word2);
 		uint16_t GetAckResSector(uint8_t * Sector);
-		uint16_t GetAckResStr(char * OutStr);
+		uint16_t GetAckResStr(char * OutStr, uint16_t size);
 		uint16_t GetAckResData(uint8_t * OutData, uint16_t size);
 		void SetThisBaudrate(int Newrate);
+		void RestoreBaud(uint32_t rate);
+		uint16_t Alloc(uint16_t size);
 
-		void printNumber(unsigned long, uint8_t);
-		void printFloat(double number, uint8_t digits);
+		void WriteText(const char * text, uint32_t size, bool newline);
+		uint8_t printNumber(char * dest, unsigned long n, uint8_t base);
+		uint8_t printSigned(char * dest, long n, uint8_t base);
+		uint8_t printFloat(char * dest, double number, uint8_t digits);
 };
 
 
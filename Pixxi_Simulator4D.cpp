@@ -0,0 +1,1361 @@
+/**
+ * Host (Linux) simulator of a Pixxi display.
+ * See header for description.
+ */
+
+#ifdef PIXXI_HOST
+
+#include "Pixxi_Simulator4D.h"
+#include "Pixxi_Serial_4Dlib.h"
+#include "Pixxi_Rle4D.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+//Argument layouts which are not a fixed number of words
+#define ARGS_STRING		-1	// null terminated string
+#define ARGS_POLYGON	-2	// n, n X words, n Y words, colour
+#define ARGS_WORDARRAY	-3	// handle, n, n words
+#define ARGS_BYTEARRAY	-4	// handle, n, n bytes
+#define ARGS_BLIT		-5	// x, y, width, height, then width * height big-endian pixels streamed by blitByte()
+#define ARGS_OPEN		-6	// null terminated string, mode byte
+#define ARGS_WRITE		-7	// n, n bytes, handle
+#define ARGS_PUTS		-8	// null terminated string, handle
+#define ARGS_SECTOR		-9	// 512 bytes
+
+#define REPLY_ACK		0
+#define REPLY_WORD		1
+#define REPLY_DATA		2
+#define REPLY_3WORDS	3
+#define REPLY_SECTOR	5
+
+//Text cell, 5x7 glyphs with a column and a row of spacing
+#define CELL_WIDTH		6
+#define CELL_HEIGHT		8
+
+typedef struct {
+	uint16_t Opcode;
+	int8_t Args;		// words, or one of ARGS_
+	uint8_t Reply;
+} Command4D;
+
+static const Command4D Table[] = {
+	{F_gfx_Cls, 0, REPLY_ACK},
+	{F_gfx_Line, 5, REPLY_ACK},
+	{F_gfx_LineTo, 2, REPLY_ACK},
+	{F_gfx_MoveTo, 2, REPLY_ACK},
+	{F_gfx_PutPixel, 3, REPLY_ACK},
+	{F_gfx_Rectangle, 5, REPLY_ACK},
+	{F_gfx_RectangleFilled, 5, REPLY_ACK},
+	{F_gfx_Circle, 4, REPLY_ACK},
+	{F_gfx_CircleFilled, 4, REPLY_ACK},
+	{F_gfx_Triangle, 7, REPLY_ACK},
+	{F_gfx_TriangleFilled, 7, REPLY_ACK},
+	{F_gfx_Polygon, ARGS_POLYGON, REPLY_ACK},
+	{F_gfx_PolygonFilled, ARGS_POLYGON, REPLY_ACK},
+	{F_gfx_Polyline, ARGS_POLYGON, REPLY_ACK},
+	{F_gfx_Clipping, 1, REPLY_ACK},
+	{F_gfx_Set, 2, REPLY_ACK},
+	{F_gfx_ScreenMode, 1, REPLY_WORD},
+	{F_txt_Set, 2, REPLY_ACK},
+	{F_txt_MoveCursor, 2, REPLY_ACK},
+	{F_putCH, 1, REPLY_ACK},
+	{F_putstr, ARGS_STRING, REPLY_WORD},
+	{F_sys_GetVersion, 0, REPLY_WORD},
+	{F_sys_GetPmmC, 0, REPLY_WORD},
+	{F_mem_Alloc, 1, REPLY_WORD},
+	{F_mem_Free, 1, REPLY_WORD},
+	{F_mem_Heap, 0, REPLY_WORD},
+	{F_setbaudWait, 1, REPLY_ACK},
+	{F_sendWordArrayToRAM, ARGS_WORDARRAY, REPLY_ACK},
+	{F_sendByteArrayToRAM, ARGS_BYTEARRAY, REPLY_ACK},
+	{F_blitComtoDisplay, ARGS_BLIT, REPLY_ACK},
+	{F_file_LoadFunction, ARGS_STRING, REPLY_WORD},
+	{F_file_CallFunction, ARGS_WORDARRAY, REPLY_WORD},
+	{F_file_Open, ARGS_OPEN, REPLY_WORD},
+	{F_file_Read, 2, REPLY_DATA},
+	{F_file_Seek, 3, REPLY_WORD},
+	{F_file_Tell, 1, REPLY_3WORDS},
+	{F_file_Size, 1, REPLY_3WORDS},
+	{F_file_Close, 1, REPLY_WORD},
+	{F_file_Error, 0, REPLY_WORD},
+	{F_file_Write, ARGS_WRITE, REPLY_WORD},
+	{F_file_PutC, 2, REPLY_WORD},
+	{F_file_PutW, 2, REPLY_WORD},
+	{F_file_PutS, ARGS_PUTS, REPLY_WORD},
+	{F_media_Init, 0, REPLY_WORD},
+	{F_media_SetSector, 2, REPLY_ACK},
+	{F_media_RdSector, 0, REPLY_SECTOR},
+	{F_media_WrSector, ARGS_SECTOR, REPLY_WORD},
+	{F_media_Flush, 0, REPLY_WORD},
+	{F_media_Video, 2, REPLY_ACK},
+	{F_media_VideoFrame, 3, REPLY_ACK},
+};
+
+//First mem_Alloc handle. Handles are word addresses, as on the display: byte 2 * (handle - RAM_BASE) of the simulated RAM.
+#define RAM_BASE		0x1000
+#define RAM_WORDS		(PIXXI_SIM_RAM_SIZE / 2)
+
+/*
+ * Setters which take one word and return the previous value, with their power-on values.
+ */
+typedef struct {
+	uint16_t Opcode;
+	uint16_t Initial;
+} Setting4D;
+
+static const Setting4D Settings[] = {
+	{F_txt_FGcolour, WHITE},
+	{F_txt_BGcolour, BLACK},
+	{F_txt_FontID, 0},
+	{F_txt_Width, 1},
+	{F_txt_Height, 1},
+	{F_txt_Xgap, 0},
+	{F_txt_Ygap, 0},
+	{F_txt_Opacity, 0},
+	{F_txt_Wrap, 0},
+	{F_txt_Bold, 0},
+	{F_txt_Italic, 0},
+	{F_txt_Inverse, 0},
+	{F_txt_Underline, 0},
+	{F_txt_Attributes, 0},
+	{F_gfx_BGcolour, BLACK},
+	{F_gfx_OutlineColour, 0},
+	{F_gfx_LinePattern, 0},
+	{F_gfx_Transparency, 0},
+	{F_gfx_TransparentColour, 0},
+	{F_gfx_BevelShadow, 0},
+	{F_gfx_BevelWidth, 0},
+	{F_gfx_Contrast, 15},
+};
+
+#define COMMAND_COUNT (sizeof(Table) / sizeof(Table[0]))
+#define SETTING_COUNT (sizeof(Settings) / sizeof(Settings[0]))
+
+//5x7 font for ' ' to '~', one byte per column, bit 0 at the top
+static const uint8_t Font5x7[95][5] = {
+	{0x00,0x00,0x00,0x00,0x00}, {0x00,0x00,0x5F,0x00,0x00}, {0x00,0x07,0x00,0x07,0x00}, {0x14,0x7F,0x14,0x7F,0x14},
+	{0x24,0x2A,0x7F,0x2A,0x12}, {0x23,0x13,0x08,0x64,0x62}, {0x36,0x49,0x56,0x20,0x50}, {0x00,0x08,0x07,0x03,0x00},
+	{0x00,0x1C,0x22,0x41,0x00}, {0x00,0x41,0x22,0x1C,0x00}, {0x2A,0x1C,0x7F,0x1C,0x2A}, {0x08,0x08,0x3E,0x08,0x08},
+	{0x00,0x80,0x70,0x30,0x00}, {0x08,0x08,0x08,0x08,0x08}, {0x00,0x00,0x60,0x60,0x00}, {0x20,0x10,0x08,0x04,0x02},
+	{0x3E,0x51,0x49,0x45,0x3E}, {0x00,0x42,0x7F,0x40,0x00}, {0x72,0x49,0x49,0x49,0x46}, {0x21,0x41,0x49,0x4D,0x33},
+	{0x18,0x14,0x12,0x7F,0x10}, {0x27,0x45,0x45,0x45,0x39}, {0x3C,0x4A,0x49,0x49,0x31}, {0x41,0x21,0x11,0x09,0x07},
+	{0x36,0x49,0x49,0x49,0x36}, {0x46,0x49,0x49,0x29,0x1E}, {0x00,0x00,0x14,0x00,0x00}, {0x00,0x40,0x34,0x00,0x00},
+	{0x00,0x08,0x14,0x22,0x41}, {0x14,0x14,0x14,0x14,0x14}, {0x00,0x41,0x22,0x14,0x08}, {0x02,0x01,0x59,0x09,0x06},
+	{0x3E,0x41,0x5D,0x59,0x4E}, {0x7C,0x12,0x11,0x12,0x7C}, {0x7F,0x49,0x49,0x49,0x36}, {0x3E,0x41,0x41,0x41,0x22},
+	{0x7F,0x41,0x41,0x41,0x3E}, {0x7F,0x49,0x49,0x49,0x41}, {0x7F,0x09,0x09,0x09,0x01}, {0x3E,0x41,0x41,0x51,0x73},
+	{0x7F,0x08,0x08,0x08,0x7F}, {0x00,0x41,0x7F,0x41,0x00}, {0x20,0x40,0x41,0x3F,0x01}, {0x7F,0x08,0x14,0x22,0x41},
+	{0x7F,0x40,0x40,0x40,0x40}, {0x7F,0x02,0x1C,0x02,0x7F}, {0x7F,0x04,0x08,0x10,0x7F}, {0x3E,0x41,0x41,0x41,0x3E},
+	{0x7F,0x09,0x09,0x09,0x06}, {0x3E,0x41,0x51,0x21,0x5E}, {0x7F,0x09,0x19,0x29,0x46}, {0x26,0x49,0x49,0x49,0x32},
+	{0x03,0x01,0x7F,0x01,0x03}, {0x3F,0x40,0x40,0x40,0x3F}, {0x1F,0x20,0x40,0x20,0x1F}, {0x3F,0x40,0x38,0x40,0x3F},
+	{0x63,0x14,0x08,0x14,0x63}, {0x03,0x04,0x78,0x04,0x03}, {0x61,0x59,0x49,0x4D,0x43}, {0x00,0x7F,0x41,0x41,0x41},
+	{0x02,0x04,0x08,0x10,0x20}, {0x00,0x41,0x41,0x41,0x7F}, {0x04,0x02,0x01,0x02,0x04}, {0x40,0x40,0x40,0x40,0x40},
+	{0x00,0x03,0x07,0x08,0x00}, {0x20,0x54,0x54,0x78,0x40}, {0x7F,0x28,0x44,0x44,0x38}, {0x38,0x44,0x44,0x44,0x28},
+	{0x38,0x44,0x44,0x28,0x7F}, {0x38,0x54,0x54,0x54,0x18}, {0x00,0x08,0x7E,0x09,0x02}, {0x18,0xA4,0xA4,0x9C,0x78},
+	{0x7F,0x08,0x04,0x04,0x78}, {0x00,0x44,0x7D,0x40,0x00}, {0x20,0x40,0x40,0x3D,0x00}, {0x7F,0x10,0x28,0x44,0x00},
+	{0x00,0x41,0x7F,0x40,0x00}, {0x7C,0x04,0x78,0x04,0x78}, {0x7C,0x08,0x04,0x04,0x78}, {0x38,0x44,0x44,0x44,0x38},
+	{0xFC,0x18,0x24,0x24,0x18}, {0x18,0x24,0x24,0x18,0xFC}, {0x7C,0x08,0x04,0x04,0x08}, {0x48,0x54,0x54,0x54,0x24},
+	{0x04,0x04,0x3F,0x44,0x24}, {0x3C,0x40,0x40,0x20,0x7C}, {0x1C,0x20,0x40,0x20,0x1C}, {0x3C,0x40,0x30,0x40,0x3C},
+	{0x44,0x28,0x10,0x28,0x44}, {0x4C,0x90,0x90,0x90,0x7C}, {0x44,0x64,0x54,0x4C,0x44}, {0x00,0x08,0x36,0x41,0x00},
+	{0x00,0x00,0x77,0x00,0x00}, {0x00,0x41,0x36,0x08,0x00}, {0x02,0x01,0x02,0x04,0x02},
+};
+
+Pixxi_Simulator4D::Pixxi_Simulator4D(uint16_t width, uint16_t height) {
+	Width = width;
+	Height = height;
+	Framebuffer = (uint16_t *) calloc((uint32_t) width * height, sizeof(uint16_t));
+
+	DefaultExecUs = 20;
+	PixelNs = 10;
+	FileByteNs = 200;
+	Baud = 0;
+	MaxBaud = 0;
+
+	_port = NULL;
+	_execCount = 0;
+	_functionCount = 0;
+	addFunction(PIXXI_RLE_DECODER, rleDecode);
+	memset(_files, 0, sizeof(_files));
+	_media = NULL;
+	_mediaSize = 0;
+	_frameUs = NULL;
+	_frameCount = 0;
+	reset();
+}
+
+Pixxi_Simulator4D::~Pixxi_Simulator4D() {
+	free(Framebuffer);
+	for (uint8_t i = 0; i < PIXXI_SIM_FILES; i++)
+		free(_files[i].Data);
+	free(_media);
+	free(_frameUs);
+}
+
+void Pixxi_Simulator4D::attach(Pixxi_SimTransport4D * port)
+{
+	_port = port;
+	_port->Responder = respond;
+	_port->ResponderContext = this;
+}
+
+void Pixxi_Simulator4D::reset(void)
+{
+	memset(Framebuffer, 0, (uint32_t) Width * Height * sizeof(uint16_t));
+
+	for (uint8_t i = 0; i < SETTING_COUNT; i++)
+		_settings[i] = Settings[i].Initial;
+
+	_cmdLen = 0;
+	_discard = false;
+	_blitLeft = 0;
+	_blitAt = 0;
+	_blitHigh = 0;
+	_freeAt = 0;
+	_penX = 0;
+	_penY = 0;
+	_textX = 0;
+	_textY = 0;
+	_blocks = 0;
+	memset(_ram, 0, sizeof(_ram));
+	setGRAM(0, 0, Width - 1, Height - 1);
+	//The card keeps its files, but nothing is open any more
+	for (uint8_t i = 0; i < PIXXI_SIM_HANDLES; i++)
+		_handles[i] = -1;
+	_fileError = 0;
+	_mediaAt = 0;
+	_extraNs = 0;
+
+	Commands = 0;
+	Unknown = 0;
+	Garbled = 0;
+	Pixels = 0;
+	FileBytes = 0;
+	MediaSeeks = 0;
+	MediaSectors = 0;
+	VideoFrames = 0;
+	MemAllocs = 0;
+	MemFrees = 0;
+	HeapUsed = 0;
+	BusyNs = 0;
+}
+
+void Pixxi_Simulator4D::setExecUs(uint16_t opcode, uint32_t us)
+{
+	for (uint8_t i = 0; i < _execCount; i++)
+	{
+		if (_execOpcodes[i] == opcode)
+		{
+			_execUs[i] = us;
+			return;
+		}
+	}
+
+	if (_execCount < PIXXI_SIM_EXEC_TIMES)
+	{
+		_execOpcodes[_execCount] = opcode;
+		_execUs[_execCount] = us;
+		_execCount++;
+	}
+}
+
+bool Pixxi_Simulator4D::addFunction(const char * name, TsimFunction4D function)
+{
+	if (_functionCount == PIXXI_SIM_FUNCTIONS)
+		return false;
+	_functionNames[_functionCount] = name;
+	_functions[_functionCount] = function;
+	_functionCount++;
+	return true;
+}
+
+uint16_t Pixxi_Simulator4D::ramWord(uint16_t handle, uint16_t index)
+{
+	uint32_t offset = 2 * ((uint32_t) handle - RAM_BASE + index);
+	if (handle < RAM_BASE || offset + 2 > PIXXI_SIM_RAM_SIZE)
+		return 0;
+	//Little-endian, as on the display
+	return _ram[offset] | _ram[offset + 1] << 8;
+}
+
+void Pixxi_Simulator4D::setGRAM(int32_t x1, int32_t y1, int32_t x2, int32_t y2)
+{
+	_gramX1 = x1;
+	_gramY1 = y1;
+	_gramX2 = x2;
+	_gramY2 = y2;
+	_gramX = x1;
+	_gramY = y1;
+}
+
+void Pixxi_Simulator4D::writeGRAM(uint16_t colour)
+{
+	plot(_gramX, _gramY, colour);
+	if (++_gramX > _gramX2)
+	{
+		_gramX = _gramX1;
+		if (++_gramY > _gramY2)
+			_gramY = _gramY1;
+	}
+}
+
+/**
+ * uSD card
+ */
+
+/*
+ * First fit, in words as the display keeps its heap. 0 if there is no gap big enough.
+ */
+uint16_t Pixxi_Simulator4D::memAlloc(uint16_t size)
+{
+	uint32_t need = (size + 1) / 2;
+	uint32_t at = RAM_BASE;
+	uint16_t i;
+
+	MemAllocs++;
+	if (_blocks == PIXXI_SIM_BLOCKS || need == 0)
+		return 0;
+
+	for (i = 0; i < _blocks; i++)
+	{
+		if (_blockAt[i] - at >= need)
+			break;
+		at = _blockAt[i] + _blockSize[i];
+	}
+	if (i == _blocks && RAM_BASE + RAM_WORDS - at < need)
+		return 0;
+
+	memmove(&_blockAt[i + 1], &_blockAt[i], (_blocks - i) * sizeof(_blockAt[0]));
+	memmove(&_blockSize[i + 1], &_blockSize[i], (_blocks - i) * sizeof(_blockSize[0]));
+	_blockAt[i] = at;
+	_blockSize[i] = need;
+	_blocks++;
+	HeapUsed += 2 * need;
+	return at;
+}
+
+bool Pixxi_Simulator4D::memFree(uint16_t handle)
+{
+	MemFrees++;
+	for (uint16_t i = 0; i < _blocks; i++)
+	{
+		if (_blockAt[i] != handle)
+			continue;
+
+		HeapUsed -= 2 * _blockSize[i];
+		_blocks--;
+		memmove(&_blockAt[i], &_blockAt[i + 1], (_blocks - i) * sizeof(_blockAt[0]));
+		memmove(&_blockSize[i], &_blockSize[i + 1], (_blocks - i) * sizeof(_blockSize[0]));
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Largest block mem_Alloc could hand out now, as mem_Heap reports it.
+ */
+uint16_t Pixxi_Simulator4D::memHeap(void)
+{
+	uint32_t at = RAM_BASE;
+	uint32_t largest = 0;
+
+	for (uint16_t i = 0; i <= _blocks; i++)
+	{
+		uint32_t end = i < _blocks ? _blockAt[i] : RAM_BASE + RAM_WORDS;
+		if (end - at > largest)
+			largest = end - at;
+		if (i < _blocks)
+			at = _blockAt[i] + _blockSize[i];
+	}
+	return 2 * largest < 0xFFFF ? 2 * largest : 0xFFFF;
+}
+
+Pixxi_SimFile4D * Pixxi_Simulator4D::findFile(const char * name)
+{
+	for (uint8_t i = 0; i < PIXXI_SIM_FILES; i++)
+	{
+		if (_files[i].Name[0] != 0 && strcasecmp(_files[i].Name, name) == 0)
+			return &_files[i];
+	}
+	return NULL;
+}
+
+bool Pixxi_Simulator4D::addFile(const char * name, const uint8_t * data, uint32_t size)
+{
+	Pixxi_SimFile4D * file = findFile(name);
+
+	for (uint8_t i = 0; file == NULL && i < PIXXI_SIM_FILES; i++)
+	{
+		if (_files[i].Name[0] == 0)
+			file = &_files[i];
+	}
+	if (file == NULL || strlen(name) >= sizeof(file->Name))
+		return false;
+
+	strcpy(file->Name, name);
+	free(file->Data);
+	file->Data = (uint8_t *) malloc(size + 1);
+	if (size > 0)
+		memcpy(file->Data, data, size);
+	file->Size = size;
+	file->Capacity = size + 1;
+	return true;
+}
+
+const uint8_t * Pixxi_Simulator4D::file(const char * name, uint32_t * size)
+{
+	Pixxi_SimFile4D * file = findFile(name);
+
+	if (file == NULL)
+		return NULL;
+	*size = file->Size;
+	return file->Data;
+}
+
+void Pixxi_Simulator4D::setMedia(uint32_t sectors)
+{
+	free(_media);
+	_media = (uint8_t *) calloc(sectors, 512);
+	_mediaSize = sectors;
+	_mediaAt = 0;
+}
+
+uint8_t * Pixxi_Simulator4D::mediaSector(uint32_t sector)
+{
+	return sector < _mediaSize ? _media + 512 * sector : NULL;
+}
+
+void Pixxi_Simulator4D::setFrameUs(const uint32_t * us, uint16_t count)
+{
+	free(_frameUs);
+	_frameUs = (uint32_t *) malloc(count * sizeof(uint32_t));
+	_frameCount = _frameUs != NULL ? count : 0;
+	if (_frameCount > 0)
+		memcpy(_frameUs, us, count * sizeof(uint32_t));
+}
+
+/*
+ * file_Open: 'r' needs the file to be there, 'w' starts it afresh, 'a' carries on at the end.
+ * Returns the handle, 0 if it could not be opened.
+ */
+int8_t Pixxi_Simulator4D::openFile(const char * name, char mode)
+{
+	Pixxi_SimFile4D * file = findFile(name);
+	int8_t handle = -1;
+
+	for (uint8_t i = 0; i < PIXXI_SIM_HANDLES && handle < 0; i++)
+	{
+		if (_handles[i] < 0)
+			handle = i;
+	}
+	if (handle < 0)
+		return 0;
+
+	if (file == NULL && (mode == 'w' || mode == 'a'))
+	{
+		if (!addFile(name, NULL, 0))
+			return 0;
+		file = findFile(name);
+	}
+	if (file == NULL)
+		return 0;
+	if (mode == 'w')
+		file->Size = 0;
+
+	_handles[handle] = file - _files;
+	_handleAt[handle] = mode == 'a' ? file->Size : 0;
+	return handle + 1;
+}
+
+Pixxi_SimFile4D * Pixxi_Simulator4D::handleFile(uint16_t handle)
+{
+	if (handle == 0 || handle > PIXXI_SIM_HANDLES || _handles[handle - 1] < 0)
+		return NULL;
+	return &_files[_handles[handle - 1]];
+}
+
+/*
+ * file_Read answers with ACK, the byte count and that many bytes.
+ */
+void Pixxi_Simulator4D::fileRead(uint16_t size, uint16_t handle)
+{
+	Pixxi_SimFile4D * file = handleFile(handle);
+	uint8_t * answer = (uint8_t *) malloc(3 + size);
+	uint16_t count = 0;
+
+	if (file != NULL)
+	{
+		uint32_t at = _handleAt[handle - 1];
+		count = at >= file->Size ? 0 : (file->Size - at < size ? file->Size - at : size);
+		memcpy(answer + 3, file->Data + at, count);
+		_handleAt[handle - 1] += count;
+		FileBytes += count;
+	}
+	_fileError = file == NULL ? 1 : 0;
+
+	answer[0] = 6;
+	answer[1] = count >> 8;
+	answer[2] = count & 0xFF;
+	reply(answer, 3 + count);
+	free(answer);
+}
+
+/*
+ * Write at the handle's position, growing the file as needed. Returns the bytes written.
+ */
+uint16_t Pixxi_Simulator4D::fileWrite(const uint8_t * data, uint16_t size, uint16_t handle)
+{
+	Pixxi_SimFile4D * file = handleFile(handle);
+
+	_fileError = file == NULL ? 1 : 0;
+	if (file == NULL)
+		return 0;
+
+	uint32_t at = _handleAt[handle - 1];
+	if (at + size > file->Capacity)
+	{
+		file->Capacity = (at + size) * 2;
+		file->Data = (uint8_t *) realloc(file->Data, file->Capacity);
+	}
+	memcpy(file->Data + at, data, size);
+	_handleAt[handle - 1] = at + size;
+	if (at + size > file->Size)
+		file->Size = at + size;
+	FileBytes += size;
+	return size;
+}
+
+/*
+ * Pixxi_RleDecode4D.4dg, line for line
+ */
+uint16_t Pixxi_Simulator4D::rleDecode(Pixxi_Simulator4D * sim, uint16_t argCount, const uint16_t * args)
+{
+	if (argCount < 6)
+		return 0;
+
+	uint16_t i = 0;
+	uint16_t drawn = 0;
+	sim->setGRAM(args[2], args[3], args[2] + args[4] - 1, args[3] + args[5] - 1);
+
+	while (i < args[1])
+	{
+		uint16_t n = sim->ramWord(args[0], i++);
+		if (n & 0x8000)
+		{
+			n = (n & 0x7FFF) + 1;
+			uint16_t colour = sim->ramWord(args[0], i++);
+			drawn += n;
+			while (n--)
+				sim->writeGRAM(colour);
+		}
+		else
+		{
+			n++;
+			drawn += n;
+			while (n--)
+				sim->writeGRAM(sim->ramWord(args[0], i++));
+		}
+	}
+	return drawn;
+}
+
+uint32_t Pixxi_Simulator4D::execUs(uint16_t opcode)
+{
+	for (uint8_t i = 0; i < _execCount; i++)
+	{
+		if (_execOpcodes[i] == opcode)
+			return _execUs[i];
+	}
+	return DefaultExecUs;
+}
+
+uint16_t * Pixxi_Simulator4D::setting(uint16_t opcode)
+{
+	for (uint8_t i = 0; i < SETTING_COUNT; i++)
+	{
+		if (Settings[i].Opcode == opcode)
+			return &_settings[i];
+	}
+	return NULL;
+}
+
+/**
+ * Command stream
+ */
+
+void Pixxi_Simulator4D::respond(void * context, Pixxi_SimTransport4D * port, const uint8_t * data, uint16_t size)
+{
+	Pixxi_Simulator4D * sim = (Pixxi_Simulator4D *) context;
+
+	//Whatever was left of the last transfer is gone
+	sim->_discard = false;
+
+	//Sent at the wrong rate, none of it makes sense
+	if (port->Baud != 0 && sim->Baud != 0 && port->Baud != sim->Baud)
+	{
+		sim->Garbled += size;
+		sim->_cmdLen = 0;
+		sim->_blitLeft = 0;
+		return;
+	}
+
+	for (uint16_t i = 0; i < size && !sim->_discard; i++)
+	{
+		if (sim->_blitLeft > 0)
+		{
+			sim->blitByte(data[i]);
+			continue;
+		}
+
+		sim->_cmd[sim->_cmdLen++] = data[i];
+
+		int32_t needed = sim->length();
+		if (needed == 0 && sim->_cmdLen < PIXXI_SIM_CMD_SIZE)
+			continue;
+
+		if (needed < 0 || needed > PIXXI_SIM_CMD_SIZE || (needed == 0 && sim->_cmdLen == PIXXI_SIM_CMD_SIZE))
+		{
+			//No telling where the next command starts
+			uint8_t nak = 0x15;
+			sim->Unknown++;
+			sim->_cmdLen = 0;
+			sim->_discard = true;
+			sim->reply(&nak, 1);
+			continue;
+		}
+
+		if ((uint32_t) needed == sim->_cmdLen)
+		{
+			sim->execute();
+			//A blit keeps its header until the pixels are in
+			if (sim->_blitLeft == 0)
+				sim->_cmdLen = 0;
+		}
+	}
+}
+
+void Pixxi_Simulator4D::blitByte(uint8_t data)
+{
+	uint32_t width = arg(2);
+
+	_blitLeft--;
+	if ((_blitAt & 1) == 0)
+		_blitHigh = data;
+	else
+	{
+		uint32_t index = _blitAt >> 1;
+		plot(arg(0) + index % width, arg(1) + index / width, _blitHigh << 8 | data);
+	}
+	_blitAt++;
+
+	if (_blitLeft == 0)
+	{
+		uint8_t ack = 6;
+		reply(&ack, 1);
+		_cmdLen = 0;
+	}
+}
+
+/*
+ * Total length of the command being received, 0 if that is not known yet, -1 if the opcode is unknown.
+ */
+int32_t Pixxi_Simulator4D::length(void)
+{
+	if (_cmdLen < 2)
+		return 0;
+
+	uint16_t opcode = _cmd[0] << 8 | _cmd[1];
+	int8_t args = -128;
+
+	for (uint8_t i = 0; i < COMMAND_COUNT; i++)
+	{
+		if (Table[i].Opcode == opcode)
+			args = Table[i].Args;
+	}
+	if (args == -128 && setting(opcode) != NULL)
+		args = 1;
+
+	switch (args)
+	{
+		case -128:
+			return -1;
+		case ARGS_STRING:
+			for (uint32_t i = 2; i < _cmdLen; i++)
+			{
+				if (_cmd[i] == 0)
+					return i + 1;
+			}
+			return 0;
+		case ARGS_POLYGON:
+			return _cmdLen < 4 ? 0 : 2 + 2 + 4 * arg(0) + 2;
+		case ARGS_WORDARRAY:
+			return _cmdLen < 6 ? 0 : 6 + 2 * arg(1);
+		case ARGS_BYTEARRAY:
+			return _cmdLen < 6 ? 0 : 6 + arg(1);
+		case ARGS_BLIT:
+			return _cmdLen < 10 ? 0 : 10;
+		case ARGS_OPEN:
+			for (uint32_t i = 2; i < _cmdLen; i++)
+			{
+				if (_cmd[i] == 0)
+					return i + 2;
+			}
+			return 0;
+		case ARGS_SECTOR:
+			return 2 + 512;
+		case ARGS_WRITE:
+			return _cmdLen < 4 ? 0 : 2 + 2 + arg(0) + 2;
+		case ARGS_PUTS:
+			for (uint32_t i = 2; i < _cmdLen; i++)
+			{
+				if (_cmd[i] == 0)
+					return i + 3;
+			}
+			return 0;
+		default:
+			return 2 + 2 * args;
+	}
+}
+
+uint16_t Pixxi_Simulator4D::arg(uint16_t index)
+{
+	uint32_t offset = 2 + 2 * index;
+	return _cmd[offset] << 8 | _cmd[offset + 1];
+}
+
+/*
+ * Send a reply once the display would have finished the command, at the line rate.
+ */
+void Pixxi_Simulator4D::reply(const uint8_t * data, uint32_t size)
+{
+	uint64_t now = Pixxi_HostNanos();
+	uint16_t opcode = _cmdLen >= 2 ? (_cmd[0] << 8 | _cmd[1]) : 0;
+	uint64_t exec = execUs(opcode) * 1000ULL + (Pixels - _pixelsBefore) * PixelNs + (FileBytes - _fileBytesBefore) * FileByteNs + _extraNs;
+
+	//Commands run one after the other
+	if (_freeAt < now)
+		_freeAt = now;
+	_freeAt += exec;
+	BusyNs += exec;
+
+	uint64_t spacing = Baud ? 10ULL * 1000000000ULL / Baud : 0;
+	uint8_t garbled[8];
+	if (MaxBaud != 0 && Baud > MaxBaud && size <= sizeof(garbled))
+	{
+		//Too fast for the link, every byte arrives wrong
+		for (uint32_t i = 0; i < size; i++)
+			garbled[i] = data[i] ^ 0xFF;
+		data = garbled;
+	}
+	_port->feedAt(data, size, _freeAt, spacing);
+}
+
+void Pixxi_Simulator4D::execute(void)
+{
+	uint16_t opcode = _cmd[0] << 8 | _cmd[1];
+	uint8_t answer[7] = {6, 0, 0, 0, 0, 0, 0};
+	uint8_t answerSize = 1;
+	uint16_t result = 0;
+	uint32_t extra = 0;			// the two words after the result of a REPLY_3WORDS
+	uint16_t * value = setting(opcode);
+
+	Commands++;
+	_pixelsBefore = Pixels;
+	_fileBytesBefore = FileBytes;
+	_extraNs = 0;
+
+	if (value != NULL)
+	{
+		//Setters all return what was there before
+		result = *value;
+		*value = arg(0);
+		answerSize = 3;
+	}
+	else switch (opcode)
+	{
+		case F_gfx_Cls:
+			rectFilled(0, 0, Width - 1, Height - 1, *setting(F_gfx_BGcolour));
+			_textX = 0;
+			_textY = 0;
+			break;
+		case F_gfx_Line:
+			line((int16_t) arg(0), (int16_t) arg(1), (int16_t) arg(2), (int16_t) arg(3), arg(4));
+			break;
+		case F_gfx_MoveTo:
+			_penX = (int16_t) arg(0);
+			_penY = (int16_t) arg(1);
+			break;
+		case F_gfx_LineTo:
+			line(_penX, _penY, (int16_t) arg(0), (int16_t) arg(1), *setting(F_gfx_OutlineColour));
+			_penX = (int16_t) arg(0);
+			_penY = (int16_t) arg(1);
+			break;
+		case F_gfx_PutPixel:
+			plot((int16_t) arg(0), (int16_t) arg(1), arg(2));
+			break;
+		case F_gfx_Rectangle:
+		{
+			int32_t xs[] = {(int16_t) arg(0), (int16_t) arg(2), (int16_t) arg(2), (int16_t) arg(0)};
+			int32_t ys[] = {(int16_t) arg(1), (int16_t) arg(1), (int16_t) arg(3), (int16_t) arg(3)};
+			polygon(4, xs, ys, arg(4), false, true);
+			break;
+		}
+		case F_gfx_RectangleFilled:
+			rectFilled((int16_t) arg(0), (int16_t) arg(1), (int16_t) arg(2), (int16_t) arg(3), arg(4));
+			break;
+		case F_gfx_Circle:
+		case F_gfx_CircleFilled:
+			circle((int16_t) arg(0), (int16_t) arg(1), arg(2), arg(3), opcode == F_gfx_CircleFilled);
+			break;
+		case F_gfx_Triangle:
+		case F_gfx_TriangleFilled:
+		{
+			int32_t xs[] = {(int16_t) arg(0), (int16_t) arg(2), (int16_t) arg(4)};
+			int32_t ys[] = {(int16_t) arg(1), (int16_t) arg(3), (int16_t) arg(5)};
+			polygon(3, xs, ys, arg(6), opcode == F_gfx_TriangleFilled, true);
+			break;
+		}
+		case F_gfx_Polygon:
+		case F_gfx_PolygonFilled:
+		case F_gfx_Polyline:
+		{
+			uint16_t n = arg(0);
+			int32_t * xs = (int32_t *) malloc(n * sizeof(int32_t) + 1);
+			int32_t * ys = (int32_t *) malloc(n * sizeof(int32_t) + 1);
+			for (uint16_t i = 0; i < n; i++)
+			{
+				xs[i] = (int16_t) arg(1 + i);
+				ys[i] = (int16_t) arg(1 + n + i);
+			}
+			polygon(n, xs, ys, arg(1 + 2 * n), opcode == F_gfx_PolygonFilled, opcode != F_gfx_Polyline);
+			free(xs);
+			free(ys);
+			break;
+		}
+		case F_gfx_ScreenMode:
+			answerSize = 3;
+			break;
+		case F_txt_MoveCursor:
+			_textY = arg(0) * (CELL_HEIGHT * *setting(F_txt_Height) + *setting(F_txt_Ygap));
+			_textX = arg(1) * (CELL_WIDTH * *setting(F_txt_Width) + *setting(F_txt_Xgap));
+			break;
+		case F_putCH:
+			putChar(arg(0));
+			break;
+		case F_putstr:
+			for (uint32_t i = 2; _cmd[i] != 0; i++)
+			{
+				putChar(_cmd[i]);
+				result++;
+			}
+			answerSize = 3;
+			break;
+		case F_sys_GetVersion:
+		case F_sys_GetPmmC:
+			result = 0x0100;
+			answerSize = 3;
+			break;
+		case F_mem_Alloc:
+			result = memAlloc(arg(0));
+			answerSize = 3;
+			break;
+		case F_mem_Heap:
+			result = memHeap();
+			answerSize = 3;
+			break;
+		case F_sendWordArrayToRAM:
+			for (uint16_t i = 0; i < arg(1); i++)
+			{
+				uint32_t offset = 2 * ((uint32_t) arg(0) - RAM_BASE + i);
+				if (arg(0) >= RAM_BASE && offset + 2 <= PIXXI_SIM_RAM_SIZE)
+				{
+					_ram[offset] = arg(2 + i) & 0xFF;
+					_ram[offset + 1] = arg(2 + i) >> 8;
+				}
+			}
+			break;
+		case F_sendByteArrayToRAM:
+			for (uint16_t i = 0; i < arg(1); i++)
+			{
+				uint32_t offset = 2 * ((uint32_t) arg(0) - RAM_BASE) + i;
+				if (arg(0) >= RAM_BASE && offset < PIXXI_SIM_RAM_SIZE)
+					_ram[offset] = _cmd[6 + i];
+			}
+			break;
+		case F_file_LoadFunction:
+			for (uint8_t i = 0; i < _functionCount; i++)
+			{
+				if (strcasecmp((const char *) _cmd + 2, _functionNames[i]) == 0)
+					result = 0x8000 | i;
+			}
+			answerSize = 3;
+			break;
+		case F_file_CallFunction:
+		{
+			uint16_t handle = arg(0) & 0x7FFF;
+			uint16_t args[PIXXI_SIM_CMD_SIZE / 2];
+			for (uint16_t i = 0; i < arg(1); i++)
+				args[i] = arg(2 + i);
+			if ((arg(0) & 0x8000) && handle < _functionCount)
+				result = _functions[handle](this, arg(1), args);
+			answerSize = 3;
+			break;
+		}
+		case F_blitComtoDisplay:
+			//Pixels are drawn as they arrive, however many there are, and the ACK follows the last
+			_blitAt = 0;
+			_blitLeft = 2 * (uint32_t) arg(2) * arg(3);
+			if (_blitLeft > 0)
+				return;
+			break;
+		case F_mem_Free:
+			result = memFree(arg(0)) ? 1 : 0;
+			answerSize = 3;
+			break;
+		case F_file_Open:
+			result = openFile((const char *) _cmd + 2, _cmd[_cmdLen - 1]);
+			_fileError = result == 0 ? 1 : 0;
+			answerSize = 3;
+			break;
+		case F_file_Read:
+			fileRead(arg(0), arg(1));
+			return;
+		case F_file_Seek:
+		{
+			Pixxi_SimFile4D * file = handleFile(arg(0));
+			uint32_t at = (uint32_t) arg(1) << 16 | arg(2);
+			//Like FAT, no seeking past the end
+			if (file != NULL && at <= file->Size)
+			{
+				_handleAt[arg(0) - 1] = at;
+				result = 1;
+			}
+			answerSize = 3;
+			break;
+		}
+		case F_file_Tell:
+		case F_file_Size:
+		{
+			Pixxi_SimFile4D * file = handleFile(arg(0));
+			if (file != NULL)
+			{
+				extra = opcode == F_file_Tell ? _handleAt[arg(0) - 1] : file->Size;
+				result = 1;
+			}
+			answerSize = 7;
+			break;
+		}
+		case F_file_Close:
+			if (handleFile(arg(0)) != NULL)
+			{
+				_handles[arg(0) - 1] = -1;
+				result = 1;
+			}
+			answerSize = 3;
+			break;
+		case F_file_Error:
+			result = _fileError;
+			answerSize = 3;
+			break;
+		case F_media_Init:
+			result = _mediaSize > 0 ? 1 : 0;
+			answerSize = 3;
+			break;
+		case F_media_SetSector:
+			_mediaAt = (uint32_t) arg(0) << 16 | arg(1);
+			MediaSeeks++;
+			break;
+		case F_media_RdSector:
+		{
+			//ACK, status, then the sector, zeros past the end of the media
+			uint8_t sector[3 + 512];
+			memset(sector, 0, sizeof(sector));
+			sector[0] = 6;
+			if (mediaSector(_mediaAt) != NULL)
+			{
+				memcpy(sector + 3, mediaSector(_mediaAt), 512);
+				sector[2] = 1;
+				FileBytes += 512;
+			}
+			_mediaAt++;
+			MediaSectors++;
+			reply(sector, sizeof(sector));
+			return;
+		}
+		case F_media_WrSector:
+			if (mediaSector(_mediaAt) != NULL)
+			{
+				memcpy(mediaSector(_mediaAt), _cmd + 2, 512);
+				FileBytes += 512;
+				result = 1;
+			}
+			_mediaAt++;
+			MediaSectors++;
+			answerSize = 3;
+			break;
+		case F_media_Flush:
+			result = 1;
+			answerSize = 3;
+			break;
+		case F_media_VideoFrame:
+			if (_frameCount > 0)
+				_extraNs = _frameUs[arg(2) % _frameCount] * 1000ULL;
+			VideoFrames++;
+			break;
+		case F_file_Write:
+			result = fileWrite(_cmd + 4, arg(0), _cmd[_cmdLen - 2] << 8 | _cmd[_cmdLen - 1]);
+			answerSize = 3;
+			break;
+		case F_file_PutC:
+		{
+			uint8_t c = arg(0);
+			result = fileWrite(&c, 1, arg(1));
+			answerSize = 3;
+			break;
+		}
+		case F_file_PutW:
+		{
+			//Low byte first, as the display stores words
+			uint8_t w[2] = {(uint8_t) (arg(0) & 0xFF), (uint8_t) (arg(0) >> 8)};
+			result = fileWrite(w, 2, arg(1));
+			answerSize = 3;
+			break;
+		}
+		case F_file_PutS:
+		{
+			uint32_t n = strlen((const char *) _cmd + 2);
+			result = fileWrite(_cmd + 2, n, _cmd[_cmdLen - 2] << 8 | _cmd[_cmdLen - 1]);
+			answerSize = 3;
+			break;
+		}
+		case F_setbaudWait:
+			if (Pixxi_Serial_4DLib::baudRate(arg(0)) == 0)
+			{
+				answer[0] = 0x15;
+				break;
+			}
+			//Switches straight away, the ACK follows at the new rate once it has settled
+			Baud = Pixxi_Serial_4DLib::baudRate(arg(0));
+			if (_freeAt < Pixxi_HostNanos())
+				_freeAt = Pixxi_HostNanos();
+			_freeAt += 100000000ULL;
+			break;
+		default:
+			//Understood but nothing to draw
+			break;
+	}
+
+	answer[1] = result >> 8;
+	answer[2] = result & 0xFF;
+	answer[3] = extra >> 24;
+	answer[4] = (extra >> 16) & 0xFF;
+	answer[5] = (extra >> 8) & 0xFF;
+	answer[6] = extra & 0xFF;
+	reply(answer, answerSize);
+}
+
+/**
+ * Rasteriser
+ */
+
+void Pixxi_Simulator4D::plot(int32_t x, int32_t y, uint16_t colour)
+{
+	if (x < 0 || y < 0 || x >= Width || y >= Height)
+		return;
+	Framebuffer[y * Width + x] = colour;
+	Pixels++;
+}
+
+void Pixxi_Simulator4D::hline(int32_t x1, int32_t x2, int32_t y, uint16_t colour)
+{
+	if (x1 > x2)
+	{
+		int32_t t = x1;
+		x1 = x2;
+		x2 = t;
+	}
+	if (y < 0 || y >= Height)
+		return;
+	if (x1 < 0)
+		x1 = 0;
+	if (x2 >= Width)
+		x2 = Width - 1;
+
+	for (int32_t x = x1; x <= x2; x++)
+		Framebuffer[y * Width + x] = colour;
+	if (x2 >= x1)
+		Pixels += x2 - x1 + 1;
+}
+
+void Pixxi_Simulator4D::line(int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t colour)
+{
+	//Bresenham
+	int32_t dx = abs(x2 - x1);
+	int32_t dy = -abs(y2 - y1);
+	int32_t sx = x1 < x2 ? 1 : -1;
+	int32_t sy = y1 < y2 ? 1 : -1;
+	int32_t err = dx + dy;
+
+	while (1)
+	{
+		plot(x1, y1, colour);
+		if (x1 == x2 && y1 == y2)
+			break;
+		int32_t e2 = 2 * err;
+		if (e2 >= dy)
+		{
+			err += dy;
+			x1 += sx;
+		}
+		if (e2 <= dx)
+		{
+			err += dx;
+			y1 += sy;
+		}
+	}
+}
+
+void Pixxi_Simulator4D::rectFilled(int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t colour)
+{
+	if (y1 > y2)
+	{
+		int32_t t = y1;
+		y1 = y2;
+		y2 = t;
+	}
+	for (int32_t y = y1; y <= y2; y++)
+		hline(x1, x2, y, colour);
+}
+
+void Pixxi_Simulator4D::circle(int32_t cx, int32_t cy, int32_t r, uint16_t colour, bool filled)
+{
+	//Midpoint circle, either joining the octants with spans or just plotting them
+	int32_t x = r;
+	int32_t y = 0;
+	int32_t err = 1 - r;
+
+	while (x >= y)
+	{
+		if (filled)
+		{
+			hline(cx - x, cx + x, cy + y, colour);
+			hline(cx - x, cx + x, cy - y, colour);
+			hline(cx - y, cx + y, cy + x, colour);
+			hline(cx - y, cx + y, cy - x, colour);
+		}
+		else
+		{
+			plot(cx + x, cy + y, colour);
+			plot(cx - x, cy + y, colour);
+			plot(cx + x, cy - y, colour);
+			plot(cx - x, cy - y, colour);
+			plot(cx + y, cy + x, colour);
+			plot(cx - y, cy + x, colour);
+			plot(cx + y, cy - x, colour);
+			plot(cx - y, cy - x, colour);
+		}
+
+		y++;
+		if (err < 0)
+			err += 2 * y + 1;
+		else
+		{
+			x--;
+			err += 2 * (y - x) + 1;
+		}
+	}
+}
+
+void Pixxi_Simulator4D::polygon(uint16_t n, const int32_t * xs, const int32_t * ys, uint16_t colour, bool filled, bool closed)
+{
+	if (n == 0)
+		return;
+
+	if (filled)
+	{
+		int32_t top = ys[0];
+		int32_t bottom = ys[0];
+		for (uint16_t i = 1; i < n; i++)
+		{
+			if (ys[i] < top)
+				top = ys[i];
+			if (ys[i] > bottom)
+				bottom = ys[i];
+		}
+		if (top < 0)
+			top = 0;
+		if (bottom >= Height)
+			bottom = Height - 1;
+
+		//Even-odd scanline fill through pixel centres
+		int32_t * cross = (int32_t *) malloc(n * sizeof(int32_t) + 1);
+		for (int32_t y = top; y <= bottom; y++)
+		{
+			uint16_t count = 0;
+			for (uint16_t i = 0; i < n; i++)
+			{
+				uint16_t j = (i + 1) % n;
+				int32_t y1 = ys[i], y2 = ys[j];
+				if (y1 == y2 || (y < y1 && y < y2) || (y >= y1 && y >= y2))
+					continue;
+				cross[count++] = xs[i] + (int64_t) (y - y1) * (xs[j] - xs[i]) / (y2 - y1);
+			}
+
+			for (uint16_t i = 1; i < count; i++)
+			{
+				int32_t v = cross[i];
+				uint16_t k = i;
+				while (k > 0 && cross[k - 1] > v)
+				{
+					cross[k] = cross[k - 1];
+					k--;
+				}
+				cross[k] = v;
+			}
+
+			for (uint16_t i = 0; i + 1 < count; i += 2)
+				hline(cross[i], cross[i + 1], y, colour);
+		}
+		free(cross);
+	}
+
+	//Outline, which also closes the gaps the fill leaves on the edges
+	for (uint16_t i = 0; i + 1 < n; i++)
+		line(xs[i], ys[i], xs[i + 1], ys[i + 1], colour);
+	if (closed && n > 2)
+		line(xs[n - 1], ys[n - 1], xs[0], ys[0], colour);
+}
+
+void Pixxi_Simulator4D::putChar(uint8_t c)
+{
+	uint16_t wide = *setting(F_txt_Width) ? *setting(F_txt_Width) : 1;
+	uint16_t high = *setting(F_txt_Height) ? *setting(F_txt_Height) : 1;
+	int32_t cellW = CELL_WIDTH * wide + *setting(F_txt_Xgap);
+	int32_t cellH = CELL_HEIGHT * high + *setting(F_txt_Ygap);
+	uint16_t fg = *setting(F_txt_FGcolour);
+	uint16_t bg = *setting(F_txt_BGcolour);
+	bool opaque = *setting(F_txt_Opacity) != 0;
+
+	if (c == '\n')
+	{
+		_textX = 0;
+		_textY += cellH;
+		return;
+	}
+	if (c == '\r')
+	{
+		_textX = 0;
+		return;
+	}
+
+	if (_textX + cellW > Width)
+	{
+		_textX = 0;
+		_textY += cellH;
+	}
+
+	const uint8_t * glyph = Font5x7[(c >= ' ' && c <= '~' ? c : '?') - ' '];
+	for (int32_t col = 0; col < CELL_WIDTH; col++)
+	{
+		uint8_t bits = col < 5 ? glyph[col] : 0;
+		for (int32_t row = 0; row < CELL_HEIGHT; row++)
+		{
+			bool on = bits & (1 << row);
+			if (!on && !opaque)
+				continue;
+			for (uint16_t dy = 0; dy < high; dy++)
+			{
+				for (uint16_t dx = 0; dx < wide; dx++)
+					plot(_textX + col * wide + dx, _textY + row * high + dy, on ? fg : bg);
+			}
+		}
+	}
+
+	_textX += cellW;
+}
+
+/**
+ * Inspection
+ */
+
+uint16_t Pixxi_Simulator4D::pixel(int16_t x, int16_t y)
+{
+	if (x < 0 || y < 0 || x >= Width || y >= Height)
+		return 0;
+	return Framebuffer[y * Width + x];
+}
+
+uint32_t Pixxi_Simulator4D::checksum(void)
+{
+	uint32_t hash = 2166136261UL;
+	for (uint32_t i = 0; i < (uint32_t) Width * Height; i++)
+	{
+		hash = (hash ^ (Framebuffer[i] & 0xFF)) * 16777619UL;
+		hash = (hash ^ (Framebuffer[i] >> 8)) * 16777619UL;
+	}
+	return hash;
+}
+
+//RGB565 to the 8 bit per channel form a PPM holds
+static void toRGB(uint16_t colour, uint8_t * rgb)
+{
+	uint8_t r = colour >> 11;
+	uint8_t g = (colour >> 5) & 0x3F;
+	uint8_t b = colour & 0x1F;
+	rgb[0] = r << 3 | r >> 2;
+	rgb[1] = g << 2 | g >> 4;
+	rgb[2] = b << 3 | b >> 2;
+}
+
+bool Pixxi_Simulator4D::saveImage(const char * path)
+{
+	FILE * file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+
+	fprintf(file, "P6\n%u %u\n255\n", Width, Height);
+	for (uint32_t i = 0; i < (uint32_t) Width * Height; i++)
+	{
+		uint8_t rgb[3];
+		toRGB(Framebuffer[i], rgb);
+		fwrite(rgb, 1, 3, file);
+	}
+
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+int32_t Pixxi_Simulator4D::compareImage(const char * path)
+{
+	FILE * file = fopen(path, "rb");
+	unsigned width, height, depth;
+	int32_t differ = 0;
+
+	if (file == NULL)
+		return -1;
+	if (fscanf(file, "P6 %u %u %u", &width, &height, &depth) != 3 || fgetc(file) == EOF
+		|| width != Width || height != Height || depth != 255)
+	{
+		fclose(file);
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < (uint32_t) Width * Height; i++)
+	{
+		uint8_t want[3], have[3];
+		if (fread(want, 1, 3, file) != 3)
+		{
+			differ = -1;
+			break;
+		}
+		toRGB(Framebuffer[i], have);
+		if (memcmp(want, have, 3) != 0)
+			differ++;
+	}
+
+	fclose(file);
+	return differ;
+}
+
+#endif
@@ -0,0 +1,222 @@
+/**
+ * Host (Linux) simulator of a Pixxi display.
+ *
+ * Only built with PIXXI_HOST defined. Plug it into one of the simulated transports and it
+ * decodes the same opcode stream a real display would get, draws into an RGB565 framebuffer
+ * and answers with ACKs (and results) at the time a display would:
+ *
+ *	Pixxi_LoopbackTransport4D link(115200);
+ *	Pixxi_Simulator4D screen(240, 320);
+ *	screen.Baud = 115200;
+ *	screen.attach(&link);
+ *	Pixxi_Serial_4DLib Display(&link);
+ *
+ * Each command takes ExecUs (per opcode, or DefaultExecUs) plus PixelNs per pixel drawn, one
+ * after the other like the real thing, and its reply then takes Baud-rate time on the wire.
+ * Text uses a built-in 5x7 font in 6x8 cells, so it is close to but not the same as the
+ * display's own fonts; it is meant for timing and for golden-image tests of the library,
+ * not for checking layouts pixel-for-pixel against hardware.
+ *
+ * addFile() puts files on a uSD card held in memory, for file_Open, file_Read, file_Write, file_PutC,
+ * file_PutW, file_PutS, file_Seek, file_Tell, file_Size and file_Close; each byte read or written
+ * costs FileByteNs on top of the opcode's time, and file() shows what a file holds now.
+ * setMedia() gives it raw sectors as well, with the sector address moving on after each one.
+ * media_VideoFrame draws nothing, but takes the time setFrameUs() gives each frame number.
+ * mem_Alloc places blocks first-fit in PIXXI_SIM_RAM_SIZE bytes, so mem_Free and mem_Heap show
+ * fragmentation as a display would, and its handles are word addresses as a display's are.
+ *
+ * Opcodes it does not know get a NAK, and the rest of that transfer is thrown away as there
+ * is no telling where the next command starts.
+ *
+ * setbaudWait switches Baud and answers 100ms later at the new rate. Anything received while
+ * the port's Baud does not match is lost, and replies above MaxBaud arrive corrupted, as with
+ * a marginal clock match, so the library's rate negotiation can be exercised.
+ */
+#ifndef Pixxi_Simulator4D_h
+#define Pixxi_Simulator4D_h
+
+#ifdef PIXXI_HOST
+
+#include "Pixxi_HostTransport4D.h"
+
+//Longest command the simulator can take in, in bytes
+#ifndef PIXXI_SIM_CMD_SIZE
+#define PIXXI_SIM_CMD_SIZE 8192
+#endif
+
+//Number of per-opcode execution times which can be set
+#define PIXXI_SIM_EXEC_TIMES 32
+
+//Display RAM behind the mem_Alloc handles, in bytes
+#ifndef PIXXI_SIM_RAM_SIZE
+#define PIXXI_SIM_RAM_SIZE 16384
+#endif
+
+//Blocks mem_Alloc can hand out at once
+#ifndef PIXXI_SIM_BLOCKS
+#define PIXXI_SIM_BLOCKS 512
+#endif
+
+//Number of functions file_LoadFunction can find
+#define PIXXI_SIM_FUNCTIONS 8
+
+//Files on the simulated uSD card, and how many of them can be open at once
+#ifndef PIXXI_SIM_FILES
+#define PIXXI_SIM_FILES 8
+#endif
+#define PIXXI_SIM_HANDLES 4
+
+class Pixxi_Simulator4D;
+
+//Stands in for a 4DGL function on the uSD card, returns what file_CallFunction answers
+typedef uint16_t (*TsimFunction4D)(Pixxi_Simulator4D * sim, uint16_t argCount, const uint16_t * args);
+
+typedef struct {
+	char Name[13];				// 8.3, compared without case as FAT does
+	uint8_t * Data;
+	uint32_t Size;
+	uint32_t Capacity;
+} Pixxi_SimFile4D;
+
+class Pixxi_Simulator4D
+{
+	public:
+		Pixxi_Simulator4D(uint16_t width, uint16_t height);
+		~Pixxi_Simulator4D();
+
+		//Answer everything sent over Port from now on
+		void attach(Pixxi_SimTransport4D * port);
+		//Back to power-on: black screen, default text and graphics settings
+		void reset(void);
+
+		//Time taken by one opcode, before the per pixel cost
+		void setExecUs(uint16_t opcode, uint32_t us);
+
+		//Have file_LoadFunction(name) find a function. The Pixxi_RleBlit4D decoder is there already.
+		bool addFunction(const char * name, TsimFunction4D function);
+		//For functions: display RAM as 4DGL sees it, as words from a mem_Alloc handle
+		uint16_t ramWord(uint16_t handle, uint16_t index);
+		//For functions: disp_setGRAM and disp_WriteWord, pixels written left to right, top to bottom into a window
+		void setGRAM(int32_t x1, int32_t y1, int32_t x2, int32_t y2);
+		void writeGRAM(uint16_t colour);
+
+		//Put a file on the uSD card, replacing one of the same name. The data is copied.
+		bool addFile(const char * name, const uint8_t * data, uint32_t size);
+		//A file's contents as they are now, NULL if there is no such file
+		const uint8_t * file(const char * name, uint32_t * size);
+		//Raw media for media_SetSector / media_RdSector / media_WrSector, this many zeroed sectors
+		void setMedia(uint32_t sectors);
+		//One 512 byte sector of it, NULL past the end
+		uint8_t * mediaSector(uint32_t sector);
+		//Time media_VideoFrame takes for each frame number, on top of its ExecUs, repeating after Count. The times are copied.
+		void setFrameUs(const uint32_t * us, uint16_t count);
+
+		uint16_t pixel(int16_t x, int16_t y);
+		//FNV-1a hash of the framebuffer, cheap to compare against a known good value
+		uint32_t checksum(void);
+		//Golden images as binary PPM. compareImage() returns the number of pixels which differ, -1 if unreadable.
+		bool saveImage(const char * path);
+		int32_t compareImage(const char * path);
+
+		uint16_t * Framebuffer;		// RGB565, row by row
+		uint16_t Width;
+		uint16_t Height;
+
+		uint32_t DefaultExecUs;		// execution time of opcodes without one of their own
+		uint32_t PixelNs;			// added per pixel drawn
+		uint32_t FileByteNs;		// added per byte read from or written to a file
+		uint32_t Baud;				// reply wire time, 0 for none
+		uint32_t MaxBaud;			// replies at faster rates are corrupted, 0 for no limit
+
+		//Statistics
+		uint32_t Commands;
+		uint32_t Unknown;			// NAKed as unknown or too long
+		uint32_t Garbled;			// bytes lost to a baud rate mismatch
+		uint64_t Pixels;			// pixels drawn
+		uint64_t FileBytes;			// bytes read from and written to files and media
+		uint32_t MediaSeeks;		// media_SetSector commands
+		uint32_t MediaSectors;		// sectors read and written
+		uint32_t VideoFrames;		// media_VideoFrame commands
+		uint32_t MemAllocs;			// mem_Alloc and mem_Free commands
+		uint32_t MemFrees;
+		uint32_t HeapUsed;			// bytes of display RAM allocated now
+		uint64_t BusyNs;			// total simulated execution time
+
+	private:
+		static void respond(void * context, Pixxi_SimTransport4D * port, const uint8_t * data, uint16_t size);
+		int32_t length(void);
+		void execute(void);
+		void reply(const uint8_t * data, uint32_t size);
+		uint16_t arg(uint16_t index);
+		uint32_t execUs(uint16_t opcode);
+		uint16_t * setting(uint16_t opcode);
+
+		void plot(int32_t x, int32_t y, uint16_t colour);
+		void hline(int32_t x1, int32_t x2, int32_t y, uint16_t colour);
+		void line(int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t colour);
+		void rectFilled(int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint16_t colour);
+		void circle(int32_t cx, int32_t cy, int32_t r, uint16_t colour, bool filled);
+		void polygon(uint16_t n, const int32_t * xs, const int32_t * ys, uint16_t colour, bool filled, bool closed);
+		void putChar(uint8_t c);
+		void blitByte(uint8_t data);
+		uint16_t memAlloc(uint16_t size);
+		bool memFree(uint16_t handle);
+		uint16_t memHeap(void);
+		Pixxi_SimFile4D * findFile(const char * name);
+		int8_t openFile(const char * name, char mode);
+		Pixxi_SimFile4D * handleFile(uint16_t handle);
+		void fileRead(uint16_t size, uint16_t handle);
+		uint16_t fileWrite(const uint8_t * data, uint16_t size, uint16_t handle);
+		static uint16_t rleDecode(Pixxi_Simulator4D * sim, uint16_t argCount, const uint16_t * args);
+
+		Pixxi_SimTransport4D * _port;
+		uint8_t _cmd[PIXXI_SIM_CMD_SIZE];
+		uint32_t _cmdLen;
+		bool _discard;				// skipping the rest of a transfer after an unknown opcode
+		uint32_t _blitLeft;			// pixel bytes of blitComtoDisplay still to come
+		uint32_t _blitAt;			// pixel bytes of it received so far
+		uint8_t _blitHigh;
+		uint64_t _freeAt;			// when the simulated display finishes what it is doing
+		uint64_t _pixelsBefore;
+		uint64_t _fileBytesBefore;
+
+		uint16_t _execOpcodes[PIXXI_SIM_EXEC_TIMES];
+		uint32_t _execUs[PIXXI_SIM_EXEC_TIMES];
+		uint8_t _execCount;
+
+		uint16_t _settings[32];		// current value of each setter, see the table in the .cpp
+		int32_t _penX;				// gfx_MoveTo / gfx_LineTo origin
+		int32_t _penY;
+		int32_t _textX;				// text cursor in pixels
+		int32_t _textY;
+		uint16_t _blockAt[PIXXI_SIM_BLOCKS];	// mem_Alloc blocks in address order, by handle
+		uint16_t _blockSize[PIXXI_SIM_BLOCKS];	// in words
+		uint16_t _blocks;
+		uint8_t _ram[PIXXI_SIM_RAM_SIZE];
+
+		const char * _functionNames[PIXXI_SIM_FUNCTIONS];
+		TsimFunction4D _functions[PIXXI_SIM_FUNCTIONS];
+		uint8_t _functionCount;
+
+		Pixxi_SimFile4D _files[PIXXI_SIM_FILES];
+		int8_t _handles[PIXXI_SIM_HANDLES];		// index into _files of each open handle, -1 if free
+		uint32_t _handleAt[PIXXI_SIM_HANDLES];	// read / write position
+		uint16_t _fileError;
+		uint8_t * _media;
+		uint32_t _mediaSize;		// in sectors
+		uint32_t _mediaAt;			// sector the next media_RdSector / media_WrSector uses
+		uint32_t * _frameUs;
+		uint16_t _frameCount;
+		uint64_t _extraNs;			// execution time of the current command on top of the rest
+
+		int32_t _gramX1;			// disp_setGRAM window and position in it
+		int32_t _gramY1;
+		int32_t _gramX2;
+		int32_t _gramY2;
+		int32_t _gramX;
+		int32_t _gramY;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,261 @@
+/**
+ * Per-command instrumentation for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_Stats4D.h"
+
+#ifdef PIXXI_STATS
+
+#include <string.h>
+#ifdef PIXXI_HOST
+#include <time.h>
+#endif
+
+/*
+ * Histogram bucket for a latency: 0 for under 8us, then two per octave.
+ */
+static uint8_t bucketOf(uint32_t us)
+{
+	if (us < 8)
+		return 0;
+
+	uint8_t octave = 31 - __builtin_clz(us);
+	uint8_t half = (us >> (octave - 1)) & 1;
+	uint32_t bucket = (octave - 3) * 2 + half + 1;
+
+	return bucket < PIXXI_STATS_BUCKETS ? bucket : PIXXI_STATS_BUCKETS - 1;
+}
+
+//Largest latency which lands in a bucket
+static uint32_t bucketTop(uint8_t bucket)
+{
+	if (bucket == 0)
+		return 7;
+
+	uint8_t octave = ((bucket - 1) >> 1) + 3;
+	uint32_t step = 1UL << (octave - 1);
+	uint32_t low = (1UL << octave) + ((bucket - 1) & 1) * step;
+
+	return low + step - 1;
+}
+
+uint32_t Pixxi_OpStats4D::meanUs(void)
+{
+	return Count ? TotalUs / Count : 0;
+}
+
+uint32_t Pixxi_OpStats4D::p99Us(void)
+{
+	//First bucket with 99% of the samples at or below it
+	uint32_t wanted = Count - Count / 100;
+	uint32_t seen = 0;
+
+	for (uint8_t i = 0; i < PIXXI_STATS_BUCKETS; i++)
+	{
+		seen += Buckets[i];
+		if (seen >= wanted && seen > 0)
+			return bucketTop(i) < MaxUs ? bucketTop(i) : MaxUs;
+	}
+	return MaxUs;
+}
+
+Pixxi_Stats4D::Pixxi_Stats4D() {
+#ifndef PIXXI_HOST
+	//Start the cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+	reset();
+}
+
+void Pixxi_Stats4D::reset(void)
+{
+	memset(_ops, 0, sizeof(_ops));
+	_used = 0;
+
+	Commands = 0;
+	Errors = 0;
+	TxBytes = 0;
+	RxBytes = 0;
+	Untracked = 0;
+}
+
+uint32_t Pixxi_Stats4D::now(void)
+{
+#ifdef PIXXI_HOST
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t) ((uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#else
+	return DWT->CYCCNT;
+#endif
+}
+
+uint32_t Pixxi_Stats4D::toUs(uint32_t ticks)
+{
+#ifdef PIXXI_HOST
+	return ticks / 1000;
+#else
+	return ticks / (SystemCoreClock / 1000000);
+#endif
+}
+
+/*
+ * Entry for an opcode, claiming a free one if it is new. NULL once the table is full.
+ */
+Pixxi_OpStats4D * Pixxi_Stats4D::lookup(uint16_t opcode)
+{
+	uint16_t index = (opcode * 40503U) & (PIXXI_STATS_OPCODES - 1);
+
+	for (uint16_t probe = 0; probe < PIXXI_STATS_OPCODES; probe++)
+	{
+		Pixxi_OpStats4D * op = &_ops[index];
+		if (op->Used && op->Opcode == opcode)
+			return op;
+
+		if (!op->Used)
+		{
+			op->Used = true;
+			op->Opcode = opcode;
+			op->MinUs = 0xFFFFFFFF;
+			_used++;
+			return op;
+		}
+		index = (index + 1) & (PIXXI_STATS_OPCODES - 1);
+	}
+
+	return NULL;
+}
+
+void Pixxi_Stats4D::tx(uint16_t opcode, uint32_t size, uint32_t ticks)
+{
+	TxBytes += size;
+
+	Pixxi_OpStats4D * op = lookup(opcode);
+	if (op == NULL)
+		return;
+	op->TxBytes += size;
+	op->WriteUs += toUs(ticks);
+}
+
+void Pixxi_Stats4D::rx(uint16_t opcode, uint32_t size)
+{
+	RxBytes += size;
+
+	Pixxi_OpStats4D * op = lookup(opcode);
+	if (op != NULL)
+		op->RxBytes += size;
+}
+
+void Pixxi_Stats4D::done(uint16_t opcode, uint32_t start, int error)
+{
+	uint32_t us = toUs(now() - start);
+
+	Commands++;
+	if (error)
+		Errors++;
+
+	Pixxi_OpStats4D * op = lookup(opcode);
+	if (op == NULL)
+	{
+		Untracked++;
+		return;
+	}
+
+	op->Count++;
+	if (error)
+		op->Errors++;
+	if (us < op->MinUs)
+		op->MinUs = us;
+	if (us > op->MaxUs)
+		op->MaxUs = us;
+	op->TotalUs += us;
+
+	uint8_t bucket = bucketOf(us);
+	if (op->Buckets[bucket] < 0xFFFF)
+		op->Buckets[bucket]++;
+}
+
+Pixxi_OpStats4D * Pixxi_Stats4D::find(uint16_t opcode)
+{
+	uint16_t index = (opcode * 40503U) & (PIXXI_STATS_OPCODES - 1);
+
+	for (uint16_t probe = 0; probe < PIXXI_STATS_OPCODES; probe++)
+	{
+		Pixxi_OpStats4D * op = &_ops[index];
+		if (!op->Used)
+			return NULL;
+		if (op->Opcode == opcode)
+			return op;
+		index = (index + 1) & (PIXXI_STATS_OPCODES - 1);
+	}
+
+	return NULL;
+}
+
+Pixxi_OpStats4D * Pixxi_Stats4D::at(uint16_t index)
+{
+	if (index >= PIXXI_STATS_OPCODES || !_ops[index].Used)
+		return NULL;
+	return &_ops[index];
+}
+
+static uint8_t * put16(uint8_t * dest, uint16_t value)
+{
+	dest[0] = value & 0xFF;
+	dest[1] = value >> 8;
+	return dest + 2;
+}
+
+static uint8_t * put32(uint8_t * dest, uint32_t value)
+{
+	dest[0] = value & 0xFF;
+	dest[1] = (value >> 8) & 0xFF;
+	dest[2] = (value >> 16) & 0xFF;
+	dest[3] = value >> 24;
+	return dest + 4;
+}
+
+uint32_t Pixxi_Stats4D::dump(uint8_t * dest, uint32_t size)
+{
+	uint32_t needed = 26 + _used * 38;
+	uint8_t * p = dest;
+
+	if (size < needed)
+		return 0;
+
+	*p++ = 'P';
+	*p++ = '4';
+	*p++ = 'S';
+	*p++ = PIXXI_STATS_DUMP_VERSION;
+	p = put16(p, _used);
+	p = put32(p, Commands);
+	p = put32(p, Errors);
+	p = put32(p, TxBytes);
+	p = put32(p, RxBytes);
+	p = put32(p, Untracked);
+
+	for (uint16_t i = 0; i < PIXXI_STATS_OPCODES; i++)
+	{
+		Pixxi_OpStats4D * op = &_ops[i];
+		if (!op->Used)
+			continue;
+
+		p = put16(p, op->Opcode);
+		p = put32(p, op->Count);
+		p = put32(p, op->Errors);
+		p = put32(p, op->TxBytes);
+		p = put32(p, op->RxBytes);
+		p = put32(p, op->WriteUs);
+		p = put32(p, op->Count ? op->MinUs : 0);
+		p = put32(p, op->meanUs());
+		p = put32(p, op->MaxUs);
+		p = put32(p, op->p99Us());
+	}
+
+	return p - dest;
+}
+
+#endif
@@ -0,0 +1,109 @@
+/**
+ * Per-command instrumentation for the Pixxi serial library.
+ *
+ * Only built when PIXXI_STATS is defined; without it every hook compiles away to nothing.
+ * For each opcode it keeps the number of calls and failures, bytes sent and received,
+ * time spent queueing its writes, and the latency from starting the command to having
+ * its whole reply (transmit + execution on the display + reply), as min/mean/max/p99.
+ * Timing uses the DWT cycle counter on the MCU and clock_gettime on the host.
+ *
+ *	Pixxi_OpStats4D * line = Display.Stats.find(F_gfx_Line);
+ *	if (line) printf("%lu calls, p99 %lu us\n", line->Count, line->p99Us());
+ *	uint32_t size = Display.Stats.dump(buffer, sizeof(buffer));
+ *
+ * p99 comes from a histogram with two buckets per octave, so it is within about 40% and
+ * never more than the real maximum.
+ */
+#ifndef Pixxi_Stats4D_h
+#define Pixxi_Stats4D_h
+
+#include "Pixxi_Transport4D.h"
+
+#ifdef PIXXI_STATS
+#define PIXXI_STAT(x) x
+#else
+#define PIXXI_STAT(x)
+#endif
+
+#ifdef PIXXI_STATS
+
+//Number of different opcodes tracked, must be a power of two
+#ifndef PIXXI_STATS_OPCODES
+#define PIXXI_STATS_OPCODES 32
+#endif
+
+#if (PIXXI_STATS_OPCODES & (PIXXI_STATS_OPCODES - 1)) != 0
+#error "PIXXI_STATS_OPCODES must be a power of two"
+#endif
+
+//Latency histogram, 8us up to about half a second, anything longer goes in the last one
+#define PIXXI_STATS_BUCKETS 32
+
+//Layout version of dump(), bump whenever it changes
+#define PIXXI_STATS_DUMP_VERSION 1
+
+class Pixxi_OpStats4D
+{
+	public:
+		uint32_t meanUs(void);
+		uint32_t p99Us(void);
+
+		uint16_t Opcode;
+		bool Used;
+		uint32_t Count;			// replies received (or failed)
+		uint32_t Errors;		// NAKs and timeouts
+		uint32_t TxBytes;
+		uint32_t RxBytes;
+		uint32_t WriteUs;		// total time spent queueing writes, including waiting for room
+		uint32_t MinUs;
+		uint32_t MaxUs;
+		uint64_t TotalUs;
+		uint16_t Buckets[PIXXI_STATS_BUCKETS];
+};
+
+class Pixxi_Stats4D
+{
+	public:
+		Pixxi_Stats4D();
+		void reset(void);
+
+		//Timestamps in raw ticks, and conversion to microseconds
+		static uint32_t now(void);
+		static uint32_t toUs(uint32_t ticks);
+
+		//Hooks used by Pixxi_Serial_4DLib
+		void tx(uint16_t opcode, uint32_t size, uint32_t ticks);
+		void rx(uint16_t opcode, uint32_t size);
+		void done(uint16_t opcode, uint32_t start, int error);
+
+		//Query, NULL if the opcode has not been seen
+		Pixxi_OpStats4D * find(uint16_t opcode);
+		//All tracked opcodes, index up to PIXXI_STATS_OPCODES. NULL for unused slots.
+		Pixxi_OpStats4D * at(uint16_t index);
+
+		/*
+		 * Write everything to Dest in a compact little-endian binary form:
+		 *	"P4S", version, uint16 opcodes, uint32 Commands, Errors, TxBytes, RxBytes, Untracked
+		 *	then per opcode: uint16 opcode, uint32 Count, Errors, TxBytes, RxBytes, WriteUs,
+		 *	MinUs, mean, MaxUs, p99
+		 * Returns the number of bytes written, 0 if Size is too small.
+		 */
+		uint32_t dump(uint8_t * dest, uint32_t size);
+
+		//Totals
+		uint32_t Commands;
+		uint32_t Errors;
+		uint32_t TxBytes;
+		uint32_t RxBytes;
+		uint32_t Untracked;		// calls not broken down by opcode as the table was full
+
+	private:
+		Pixxi_OpStats4D * lookup(uint16_t opcode);
+
+		Pixxi_OpStats4D _ops[PIXXI_STATS_OPCODES];
+		uint16_t _used;
+};
+
+#endif
+
+#endif
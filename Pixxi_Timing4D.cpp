@@ -0,0 +1,237 @@
+/**
+ * Adaptive reply timeouts for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_Timing4D.h"
+#include "Pixxi_Const4D.h"
+#include <string.h>
+
+Pixxi_Timing4D::Pixxi_Timing4D() {
+	Enabled = false;
+	Baud = 0;
+	clear();
+}
+
+void Pixxi_Timing4D::clear(void)
+{
+	memset(_ops, 0, sizeof(_ops));
+	memset(Classes, 0, sizeof(Classes));
+	Learned = 0;
+}
+
+uint32_t Pixxi_Timing4D::wireUs(uint32_t bytes)
+{
+	if (Baud == 0)
+		return 0;
+	//8N1 framing, 10 bits per byte
+	return (uint64_t) bytes * 10000000ULL / Baud;
+}
+
+bool Pixxi_Timing4D::slow(uint16_t opcode)
+{
+	switch (opcode)
+	{
+		case F_file_CallFunction:
+		case F_file_Dir:
+		case F_file_Erase:
+		case F_file_Exec:
+		case F_file_LoadFunction:
+		case F_file_LoadImageControl:
+		case F_file_Mount:
+		case F_file_PlayWAV:
+		case F_file_Run:
+		case F_file_ScreenCapture:
+		case F_media_Flush:
+		case F_media_Init:
+		case F_setbaudWait:
+		case F_sys_Sleep:
+		//The card can stall for a write or an erase at any time
+		case F_file_Close:
+		case F_file_GetC:
+		case F_file_GetS:
+		case F_file_GetW:
+		case F_file_Image:
+		case F_file_Index:
+		case F_file_Open:
+		case F_file_PutC:
+		case F_file_PutS:
+		case F_file_PutW:
+		case F_file_Read:
+		case F_file_Seek:
+		case F_file_Write:
+		case F_media_Image:
+		case F_media_ReadByte:
+		case F_media_ReadWord:
+		case F_media_RdSector:
+		case F_media_Video:
+		case F_media_VideoFrame:
+		case F_media_WriteByte:
+		case F_media_WriteWord:
+		case F_media_WrSector:
+		//Time goes with the area filled, which the bytes sent say nothing about
+		case F_gfx_CircleFilled:
+		case F_gfx_EllipseFilled:
+		case F_gfx_Panel:
+		case F_gfx_PolygonFilled:
+		case F_gfx_RectangleFilled:
+		case F_gfx_TriangleFilled:
+		case F_img_Show:
+			return true;
+		default:
+			return false;
+	}
+}
+
+uint8_t Pixxi_Timing4D::classOf(uint16_t opcode)
+{
+	switch (opcode)
+	{
+		case F_gfx_BGcolour:
+		case F_gfx_BevelShadow:
+		case F_gfx_BevelWidth:
+		case F_gfx_Clipping:
+		case F_gfx_ClipWindow:
+		case F_gfx_Contrast:
+		case F_gfx_FrameDelay:
+		case F_gfx_Get:
+		case F_gfx_GetPixel:
+		case F_gfx_LinePattern:
+		case F_gfx_OutlineColour:
+		case F_gfx_Set:
+		case F_gfx_SetClipRegion:
+		case F_gfx_Transparency:
+		case F_gfx_TransparentColour:
+		case F_mem_Alloc:
+		case F_mem_Free:
+		case F_mem_Heap:
+		case F_peekM:
+		case F_pokeM:
+		case F_sys_GetModel:
+		case F_sys_GetPmmC:
+		case F_sys_GetVersion:
+		case F_touch_DetectRegion:
+		case F_touch_Get:
+		case F_touch_Set:
+		case F_txt_Attributes:
+		case F_txt_BGcolour:
+		case F_txt_Bold:
+		case F_txt_FGcolour:
+		case F_txt_FontID:
+		case F_txt_Height:
+		case F_txt_Inverse:
+		case F_txt_Italic:
+		case F_txt_MoveCursor:
+		case F_txt_Opacity:
+		case F_txt_Set:
+		case F_txt_Underline:
+		case F_txt_Width:
+		case F_txt_Wrap:
+		case F_txt_Xgap:
+		case F_txt_Ygap:
+			return PIXXI_TIMING_REPLY;
+		case F_gfx_Circle:
+		case F_gfx_Ellipse:
+		case F_gfx_Line:
+		case F_gfx_LineTo:
+		case F_gfx_MoveTo:
+		case F_gfx_Polygon:
+		case F_gfx_Polyline:
+		case F_gfx_PutPixel:
+		case F_gfx_Rectangle:
+		case F_gfx_Triangle:
+		case F_putCH:
+			return PIXXI_TIMING_DRAW;
+		default:
+			return PIXXI_TIMING_NONE;
+	}
+}
+
+Pixxi_OpTiming4D * Pixxi_Timing4D::find(uint16_t opcode)
+{
+	uint16_t index = (opcode * 40503U) & (PIXXI_TIMING_OPCODES - 1);
+
+	for (uint16_t probe = 0; probe < PIXXI_TIMING_OPCODES; probe++)
+	{
+		Pixxi_OpTiming4D * op = &_ops[index];
+		if (op->Count == 0)
+			return NULL;
+		if (op->Opcode == opcode)
+			return op;
+		index = (index + 1) & (PIXXI_TIMING_OPCODES - 1);
+	}
+	return NULL;
+}
+
+uint32_t Pixxi_Timing4D::limit(uint16_t opcode, uint32_t bytes, uint32_t fallback)
+{
+	if (!Enabled || slow(opcode))
+		return fallback;
+
+	Pixxi_OpTiming4D * op = find(opcode);
+	if (op == NULL || op->Count < PIXXI_TIMING_SAMPLES)
+	{
+		//Not seen often enough yet, go by the others of its class
+		uint8_t kind = classOf(opcode);
+		op = kind != PIXXI_TIMING_NONE ? &Classes[kind] : NULL;
+	}
+	if (op == NULL || op->Count < PIXXI_TIMING_SAMPLES)
+		return fallback;
+
+	uint32_t ms = (wireUs(bytes) + op->ExecUs + 4 * op->DeviationUs) / 1000 + PIXXI_TIMING_SLACK_MS;
+	if (ms < PIXXI_TIMING_MIN_MS)
+		ms = PIXXI_TIMING_MIN_MS;
+	return ms < fallback ? ms : fallback;
+}
+
+void Pixxi_Timing4D::learn(uint16_t opcode, uint32_t ms, uint32_t bytes)
+{
+	uint16_t index = (opcode * 40503U) & (PIXXI_TIMING_OPCODES - 1);
+	Pixxi_OpTiming4D * op = NULL;
+
+	//Whatever the wire does not account for was spent on the display
+	uint32_t wire = wireUs(bytes);
+	uint32_t exec = ms * 1000 > wire ? ms * 1000 - wire : 0;
+	uint8_t kind = classOf(opcode);
+
+	if (kind != PIXXI_TIMING_NONE)
+		update(&Classes[kind], exec);
+
+	//Find it, or claim a free entry. Once the table is full new opcodes go by their class.
+	for (uint16_t probe = 0; probe < PIXXI_TIMING_OPCODES; probe++)
+	{
+		Pixxi_OpTiming4D * at = &_ops[index];
+		if (at->Count == 0 || at->Opcode == opcode)
+		{
+			op = at;
+			break;
+		}
+		index = (index + 1) & (PIXXI_TIMING_OPCODES - 1);
+	}
+	if (op == NULL)
+		return;
+
+	op->Opcode = opcode;
+	update(op, exec);
+	Learned++;
+}
+
+void Pixxi_Timing4D::update(Pixxi_OpTiming4D * op, uint32_t exec)
+{
+	if (op->Count == 0)
+	{
+		op->ExecUs = exec;
+		op->DeviationUs = exec / 2;
+	}
+	else
+	{
+		//Gains of 1/8 and 1/4, as for TCP round trip times
+		int32_t error = (int32_t) exec - (int32_t) op->ExecUs;
+		uint32_t size = error < 0 ? -error : error;
+		op->ExecUs = (int32_t) op->ExecUs + error / 8;
+		op->DeviationUs = (int32_t) op->DeviationUs + ((int32_t) size - (int32_t) op->DeviationUs) / 4;
+	}
+
+	if (op->Count < 0xFFFF)
+		op->Count++;
+}
@@ -0,0 +1,111 @@
+/**
+ * Adaptive reply timeouts for the Pixxi serial library.
+ *
+ * TimeLimit4D is a single limit sized for the slowest commands, so a lost ACK on a fast one
+ * holds everything up for seconds. Once turned on (calibrate() does so) every command gets a
+ * limit of its own instead: the wire time of the bytes it moves at the link's bit time, plus
+ * its execution time on the display as learned from earlier calls, kept as a moving average
+ * and mean deviation the way TCP keeps round trip times:
+ *
+ *	limit = wire + exec + 4 * deviation + PIXXI_TIMING_SLACK_MS
+ *
+ * never less than PIXXI_TIMING_MIN_MS and never more than TimeLimit4D. Opcodes which have
+ * not been seen PIXXI_TIMING_SAMPLES times yet, and those which take as long as they take
+ * (file_Exec, file_Run, media_Init, anything touching the card, filled shapes and images,
+ * whose time goes with their area), keep TimeLimit4D.
+ *
+ * A reply which misses its limit may still be on its way. After a timeout nothing more is sent
+ * until the line has been quiet for PIXXI_TIMING_QUIET_MS (or TimeLimit4D has gone by), and
+ * whatever arrives meanwhile is thrown away, so a late reply is not taken for the next one.
+ *
+ * Until an opcode has its own samples it goes by its class, if it has one: calibrate() times
+ * sys_GetVersion for the commands which are only answered and an off-screen gfx_PutPixel for
+ * the outline drawing, and every reply learned from also feeds its class.
+ *
+ *	Display.calibrate();
+ *	Pixxi_OpTiming4D * line = Display.Timing.find(F_gfx_Line);
+ */
+#ifndef Pixxi_Timing4D_h
+#define Pixxi_Timing4D_h
+
+#include "Pixxi_Transport4D.h"
+
+//Number of different opcodes learned, must be a power of two
+#ifndef PIXXI_TIMING_OPCODES
+#define PIXXI_TIMING_OPCODES 32
+#endif
+
+#if (PIXXI_TIMING_OPCODES & (PIXXI_TIMING_OPCODES - 1)) != 0
+#error "PIXXI_TIMING_OPCODES must be a power of two"
+#endif
+
+//Replies seen before an opcode's own limit is used
+#ifndef PIXXI_TIMING_SAMPLES
+#define PIXXI_TIMING_SAMPLES 4
+#endif
+
+//Shortest limit handed out, and the allowance for tick granularity and scheduling on top
+#ifndef PIXXI_TIMING_MIN_MS
+#define PIXXI_TIMING_MIN_MS 20
+#endif
+#ifndef PIXXI_TIMING_SLACK_MS
+#define PIXXI_TIMING_SLACK_MS 5
+#endif
+
+//How long the line has to be quiet after a timeout before the next command goes out
+#ifndef PIXXI_TIMING_QUIET_MS
+#define PIXXI_TIMING_QUIET_MS 500
+#endif
+
+//Round trips calibrate() makes for each class
+#ifndef PIXXI_TIMING_PROBES
+#define PIXXI_TIMING_PROBES 8
+#endif
+
+//Classes of opcodes which take about as long as each other
+#define PIXXI_TIMING_REPLY		0	// answered without drawing: queries, setters, memory
+#define PIXXI_TIMING_DRAW		1	// outlines, pixels and the pen, whose time does not go with an area
+#define PIXXI_TIMING_CLASSES	2
+#define PIXXI_TIMING_NONE		0xFF
+
+class Pixxi_OpTiming4D
+{
+	public:
+		uint16_t Opcode;
+		uint16_t Count;			// replies learned from, stops at 0xFFFF
+		uint32_t ExecUs;		// smoothed execution time on the display
+		uint32_t DeviationUs;	// smoothed mean deviation of it
+};
+
+class Pixxi_Timing4D
+{
+	public:
+		Pixxi_Timing4D();
+		void clear(void);
+
+		//Limit in ms for a command moving Bytes over the link (both ways), Fallback if not known
+		uint32_t limit(uint16_t opcode, uint32_t bytes, uint32_t fallback);
+		//A command took Ms from being started to having all of its reply, moving Bytes
+		void learn(uint16_t opcode, uint32_t ms, uint32_t bytes);
+		//Time Bytes take on the wire at Baud, 8N1
+		uint32_t wireUs(uint32_t bytes);
+		//Opcodes which can run for as long as they like and always get the fallback
+		static bool slow(uint16_t opcode);
+		//PIXXI_TIMING_ class of an opcode, PIXXI_TIMING_NONE if it only goes by its own samples
+		static uint8_t classOf(uint16_t opcode);
+
+		//NULL if the opcode has not been seen
+		Pixxi_OpTiming4D * find(uint16_t opcode);
+
+		bool Enabled;			// limit() returns the fallback while false
+		uint32_t Baud;			// line rate, 0 to leave wire time out
+		uint32_t Learned;		// replies learned from
+		Pixxi_OpTiming4D Classes[PIXXI_TIMING_CLASSES];	// what opcodes not yet learned go by
+
+	private:
+		static void update(Pixxi_OpTiming4D * op, uint32_t exec);
+
+		Pixxi_OpTiming4D _ops[PIXXI_TIMING_OPCODES];
+};
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * Transport interface for the Pixxi serial library.
+ *
+ * Everything that actually moves bytes to and from the display sits behind this class,
+ * so the protocol code does not care whether it is talking to a UART with DMA or to
+ * a test rig on a PC.
+ *
+ * Build with PIXXI_HOST defined to compile the library for a Linux host instead of the MCU.
+ *
+ * PIXXI_TRANSPORT names the transport class the library is compiled against.
+ * On the MCU it defaults to the (final) HAL transport, so every call is resolved at compile
+ * time and costs the same as calling the HAL directly. On the host it defaults to this
+ * interface so the backend can be chosen at run time. Define it as Pixxi_Transport4D on
+ * the MCU as well if you need to plug in your own transport there.
+ */
+#ifndef Pixxi_Transport4D_h
+#define Pixxi_Transport4D_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef PIXXI_HOST
+//Host backends are polled from the calling thread, nothing can interrupt us
+#define PIXXI_ENTER_CRITICAL()
+#define PIXXI_EXIT_CRITICAL()
+#else
+#include "stm32l4xx_hal.h"
+#define PIXXI_ENTER_CRITICAL()	uint32_t _primask4D = __get_PRIMASK(); __disable_irq()
+#define PIXXI_EXIT_CRITICAL()	__set_PRIMASK(_primask4D)
+#endif
+
+class Pixxi_TxRing4D;
+class Pixxi_RxRing4D;
+
+class Pixxi_Transport4D
+{
+	public:
+		Pixxi_Transport4D() : TxRing(NULL), RxRing(NULL) {}
+		virtual ~Pixxi_Transport4D() {}
+
+		/*
+		 * Start sending Size bytes in the background. The buffer belongs to the transport
+		 * until it reports TxCplt() to the attached ring.
+		 * Returns false if the transfer could not be started at all.
+		 */
+		virtual bool startTx(const uint8_t * data, uint16_t size) = 0;
+
+		/*
+		 * Start continuous reception into Buffer, wrapping at Size. The transport reports
+		 * progress to the attached receive ring and must keep receiving until told otherwise.
+		 */
+		virtual bool startRx(uint8_t * buffer, uint16_t size) = 0;
+
+		//Millisecond tick used for timeouts
+		virtual uint32_t millis(void) = 0;
+
+		//Give pending completions a chance to run. Only needed where there are no interrupts.
+		virtual void poll(void) {}
+
+		//Called repeatedly while the producer is waiting for room in the transmit ring
+		virtual void waitTx(void) { poll(); }
+
+		//Called repeatedly while a reader is waiting for bytes to arrive
+		virtual void waitRx(void) { poll(); }
+
+		/*
+		 * Change the line rate. Only called once everything handed to startTx has gone, and
+		 * reception is restarted with startRx afterwards. Returns false if it cannot be done.
+		 */
+		virtual bool setBaud(uint32_t baud) { return false; }
+		//Current line rate, 0 if not known
+		virtual uint32_t baud(void) { return 0; }
+		//Whether setBaud(Baud) would succeed, without touching the port
+		virtual bool supportsBaud(uint32_t baud) { return false; }
+
+		//Rings which receive our notifications
+		Pixxi_TxRing4D * TxRing;
+		Pixxi_RxRing4D * RxRing;
+};
+
+#ifndef PIXXI_TRANSPORT
+#ifdef PIXXI_HOST
+#define PIXXI_TRANSPORT Pixxi_Transport4D
+#else
+#define PIXXI_TRANSPORT Pixxi_HalTransport4D
+#endif
+#endif
+
+#ifndef PIXXI_HOST
+#include "Pixxi_HalTransport4D.h"
+#endif
+
+#endif
@@ -0,0 +1,163 @@
+/**
+ * Transmit ring buffer for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_TxRing4D.h"
+#include <string.h>
+
+#define TX_RING_MASK (PIXXI_TX_RING_SIZE - 1)
+
+Pixxi_TxRing4D::Pixxi_TxRing4D() {
+	_port = NULL;
+	_head = 0;
+	_tail = 0;
+	_inflight = 0;
+	_halfDone = 0;
+	_busy = 0;
+	_direct = NULL;
+	_directLeft = 0;
+	_directBusy = 0;
+
+	BytesQueued = 0;
+	Transfers = 0;
+	Stalls = 0;
+	Dropped = 0;
+}
+
+void Pixxi_TxRing4D::attach(PIXXI_TRANSPORT * port) {
+	_port = port;
+	_port->TxRing = this;
+}
+
+void Pixxi_TxRing4D::write(const uint8_t * source, uint32_t size)
+{
+	while (size > 0)
+	{
+		uint32_t space = PIXXI_TX_RING_SIZE - (_head - _tail);
+		if (space == 0)
+		{
+			//Ring is full, wait for the transport to release some of it
+			Stalls++;
+			while (_head - _tail == PIXXI_TX_RING_SIZE)
+				_port->waitTx();
+			continue;
+		}
+
+		//Copy as much as fits before the end of the buffer
+		uint32_t index = _head & TX_RING_MASK;
+		uint32_t count = size < space ? size : space;
+		if (count > PIXXI_TX_RING_SIZE - index)
+			count = PIXXI_TX_RING_SIZE - index;
+
+		memcpy(&_buf[index], source, count);
+		_head = _head + count;
+		source += count;
+		size -= count;
+		BytesQueued += count;
+
+		//Get it moving while we copy the rest
+		kick();
+	}
+}
+
+void Pixxi_TxRing4D::writeDirect(const uint8_t * source, uint32_t size)
+{
+	//Whatever is already queued has to go first
+	flush();
+
+	_direct = source;
+	_directLeft = size;
+	BytesQueued += size;
+	kick();
+}
+
+void Pixxi_TxRing4D::flush(void)
+{
+	while (_head != _tail || _directLeft > 0)
+		_port->waitTx();
+}
+
+uint32_t Pixxi_TxRing4D::pending(void)
+{
+	return _head - _tail + _directLeft;
+}
+
+/*
+ * Start a transfer of the next contiguous block if the transport is idle.
+ * Safe to call from both the main loop and the completion interrupt.
+ */
+void Pixxi_TxRing4D::kick(void)
+{
+	const uint8_t * source;
+	uint32_t count;
+
+	PIXXI_ENTER_CRITICAL();
+	if (_busy || (_head == _tail && _directLeft == 0))
+	{
+		PIXXI_EXIT_CRITICAL();
+		return;
+	}
+
+	if (_directLeft > 0)
+	{
+		//Straight out of the caller's buffer, as much as one transfer can take
+		source = _direct;
+		count = _directLeft;
+		if (count > 0xFFFF)
+			count = 0xFFFF;
+		_directBusy = 1;
+	}
+	else
+	{
+		uint32_t index = _tail & TX_RING_MASK;
+		source = &_buf[index];
+		count = _head - _tail;
+		//A single transfer cannot wrap around the end of the buffer
+		if (count > PIXXI_TX_RING_SIZE - index)
+			count = PIXXI_TX_RING_SIZE - index;
+	}
+
+	_busy = 1;
+	_inflight = count;
+	_halfDone = 0;
+	Transfers++;
+	PIXXI_EXIT_CRITICAL();
+
+	if (!_port->startTx(source, count))
+	{
+		//Nothing we can do with these bytes, throw them away rather than lock up
+		Dropped += count;
+		TxCplt();
+	}
+}
+
+void Pixxi_TxRing4D::TxHalfCplt(void)
+{
+	//Nothing to hand back early when the data is not ours
+	if (_directBusy)
+		return;
+
+	//The first half of the transfer has been read out already, let the producer reuse it
+	uint16_t half = _inflight >> 1;
+	_tail = _tail + half;
+	_halfDone = half;
+}
+
+void Pixxi_TxRing4D::TxCplt(void)
+{
+	if (_directBusy)
+	{
+		_direct = _direct + _inflight;
+		_directLeft = _directLeft - _inflight;
+		_directBusy = 0;
+	}
+	else
+		_tail = _tail + _inflight - _halfDone;
+	_inflight = 0;
+	_halfDone = 0;
+	_busy = 0;
+
+	//Chain the next block, if any
+	kick();
+}
@@ -0,0 +1,66 @@
+/**
+ * Transmit ring buffer for the Pixxi serial library.
+ *
+ * All of the private write routines copy into this ring and return straight away.
+ * The ring is drained in the background by the transport (UART DMA on the MCU), so the
+ * next command can be built while the previous one is still on the wire.
+ */
+#ifndef Pixxi_TxRing4D_h
+#define Pixxi_TxRing4D_h
+
+#include "Pixxi_Transport4D.h"
+
+/*
+ * Size of the transmit ring in bytes, must be a power of two.
+ * 512 holds a few dozen typical gfx_ commands.
+ */
+#ifndef PIXXI_TX_RING_SIZE
+#define PIXXI_TX_RING_SIZE 512
+#endif
+
+#if (PIXXI_TX_RING_SIZE & (PIXXI_TX_RING_SIZE - 1)) != 0
+#error "PIXXI_TX_RING_SIZE must be a power of two"
+#endif
+
+class Pixxi_TxRing4D
+{
+	public:
+		Pixxi_TxRing4D();
+		void attach(PIXXI_TRANSPORT * port);
+
+		//Queue bytes for transmission, waits only if the ring is full
+		void write(const uint8_t * source, uint32_t size);
+		//Send straight from the caller's buffer once everything queued before it has gone.
+		//The buffer must be left alone until pending() says it has been sent.
+		void writeDirect(const uint8_t * source, uint32_t size);
+		//Wait until every queued byte has left the ring
+		void flush(void);
+		//Number of bytes queued or in flight
+		uint32_t pending(void);
+
+		//Called by the transport, usually from the DMA interrupt
+		void TxHalfCplt(void);
+		void TxCplt(void);
+
+		//Statistics
+		uint32_t BytesQueued;		// total bytes accepted by write()
+		uint32_t Transfers;			// number of transfers handed to the transport
+		uint32_t Stalls;			// number of times write() had to wait for room
+		uint32_t Dropped;			// bytes discarded because the transport refused them
+
+	private:
+		void kick(void);
+
+		PIXXI_TRANSPORT * _port;
+		uint8_t _buf[PIXXI_TX_RING_SIZE];
+		volatile uint32_t _head;		// free running write count
+		volatile uint32_t _tail;		// free running count of bytes released by the transport
+		volatile uint16_t _inflight;	// size of the transfer currently on the wire
+		volatile uint16_t _halfDone;	// part of it already released by the half complete callback
+		volatile uint8_t _busy;
+		const uint8_t * volatile _direct;	// caller's buffer still to be sent by writeDirect()
+		volatile uint32_t _directLeft;
+		volatile uint8_t _directBusy;		// transfer on the wire comes from _direct
+};
+
+#endif
@@ -0,0 +1,172 @@
+/**
+ * Paced GCI video playback for the Pixxi serial library.
+ * See header for description.
+ */
+
+#include "Pixxi_Video4D.h"
+
+Pixxi_VideoPlayer4D::Pixxi_VideoPlayer4D(Pixxi_Serial_4DLib * display) {
+	_display = display;
+	_head = 0;
+	_tail = 0;
+	_out = 0;
+	_count = 0;
+	_next = 0;
+	_sending = false;
+
+	LeadUs = PIXXI_VIDEO_LEAD_US;
+	Skip = true;
+	Loop = false;
+	Queue = NULL;
+
+	Shown = 0;
+	Dropped = 0;
+	Failed = 0;
+	LateUs = 0;
+	_firstShown = 0;
+	_lastShown = 0;
+	_lateSum = 0;
+	_lateSquares = 0;
+}
+
+void Pixxi_VideoPlayer4D::start(uint16_t x, uint16_t y, uint16_t first, uint16_t count, uint32_t frameUs, uint32_t us)
+{
+	_x = x;
+	_y = y;
+	_first = first;
+	_count = count;
+	_frameUs = frameUs > 0 ? frameUs : 1;
+	_start = us;
+	_next = 0;
+	_sending = count > 0;
+
+	Shown = 0;
+	Dropped = 0;
+	Failed = 0;
+	LateUs = 0;
+	_lateSum = 0;
+	_lateSquares = 0;
+}
+
+void Pixxi_VideoPlayer4D::stop(void)
+{
+	_sending = false;
+}
+
+bool Pixxi_VideoPlayer4D::playing(void)
+{
+	return _sending || _out > 0;
+}
+
+/*
+ * Send the frame at Index in the schedule. If Queue refuses it, its future fails and it is counted then.
+ */
+void Pixxi_VideoPlayer4D::send(uint32_t index)
+{
+	Pixxi_Future4D * frame = &_frames[_head];
+	Pixxi_Command4D command;
+
+	command.begin(F_media_VideoFrame).word(_x).word(_y).word(_first + index % _count);
+	command.reply(PIXXI_REPLY_ACK, frame);
+
+	if (Queue != NULL)
+		Queue->push(&command, PIXXI_LANE_URGENT);
+	else
+		_display->submit(command.Bytes, command.Length, NULL, 0, command.Reply, frame);
+
+	_index[_head] = index;
+	_head = (_head + 1) % PIXXI_VIDEO_IN_FLIGHT;
+	_out++;
+}
+
+/*
+ * Count the frames which have come in, in the order they were sent.
+ */
+void Pixxi_VideoPlayer4D::collect(uint32_t us)
+{
+	while (_out > 0 && _frames[_tail].ready())
+	{
+		if (_frames[_tail].ok())
+		{
+			int32_t late = (int32_t) (us - (_start + _index[_tail] * _frameUs));
+
+			if (Shown == 0)
+				_firstShown = us;
+			_lastShown = us;
+			Shown++;
+			if (late > 0 && (uint32_t) late > LateUs)
+				LateUs = late;
+			_lateSum += late;
+			_lateSquares += (int64_t) late * late;
+		}
+		else
+			Failed++;
+
+		_tail = (_tail + 1) % PIXXI_VIDEO_IN_FLIGHT;
+		_out--;
+	}
+}
+
+void Pixxi_VideoPlayer4D::tick(uint32_t us)
+{
+	//Replies only come in through the display task when there is a queue
+	if (Queue == NULL)
+		_display->service();
+	collect(us);
+
+	if (!_sending)
+		return;
+
+	//Latest frame whose time to be sent has come
+	uint32_t due = (us + LeadUs - _start) / _frameUs;
+	if ((int32_t) (us + LeadUs - _start) < 0 || due < _next)
+		return;
+	if (_out >= PIXXI_VIDEO_IN_FLIGHT)
+		return;
+
+	if (Skip && due > _next)
+	{
+		uint32_t last = Loop ? due : (due < _count ? due : _count - 1);
+		Dropped += last - _next;
+		_next = last;
+	}
+
+	send(_next++);
+	if (!Loop && _next >= _count)
+		_sending = false;
+}
+
+float Pixxi_VideoPlayer4D::fps(void)
+{
+	if (Shown < 2 || _lastShown == _firstShown)
+		return 0;
+	return (Shown - 1) * 1000000.0f / (uint32_t) (_lastShown - _firstShown);
+}
+
+/*
+ * Standard deviation of how late the frames came in, in us.
+ */
+uint32_t Pixxi_VideoPlayer4D::jitterUs(void)
+{
+	if (Shown < 2)
+		return 0;
+
+	int64_t mean = _lateSum / Shown;
+	int64_t variance = (int64_t) (_lateSquares / Shown) - mean * mean;
+	if (variance <= 0)
+		return 0;
+
+	//Integer square root, no need for the maths library
+	uint64_t root = 0;
+	for (uint64_t bit = 1ULL << 62; bit != 0; bit >>= 2)
+	{
+		if ((uint64_t) variance >= root + bit)
+		{
+			variance -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+			root >>= 1;
+	}
+	return root;
+}
@@ -0,0 +1,100 @@
+/**
+ * Paced GCI video playback for the Pixxi serial library.
+ *
+ * Calling media_VideoFrame from the main loop shows frames whenever the loop gets round to it,
+ * and waits for each ACK; gfx_FrameDelay only sets a fixed pause on the display. Pixxi_VideoPlayer4D
+ * instead works out from a clock which frame should be on the screen, and sends each one ahead of
+ * its time by LeadUs, without waiting for the ACK of the one before:
+ *
+ *	Pixxi_VideoPlayer4D Clip(&Display);
+ *	Display.media_SetSector(hi, lo);				// start of the GCI video
+ *	Clip.start(0, 0, 0, 120, 40000, micros());		// frames 0-119 at 25fps
+ *	while (Clip.playing()) {
+ *		Clip.tick(micros());
+ *		...
+ *	}
+ *
+ * tick() takes any free-running microsecond count, so it works from a timer interrupt as well,
+ * passing the timer's counter or the number of interrupts times their period. It only ever
+ * sends a frame, it never waits, and it can be called at any rate; the frames just go out on
+ * the first tick after their time. From an interrupt, either nothing else may use the display
+ * while the video plays, or set Queue: frames are then pushed onto that queue's urgent lane,
+ * which is safe from an interrupt, and the display task's pump() sends them.
+ *
+ * Up to PIXXI_VIDEO_IN_FLIGHT frames are outstanding at once, so when a frame takes the display
+ * longer than its period, the next one is already queued behind it and follows without a gap
+ * for the round trip. When even that is not enough and a frame's time has gone by before it
+ * could be sent, it is skipped (Dropped) and the player jumps to the frame which is due, so the
+ * clip keeps its length; with Skip off every frame is shown, and the clip ends late instead.
+ *
+ * A frame counts as shown when its ACK comes in, and how late that is against its place in
+ * the schedule gives LateUs and jitterUs(), the spread of that lateness. fps() is the rate at
+ * which the frames were actually shown.
+ */
+#ifndef Pixxi_Video4D_h
+#define Pixxi_Video4D_h
+
+#include "Pixxi_Queue4D.h"
+
+//Frames which can be outstanding at once, the one on the display and the ones queued behind it
+#ifndef PIXXI_VIDEO_IN_FLIGHT
+#define PIXXI_VIDEO_IN_FLIGHT 2
+#endif
+
+//LeadUs to start with
+#ifndef PIXXI_VIDEO_LEAD_US
+#define PIXXI_VIDEO_LEAD_US 1000
+#endif
+
+class Pixxi_VideoPlayer4D
+{
+	public:
+		Pixxi_VideoPlayer4D(Pixxi_Serial_4DLib * display);
+
+		//Play Count frames from First on at X, Y, one every FrameUs, the first at Us. Clears the statistics.
+		void start(uint16_t x, uint16_t y, uint16_t first, uint16_t count, uint32_t frameUs, uint32_t us);
+		//Send no more frames. Those already sent are still counted as they come in.
+		void stop(void);
+		//True until the last frame has come in, or stop()
+		bool playing(void);
+		//Send whatever frame is due at Us, and take in the ones which have come in. Never waits.
+		void tick(uint32_t us);
+
+		uint32_t LeadUs;		// how long before its time a frame is sent, to cover its command on the wire
+		bool Skip;				// jump to the frame which is due when behind, rather than show every one late
+		bool Loop;				// start again from First after the last frame, until stop()
+		Pixxi_CommandQueue4D * Queue;	// if set, frames are pushed here instead of being sent directly
+
+		//Statistics
+		uint32_t Shown;			// frames ACKed
+		uint32_t Dropped;		// frames skipped because they were already late
+		uint32_t Failed;		// frames NAKed, timed out or refused by Queue
+		uint32_t LateUs;		// latest any frame came in after its time
+		float fps(void);
+		uint32_t jitterUs(void);
+
+	private:
+		void send(uint32_t index);
+		void collect(uint32_t us);
+
+		Pixxi_Serial_4DLib * _display;
+		Pixxi_Future4D _frames[PIXXI_VIDEO_IN_FLIGHT];
+		uint32_t _index[PIXXI_VIDEO_IN_FLIGHT];	// place in the schedule of each frame sent
+		uint8_t _head;				// next of _frames to send with
+		uint8_t _tail;				// oldest one outstanding
+		uint8_t _out;				// number outstanding
+		uint16_t _x;
+		uint16_t _y;
+		uint16_t _first;
+		uint16_t _count;
+		uint32_t _frameUs;
+		uint32_t _start;			// Us of frame 0
+		uint32_t _next;				// place in the schedule of the next frame to send
+		bool _sending;
+		uint32_t _firstShown;		// Us when the first and last frames came in
+		uint32_t _lastShown;
+		int64_t _lateSum;			// of each frame's lateness and its square, for jitterUs()
+		uint64_t _lateSquares;
+};
+
+#endif